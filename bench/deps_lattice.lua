@@ -0,0 +1,58 @@
+-- ninja.deps_foreach and configure on a diamond lattice: 50 layers of 100
+-- targets, each depending on two targets of the layer below, so every top
+-- target reaches most of the graph through many paths.
+--
+--   njx --no-daemon bench/deps_lattice.lua
+--
+-- 'dfs' walks the graph afresh for every target, as ninja.deps_foreach did
+-- before it kept an order per target; 'cached' scans those orders.
+jit.off()
+
+local ninja = _G.ninja
+ninja.config(function(c) c.dry_run = 1; c.verbosity = C.NINJA__QUIET; c.parallelism = 1 end)
+
+local W, L = 100, 50
+
+local src = path.combine(ninja.build_dir(), 'bench', 'lattice.c'); do
+    fs.mkdir(path.combine(ninja.build_dir(), 'bench'))
+    local f = io.open(src, 'w'); f:write('int x;\n'); f:close()
+end
+
+local layers = {}; for l = 1, L do
+    local layer = {}; for i = 1, W do
+        local t = ninja.target('lattice_' .. l .. '_' .. i):type(l == L and 'binary' or 'static'):src(src):define(public { 'L' .. l })
+        if l > 1 then t:deps(layers[l - 1][i], layers[l - 1][i % W + 1]) end
+        layer[i] = t
+    end
+    layers[l] = layer
+end
+
+local top = layers[L]
+
+-- dependencies first, each once
+local function dfs(target, fx, visited)
+    if visited[target] then return end
+    visited[target] = true
+    for _, dep in ipairs(target.opts.deps or {}) do dfs(dep, fx, visited) end
+    fx(target)
+end
+
+local function walks(foreach)
+    local n, t0 = 0, os.clock(); for _, t in ipairs(top) do
+        foreach(t, function() n = n + 1 end)
+    end
+    return n, os.clock() - t0
+end
+
+-- os.clock() counts milliseconds in ljx
+local n, ms = walks(function(t, fx) dfs(t, fx, {}) end)
+print(string.format('dfs walks: %d visits in %.0fms', n, ms))
+n, ms = walks(ninja.deps_foreach)
+print(string.format('first cached walks, building the orders: %d visits in %.0fms', n, ms))
+n, ms = walks(ninja.deps_foreach)
+print(string.format('cached walks: %d visits in %.0fms', n, ms))
+
+local t0, configured = os.clock(), 0; ninja.targets_foreach(top, function(t)
+    t:configure(); configured = configured + 1
+end)
+print(string.format('configure: %d targets in %.0fms', configured, os.clock() - t0))
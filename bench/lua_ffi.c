@@ -0,0 +1,38 @@
+// per-call cost of a helper bound as a lua_CFunction against the same helper
+// called through the FFI, the way lua_ffi in ljxx.h binds path.* and fs.*:
+//
+//   make -C deps/LuaJIT
+//   cc -O2 -Ideps/LuaJIT/src bench/lua_ffi.c deps/LuaJIT/src/libluajit.a -lm -ldl -rdynamic -o lua_ffi_bench
+//   LUA_PATH='deps/LuaJIT/src/?.lua;;' ./lua_ffi_bench bench/lua_ffi.lua
+//
+// -rdynamic exports ljx_path_fnmatch for ffi.C, as ljx's symbol table does.
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <fnmatch.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// path.fnmatch as a classic binding.
+static int fnmatch_cfunction(lua_State * L) {
+    lua_pushboolean(L, fnmatch(luaL_checkstring(L, 1), luaL_checkstring(L, 2), 0) == 0); return 1;
+}
+
+// path.fnmatch as lua_ffi generates it.
+bool ljx_path_fnmatch(const char * pattern, const char * path) {
+    return fnmatch(pattern, path, 0) == 0;
+}
+
+int main(int argc, char ** argv) {
+    if(argc < 2) { fprintf(stderr, "usage: %s bench/lua_ffi.lua\n", argv[0]); return 1; }
+
+    lua_State * L = luaL_newstate(); luaL_openlibs(L);
+
+    lua_newtable(L); lua_pushcfunction(L, fnmatch_cfunction); lua_setfield(L, -2, "fnmatch"); lua_setglobal(L, "cpath");
+
+    if(luaL_dofile(L, argv[1])) { fprintf(stderr, "%s\n", lua_tostring(L, -1)); return 1; }
+
+    lua_close(L); return 0;
+}
@@ -0,0 +1,52 @@
+-- run by bench/lua_ffi.c: path.fnmatch as a lua_CFunction (cpath) and as
+-- an FFI call (fpath) in the same hot loop. prints ns per call and trace
+-- aborts; jit.v's log goes to lua_ffi.jitv.txt, where the lua_CFunction
+-- loop shows "stitch C:" at the call site.
+local ffi = require('ffi')
+
+ffi.cdef [[
+    bool ljx_path_fnmatch(const char * pattern, const char * path);
+    typedef struct { long sec, nsec; } bench_timespec;
+    int clock_gettime(int clock, bench_timespec * ts);
+]]
+
+local ts = ffi.new('bench_timespec'); local function now()
+    ffi.C.clock_gettime(1, ts); return tonumber(ts.sec) + tonumber(ts.nsec) * 1e-9
+end
+
+-- as lua_ffi binds it: nil checks in Lua, inlined by the JIT.
+local fpath = { fnmatch = (function(f) return function(a1, a2)
+    if a1 == nil then error("bad argument #1 to 'fnmatch' (string expected, got nil)", 2) end
+    if a2 == nil then error("bad argument #2 to 'fnmatch' (string expected, got nil)", 2) end
+    return f(a1, a2)
+end end)(ffi.C.ljx_path_fnmatch) }
+
+local aborts = 0; jit.attach(function(what)
+    if what == 'abort' then aborts = aborts + 1 end
+end, 'trace')
+
+local files = {}; for i = 1, 64 do
+    files[i] = 'src/file' .. i .. (i % 3 == 0 and '.cpp' or '.h')
+end
+
+local rounds = 200000
+
+local function run(name, path)
+    aborts = 0; local n, t0 = 0, now()
+    for _ = 1, rounds do
+        for i = 1, #files do
+            if path.fnmatch('*', files[i]) then n = n + 1 end
+        end
+    end
+    local dt, calls = now() - t0, rounds * #files
+    print(string.format('%-14s %.3fs for %d calls, %.1f ns/call, trace aborts=%d', name, dt, calls, dt * 1e9 / calls, aborts))
+end
+
+-- jit.v needs the jit/vmdef.lua a LuaJIT build generates
+local ok, jit_v = pcall(require, 'jit.v'); if ok then
+    jit_v.on('lua_ffi.jitv.txt')
+else
+    print('no jit.v, see bench/lua_ffi.c for LUA_PATH')
+end
+
+run('lua_CFunction', cpath); run('ffi', fpath)
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// symbols `ffi.C` resolves inside the executable. each translation unit lists
+// what it exports and registers the list once at startup:
+//
+//     #define MY_SYMS(_) _(foo) _(bar)
+//     CLIB_SYMTAB(my_syms, MY_SYMS);
+//
+// the names are laid out in a perfect hash table at compile time, so a lookup
+// costs two hashes (bucket, then slot) and one strcmp however many symbols
+// there are.
+
+extern "C" {
+    struct clib_symtab_t {
+        const char * const * names; void * const * syms; uint32_t n;
+        const uint16_t * disp; uint32_t nbuckets;
+        const uint16_t * slots; uint32_t mask;
+        clib_symtab_t * next;
+    };
+
+    // add a table to those clib_getsym() searches (lj_clib.c).
+    void clib_register(clib_symtab_t * t);
+}
+
+// must match clib_hash() in lj_clib.c: fnv-1a, seeded, with a murmur3 finalizer.
+constexpr uint32_t clib_hash(const char * s, uint32_t seed) {
+    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u); for(; *s; ++s) {
+        h ^= (uint8_t)*s; h *= 16777619u;
+    }
+
+    h ^= h >> 16; h *= 0x85ebca6bu; h ^= h >> 13; h *= 0xc2b2ae35u; h ^= h >> 16; return h;
+}
+
+constexpr bool clib_streq(const char * a, const char * b) {
+    while(*a && *a == *b) { ++a; ++b; } return *a == *b;
+}
+
+// hash-and-displace: names are split into buckets by clib_hash(name, 0), and
+// each bucket, largest first, gets the first seed that puts all of its names
+// into free slots of `slots` (size a power of two). scratch holds 3 * n +
+// 2 * nbuckets + 1 words.
+constexpr void clib_build_hash(const char * const * names, uint32_t n, uint16_t * disp, uint32_t nbuckets,
+                               uint16_t * slots, uint32_t size, uint32_t * scratch) {
+    constexpr uint16_t empty = 0xffff;
+
+    // names grouped by bucket: those of bucket b are members[first[b]] .. members[first[b + 1] - 1].
+    uint32_t * bucket = scratch; uint32_t * members = bucket + n; uint32_t * taken = members + n;
+    uint32_t * first = taken + n; uint32_t * fill = first + nbuckets + 1;
+
+    for(uint32_t i = 0; i < size; ++i) slots[i] = empty;
+    for(uint32_t b = 0; b <= nbuckets; ++b) first[b] = 0;
+
+    for(uint32_t i = 0; i < n; ++i) {
+        bucket[i] = clib_hash(names[i], 0) % nbuckets; ++first[bucket[i] + 1];
+    }
+
+    for(uint32_t b = 0; b < nbuckets; ++b) { first[b + 1] += first[b]; fill[b] = 0; }
+
+    for(uint32_t i = 0; i < n; ++i) {
+        uint32_t b = bucket[i]; members[first[b] + fill[b]++] = i;
+    }
+
+    for(uint32_t k = n; k > 0; --k) for(uint32_t b = 0; b < nbuckets; ++b) {
+        if(first[b + 1] - first[b] != k) continue;
+
+        // equal names always share a bucket.
+        for(uint32_t i = first[b]; i < first[b + 1]; ++i) for(uint32_t j = first[b]; j < i; ++j) {
+            if(clib_streq(names[members[i]], names[members[j]])) throw "clib: duplicate symbol";
+        }
+
+        for(uint32_t d = 1;; ++d) {
+            if(d == empty) throw "clib: no perfect hash";
+
+            bool ok = true; for(uint32_t i = 0; ok && i < k; ++i) {
+                uint32_t s = clib_hash(names[members[first[b] + i]], d) & (size - 1);
+
+                ok = (slots[s] == empty); for(uint32_t t = 0; ok && t < i; ++t) ok = (taken[t] != s);
+
+                taken[i] = s;
+            }
+
+            if(!ok) continue;
+
+            for(uint32_t i = 0; i < k; ++i) slots[taken[i]] = (uint16_t)members[first[b] + i];
+
+            disp[b] = (uint16_t)d; break;
+        }
+    }
+}
+
+constexpr uint32_t clib_hash_buckets(size_t n) { return (uint32_t)((n + 3) / 4); }
+
+constexpr uint32_t clib_hash_size(size_t n) { uint32_t m = 2; while(m < 2 * n) m <<= 1; return m; }
+
+template<size_t N>
+struct clib_perfect_hash {
+    static constexpr uint32_t nbuckets = clib_hash_buckets(N);
+    static constexpr uint32_t size = clib_hash_size(N);
+
+    static_assert(N > 0 && N < 0xffff, "clib: symbol table size");
+
+    uint16_t disp[nbuckets] = {}; uint16_t slots[size] = {};
+
+    constexpr clib_perfect_hash(const char * const (&names)[N]) {
+        uint32_t scratch[3 * N + 2 * nbuckets + 1] = {}; clib_build_hash(names, N, disp, nbuckets, slots, size, scratch);
+    }
+};
+
+struct clib_registrar {
+    clib_registrar(clib_symtab_t * t) { clib_register(t); }
+};
+
+#define CLIB_NAME(name) #name,
+#define CLIB_ADDR(name) (void *)(name),
+
+// define and register the symbol table `var` from the x-macro LIST.
+#define CLIB_SYMTAB(var, LIST) \
+    static constexpr const char * var##_names[] = { LIST(CLIB_NAME) }; \
+    static constexpr clib_perfect_hash<std::size(var##_names)> var##_hash(var##_names); \
+    static void * const var##_syms[] = { LIST(CLIB_ADDR) }; \
+    static clib_symtab_t var = { \
+        var##_names, var##_syms, std::size(var##_names), \
+        var##_hash.disp, var##_hash.nbuckets, var##_hash.slots, var##_hash.size - 1, nullptr }; \
+    static clib_registrar var##_registrar(&var)
+
+// a table filled at run time, e.g. by lua_ffi bindings; its hash is rebuilt
+// on every add, which is fine for the few dozen symbols of a startup. adding
+// a name again, as every further lua_State does, is a no-op.
+struct clib_dynamic_symtab {
+    clib_symtab_t t {}; bool registered = false; std::mutex mutex;
+
+    std::deque<std::string> strings; std::vector<const char *> names; std::vector<void *> syms;
+    std::vector<uint16_t> disp, slots; std::vector<uint32_t> scratch;
+
+    void add(std::string_view name, void * sym) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for(auto x : names) if(name == x) return;
+
+        names.push_back(strings.emplace_back(name).c_str()); syms.push_back(sym);
+
+        uint32_t n = (uint32_t)names.size(), nbuckets = clib_hash_buckets(n), size = clib_hash_size(n);
+
+        disp.assign(nbuckets, 0); slots.assign(size, 0); scratch.assign(3 * n + 2 * nbuckets + 1, 0);
+
+        clib_build_hash(names.data(), n, disp.data(), nbuckets, slots.data(), size, scratch.data());
+
+        t.names = names.data(); t.syms = syms.data(); t.n = n;
+        t.disp = disp.data(); t.nbuckets = nbuckets; t.slots = slots.data(); t.mask = size - 1;
+
+        if(!registered) { clib_register(&t); registered = true; }
+    }
+};
+
+inline clib_dynamic_symtab $clib_dynamic_syms;
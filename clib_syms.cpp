@@ -2,15 +2,10 @@
 #include <stdint.h>
 
 #include "ljxx.h"
+#include "clib.h"
 
 extern lua_State * __L;
 
-struct clib_sym_t {
-    const char * name; void * sym;
-};
-
-#define CLIB_SYM(name) { #name, (void *)(name) }
-
 int reftable_ref(lua_table t, lua_gcptr x) {
     printf("reftable\n");
     __L->top->u64 = ((uint64_t)t.value) | (((uint64_t)LJ_TTAB) << 47); incr_top(__L);
@@ -42,28 +37,20 @@ extern void ninja_build();
 extern void ninja_clean();
 }
 
-static clib_sym_t __clib_syms[] = {
-    CLIB_SYM(reftable_ref),
-    CLIB_SYM(reftable_unref),
-    CLIB_SYM(ninja_config_get),
-    CLIB_SYM(ninja_config_apply),
-    CLIB_SYM(ninja_reset),
-    CLIB_SYM(ninja_dump),
-    CLIB_SYM(ninja_var_get),
-    CLIB_SYM(ninja_var_set),
-    CLIB_SYM(ninja_pool_add),
-    CLIB_SYM(ninja_edge_add),
-    CLIB_SYM(ninja_rule_add),
-    CLIB_SYM(ninja_default_add),
-    CLIB_SYM(ninja_build),
-    CLIB_SYM(ninja_clean),
-    {0, 0}};
-
-extern "C" {
-    extern clib_sym_t * clib_syms;
-}
-
-__attribute__((constructor)) static void clib_init() {
-    printf("clib_syms init\n");
-    clib_syms = __clib_syms;
-}
+#define CLIB_SYMS(_) \
+    _(reftable_ref) \
+    _(reftable_unref) \
+    _(ninja_config_get) \
+    _(ninja_config_apply) \
+    _(ninja_reset) \
+    _(ninja_dump) \
+    _(ninja_var_get) \
+    _(ninja_var_set) \
+    _(ninja_pool_add) \
+    _(ninja_edge_add) \
+    _(ninja_rule_add) \
+    _(ninja_default_add) \
+    _(ninja_build) \
+    _(ninja_clean)
+
+CLIB_SYMTAB(clib_syms, CLIB_SYMS);
@@ -152,28 +152,65 @@ static void clib_unloadlib(CLibrary *cl)
 #endif    
 }
 
-struct clib_sym_t {
-  const char * name; void *sym;
+/* Symbols of the executable itself, registered by clib.h's CLIB_SYMTAB().
+** Each table is a perfect hash built at compile time: a name's bucket
+** gives the seed that hashes it to its slot.
+*/
+struct clib_symtab_t {
+  const char *const *names; void *const *syms; uint32_t n;
+  const uint16_t *disp; uint32_t nbuckets;
+  const uint16_t *slots; uint32_t mask;
+  struct clib_symtab_t *next;
 };
 
-struct clib_sym_t * clib_syms = 0;
+static struct clib_symtab_t *clib_symtabs = NULL;
+
+void clib_register(struct clib_symtab_t *t)
+{
+  t->next = clib_symtabs;
+  clib_symtabs = t;
+}
+
+/* Must match clib_hash() in clib.h. */
+static uint32_t clib_hash(const char *s, uint32_t seed)
+{
+  uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+  for (; *s; s++) {
+    h ^= (uint8_t)*s;
+    h *= 16777619u;
+  }
+  h ^= h >> 16; h *= 0x85ebca6bu;
+  h ^= h >> 13; h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+static void *clib_symtab_find(const char *name)
+{
+  struct clib_symtab_t *t;
+  uint32_t h0 = clib_hash(name, 0);
+  for (t = clib_symtabs; t; t = t->next) {
+    uint32_t d = t->disp[h0 % t->nbuckets];
+    uint32_t i = t->slots[clib_hash(name, d) & t->mask];
+    if (i < t->n && !strcmp(t->names[i], name)) return t->syms[i];
+  }
+  return NULL;
+}
 
 static void *clib_getsym(CLibrary *cl, const char *name)
 {
 #ifdef __COSMOCC__
   if(cl->handle == CLIB_DEFHANDLE) {
-    struct clib_sym_t *sym = clib_syms;
-    while (sym->name) {
-      if (!strcmp(sym->name, name)) return sym->sym;
-      sym++;
-    }
-    return NULL;
+    return clib_symtab_find(name);
   }
   else {
     return cosmo_dltramp(cosmo_dlsym(cl->handle, name));
   }
 #else
-  void *p = dlsym(cl->handle, name); return p;
+  void *p = NULL;
+  if (cl->handle == CLIB_DEFHANDLE) p = clib_symtab_find(name);
+  if (!p) p = dlsym(cl->handle, name);
+  return p;
 #endif
 }
 
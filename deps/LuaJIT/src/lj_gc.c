@@ -730,8 +730,45 @@ static size_t gc_onestep(lua_State *L)
   }
 }
 
+/* The universe whose GC steps are timed, its clock and its stats. */
+static global_State *gc_timed_g;
+static uint64_t (*gc_clock)(void);
+static GCStats gc_timed_stats;
+
+#define gc_timed(g)	((g) == gc_timed_g)
+
+/* Time the GC steps of g with clock, or stop timing them if clock is NULL. */
+void lj_gc_setclock(global_State *g, uint64_t (*clock)(void))
+{
+  gc_timed_g = clock ? g : NULL;
+  gc_clock = clock;
+  memset(&gc_timed_stats, 0, sizeof(gc_timed_stats));
+}
+
+/* Stats of g, or NULL if its GC steps are not timed. */
+GCStats *lj_gc_stats(global_State *g)
+{
+  return gc_timed(g) ? &gc_timed_stats : NULL;
+}
+
+/* Account a GC step of ns nanoseconds, which may end a cycle. */
+static void gc_stats(uint64_t ns, int endcycle)
+{
+  GCStats *s = &gc_timed_stats;
+  s->steps++;
+  s->ns += ns;
+  if (ns > s->maxns) s->maxns = ns;
+  if (endcycle) {
+    s->cycles++;
+    s->last_steps = s->steps; s->last_ns = s->ns; s->last_maxns = s->maxns;
+    s->total_ns += s->ns;
+    if (s->maxns > s->worst_ns) s->worst_ns = s->maxns;
+    s->steps = s->ns = s->maxns = 0;
+  }
+}
+
 /* Perform a limited amount of incremental GC steps. */
-int LJ_FASTCALL lj_gc_step(lua_State *L)
+static int gc_step(lua_State *L)
 {
   global_State *g = G(L);
   GCSize lim;
@@ -762,6 +799,19 @@ int LJ_FASTCALL lj_gc_step(lua_State *L)
   }
 }
 
+int LJ_FASTCALL lj_gc_step(lua_State *L)
+{
+  global_State *g = G(L);
+  uint64_t t;
+  int r;
+  if (!gc_timed(g))
+    return gc_step(L);
+  t = gc_clock();
+  r = gc_step(L);
+  gc_stats(gc_clock() - t, r == 1);
+  return r;
+}
+
 /* Ditto, but fix the stack top first. */
 void LJ_FASTCALL lj_gc_step_fixtop(lua_State *L)
 {
@@ -788,6 +838,7 @@ void lj_gc_fullgc(lua_State *L)
 {
   global_State *g = G(L);
   int32_t ostate = g->vmstate;
+  uint64_t t = gc_timed(g) ? gc_clock() : 0;
   setvmstate(g, GC);
   if (g->gc.state <= GCSatomic) {  /* Caught somewhere in the middle. */
     setmref(g->gc.sweep, &g->gc.root);  /* Sweep everything (preserving it). */
@@ -806,6 +857,8 @@ void lj_gc_fullgc(lua_State *L)
   do { gc_onestep(L); } while (g->gc.state != GCSpause);
   g->gc.threshold = (g->gc.estimate/100) * g->gc.pause;
   g->vmstate = ostate;
+  if (gc_timed(g))
+    gc_stats(gc_clock() - t, 1);
 }
 
 /* -- Write barriers ------------------------------------------------------ */
@@ -61,6 +61,21 @@ LJ_FUNC int LJ_FASTCALL lj_gc_step_jit(global_State *g, MSize steps);
 #endif
 LJ_FUNC void lj_gc_fullgc(lua_State *L);
 
+/* GC pause instrumentation (ljx). Times are in nanoseconds. The stats live
+** outside global_State, whose layout the VM is built against, so only one
+** universe is measured at a time. Set the clock before other threads open
+** universes of their own.
+*/
+typedef struct GCStats {
+  uint64_t cycles;	/* Completed GC cycles. */
+  uint64_t steps, ns, maxns;	/* Current cycle: steps, time, longest step. */
+  uint64_t last_steps, last_ns, last_maxns;	/* Same, for the last cycle. */
+  uint64_t total_ns, worst_ns;	/* All cycles: time, longest step. */
+} GCStats;
+
+LJ_FUNC void lj_gc_setclock(global_State *g, uint64_t (*clock)(void));
+LJ_FUNC GCStats *lj_gc_stats(global_State *g);
+
 /* GC check: drive collector forward if the GC threshold has been reached. */
 #define lj_gc_check(L) \
   { if (LJ_UNLIKELY(G(L)->gc.total >= G(L)->gc.threshold)) \
@@ -183,6 +183,8 @@ static void close_state(lua_State *L)
 {
   global_State *g = G(L);
   lj_func_closeuv(L, tvref(L->stack));
+  if (lj_gc_stats(g))  /* Stop timing a universe that goes away. */
+    lj_gc_setclock(g, NULL);
   lj_gc_freeall(g);
   lj_assertG(gcref(g->gc.root) == obj2gco(L),
 	     "main thread is not first GC object");
@@ -0,0 +1,329 @@
+#include "archive.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "string_piece_util.h"
+#include "util.h"
+
+using namespace std;
+
+namespace {
+
+const char kThinMagic[] = "!<thin>\n";
+
+/// Reads the integers of an ELF file of either byte order; a read past the
+/// end yields 0 and clears ok_.
+struct ElfReader {
+  ElfReader(const string& data, bool big_endian)
+      : data_(data), big_endian_(big_endian), ok_(true) {}
+
+  uint64_t Read(uint64_t offset, size_t width) {
+    if (offset > data_.size() || width > data_.size() - offset) {
+      ok_ = false;
+      return 0;
+    }
+    uint64_t x = 0;
+    for (size_t i = 0; i < width; ++i) {
+      size_t at = offset + (big_endian_ ? i : width - 1 - i);
+      x = (x << 8) | static_cast<unsigned char>(data_[at]);
+    }
+    return x;
+  }
+
+  const string& data_;
+  bool big_endian_;
+  bool ok_;
+};
+
+/// An ar member header: name, date, uid, gid, mode, size and "`\n", with
+/// the fields padded with spaces.
+void AppendHeader(const string& name, const char* owner, const char* mode,
+                  uint64_t size, string* out) {
+  char header[61];
+  snprintf(header, sizeof(header), "%-16s%-12s%-6s%-6s%-8s%-10llu`\n",
+           name.c_str(), owner, owner, owner, mode,
+           static_cast<unsigned long long>(size));
+  out->append(header, 60);
+}
+
+void AppendBigEndian32(uint32_t x, string* out) {
+  out->push_back(static_cast<char>(x >> 24));
+  out->push_back(static_cast<char>(x >> 16));
+  out->push_back(static_cast<char>(x >> 8));
+  out->push_back(static_cast<char>(x));
+}
+
+uint32_t ReadBigEndian32(const char* p) {
+  const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+  return (uint32_t(u[0]) << 24) | (uint32_t(u[1]) << 16) |
+         (uint32_t(u[2]) << 8) | uint32_t(u[3]);
+}
+
+bool IsAbsolute(const string& path) {
+#ifdef _WIN32
+  if (path.size() > 1 && path[1] == ':')
+    return true;
+  if (!path.empty() && path[0] == '\\')
+    return true;
+#endif
+  return !path.empty() && path[0] == '/';
+}
+
+}  // anonymous namespace
+
+bool ReadObjectSymbols(const string& contents, vector<string>* symbols,
+                       string* err) {
+  if (contents.size() < 0x34 || contents.compare(0, 4, "\x7f" "ELF") != 0 ||
+      (contents[4] != 1 && contents[4] != 2)) {
+    *err = "not an ELF object";
+    return false;
+  }
+
+  // Offsets and widths of the fields read, for ELFCLASS32 and ELFCLASS64.
+  const bool is64 = contents[4] == 2;
+  const size_t word = is64 ? 8 : 4;
+  ElfReader r(contents, contents[5] == 2);
+
+  const uint64_t shoff = r.Read(is64 ? 0x28 : 0x20, word);
+  const uint64_t shentsize = r.Read(is64 ? 0x3a : 0x2e, 2);
+  uint64_t shnum = r.Read(is64 ? 0x3c : 0x30, 2);
+  // More sections than fit in e_shnum: the count is section 0's sh_size.
+  if (shnum == 0 && shoff != 0)
+    shnum = r.Read(shoff + (is64 ? 32 : 20), word);
+
+  for (uint64_t i = 0; i < shnum && shentsize > 0 && r.ok_; ++i) {
+    const uint64_t sh = shoff + i * shentsize;
+    if (r.Read(sh + 4, 4) != 2)  // SHT_SYMTAB
+      continue;
+    const uint64_t offset = r.Read(sh + (is64 ? 24 : 16), word);
+    const uint64_t size = r.Read(sh + (is64 ? 32 : 20), word);
+    const uint64_t strtab = shoff + r.Read(sh + (is64 ? 40 : 24), 4) * shentsize;
+    // sh_info: locals come first, this is the first symbol that is not.
+    const uint64_t first = r.Read(sh + (is64 ? 44 : 28), 4);
+    const uint64_t entsize = r.Read(sh + (is64 ? 56 : 36), word);
+    const uint64_t stroff = r.Read(strtab + (is64 ? 24 : 16), word);
+    const uint64_t strsize = r.Read(strtab + (is64 ? 32 : 20), word);
+    if (entsize == 0 || offset > contents.size() ||
+        size > contents.size() - offset || stroff > contents.size() ||
+        strsize > contents.size() - stroff)
+      r.ok_ = false;
+
+    for (uint64_t j = first; r.ok_ && j < size / entsize; ++j) {
+      const uint64_t sym = offset + j * entsize;
+      const uint64_t name = r.Read(sym, 4);
+      const uint64_t bind = r.Read(sym + (is64 ? 4 : 12), 1) >> 4;
+      const uint64_t shndx = r.Read(sym + (is64 ? 6 : 14), 2);
+      // STB_GLOBAL, STB_WEAK and STB_GNU_UNIQUE; SHN_UNDEF is not defined.
+      if (shndx == 0 || (bind != 1 && bind != 2 && bind != 10))
+        continue;
+      if (name >= strsize) {
+        r.ok_ = false;
+        break;
+      }
+      const char* s = contents.data() + stroff + name;
+      string symbol(s, strnlen(s, strsize - name));
+      if (symbol == "__gnu_lto_slim") {
+        *err = "GCC LTO object without machine code";
+        return false;
+      }
+      symbols->push_back(symbol);
+    }
+  }
+
+  if (!r.ok_) {
+    *err = "truncated ELF object";
+    return false;
+  }
+  return true;
+}
+
+ThinArchive::ThinArchive(const string& path) : path_(path) {}
+
+bool ThinArchive::Parse(const string& contents, string* err) {
+  members_.clear();
+  index_.clear();
+  if (contents.compare(0, 8, kThinMagic) != 0) {
+    *err = "not a thin archive";
+    return false;
+  }
+
+  // The index names members by the offset of their header.
+  map<uint64_t, size_t> at;
+  string symtab, names;
+  for (size_t pos = 8; pos < contents.size();) {
+    if (contents.size() - pos < 60 || contents.compare(pos + 58, 2, "`\n")) {
+      *err = "corrupt thin archive";
+      return false;
+    }
+    const size_t header = pos;
+    const uint64_t size = strtoull(contents.c_str() + pos + 48, NULL, 10);
+    string name = contents.substr(pos, 16);
+    pos += 60;
+
+    if (name[0] == '/' && (name[1] == ' ' || name[1] == '/')) {
+      // The symbol index or the long names; these have their data here.
+      if (size > contents.size() - pos) {
+        *err = "corrupt thin archive";
+        return false;
+      }
+      (name[1] == ' ' ? symtab : names) = contents.substr(pos, size);
+      pos += size + (size & 1);
+      continue;
+    }
+
+    Member member;
+    member.size = size;
+    if (name[0] == '/') {
+      size_t begin = strtoul(name.c_str() + 1, NULL, 10);
+      size_t end = names.find("/\n", begin);
+      if (begin >= names.size() || end == string::npos) {
+        *err = "corrupt thin archive";
+        return false;
+      }
+      member.name = names.substr(begin, end - begin);
+    } else {
+      member.name = name.substr(0, name.find('/'));
+    }
+    at[header] = members_.size();
+    index_[member.name] = members_.size();
+    members_.push_back(member);
+  }
+
+  if (symtab.size() >= 4) {
+    const uint32_t count = ReadBigEndian32(symtab.data());
+    size_t name = 4 + 4 * size_t(count);
+    if (name > symtab.size()) {
+      *err = "corrupt thin archive";
+      return false;
+    }
+    for (uint32_t i = 0; i < count && name < symtab.size(); ++i) {
+      const char* s = symtab.data() + name;
+      size_t len = strnlen(s, symtab.size() - name);
+      map<uint64_t, size_t>::const_iterator m =
+          at.find(ReadBigEndian32(symtab.data() + 4 + 4 * i));
+      if (m == at.end()) {
+        *err = "corrupt thin archive";
+        return false;
+      }
+      members_[m->second].symbols.push_back(string(s, len));
+      name += len + 1;
+    }
+  }
+  return true;
+}
+
+bool ThinArchive::Add(const string& path, const string& contents,
+                      string* err) {
+  Member member;
+  member.name = MemberName(path);
+  member.size = contents.size();
+  if (!ReadObjectSymbols(contents, &member.symbols, err)) {
+    *err = path + ": " + *err;
+    return false;
+  }
+
+  pair<map<string, size_t>::iterator, bool> i =
+      index_.insert(make_pair(member.name, members_.size()));
+  if (i.second)
+    members_.push_back(member);
+  else
+    swap(members_[i.first->second], member);
+  return true;
+}
+
+string ThinArchive::Contents() const {
+  // The index holds the offsets of the member headers, which come after
+  // the index and the long names, so their sizes go first.
+  string names;
+  vector<size_t> name_offsets;
+  size_t symbols = 0, symbol_bytes = 0;
+  for (size_t i = 0; i < members_.size(); ++i) {
+    name_offsets.push_back(names.size());
+    names += members_[i].name;
+    names += "/\n";
+    symbols += members_[i].symbols.size();
+    for (size_t j = 0; j < members_[i].symbols.size(); ++j)
+      symbol_bytes += members_[i].symbols[j].size() + 1;
+  }
+  // Padded to an even size, which GNU ar counts in the member's size.
+  size_t symtab_size = 4 + 4 * symbols + symbol_bytes;
+  symtab_size += symtab_size & 1;
+
+  size_t offset = 8;
+  if (symbols > 0)
+    offset += 60 + symtab_size;
+  if (!names.empty())
+    offset += 60 + names.size() + (names.size() & 1);
+
+  string out = kThinMagic;
+  out.reserve(offset + 60 * members_.size());
+
+  if (symbols > 0) {
+    AppendHeader("/", "0", "0", symtab_size, &out);
+    AppendBigEndian32(static_cast<uint32_t>(symbols), &out);
+    for (size_t i = 0; i < members_.size(); ++i) {
+      for (size_t j = 0; j < members_[i].symbols.size(); ++j)
+        AppendBigEndian32(static_cast<uint32_t>(offset + 60 * i), &out);
+    }
+    for (size_t i = 0; i < members_.size(); ++i) {
+      for (size_t j = 0; j < members_[i].symbols.size(); ++j)
+        out.append(members_[i].symbols[j].c_str(),
+                   members_[i].symbols[j].size() + 1);
+    }
+    if (symbol_bytes & 1)
+      out.push_back('\0');
+  }
+
+  if (!names.empty()) {
+    AppendHeader("//", "", "", names.size(), &out);
+    out += names;
+    if (names.size() & 1)
+      out.push_back('\n');
+  }
+
+  char name[24];
+  for (size_t i = 0; i < members_.size(); ++i) {
+    snprintf(name, sizeof(name), "/%zu", name_offsets[i]);
+    AppendHeader(name, "0", "644", members_[i].size, &out);
+  }
+  return out;
+}
+
+string ThinArchive::MemberName(const string& path) const {
+  if (IsAbsolute(path))
+    return path;
+
+  // Climb out of the directories of the archive that path is not in.
+  vector<StringPiece> dir = SplitStringPiece(path_, '/');
+  dir.pop_back();
+  vector<StringPiece> file = SplitStringPiece(path, '/');
+  size_t common = 0;
+  while (common < dir.size() && common + 1 < file.size() &&
+         dir[common] == file[common])
+    ++common;
+
+  string name;
+  for (size_t i = common; i < dir.size(); ++i) {
+    if (dir[i] == ".." || IsAbsolute(path_)) {
+      // Not a way back down by name: name the object from the root.
+      char cwd[4096];
+      if (!getcwd(cwd, sizeof(cwd)))
+        return path;
+      return string(cwd) + "/" + path;
+    }
+    name += "../";
+  }
+  for (size_t i = common; i < file.size(); ++i) {
+    name += file[i].AsString();
+    if (i + 1 < file.size())
+      name += '/';
+  }
+  return name;
+}
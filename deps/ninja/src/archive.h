@@ -0,0 +1,58 @@
+#ifndef NINJA_ARCHIVE_H_
+#define NINJA_ARCHIVE_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+/// Thin static archives ("!<thin>\n"), as GNU ar rcsT writes them.  A thin
+/// archive holds the symbol index and the paths of its members, not their
+/// contents; linkers read the members from those paths, which are relative
+/// to the archive's directory.  Writing one costs the size of the index,
+/// and updating one reads the symbols of the objects that changed only,
+/// keeping those of the others from the archive.
+///
+/// Symbols are read from ELF objects.  Other formats (COFF, Mach-O, LLVM
+/// bitcode) and GCC's slim LTO objects, whose symbols only the compiler
+/// knows, are an error: their archives are left to ar.
+
+/// Add the symbols an ELF object in \a contents defines for other objects
+/// (global, weak and unique ones, common included) to \a symbols.
+bool ReadObjectSymbols(const std::string& contents,
+                       std::vector<std::string>* symbols, std::string* err);
+
+struct ThinArchive {
+  struct Member {
+    std::string name;
+    uint64_t size;
+    std::vector<std::string> symbols;
+  };
+
+  /// An empty archive written to \a path.
+  explicit ThinArchive(const std::string& path);
+
+  /// Read the members and the symbol index of the thin archive in
+  /// \a contents, as Contents() writes it.
+  bool Parse(const std::string& contents, std::string* err);
+
+  /// Make the object at \a path, which holds \a contents, a member: the
+  /// member of the same path is replaced in place, else one is appended.
+  bool Add(const std::string& path, const std::string& contents,
+           std::string* err);
+
+  std::string Contents() const;
+
+  /// \a path as a member name: relative to the archive's directory, unless
+  /// absolute.
+  std::string MemberName(const std::string& path) const;
+
+  std::string path_;
+  std::vector<Member> members_;
+
+ private:
+  std::map<std::string, size_t> index_;
+};
+
+#endif  // NINJA_ARCHIVE_H_
@@ -0,0 +1,154 @@
+#include "archive.h"
+
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+struct Symbol {
+  const char* name;
+  int bind;
+  int shndx;
+};
+
+void Put(string* out, size_t offset, uint64_t x, size_t width) {
+  for (size_t i = 0; i < width; ++i)
+    (*out)[offset + i] = static_cast<char>(x >> (8 * i));
+}
+
+/// A little-endian ELF64 object with nothing but a symbol table, whose
+/// locals end before \a first_global: the header, the section headers
+/// (null, .strtab, .symtab), then the tables.
+string ElfObject(const Symbol* symbols, size_t count, size_t first_global) {
+  string strtab(1, '\0');
+  string symtab(24, '\0');
+  for (size_t i = 0; i < count; ++i) {
+    string sym(24, '\0');
+    Put(&sym, 0, strtab.size(), 4);
+    Put(&sym, 4, (symbols[i].bind << 4) | 2, 1);
+    Put(&sym, 6, symbols[i].shndx, 2);
+    symtab += sym;
+    strtab += symbols[i].name;
+    strtab.push_back('\0');
+  }
+  strtab.resize((strtab.size() + 7) & ~size_t(7));
+
+  string elf(256, '\0');
+  elf.replace(0, 7, "\x7f" "ELF\x02\x01\x01");
+  Put(&elf, 16, 1, 2);     // ET_REL
+  Put(&elf, 18, 62, 2);    // EM_X86_64
+  Put(&elf, 0x28, 64, 8);  // e_shoff
+  Put(&elf, 0x34, 64, 2);
+  Put(&elf, 0x3a, 64, 2);
+  Put(&elf, 0x3c, 3, 2);
+  Put(&elf, 128 + 4, 3, 4);  // SHT_STRTAB
+  Put(&elf, 128 + 24, 256, 8);
+  Put(&elf, 128 + 32, strtab.size(), 8);
+  Put(&elf, 192 + 4, 2, 4);  // SHT_SYMTAB
+  Put(&elf, 192 + 24, 256 + strtab.size(), 8);
+  Put(&elf, 192 + 32, symtab.size(), 8);
+  Put(&elf, 192 + 40, 1, 4);
+  Put(&elf, 192 + 44, first_global, 4);
+  Put(&elf, 192 + 56, 24, 8);
+  return elf + strtab + symtab;
+}
+
+string ElfObject(const char* global) {
+  Symbol symbols[] = { { global, 1, 1 } };
+  return ElfObject(symbols, 1, 1);
+}
+
+}  // anonymous namespace
+
+TEST(ArchiveTest, ReadObjectSymbols) {
+  Symbol symbols[] = {
+    { "local", 0, 1 },
+    { "global", 1, 1 },
+    { "undefined", 1, 0 },
+    { "weak", 2, 1 },
+    { "common", 1, 0xfff2 },
+    { "unique", 10, 1 },
+  };
+  vector<string> names;
+  string err;
+  EXPECT_TRUE(ReadObjectSymbols(ElfObject(symbols, 6, 1), &names, &err));
+  EXPECT_EQ("", err);
+  ASSERT_EQ(4u, names.size());
+  EXPECT_EQ("global", names[0]);
+  EXPECT_EQ("weak", names[1]);
+  EXPECT_EQ("common", names[2]);
+  EXPECT_EQ("unique", names[3]);
+
+  EXPECT_FALSE(ReadObjectSymbols("BC\xc0\xde", &names, &err));
+  EXPECT_EQ("not an ELF object", err);
+
+  string truncated = ElfObject(symbols, 6, 1);
+  truncated.resize(truncated.size() - 1);
+  EXPECT_FALSE(ReadObjectSymbols(truncated, &names, &err));
+  EXPECT_EQ("truncated ELF object", err);
+
+  Symbol lto[] = { { "__gnu_lto_slim", 1, 0xfff2 } };
+  EXPECT_FALSE(ReadObjectSymbols(ElfObject(lto, 1, 0), &names, &err));
+  EXPECT_EQ("GCC LTO object without machine code", err);
+}
+
+TEST(ArchiveTest, MemberName) {
+  ThinArchive archive("out/lib/libx.a");
+  EXPECT_EQ("a.o", archive.MemberName("out/lib/a.o"));
+  EXPECT_EQ("obj/a.o", archive.MemberName("out/lib/obj/a.o"));
+  EXPECT_EQ("../obj/a.o", archive.MemberName("out/obj/a.o"));
+  EXPECT_EQ("../../a.o", archive.MemberName("a.o"));
+  EXPECT_EQ("/abs/a.o", archive.MemberName("/abs/a.o"));
+
+  EXPECT_EQ("out/a.o", ThinArchive("libx.a").MemberName("out/a.o"));
+}
+
+TEST(ArchiveTest, WriteParseUpdate) {
+  string err;
+  ThinArchive archive("out/libx.a");
+  ASSERT_TRUE(archive.Add("out/a.o", ElfObject("a"), &err)) << err;
+  ASSERT_TRUE(archive.Add("src/b.o", ElfObject("b"), &err)) << err;
+  ASSERT_TRUE(archive.Add("out/empty.o", ElfObject(NULL, 0, 1), &err));
+
+  string contents = archive.Contents();
+  ASSERT_EQ(0u, contents.compare(0, 8, "!<thin>\n"));
+  // The index: 2 symbols, at the headers of the first and second member.
+  const size_t symtab = 8 + 60;
+  EXPECT_EQ(string("\0\0\0\2", 4), contents.substr(symtab, 4));
+  const size_t names = symtab + 16;
+  EXPECT_EQ(string("a\0b\0", 4), contents.substr(symtab + 12, 4));
+  EXPECT_EQ("//", contents.substr(names, 2));
+  EXPECT_EQ("a.o/\n../src/b.o/\nempty.o/\n", contents.substr(names + 60, 26));
+  const size_t first = names + 60 + 26;
+  EXPECT_EQ(string("\0\0\0", 3) + char(first), contents.substr(symtab + 4, 4));
+  EXPECT_EQ("/0 ", contents.substr(first, 3));
+  EXPECT_EQ(contents.size(), first + 3 * 60);
+
+  ThinArchive read("out/libx.a");
+  ASSERT_TRUE(read.Parse(contents, &err)) << err;
+  ASSERT_EQ(3u, read.members_.size());
+  EXPECT_EQ("../src/b.o", read.members_[1].name);
+  EXPECT_EQ(ElfObject("b").size(), read.members_[1].size);
+  ASSERT_EQ(1u, read.members_[1].symbols.size());
+  EXPECT_EQ("b", read.members_[1].symbols[0]);
+  EXPECT_TRUE(read.members_[2].symbols.empty());
+  EXPECT_EQ(contents, read.Contents());
+
+  // An object that changed keeps its place; a new one goes last.
+  Symbol symbols[] = { { "b2", 1, 1 }, { "b3", 2, 1 } };
+  ASSERT_TRUE(read.Add("src/b.o", ElfObject(symbols, 2, 1), &err));
+  ASSERT_TRUE(read.Add("out/c.o", ElfObject("c"), &err));
+  ASSERT_EQ(4u, read.members_.size());
+  EXPECT_EQ(2u, read.members_[1].symbols.size());
+  EXPECT_EQ("c.o", read.members_[3].name);
+
+  ThinArchive reread("out/libx.a");
+  ASSERT_TRUE(reread.Parse(read.Contents(), &err)) << err;
+  ASSERT_EQ(4u, reread.members_.size());
+  EXPECT_EQ("b3", reread.members_[1].symbols[1]);
+  EXPECT_EQ("c", reread.members_[3].symbols[0]);
+
+  EXPECT_FALSE(reread.Parse("!<arch>\n", &err));
+  EXPECT_EQ("not a thin archive", err);
+}
@@ -32,8 +32,12 @@
 #include "disk_interface.h"
 #include "graph.h"
 #include "metrics.h"
+#ifndef _WIN32
+#include "remote.h"
+#endif
 #include "state.h"
 #include "status.h"
+#include "string_piece_util.h"
 #include "subprocess.h"
 #include "util.h"
 
@@ -73,6 +77,87 @@ bool DryRunCommandRunner::WaitForCommand(Result* result) {
    return true;
 }
 
+/// Write the response file of @a edge to @a rspfile, unless it already holds
+/// the same contents; only a file kept with rspfile_keep outlives a
+/// successful build, so that is what makes the skip pay off.  When the
+/// rule's rspfile_content is just $in or $in_newline, the file is written
+/// from the inputs a chunk at a time, which saves one copy of the list.
+/// The build log's command hash still evaluates rspfile_content into a
+/// single string, so the whole list is held in memory once per edge.
+bool WriteRspfile(DiskInterface* disk_interface, const Edge* edge,
+                  const string& rspfile) {
+  const size_t kChunk = 64 << 10;
+
+  char separator = 0;
+  const EvalString* content = edge->rule().GetBinding("rspfile_content");
+  if (content && content->parsed_.size() == 1 &&
+      content->parsed_[0].second == EvalString::SPECIAL &&
+      !edge->env_->HasOwnBinding("rspfile_content")) {
+    if (content->parsed_[0].first == "in")
+      separator = ' ';
+    else if (content->parsed_[0].first == "in_newline")
+      separator = '\n';
+  }
+
+  int written;
+  if (separator) {
+    size_t i = 0;
+    const size_t end =
+        edge->inputs_.size() - edge->implicit_deps_ - edge->order_only_deps_;
+    written = disk_interface->WriteChunks(rspfile, [&](string* chunk) {
+      chunk->clear();
+      for (; i < end && chunk->size() < kChunk; ++i) {
+        if (i > 0)
+          chunk->push_back(separator);
+        // Escaped as EdgeEnv escapes $in.
+#ifdef _WIN32
+        GetWin32EscapedString(edge->inputs_[i]->PathDecanonicalized(), chunk);
+#else
+        GetShellEscapedString(edge->inputs_[i]->PathDecanonicalized(), chunk);
+#endif
+      }
+      return !chunk->empty();
+    });
+  } else {
+    string contents = edge->GetBinding("rspfile_content");
+    bool done = false;
+    written = disk_interface->WriteChunks(rspfile, [&](string* chunk) {
+      if (done)
+        return false;
+      chunk->swap(contents);
+      done = true;
+      return true;
+    });
+  }
+  return written >= 0;
+}
+
+/// Whether @a edge can bring its output up to date with its rule's
+/// update_command.  The output must exist and the build log must show it
+/// was built by the same command, so from the same inputs.  Only a few of
+/// those may have changed; past that, doing it all again is as quick, and
+/// $in_changed must stay short enough for a command line.  Remote edges
+/// never update: the worker does not have the existing output.
+bool CanUpdate(const Edge* edge, BuildLog* build_log) {
+  const size_t kMaxChangedLength = 16 << 10;
+
+  if (!build_log || !edge->command_logged_ || edge->outputs_.empty() ||
+      !edge->outputs_[0]->exists() ||
+      edge->GetBinding("update_command").empty() ||
+      edge->GetBindingBool("remote"))
+    return false;
+
+  vector<const Node*> changed;
+  edge->CollectChangedInputs(&changed);
+  const size_t explicit_deps_count =
+      edge->inputs_.size() - edge->implicit_deps_ - edge->order_only_deps_;
+  size_t length = 0;
+  for (size_t i = 0; i < changed.size(); ++i)
+    length += changed[i]->path().size() + 1;
+  return !changed.empty() && changed.size() * 4 <= explicit_deps_count &&
+         length <= kMaxChangedLength;
+}
+
 }  // namespace
 
 Plan::Plan(Builder* builder)
@@ -153,13 +238,19 @@ void Plan::EdgeWanted(const Edge* edge) {
     ++command_edges_;
 }
 
-Edge* Plan::FindWork() {
-  if (ready_.empty())
-    return NULL;
-  EdgeSet::iterator e = ready_.begin();
-  Edge* edge = *e;
-  ready_.erase(e);
-  return edge;
+Edge* Plan::FindWork(int64_t memory_budget, int weight_budget) {
+  for (EdgeSet::iterator e = ready_.begin(); e != ready_.end(); ++e) {
+    Edge* edge = *e;
+    if (memory_budget >= 0 && builder_ &&
+        builder_->EstimateMemory(edge) > memory_budget)
+      continue;
+    if (weight_budget >= 0 && !edge->is_phony() &&
+        edge->weight() > weight_budget)
+      continue;
+    ready_.erase(e);
+    return edge;
+  }
+  return NULL;
 }
 
 void Plan::ScheduleWork(map<Edge*, Want>::iterator want_e) {
@@ -452,20 +543,6 @@ void Plan::Dump() const {
   printf("ready: %d\n", (int)ready_.size());
 }
 
-struct RealCommandRunner : public CommandRunner {
-  explicit RealCommandRunner(const BuildConfig& config) : config_(config) {}
-  virtual ~RealCommandRunner() {}
-  virtual bool CanRunMore() const;
-  virtual bool StartCommand(Edge* edge);
-  virtual bool WaitForCommand(Result* result);
-  virtual vector<Edge*> GetActiveEdges();
-  virtual void Abort();
-
-  const BuildConfig& config_;
-  SubprocessSet subprocs_;
-  map<const Subprocess*, Edge*> subproc_to_edge_;
-};
-
 vector<Edge*> RealCommandRunner::GetActiveEdges() {
   vector<Edge*> edges;
   for (map<const Subprocess*, Edge*>::iterator e = subproc_to_edge_.begin();
@@ -476,22 +553,77 @@ vector<Edge*> RealCommandRunner::GetActiveEdges() {
 
 void RealCommandRunner::Abort() {
   subprocs_.Clear();
+  running_weight_ = 0;
 }
 
 bool RealCommandRunner::CanRunMore() const {
-  size_t subproc_number =
-      subprocs_.running_.size() + subprocs_.finished_.size();
-  return (int)subproc_number < config_.parallelism
+  return running_weight_ < config_.parallelism
     && ((subprocs_.running_.empty() || config_.max_load_average <= 0.0f)
         || GetLoadAverage() < config_.max_load_average);
 }
 
+int RealCommandRunner::AvailableWeight() const {
+  if (running_weight_ == 0)
+    return -1;
+  return max(config_.parallelism - running_weight_, 0);
+}
+
+bool RealCommandRunner::CanRun(const Edge* edge) const {
+  int available = AvailableWeight();
+  return CanRunMore() && (available < 0 || edge->weight() <= available);
+}
+
+bool RealCommandRunner::UseSandbox(const Edge* edge) {
+  string sandbox = edge->GetBinding("sandbox");
+  if (sandbox.empty() ? !config_.sandbox : sandbox == "0")
+    return false;
+  // The first run of a command with a depfile is what discovers its
+  // inputs, so it cannot be confined to them yet.
+  if (edge->use_console() || edge->deps_missing_)
+    return false;
+  if (!Subprocess::SandboxAvailable()) {
+    if (!sandbox_warned_)
+      Warning("sandboxing is not available here, running commands unconfined");
+    sandbox_warned_ = true;
+    return false;
+  }
+  return true;
+}
+
 bool RealCommandRunner::StartCommand(Edge* edge) {
   string command = edge->EvaluateCommand();
-  Subprocess* subproc = subprocs_.Add(command, edge->use_console());
+
+  SubprocessSandbox sandbox;
+  bool use_sandbox = UseSandbox(edge);
+  if (use_sandbox) {
+    for (vector<Node*>::iterator i = edge->inputs_.begin();
+         i != edge->inputs_.end(); ++i)
+      sandbox.inputs.push_back((*i)->path());
+    for (vector<Node*>::iterator o = edge->outputs_.begin();
+         o != edge->outputs_.end(); ++o)
+      sandbox.outputs.push_back((*o)->path());
+    string rspfile = edge->GetUnescapedRspfile();
+    if (!rspfile.empty() && !edge->update_)
+      sandbox.inputs.push_back(rspfile);
+    string depfile = edge->GetUnescapedDepfile();
+    if (!depfile.empty())
+      sandbox.outputs.push_back(depfile);
+    // Anything else the command may read, e.g. a compiler outside the
+    // system directories.
+    string paths = edge->GetBinding("sandbox_paths");
+    vector<StringPiece> split = SplitStringPiece(paths, ' ');
+    for (vector<StringPiece>::iterator p = split.begin(); p != split.end(); ++p) {
+      if (p->len_ > 0)
+        sandbox.inputs.push_back(p->AsString());
+    }
+  }
+
+  Subprocess* subproc = subprocs_.Add(command, edge->use_console(),
+                                      use_sandbox ? &sandbox : NULL);
   if (!subproc)
     return false;
   subproc_to_edge_.insert(make_pair(subproc, edge));
+  running_weight_ += edge->weight();
 
   return true;
 }
@@ -506,10 +638,12 @@ bool RealCommandRunner::WaitForCommand(Result* result) {
 
   result->status = subproc->Finish();
   result->output = subproc->GetOutput();
+  result->peak_rss = subproc->GetPeakRss();
 
   map<const Subprocess*, Edge*>::iterator e = subproc_to_edge_.find(subproc);
   result->edge = e->second;
   subproc_to_edge_.erase(e);
+  running_weight_ -= result->edge->weight();
 
   delete subproc;
   return true;
@@ -520,7 +654,8 @@ Builder::Builder(State* state, const BuildConfig& config,
                  DiskInterface* disk_interface, Status *status,
                  int64_t start_time_millis)
     : state_(state), config_(config), plan_(this), status_(status),
-      start_time_millis_(start_time_millis), disk_interface_(disk_interface),
+      running_memory_total_(0), start_time_millis_(start_time_millis),
+      disk_interface_(disk_interface),
       scan_(state, build_log, deps_log, disk_interface,
             &config_.depfile_parser_options) {
   lock_file_path_ = ".ninja_lock";
@@ -620,6 +755,10 @@ bool Builder::Build(string* err) {
   if (!command_runner_.get()) {
     if (config_.dry_run)
       command_runner_.reset(new DryRunCommandRunner);
+#ifndef _WIN32
+    else if (!config_.remote_workers.empty())
+      command_runner_.reset(new RemoteCommandRunner(config_));
+#endif
     else
       command_runner_.reset(new RealCommandRunner(config_));
   }
@@ -635,7 +774,8 @@ bool Builder::Build(string* err) {
   while (plan_.more_to_do()) {
     // See if we can start any more commands.
     if (failures_allowed && command_runner_->CanRunMore()) {
-      if (Edge* edge = plan_.FindWork()) {
+      if (Edge* edge = plan_.FindWork(AvailableMemory(),
+                                      command_runner_->AvailableWeight())) {
         if (edge->GetBindingBool("generator")) {
           scan_.build_log()->Close();
         }
@@ -712,9 +852,15 @@ bool Builder::StartEdge(Edge* edge, string* err) {
   if (edge->is_phony())
     return true;
 
+  edge->update_ = !config_.dry_run && CanUpdate(edge, scan_.build_log());
+
   int64_t start_time_millis = GetTimeMillis() - start_time_millis_;
   running_edges_.insert(make_pair(edge, start_time_millis));
 
+  int64_t memory = EstimateMemory(edge);
+  running_memory_.insert(make_pair(edge, memory));
+  running_memory_total_ += memory;
+
   status_->BuildEdgeStarted(edge, start_time_millis);
 
   TimeStamp build_start = -1;
@@ -736,14 +882,13 @@ bool Builder::StartEdge(Edge* edge, string* err) {
 
   edge->command_start_time_ = build_start;
 
-  // Create response file, if needed
+  // Create response file, if needed; the update_command passes
+  // $in_changed instead of the whole list.
   // XXX: this may also block; do we care?
   string rspfile = edge->GetUnescapedRspfile();
-  if (!rspfile.empty()) {
-    string content = edge->GetBinding("rspfile_content");
-    if (!disk_interface_->WriteFile(rspfile, content))
-      return false;
-  }
+  if (!rspfile.empty() && !edge->update_ &&
+      !WriteRspfile(disk_interface_, edge, rspfile))
+    return false;
 
   // start command computing and run it
   if (!command_runner_->StartCommand(edge)) {
@@ -785,6 +930,10 @@ bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
   end_time_millis = GetTimeMillis() - start_time_millis_;
   running_edges_.erase(it);
 
+  RunningMemoryMap::iterator mem = running_memory_.find(edge);
+  running_memory_total_ -= mem->second;
+  running_memory_.erase(mem);
+
   status_->BuildEdgeFinished(edge, end_time_millis, result->success(),
                              result->output);
 
@@ -836,14 +985,16 @@ bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
   if (!plan_.EdgeFinished(edge, Plan::kEdgeSucceeded, err))
     return false;
 
-  // Delete any left over response file.
+  // Delete any left over response file, unless the rule keeps it so an
+  // identical one need not be written again next time.
   string rspfile = edge->GetUnescapedRspfile();
-  if (!rspfile.empty() && !g_keep_rsp)
+  if (!rspfile.empty() && !g_keep_rsp && !edge->GetBindingBool("rspfile_keep"))
     disk_interface_->RemoveFile(rspfile);
 
   if (scan_.build_log()) {
     if (!scan_.build_log()->RecordCommand(edge, start_time_millis,
-                                          end_time_millis, record_mtime)) {
+                                          end_time_millis, record_mtime,
+                                          result->peak_rss)) {
       *err = string("Error writing to build log: ") + strerror(errno);
       return false;
     }
@@ -931,6 +1082,29 @@ bool Builder::ExtractDeps(CommandRunner::Result* result,
   return true;
 }
 
+int64_t Builder::EstimateMemory(const Edge* edge) const {
+  int64_t memory = edge->memory();
+  if (BuildLog* build_log = scan_.build_log()) {
+    for (vector<Node*>::const_iterator o = edge->outputs_.begin();
+         o != edge->outputs_.end(); ++o) {
+      BuildLog::LogEntry* entry = build_log->LookupByOutput((*o)->path());
+      if (entry && entry->peak_rss > memory)
+        memory = entry->peak_rss;
+    }
+  }
+  return memory;
+}
+
+int64_t Builder::AvailableMemory() const {
+  // With nothing running, let the next command start even if it is
+  // estimated to exceed the whole budget; otherwise it could never run.
+  if (config_.max_memory <= 0 || running_memory_.empty())
+    return -1;
+  if (running_memory_total_ >= config_.max_memory)
+    return 0;
+  return config_.max_memory - running_memory_total_;
+}
+
 bool Builder::LoadDyndeps(Node* node, string* err) {
   status_->BuildLoadDyndeps();
 
@@ -25,6 +25,7 @@
 #include "depfile_parser.h"
 #include "graph.h"  // XXX needed for DependencyScan; should rearrange.
 #include "exit_status.h"
+#include "subprocess.h"
 #include "util.h"  // int64_t
 
 struct BuildLog;
@@ -45,9 +46,11 @@ struct Plan {
   /// fill in |err| with an error message if there's a problem.
   bool AddTarget(const Node* target, std::string* err);
 
-  // Pop a ready edge off the queue of edges to build.
+  // Pop a ready edge off the queue of edges to build.  Edges whose estimated
+  // memory use exceeds |memory_budget| bytes, or whose weight exceeds
+  // |weight_budget|, are left in the queue; a negative budget means no limit.
   // Returns NULL if there's no work to do.
-  Edge* FindWork();
+  Edge* FindWork(int64_t memory_budget = -1, int weight_budget = -1);
 
   /// Returns true if there's more work to be done.
   bool more_to_do() const { return wanted_edges_ > 0 && command_edges_ > 0; }
@@ -136,14 +139,18 @@ private:
 struct CommandRunner {
   virtual ~CommandRunner() {}
   virtual bool CanRunMore() const = 0;
+  /// The largest weight an edge started next may have, or -1 for any.
+  virtual int AvailableWeight() const { return -1; }
   virtual bool StartCommand(Edge* edge) = 0;
 
   /// The result of waiting for a command.
   struct Result {
-    Result() : edge(NULL) {}
+    Result() : edge(NULL), peak_rss(0) {}
     Edge* edge;
     ExitStatus status;
     std::string output;
+    /// Peak resident set size of the command in bytes, 0 if unknown.
+    int64_t peak_rss;
     bool success() const { return status == ExitSuccess; }
   };
   /// Wait for a command to complete, or return false if interrupted.
@@ -156,7 +163,8 @@ struct CommandRunner {
 /// Options (e.g. verbosity, parallelism) passed to a build.
 struct BuildConfig {
   BuildConfig() : verbosity(NORMAL), dry_run(false), parallelism(1),
-                  failures_allowed(1), max_load_average(-0.0f) {}
+                  failures_allowed(1), max_load_average(-0.0f),
+                  max_memory(0), sandbox(false) {}
 
   enum Verbosity {
     QUIET,  // No output -- used when testing.
@@ -171,7 +179,46 @@ struct BuildConfig {
   /// The maximum load average we must not exceed. A negative value
   /// means that we do not have any limit.
   double max_load_average;
+  /// The total memory in bytes that concurrently running commands are
+  /// estimated to use must stay below this.  0 means no limit.
+  int64_t max_memory;
+  /// Run commands confined to their declared inputs, see SubprocessSandbox.
+  /// Edges can override this with a "sandbox" binding of 0 or 1.
+  bool sandbox;
   DepfileParserOptions depfile_parser_options;
+  /// "host:port" addresses of workers that run edges with a "remote"
+  /// binding, see RemoteCommandRunner.
+  std::vector<std::string> remote_workers;
+  /// The secret the workers challenge every connection for.
+  std::string remote_secret;
+};
+
+/// RealCommandRunner runs commands as local subprocesses.
+struct RealCommandRunner : public CommandRunner {
+  explicit RealCommandRunner(const BuildConfig& config)
+      : config_(config), running_weight_(0), sandbox_warned_(false) {}
+  virtual ~RealCommandRunner() {}
+  virtual bool CanRunMore() const;
+  /// What is left of config_.parallelism, or any weight with nothing
+  /// running, so that an edge heavier than -j can still run alone.
+  virtual int AvailableWeight() const;
+  virtual bool StartCommand(Edge* edge);
+  virtual bool WaitForCommand(Result* result);
+  virtual std::vector<Edge*> GetActiveEdges();
+  virtual void Abort();
+
+  /// Whether \a edge fits next to the commands already running.
+  bool CanRun(const Edge* edge) const;
+
+  const BuildConfig& config_;
+  SubprocessSet subprocs_;
+  std::map<const Subprocess*, Edge*> subproc_to_edge_;
+  /// Total weight of the edges whose commands have not been reaped yet.
+  int running_weight_;
+
+  /// Whether to confine \a edge's command to its declared inputs.
+  bool UseSandbox(const Edge* edge);
+  bool sandbox_warned_;
 };
 
 /// Builder wraps the build process: starting commands, updating status.
@@ -212,6 +259,11 @@ struct Builder {
   /// Load the dyndep information provided by the given node.
   bool LoadDyndeps(Node* node, std::string* err);
 
+  /// Estimate the peak memory use of an edge's command in bytes: the
+  /// larger of its declared "memory" binding and the peak RSS recorded in
+  /// the build log for its outputs.  0 if unknown.
+  int64_t EstimateMemory(const Edge* edge) const;
+
   State* state_;
   const BuildConfig& config_;
   Plan plan_;
@@ -227,6 +279,16 @@ struct Builder {
   typedef std::map<const Edge*, int> RunningEdgeMap;
   RunningEdgeMap running_edges_;
 
+  /// Map of running edge to the memory it was estimated to use, and the
+  /// total of those estimates.
+  typedef std::map<const Edge*, int64_t> RunningMemoryMap;
+  RunningMemoryMap running_memory_;
+  int64_t running_memory_total_;
+
+  /// Memory left in the config's budget for new commands, or -1 if the
+  /// next command may start regardless of its estimate.
+  int64_t AvailableMemory() const;
+
   /// Time the build started.
   int64_t start_time_millis_;
 
@@ -54,7 +54,7 @@ namespace {
 
 const char kFileSignature[] = "# ninja log v%d\n";
 const int kOldestSupportedVersion = 6;
-const int kCurrentVersion = 6;
+const int kCurrentVersion = 7;
 
 // 64bit MurmurHash2, by Austin Appleby
 #if defined(_MSC_VER)
@@ -113,12 +113,13 @@ uint64_t BuildLog::LogEntry::HashCommand(StringPiece command) {
 }
 
 BuildLog::LogEntry::LogEntry(const string& output)
-  : output(output) {}
+  : output(output), peak_rss(0) {}
 
 BuildLog::LogEntry::LogEntry(const string& output, uint64_t command_hash,
-  int start_time, int end_time, TimeStamp mtime)
+  int start_time, int end_time, TimeStamp mtime, int64_t peak_rss)
   : output(output), command_hash(command_hash),
-    start_time(start_time), end_time(end_time), mtime(mtime)
+    start_time(start_time), end_time(end_time), mtime(mtime),
+    peak_rss(peak_rss)
 {}
 
 BuildLog::BuildLog()
@@ -142,7 +143,7 @@ bool BuildLog::OpenForWrite(const string& path, const BuildLogUser& user,
 }
 
 bool BuildLog::RecordCommand(Edge* edge, int start_time, int end_time,
-                             TimeStamp mtime) {
+                             TimeStamp mtime, int64_t peak_rss) {
   string command = edge->EvaluateCommand(true);
   uint64_t command_hash = LogEntry::HashCommand(command);
   for (vector<Node*>::iterator out = edge->outputs_.begin();
@@ -160,6 +161,7 @@ bool BuildLog::RecordCommand(Edge* edge, int start_time, int end_time,
     log_entry->start_time = start_time;
     log_entry->end_time = end_time;
     log_entry->mtime = mtime;
+    log_entry->peak_rss = peak_rss;
 
     if (!OpenForWriteIfNeeded()) {
       return false;
@@ -352,7 +354,12 @@ LoadStatus BuildLog::Load(const string& path, string* err) {
     entry->end_time = end_time;
     entry->mtime = mtime;
     char c = *end; *end = '\0';
-    entry->command_hash = (uint64_t)strtoull(start, NULL, 16);
+    char* hash_end;
+    entry->command_hash = (uint64_t)strtoull(start, &hash_end, 16);
+    // Since v7 the command hash is followed by the peak RSS in bytes.
+    entry->peak_rss = 0;
+    if (*hash_end == kFieldSeparator)
+      entry->peak_rss = strtoll(hash_end + 1, NULL, 10);
     *end = c;
   }
   fclose(file);
@@ -384,9 +391,9 @@ BuildLog::LogEntry* BuildLog::LookupByOutput(const string& path) {
 }
 
 bool BuildLog::WriteEntry(FILE* f, const LogEntry& entry) {
-  return fprintf(f, "%d\t%d\t%" PRId64 "\t%s\t%" PRIx64 "\n",
+  return fprintf(f, "%d\t%d\t%" PRId64 "\t%s\t%" PRIx64 "\t%" PRId64 "\n",
           entry.start_time, entry.end_time, entry.mtime,
-          entry.output.c_str(), entry.command_hash) > 0;
+          entry.output.c_str(), entry.command_hash, entry.peak_rss) > 0;
 }
 
 bool BuildLog::Recompact(const string& path, const BuildLogUser& user,
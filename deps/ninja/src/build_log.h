@@ -40,6 +40,7 @@ struct BuildLogUser {
 ///    when we need to rebuild due to the command changing
 /// 2) timing information, perhaps for generating reports
 /// 3) restat information
+/// 4) peak memory use, for scheduling against a memory budget
 struct BuildLog {
   BuildLog();
   ~BuildLog();
@@ -49,7 +50,7 @@ struct BuildLog {
   bool OpenForWrite(const std::string& path, const BuildLogUser& user,
                     std::string* err);
   bool RecordCommand(Edge* edge, int start_time, int end_time,
-                     TimeStamp mtime = 0);
+                     TimeStamp mtime = 0, int64_t peak_rss = 0);
   void Close();
 
   /// Load the on-disk log.
@@ -61,6 +62,8 @@ struct BuildLog {
     int start_time;
     int end_time;
     TimeStamp mtime;
+    /// Peak resident set size of the last run in bytes, 0 if unknown.
+    int64_t peak_rss;
 
     static uint64_t HashCommand(StringPiece command);
 
@@ -68,12 +71,13 @@ struct BuildLog {
     bool operator==(const LogEntry& o) {
       return output == o.output && command_hash == o.command_hash &&
           start_time == o.start_time && end_time == o.end_time &&
-          mtime == o.mtime;
+          mtime == o.mtime && peak_rss == o.peak_rss;
     }
 
     explicit LogEntry(const std::string& output);
     LogEntry(const std::string& output, uint64_t command_hash,
-             int start_time, int end_time, TimeStamp mtime);
+             int start_time, int end_time, TimeStamp mtime,
+             int64_t peak_rss = 0);
   };
 
   /// Lookup a previously-run command by its output path.
@@ -257,6 +257,58 @@ TEST_F(PlanTest, ConsolePool) {
 "build out2: poolcat in\n");
 }
 
+TEST_F(PlanTest, PoolWithWeight) {
+  // Each edge takes up the whole pool, so they run one at a time.
+  TestPoolWithDepthOne(
+"pool foobar\n"
+"  depth = 4\n"
+"rule poolcat\n"
+"  command = cat $in > $out\n"
+"  pool = foobar\n"
+"  weight = 3\n"
+"build out1: poolcat in\n"
+"build out2: poolcat in\n");
+}
+
+TEST_F(PlanTest, WeightBudget) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule heavy\n"
+"  command = cat $in > $out\n"
+"  weight = 3\n"
+"build out1: heavy in\n"
+"build out2: cat in\n"
+"build out3: heavy in\n"
+"build all: phony out1 out2 out3\n"));
+  GetNode("out1")->MarkDirty();
+  GetNode("out2")->MarkDirty();
+  GetNode("out3")->MarkDirty();
+  GetNode("all")->MarkDirty();
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("all"), &err));
+  ASSERT_EQ("", err);
+
+  // Only out2 fits in what is left; the heavy edges stay queued.
+  Edge* edge = plan_.FindWork(-1, 2);
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("out2", edge->outputs_[0]->path());
+  EXPECT_FALSE(plan_.FindWork(-1, 2));
+
+  edge = plan_.FindWork(-1, 3);
+  ASSERT_TRUE(edge);
+  EXPECT_EQ(3, edge->weight());
+
+  // RealCommandRunner leaves what -j allows, and anything when idle.
+  BuildConfig config;
+  config.parallelism = 4;
+  RealCommandRunner runner(config);
+  EXPECT_EQ(-1, runner.AvailableWeight());
+  EXPECT_TRUE(runner.CanRun(edge));
+  runner.running_weight_ = 3;
+  EXPECT_EQ(1, runner.AvailableWeight());
+  EXPECT_FALSE(runner.CanRun(edge));
+  EXPECT_TRUE(runner.CanRunMore());
+}
+
 TEST_F(PlanTest, PoolsWithDepthTwo) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "pool foobar\n"
@@ -1483,6 +1535,32 @@ TEST_F(BuildTest, PoolEdgesReadyButNotWanted) {
   EXPECT_GE(save_state.LookupPool("some_pool")->current_use(), 0);
 }
 
+TEST_F(BuildTest, MemoryBudget) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out1: cat in1\n"
+"  memory = 6G\n"
+"build out2: cat in1\n"
+"  memory = 6G\n"
+"build out3: cat in1\n"
+"  memory = 1G\n"
+"build final: cat out1 out2 out3\n"));
+  fs_.Create("in1", "");
+
+  // out2 does not fit next to out1, but out3 does.
+  config_.max_memory = 8LL << 30;
+  command_runner_.max_active_edges_ = 3;
+
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("final", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(4u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("cat in1 > out1", command_runner_.commands_ran_[0]);
+  EXPECT_EQ("cat in1 > out3", command_runner_.commands_ran_[1]);
+  EXPECT_EQ("cat in1 > out2", command_runner_.commands_ran_[2]);
+}
+
 struct BuildWithLogTest : public BuildTest {
   BuildWithLogTest() {
     builder_.SetBuildLog(&build_log_);
@@ -1633,6 +1711,120 @@ TEST_F(BuildWithLogTest, RebuildAfterFailure) {
   EXPECT_EQ("", err);
 }
 
+TEST_F(BuildWithLogTest, UpdateCommand) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule touch\n"
+"  command = ar $out $in\n"
+"  update_command = ar-update $out $in_changed\n"
+"build lib: touch a b c d e | implicit\n"));
+
+  const char* inputs[] = { "a", "b", "c", "d", "e", "implicit" };
+  for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i)
+    fs_.Create(inputs[i], "");
+
+  // No output yet: the whole command.
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("lib", &err));
+  EXPECT_TRUE(builder_.Build(&err));
+  EXPECT_EQ("", err);
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("ar lib a b c d e", command_runner_.commands_ran_[0]);
+
+  // One input changed: only it is passed on, and the log keeps the command.
+  fs_.Tick();
+  fs_.Create("b", "");
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("lib", &err));
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("ar-update lib b", command_runner_.commands_ran_[0]);
+
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("lib", &err));
+  EXPECT_TRUE(builder_.AlreadyUpToDate());
+
+  // Most of them, or only an implicit one: the whole command again.
+  fs_.Tick();
+  fs_.Create("b", "");
+  fs_.Create("c", "");
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("lib", &err));
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("ar lib a b c d e", command_runner_.commands_ran_[0]);
+
+  fs_.Tick();
+  fs_.Create("implicit", "");
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("lib", &err));
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("ar lib a b c d e", command_runner_.commands_ran_[0]);
+}
+
+TEST_F(BuildWithLogTest, UpdateCommandNoRspfile) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule touch\n"
+"  command = ar $out @$out.rsp\n"
+"  rspfile = $out.rsp\n"
+"  rspfile_content = $in\n"
+"  update_command = ar-update $out $in_changed\n"
+"build lib: touch a b c d e\n"));
+
+  const char* inputs[] = { "a", "b", "c", "d", "e" };
+  for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i)
+    fs_.Create(inputs[i], "");
+
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("lib", &err));
+  EXPECT_TRUE(builder_.Build(&err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ(1u, fs_.files_created_.count("lib.rsp"));
+
+  // The update names the changed inputs itself: no response file.
+  fs_.Tick();
+  fs_.Create("b", "");
+  fs_.files_created_.clear();
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("lib", &err));
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("ar-update lib b", command_runner_.commands_ran_[0]);
+  EXPECT_EQ(0u, fs_.files_created_.count("lib.rsp"));
+}
+
+TEST_F(BuildWithLogTest, UpdateCommandNotRemote) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule touch\n"
+"  command = ar $out $in\n"
+"  update_command = ar-update $out $in_changed\n"
+"  remote = 1\n"
+"build lib: touch a b c d e\n"));
+
+  const char* inputs[] = { "a", "b", "c", "d", "e" };
+  for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i)
+    fs_.Create(inputs[i], "");
+
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("lib", &err));
+  EXPECT_TRUE(builder_.Build(&err));
+  EXPECT_EQ("", err);
+
+  // A worker would not have the existing archive to update.
+  fs_.Tick();
+  fs_.Create("b", "");
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("lib", &err));
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("ar lib a b c d e", command_runner_.commands_ran_[0]);
+}
+
 TEST_F(BuildWithLogTest, RebuildWithNoInputs) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "rule touch\n"
@@ -2065,6 +2257,76 @@ TEST_F(BuildTest, RspFileFailure) {
   ASSERT_EQ("Another very long command", fs_.files_["out.rsp"].contents);
 }
 
+// Test that an RSP file of just $in is written from the inputs, and that one
+// left by an earlier run is only rewritten if it differs
+TEST_F(BuildTest, RspFileFromInputs) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+    "rule fail\n"
+    "  command = fail\n"
+    "  rspfile = $out.rsp\n"
+    "  rspfile_content = $in_newline\n"
+    "build out: fail in1 in$ 2 | implicit || order_only\n"
+    "build out2: fail in1 in$ 2\n"));
+
+  fs_.Create("out.rsp", "in1\n'in 2'");
+  fs_.Create("out2.rsp", "in1\n'in 2'\nstale");
+  TimeStamp leftover = fs_.files_["out.rsp"].mtime;
+  fs_.Tick();
+  fs_.Create("in1", "");
+  fs_.Create("in 2", "");
+  fs_.Create("implicit", "");
+  fs_.Create("order_only", "");
+
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  EXPECT_TRUE(builder_.AddTarget("out2", &err));
+  ASSERT_EQ("", err);
+  config_.failures_allowed = 2;
+  EXPECT_FALSE(builder_.Build(&err));
+  ASSERT_EQ(2u, command_runner_.commands_ran_.size());
+
+  EXPECT_EQ("in1\n'in 2'", fs_.files_["out.rsp"].contents);
+  EXPECT_EQ(leftover, fs_.files_["out.rsp"].mtime);
+  EXPECT_EQ("in1\n'in 2'", fs_.files_["out2.rsp"].contents);
+  EXPECT_GT(fs_.files_["out2.rsp"].mtime, leftover);
+}
+
+// Test that a rule with rspfile_keep leaves its RSP file after a successful
+// build, and that the next build does not write it again
+TEST_F(BuildTest, RspFileKeep) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+    "rule touch\n"
+    "  command = touch $out\n"
+    "  rspfile = $out.rsp\n"
+    "  rspfile_content = $in\n"
+    "  rspfile_keep = 1\n"
+    "build out: touch in1 in2\n"));
+
+  fs_.Create("in1", "");
+  fs_.Create("in2", "");
+
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ(0u, fs_.files_removed_.count("out.rsp"));
+  EXPECT_EQ("in1 in2", fs_.files_["out.rsp"].contents);
+  TimeStamp written = fs_.files_["out.rsp"].mtime;
+
+  fs_.Tick();
+  fs_.Create("in1", "");
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("in1 in2", fs_.files_["out.rsp"].contents);
+  EXPECT_EQ(written, fs_.files_["out.rsp"].mtime);
+}
+
 // Test that contents of the RSP file behaves like a regular part of
 // command line, i.e. triggers a rebuild if changed
 TEST_F(BuildWithLogTest, RspFileCmdLineChange) {
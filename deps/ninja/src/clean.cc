@@ -17,8 +17,11 @@
 #include <assert.h>
 #include <stdio.h>
 
+#include <algorithm>
+
 #include "disk_interface.h"
 #include "graph.h"
+#include "metrics.h"
 #include "state.h"
 #include "util.h"
 
@@ -31,14 +34,13 @@ Cleaner::Cleaner(State* state,
     config_(config),
     dyndep_loader_(state, disk_interface),
     cleaned_files_count_(0),
+    files_per_second_(0),
+    start_millis_(0),
+    remove_empty_dirs_(false),
     disk_interface_(disk_interface),
     status_(0) {
 }
 
-int Cleaner::RemoveFile(const string& path) {
-  return disk_interface_->RemoveFile(path);
-}
-
 bool Cleaner::FileExists(const string& path) {
   string err;
   TimeStamp mtime = disk_interface_->Stat(path, &err);
@@ -60,15 +62,24 @@ void Cleaner::Remove(const string& path) {
       if (FileExists(path))
         Report(path);
     } else {
-      int ret = RemoveFile(path);
-      if (ret == 0)
-        Report(path);
-      else if (ret == -1)
-        status_ = 1;
+      pending_.push_back(path);
     }
   }
 }
 
+void Cleaner::RemovePending() {
+  vector<int> results;
+  disk_interface_->RemoveFiles(pending_, config_.parallelism,
+                               remove_empty_dirs_, &results);
+  for (size_t i = 0; i < pending_.size(); ++i) {
+    if (results[i] == 0)
+      Report(pending_[i]);
+    else if (results[i] == -1)
+      status_ = 1;
+  }
+  pending_.clear();
+}
+
 bool Cleaner::IsAlreadyRemoved(const string& path) {
   set<string>::iterator i = removed_.find(path);
   return (i != removed_.end());
@@ -85,6 +96,7 @@ void Cleaner::RemoveEdgeFiles(Edge* edge) {
 }
 
 void Cleaner::PrintHeader() {
+  start_millis_ = GetTimeMillis();
   if (config_.verbosity == BuildConfig::QUIET)
     return;
   printf("Cleaning...");
@@ -96,9 +108,15 @@ void Cleaner::PrintHeader() {
 }
 
 void Cleaner::PrintFooter() {
+  int64_t millis = max<int64_t>(GetTimeMillis() - start_millis_, 1);
+  files_per_second_ = cleaned_files_count_ * 1000.0 / millis;
   if (config_.verbosity == BuildConfig::QUIET)
     return;
-  printf("%d files.\n", cleaned_files_count_);
+  if (cleaned_files_count_ > 0 && !config_.dry_run)
+    printf("%d files, %.0f files/s.\n", cleaned_files_count_,
+           files_per_second_);
+  else
+    printf("%d files.\n", cleaned_files_count_);
 }
 
 int Cleaner::CleanAll(bool generator) {
@@ -120,6 +138,7 @@ int Cleaner::CleanAll(bool generator) {
 
     RemoveEdgeFiles(*e);
   }
+  RemovePending();
   PrintFooter();
   return status_;
 }
@@ -142,6 +161,7 @@ int Cleaner::CleanDead(const BuildLog::Entries& entries) {
       Remove(i->first.AsString());
     }
   }
+  RemovePending();
   PrintFooter();
   return status_;
 }
@@ -174,6 +194,7 @@ int Cleaner::CleanTarget(Node* target) {
   PrintHeader();
   LoadDyndeps();
   DoCleanTarget(target);
+  RemovePending();
   PrintFooter();
   return status_;
 }
@@ -193,6 +214,15 @@ int Cleaner::CleanTarget(const char* target) {
 }
 
 int Cleaner::CleanTargets(int target_count, char* targets[]) {
+  return DoCleanTargets(target_count, targets, true);
+}
+
+int Cleaner::CleanOutputs(int target_count, char* targets[]) {
+  return DoCleanTargets(target_count, targets, false);
+}
+
+int Cleaner::DoCleanTargets(int target_count, char* targets[],
+                            bool subgraph) {
   Reset();
   PrintHeader();
   LoadDyndeps();
@@ -209,12 +239,22 @@ int Cleaner::CleanTargets(int target_count, char* targets[]) {
     if (target) {
       if (IsVerbose())
         printf("Target %s\n", target_name.c_str());
-      DoCleanTarget(target);
+      if (subgraph) {
+        DoCleanTarget(target);
+      } else if (Edge* e = target->in_edge()) {
+        if (!e->is_phony()) {
+          for (vector<Node*>::iterator o = e->outputs_.begin();
+               o != e->outputs_.end(); ++o)
+            Remove((*o)->path());
+          RemoveEdgeFiles(e);
+        }
+      }
     } else {
       Error("unknown target '%s'", target_name.c_str());
       status_ = 1;
     }
   }
+  RemovePending();
   PrintFooter();
   return status_;
 }
@@ -241,6 +281,7 @@ int Cleaner::CleanRule(const Rule* rule) {
   PrintHeader();
   LoadDyndeps();
   DoCleanRule(rule);
+  RemovePending();
   PrintFooter();
   return status_;
 }
@@ -277,6 +318,7 @@ int Cleaner::CleanRules(int rule_count, char* rules[]) {
       status_ = 1;
     }
   }
+  RemovePending();
   PrintFooter();
   return status_;
 }
@@ -286,6 +328,7 @@ void Cleaner::Reset() {
   cleaned_files_count_ = 0;
   removed_.clear();
   cleaned_.clear();
+  pending_.clear();
 }
 
 void Cleaner::LoadDyndeps() {
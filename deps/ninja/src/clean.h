@@ -17,6 +17,7 @@
 
 #include <set>
 #include <string>
+#include <vector>
 
 #include "build.h"
 #include "dyndep.h"
@@ -42,6 +43,10 @@ struct Cleaner {
   /// Clean the given target @a targets.
   /// @return non-zero if an error occurs.
   int CleanTargets(int target_count, char* targets[]);
+  /// Clean the outputs of the edges that build the given @a targets, but
+  /// not the files those edges depend on.
+  /// @return non-zero if an error occurs.
+  int CleanOutputs(int target_count, char* targets[]);
 
   /// Clean all built files, except for files created by generator rules.
   /// @param generator If set, also clean files created by generator rules.
@@ -67,6 +72,16 @@ struct Cleaner {
     return cleaned_files_count_;
   }
 
+  /// @return how many files per second the last clean removed.
+  double files_per_second() const {
+    return files_per_second_;
+  }
+
+  /// Also remove the directories that cleaning leaves empty.
+  void set_remove_empty_dirs(bool remove_empty_dirs) {
+    remove_empty_dirs_ = remove_empty_dirs;
+  }
+
   /// @return whether the cleaner is in verbose mode.
   bool IsVerbose() const {
     return (config_.verbosity != BuildConfig::QUIET
@@ -74,15 +89,14 @@ struct Cleaner {
   }
 
  private:
-  /// Remove the file @a path.
-  /// @return whether the file has been removed.
-  int RemoveFile(const std::string& path);
   /// @returns whether the file @a path exists.
   bool FileExists(const std::string& path);
   void Report(const std::string& path);
 
-  /// Remove the given @a path file only if it has not been already removed.
+  /// Queue the given @a path file for removal, unless it already is.
   void Remove(const std::string& path);
+  /// Remove the queued files, config_.parallelism at a time.
+  void RemovePending();
   /// @return whether the given @a path has already been removed.
   bool IsAlreadyRemoved(const std::string& path);
   /// Remove the depfile and rspfile for an Edge.
@@ -90,6 +104,8 @@ struct Cleaner {
 
   /// Helper recursive method for CleanTarget().
   void DoCleanTarget(Node* target);
+  /// Clean the outputs of @a target's in-edge, or its whole subgraph.
+  int DoCleanTargets(int target_count, char* targets[], bool subgraph);
   void PrintHeader();
   void PrintFooter();
   void DoCleanRule(const Rule* rule);
@@ -103,7 +119,11 @@ struct Cleaner {
   DyndepLoader dyndep_loader_;
   std::set<std::string> removed_;
   std::set<Node*> cleaned_;
+  std::vector<std::string> pending_;
   int cleaned_files_count_;
+  double files_per_second_;
+  int64_t start_millis_;
+  bool remove_empty_dirs_;
   DiskInterface* disk_interface_;
   int status_;
 };
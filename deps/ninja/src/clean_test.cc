@@ -14,6 +14,7 @@
 
 #include "clean.h"
 #include "build.h"
+#include "disk_interface.h"
 
 #include "util.h"
 #include "test.h"
@@ -598,4 +599,64 @@ TEST_F(CleanDeadTest, CleanDeadPreservesInputs) {
   EXPECT_NE(0, fs_.Stat("out2", &err));
   log2.Close();
 }
+
+TEST_F(CleanTest, CleanTargetOnRealDisk) {
+  ScopedTempDir temp_dir;
+  temp_dir.CreateAndEnter("CleanTest");
+  RealDiskInterface disk;
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build obj/a/x.o: cat src\n"
+"build obj/b/y.o: cat src\n"
+"build lib/l.a: cat obj/a/x.o obj/b/y.o\n"
+"build other/z.o: cat src\n"));
+  disk.MakeDirs("obj/a/x.o");
+  disk.MakeDirs("obj/b/y.o");
+  disk.MakeDirs("lib/l.a");
+  disk.MakeDirs("other/z.o");
+  disk.WriteFile("obj/a/x.o", "");
+  disk.WriteFile("obj/b/y.o", "");
+  disk.WriteFile("lib/l.a", "");
+  disk.WriteFile("other/z.o", "");
+
+  config_.parallelism = 4;
+  Cleaner cleaner(&state_, config_, &disk);
+  cleaner.set_remove_empty_dirs(true);
+  EXPECT_EQ(0, cleaner.CleanTarget("lib/l.a"));
+  EXPECT_EQ(3, cleaner.cleaned_files_count());
+  EXPECT_GT(cleaner.files_per_second(), 0);
+
+  // The subgraph and the directories it leaves empty are gone, the rest
+  // is kept.
+  string err;
+  EXPECT_EQ(0, disk.Stat("obj", &err));
+  EXPECT_EQ(0, disk.Stat("lib", &err));
+  EXPECT_GT(disk.Stat("other/z.o", &err), 0);
+  temp_dir.Cleanup();
+}
+
+TEST_F(CleanTest, CleanOutputs) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build in1: cat src1\n"
+"build out1 | out1.lib: cat in1\n"
+"build all: phony out1\n"));
+  fs_.Create("in1", "");
+  fs_.Create("out1", "");
+  fs_.Create("out1.lib", "");
+
+  // Only what the target's own edge writes; its inputs stay.
+  Cleaner cleaner(&state_, config_, &fs_);
+  char out1[] = "out1";
+  char* targets[] = { out1 };
+  ASSERT_EQ(0, cleaner.CleanOutputs(1, targets));
+  EXPECT_EQ(2, cleaner.cleaned_files_count());
+  string err;
+  EXPECT_LT(0, fs_.Stat("in1", &err));
+  EXPECT_EQ(0, fs_.Stat("out1.lib", &err));
+
+  char all[] = "all";
+  targets[0] = all;
+  ASSERT_EQ(0, cleaner.CleanOutputs(1, targets));
+  EXPECT_EQ(0, cleaner.cleaned_files_count());
+  EXPECT_LT(0, fs_.Stat("in1", &err));
+}
 }  // anonymous namespace
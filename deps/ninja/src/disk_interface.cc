@@ -28,7 +28,12 @@
 
 #include <sstream>
 #else
+#include <fcntl.h>
 #include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <unordered_map>
 #endif
 
 #include "metrics.h"
@@ -157,6 +162,26 @@ bool DiskInterface::MakeDirs(const string& path) {
   return MakeDir(dir);
 }
 
+void DiskInterface::RemoveFiles(const vector<string>& paths,
+                                int /* parallelism */,
+                                bool /* remove_empty_dirs */,
+                                vector<int>* results) {
+  results->resize(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i)
+    (*results)[i] = RemoveFile(paths[i]);
+}
+
+int DiskInterface::WriteChunks(const string& path,
+                               const function<bool(string*)>& next) {
+  string contents, chunk;
+  while (next(&chunk))
+    contents += chunk;
+  string old, err;
+  if (ReadFile(path, &old, &err) == Okay && old == contents)
+    return 0;
+  return WriteFile(path, contents) ? 1 : -1;
+}
+
 // RealDiskInterface -----------------------------------------------------------
 RealDiskInterface::RealDiskInterface() 
 #ifdef _WIN32
@@ -271,6 +296,72 @@ bool RealDiskInterface::WriteFile(const string& path, const string& contents) {
   return true;
 }
 
+int RealDiskInterface::WriteChunks(const string& path,
+                                   const function<bool(string*)>& next) {
+#ifdef _WIN32
+  return DiskInterface::WriteChunks(path, next);
+#else
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    Error("WriteFile(%s): Unable to create file. %s",
+          path.c_str(), strerror(errno));
+    return -1;
+  }
+
+  // While the chunks match the file, read the bytes each would overwrite;
+  // from the first that differs on, write them.
+  bool same = true;
+  bool ok = true;
+  off_t offset = 0;
+  string chunk, old;
+  while (ok && next(&chunk)) {
+    if (same) {
+      old.resize(chunk.size());
+      size_t n = 0;
+      for (ssize_t r; n < old.size(); n += r) {
+        r = pread(fd, &old[n], old.size() - n, offset + n);
+        if (r <= 0)
+          break;
+      }
+      if (n == chunk.size() && old == chunk) {
+        offset += chunk.size();
+        continue;
+      }
+      same = false;
+    }
+    for (size_t n = 0; ok && n < chunk.size();) {
+      ssize_t w = pwrite(fd, chunk.data() + n, chunk.size() - n, offset + n);
+      if (w < 0 && errno != EINTR)
+        ok = false;
+      else if (w > 0)
+        n += w;
+    }
+    offset += chunk.size();
+  }
+
+  if (!ok) {
+    Error("WriteFile(%s): Unable to write to the file. %s",
+          path.c_str(), strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  // The file may also have been longer.
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size != offset) {
+    same = false;
+    if (ftruncate(fd, offset) < 0)
+      ok = false;
+  }
+  if (close(fd) < 0 || !ok) {
+    Error("WriteFile(%s): Unable to close the file. %s",
+          path.c_str(), strerror(errno));
+    return -1;
+  }
+  return same ? 0 : 1;
+#endif
+}
+
 bool RealDiskInterface::MakeDir(const string& path) {
   if (::MakeDir(path) < 0) {
     if (errno == EEXIST) {
@@ -360,6 +451,100 @@ int RealDiskInterface::RemoveFile(const string& path) {
   return 0;
 }
 
+void RealDiskInterface::RemoveFiles(const vector<string>& paths,
+                                    int parallelism, bool remove_empty_dirs,
+                                    vector<int>* results) {
+#ifdef _WIN32
+  DiskInterface::RemoveFiles(paths, parallelism, remove_empty_dirs, results);
+#else
+  results->assign(paths.size(), 1);
+
+  // Group the paths by directory, so that each directory is looked up once.
+  vector<string> dirs;
+  vector<vector<size_t> > groups;
+  unordered_map<string, size_t> group_of;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    string dir = DirName(paths[i]);
+    unordered_map<string, size_t>::iterator it = group_of.find(dir);
+    if (it == group_of.end()) {
+      it = group_of.insert(make_pair(dir, dirs.size())).first;
+      dirs.push_back(dir);
+      groups.push_back(vector<size_t>());
+    }
+    groups[it->second].push_back(i);
+  }
+
+  vector<int> errors(paths.size(), 0);
+  atomic<size_t> next(0);
+  auto work = [&]() {
+    for (size_t g; (g = next++) < groups.size();) {
+      int dir_fd = open(dirs[g].empty() ? "." : dirs[g].c_str(),
+                        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (dir_fd < 0) {
+        int err = errno;
+        for (size_t i : groups[g]) {
+          (*results)[i] = (err == ENOENT) ? 1 : -1;
+          errors[i] = err;
+        }
+        continue;
+      }
+      for (size_t i : groups[g]) {
+        const string& path = paths[i];
+        size_t slash = path.find_last_of('/');
+        const char* name =
+            path.c_str() + (slash == string::npos ? 0 : slash + 1);
+        int r = unlinkat(dir_fd, name, 0);
+        // remove() deletes directories too.
+        if (r < 0 && (errno == EISDIR || errno == EPERM))
+          r = unlinkat(dir_fd, name, AT_REMOVEDIR);
+        if (r == 0) {
+          (*results)[i] = 0;
+        } else if (errno == ENOENT) {
+          (*results)[i] = 1;
+        } else {
+          (*results)[i] = -1;
+          errors[i] = errno;
+        }
+      }
+      close(dir_fd);
+    }
+  };
+
+  size_t threads = min<size_t>(max(parallelism, 1), groups.size());
+  vector<thread> pool;
+  for (size_t i = 1; i < threads; ++i)
+    pool.push_back(thread(work));
+  work();
+  for (size_t i = 0; i < pool.size(); ++i)
+    pool[i].join();
+
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if ((*results)[i] < 0)
+      Error("remove(%s): %s", paths[i].c_str(), strerror(errors[i]));
+  }
+
+  if (!remove_empty_dirs)
+    return;
+
+  // Deepest first, so a directory is tried after its subdirectories.  Only
+  // relative paths are climbed: the build owns what is below the cwd.
+  vector<string> order;
+  for (size_t g = 0; g < dirs.size(); ++g) {
+    if (!dirs[g].empty() && dirs[g][0] != '/')
+      order.push_back(dirs[g]);
+  }
+  sort(order.begin(), order.end(), [](const string& a, const string& b) {
+    return a.size() > b.size();
+  });
+  for (size_t i = 0; i < order.size(); ++i) {
+    for (string dir = order[i]; !dir.empty(); dir = DirName(dir)) {
+      if (rmdir(dir.c_str()) < 0 && errno != ENOENT)
+        break;
+    }
+  }
+#endif
+}
+
 void RealDiskInterface::AllowStatCache(bool allow) {
 #ifdef _WIN32
   use_cache_ = allow;
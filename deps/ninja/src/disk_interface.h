@@ -15,8 +15,10 @@
 #ifndef NINJA_DISK_INTERFACE_H_
 #define NINJA_DISK_INTERFACE_H_
 
+#include <functional>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "timestamp.h"
 
@@ -62,6 +64,25 @@ struct DiskInterface: public FileReader {
   ///          -1 if an error occurs.
   virtual int RemoveFile(const std::string& path) = 0;
 
+  /// Remove each of @a paths, as RemoveFile() would, storing its result at
+  /// the same index of @a results.  Up to @a parallelism removals may run at
+  /// once.  If @a remove_empty_dirs, the directories of relative paths that
+  /// are left empty are removed too, and so on up.  The default removes the
+  /// files one at a time and keeps the directories.
+  virtual void RemoveFiles(const std::vector<std::string>& paths,
+                           int parallelism, bool remove_empty_dirs,
+                           std::vector<int>* results);
+
+  /// Make @a path hold the chunks @a next produces: each call replaces its
+  /// argument by the next chunk, and returns false when there are no more.
+  /// Bytes the file already holds are not rewritten.
+  /// @returns 1 if the file was written, 0 if it already held the chunks,
+  ///          and -1 if an error occurs.
+  /// The default collects the chunks and calls WriteFile() if they differ
+  /// from what ReadFile() returns.
+  virtual int WriteChunks(const std::string& path,
+                          const std::function<bool(std::string*)>& next);
+
   /// Create all the parent directories for path; like mkdir -p
   /// `basename path`.
   bool MakeDirs(const std::string& path);
@@ -77,6 +98,16 @@ struct RealDiskInterface : public DiskInterface {
   virtual Status ReadFile(const std::string& path, std::string* contents,
                           std::string* err);
   virtual int RemoveFile(const std::string& path);
+  /// Groups @a paths by directory and unlinks each group relative to a
+  /// descriptor of its directory, the groups spread over @a parallelism
+  /// threads.
+  virtual void RemoveFiles(const std::vector<std::string>& paths,
+                           int parallelism, bool remove_empty_dirs,
+                           std::vector<int>* results);
+  /// Compares the chunks with the file as they come and writes from the
+  /// first one that differs, so the whole contents are never held at once.
+  virtual int WriteChunks(const std::string& path,
+                          const std::function<bool(std::string*)>& next);
 
   /// Whether stat information can be cached.  Only has an effect on Windows.
   void AllowStatCache(bool allow);
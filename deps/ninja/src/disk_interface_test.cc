@@ -257,6 +257,92 @@ TEST_F(DiskInterfaceTest, RemoveDirectory) {
   EXPECT_EQ(1, disk_.RemoveFile("does not exist"));
 }
 
+TEST_F(DiskInterfaceTest, RemoveFiles) {
+  ASSERT_TRUE(disk_.MakeDirs("a/b/x"));
+  ASSERT_TRUE(disk_.MakeDirs("c/x"));
+  ASSERT_TRUE(Touch("a/b/x"));
+  ASSERT_TRUE(Touch("a/y"));
+  ASSERT_TRUE(Touch("c/x"));
+  ASSERT_TRUE(Touch("z"));
+  ASSERT_TRUE(disk_.MakeDir("d"));
+
+  std::vector<std::string> paths;
+  paths.push_back("a/b/x");
+  paths.push_back("a/y");
+  paths.push_back("c/x");
+  paths.push_back("c/missing");
+  paths.push_back("z");
+  paths.push_back("d");
+  std::vector<int> results;
+  disk_.RemoveFiles(paths, 4, false, &results);
+  ASSERT_EQ(6u, results.size());
+  EXPECT_EQ(0, results[0]);
+  EXPECT_EQ(0, results[1]);
+  EXPECT_EQ(0, results[2]);
+  EXPECT_EQ(1, results[3]);
+  EXPECT_EQ(0, results[4]);
+  EXPECT_EQ(0, results[5]);
+
+  std::string err;
+  EXPECT_EQ(0, disk_.Stat("a/y", &err));
+  EXPECT_EQ(0, disk_.Stat("d", &err));
+  // Directories are kept unless asked for.
+  EXPECT_GT(disk_.Stat("a/b", &err), 0);
+  EXPECT_GT(disk_.Stat("c", &err), 0);
+}
+
+TEST_F(DiskInterfaceTest, RemoveFilesAndEmptyDirs) {
+  ASSERT_TRUE(disk_.MakeDirs("a/b/c/x"));
+  ASSERT_TRUE(disk_.MakeDirs("a/keep/x"));
+  ASSERT_TRUE(Touch("a/b/c/x"));
+  ASSERT_TRUE(Touch("a/b/y"));
+  ASSERT_TRUE(Touch("a/keep/x"));
+
+  std::vector<std::string> paths;
+  paths.push_back("a/b/c/x");
+  paths.push_back("a/b/y");
+  std::vector<int> results;
+  disk_.RemoveFiles(paths, 2, true, &results);
+  EXPECT_EQ(0, results[0]);
+  EXPECT_EQ(0, results[1]);
+
+  std::string err;
+  EXPECT_EQ(0, disk_.Stat("a/b", &err));
+  EXPECT_GT(disk_.Stat("a/keep/x", &err), 0);
+  EXPECT_GT(disk_.Stat("a", &err), 0);
+}
+
+TEST_F(DiskInterfaceTest, WriteChunks) {
+  std::vector<std::string> chunks;
+  size_t next_chunk = 0;
+  std::function<bool(std::string*)> next = [&](std::string* chunk) {
+    if (next_chunk == chunks.size())
+      return false;
+    *chunk = chunks[next_chunk++];
+    return true;
+  };
+
+  chunks.push_back("abc");
+  chunks.push_back("def");
+  EXPECT_EQ(1, disk_.WriteChunks("f", next));
+  next_chunk = 0;
+  EXPECT_EQ(0, disk_.WriteChunks("f", next));
+
+  std::string contents, err;
+  chunks[1] = "dX";
+  next_chunk = 0;
+  EXPECT_EQ(1, disk_.WriteChunks("f", next));
+  EXPECT_EQ(DiskInterface::Okay, disk_.ReadFile("f", &contents, &err));
+  EXPECT_EQ("abcdX", contents);
+
+  chunks.pop_back();
+  next_chunk = 0;
+  EXPECT_EQ(1, disk_.WriteChunks("f", next));
+  contents.clear();
+  EXPECT_EQ(DiskInterface::Okay, disk_.ReadFile("f", &contents, &err));
+  EXPECT_EQ("abc", contents);
+}
+
 struct StatTest : public StateTestWithBuiltinRules,
                   public DiskInterface {
   StatTest() : scan_(&state_, NULL, NULL, this, NULL) {}
@@ -71,11 +71,18 @@ bool Rule::IsReservedBinding(const string& var) {
       var == "description" ||
       var == "deps" ||
       var == "generator" ||
+      var == "memory" ||
       var == "pool" ||
+      var == "remote" ||
       var == "restat" ||
       var == "rspfile" ||
       var == "rspfile_content" ||
-      var == "msvc_deps_prefix";
+      var == "rspfile_keep" ||
+      var == "sandbox" ||
+      var == "sandbox_paths" ||
+      var == "update_command" ||
+      var == "msvc_deps_prefix" ||
+      var == "weight";
 }
 
 const map<string, const Rule*>& BindingEnv::GetRules() const {
@@ -92,6 +92,11 @@ struct BindingEnv : public Env {
 
   void AddBinding(const std::string& key, const std::string& val);
 
+  /// Whether @a key is bound in this scope itself, not in a parent's.
+  bool HasOwnBinding(const std::string& key) const {
+    return bindings_.count(key) != 0;
+  }
+
   /// This is tricky.  Edges want lookup scope to go in this order:
   /// 1) value set on edge itself (edge_->env_)
   /// 2) value set on rule, with expansion in the edge's scope
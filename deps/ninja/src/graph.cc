@@ -264,6 +264,16 @@ bool DependencyScan::VerifyDAG(Node* node, vector<Node*>* stack, string* err) {
 bool DependencyScan::RecomputeOutputsDirty(Edge* edge, Node* most_recent_input,
                                            bool* outputs_dirty, string* err) {
   string command = edge->EvaluateCommand(/*incl_rsp_file=*/true);
+  // Record what the log says while the command is at hand, so that
+  // CanUpdate() need not evaluate it, rspfile and all, a second time.
+  if (build_log() && !edge->outputs_.empty() &&
+      (edge->rule().GetBinding("update_command") ||
+       edge->env_->HasOwnBinding("update_command"))) {
+    BuildLog::LogEntry* entry =
+        build_log()->LookupByOutput(edge->outputs_[0]->path());
+    edge->command_logged_ =
+        entry && entry->command_hash == BuildLog::LogEntry::HashCommand(command);
+  }
   for (vector<Node*>::iterator o = edge->outputs_.begin();
        o != edge->outputs_.end(); ++o) {
     if (RecomputeOutputDirty(edge, most_recent_input, command, *o)) {
@@ -403,6 +413,10 @@ string EdgeEnv::LookupVariable(const string& var) {
       edge_->order_only_deps_;
     return MakePathList(edge_->inputs_.data(), explicit_deps_count,
                         var == "in" ? ' ' : '\n');
+  } else if (var == "in_changed") {
+    vector<const Node*> changed;
+    edge_->CollectChangedInputs(&changed);
+    return MakePathList(changed.data(), changed.size(), ' ');
   } else if (var == "out") {
     int explicit_outs_count = edge_->outputs_.size() - edge_->implicit_outs_;
     return MakePathList(&edge_->outputs_[0], explicit_outs_count, ' ');
@@ -509,8 +523,19 @@ void Edge::CollectInputs(bool shell_escape,
   }
 }
 
+void Edge::CollectChangedInputs(std::vector<const Node*>* out) const {
+  TimeStamp built = outputs_.empty() ? 0 : outputs_[0]->mtime();
+  size_t explicit_deps_count = inputs_.size() - implicit_deps_ -
+                               order_only_deps_;
+  for (size_t i = 0; i < explicit_deps_count; ++i) {
+    if (inputs_[i]->dirty() || inputs_[i]->mtime() > built)
+      out->push_back(inputs_[i]);
+  }
+}
+
 std::string Edge::EvaluateCommand(const bool incl_rsp_file) const {
-  string command = GetBinding("command");
+  string command =
+      GetBinding(update_ && !incl_rsp_file ? "update_command" : "command");
   if (incl_rsp_file) {
     string rspfile_content = GetBinding("rspfile_content");
     if (!rspfile_content.empty())
@@ -528,6 +553,30 @@ bool Edge::GetBindingBool(const string& key) const {
   return !GetBinding(key).empty();
 }
 
+int Edge::weight() const {
+  if (weight_ < 0) {
+    string weight = GetBinding("weight");
+    weight_ = weight.empty() ? 1 : atoi(weight.c_str());
+    if (weight_ < 1)
+      weight_ = 1;
+  }
+  return weight_;
+}
+
+int64_t Edge::memory() const {
+  if (memory_ < 0) {
+    string memory = GetBinding("memory");
+    memory_ = 0;
+    if (!memory.empty() && !ParseMemorySize(memory, &memory_)) {
+      Warning("invalid memory size '%s' on edge producing '%s'",
+              memory.c_str(), outputs_.empty() ? "?" :
+              outputs_[0]->path().c_str());
+      memory_ = 0;
+    }
+  }
+  return memory_;
+}
+
 string Edge::GetUnescapedDepfile() const {
   EdgeEnv env(this, EdgeEnv::kDoNotEscape);
   return env.LookupVariable("depfile");
@@ -22,6 +22,7 @@
 
 #include "dyndep.h"
 #include "eval_env.h"
+#include "string_piece.h"
 #include "timestamp.h"
 #include "util.h"
 
@@ -37,8 +38,8 @@ struct State;
 /// Information about a node in the dependency graph: the file, whether
 /// it's dirty, mtime, etc.
 struct Node {
-  Node(const std::string& path, uint64_t slash_bits)
-      : path_(path),
+  Node(StringPiece path, uint64_t slash_bits)
+      : path_(path.str_, path.len_),
         slash_bits_(slash_bits),
         mtime_(-1),
         exists_(ExistenceStatusUnknown),
@@ -188,7 +189,7 @@ struct Edge {
         id_(0), outputs_ready_(false), deps_loaded_(false),
         deps_missing_(false), generated_by_dep_loader_(false),
         command_start_time_(0), implicit_deps_(0), order_only_deps_(0),
-        implicit_outs_(0) {}
+        implicit_outs_(0), update_(false), command_logged_(false), weight_(-1), memory_(-1) {}
 
   /// Return true if all inputs' in-edges are ready.
   bool AllInputsReady() const;
@@ -196,6 +197,8 @@ struct Edge {
   /// Expand all variables in a command and return it as a string.
   /// If incl_rsp_file is enabled, the string will also contain the
   /// full contents of a response file (if applicable)
+  /// The command is the rule's update_command when update_ is set, except
+  /// with incl_rsp_file: that is what the build log records.
   std::string EvaluateCommand(bool incl_rsp_file = false) const;
 
   /// Returns the shell-escaped value of |key|.
@@ -214,6 +217,11 @@ struct Edge {
   // Append all edge explicit inputs to |*out|. Possibly with shell escaping.
   void CollectInputs(bool shell_escape, std::vector<std::string>* out) const;
 
+  /// Append the explicit inputs that changed since the first output was
+  /// built to |*out|: those this build marked dirty and those newer than
+  /// the output.  These are what $in_changed lists.
+  void CollectChangedInputs(std::vector<const Node*>* out) const;
+
   const Rule* rule_;
   Pool* pool_;
   std::vector<Node*> inputs_;
@@ -231,7 +239,12 @@ struct Edge {
 
   const Rule& rule() const { return *rule_; }
   Pool* pool() const { return pool_; }
-  int weight() const { return 1; }
+  /// The share of its pool's depth and of the build's job slots that this
+  /// edge occupies while running, from the "weight" binding.  Defaults to 1.
+  int weight() const;
+  /// Declared peak memory use of this edge's command in bytes, from the
+  /// "memory" binding (e.g. "512M" or "8G").  0 if not declared.
+  int64_t memory() const;
   bool outputs_ready() const { return outputs_ready_; }
 
   // There are three types of inputs.
@@ -262,9 +275,23 @@ struct Edge {
     return index >= outputs_.size() - implicit_outs_;
   }
 
+  /// Whether the builder runs the rule's update_command, which brings the
+  /// existing output up to date from $in_changed, rather than its command.
+  bool update_;
+
+  /// Whether the build log shows the first output was built by the current
+  /// command, as the dependency scan found.  Only looked up for edges with
+  /// an update_command, see CanUpdate().
+  bool command_logged_;
+
   bool is_phony() const;
   bool use_console() const;
   bool maybe_phonycycle_diagnostic() const;
+
+ private:
+  /// Lazily evaluated "weight" and "memory" bindings; -1 until first use.
+  mutable int weight_;
+  mutable int64_t memory_;
 };
 
 struct EdgeCmp {
@@ -0,0 +1,363 @@
+#include "graph_export.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "graph.h"
+#include "hash_map.h"
+#include "json.h"
+#include "state.h"
+#include "string_piece.h"
+#include "util.h"
+
+using namespace std;
+
+string EvaluateCommandWithRspfile(const Edge* edge,
+                                  const EvaluateCommandMode mode) {
+  string command = edge->EvaluateCommand();
+  if (mode == ECM_NORMAL)
+    return command;
+
+  string rspfile = edge->GetUnescapedRspfile();
+  if (rspfile.empty())
+    return command;
+
+  size_t index = command.find(rspfile);
+  if (index == 0 || index == string::npos ||
+      (command[index - 1] != '@' &&
+       command.find("--option-file=") != index - 14 &&
+       command.find("-f ") != index - 3))
+    return command;
+
+  string rspfile_content = edge->GetBinding("rspfile_content");
+  size_t newline_index = 0;
+  while ((newline_index = rspfile_content.find('\n', newline_index)) !=
+         string::npos) {
+    rspfile_content.replace(newline_index, 1, 1, ' ');
+    ++newline_index;
+  }
+  if (command[index - 1] == '@') {
+    command.replace(index - 1, rspfile.length() + 1, rspfile_content);
+  } else if (command.find("-f ") == index - 3) {
+    command.replace(index - 3, rspfile.length() + 3, rspfile_content);
+  } else {  // --option-file syntax
+    command.replace(index - 14, rspfile.length() + 14, rspfile_content);
+  }
+  return command;
+}
+
+void CompilationDatabase::Collect(
+    const State& state, const string& directory,
+    const function<bool(const Edge*)>& filter, EvaluateCommandMode mode,
+    int parallelism) {
+  const vector<Edge*>& edges = state.edges_;
+  const string dir = EncodeJSONString(directory);
+
+  // Evaluating commands is most of the work; threads take the edges a chunk
+  // at a time and leave the entries of those they skip empty.
+  const size_t kChunk = 256;
+  vector<string> entries(edges.size());
+  atomic<size_t> next(0);
+  auto work = [&]() {
+    for (size_t begin; (begin = next.fetch_add(kChunk)) < edges.size();) {
+      size_t end = min(begin + kChunk, edges.size());
+      for (size_t i = begin; i < end; ++i) {
+        const Edge* edge = edges[i];
+        if (edge->inputs_.empty() || edge->outputs_.empty() ||
+            edge->is_phony() || (filter && !filter(edge)))
+          continue;
+        string& entry = entries[i];
+        entry = "  {\"directory\": \"" + dir + "\", \"command\": \"";
+        entry += EncodeJSONString(EvaluateCommandWithRspfile(edge, mode));
+        entry += "\", \"file\": \"";
+        entry += EncodeJSONString(edge->inputs_[0]->path());
+        entry += "\", \"output\": \"";
+        entry += EncodeJSONString(edge->outputs_[0]->path());
+        entry += "\"}";
+      }
+    }
+  };
+
+  size_t threads = min<size_t>(max(parallelism, 1),
+                               (edges.size() + kChunk - 1) / kChunk);
+  vector<thread> pool;
+  for (size_t i = 1; i < threads; ++i)
+    pool.push_back(thread(work));
+  work();
+  for (size_t i = 0; i < pool.size(); ++i)
+    pool[i].join();
+
+  entries_.clear();
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (!entries[i].empty())
+      entries_.push_back(std::move(entries[i]));
+  }
+}
+
+string CompilationDatabase::Contents() const {
+  size_t size = 4;
+  for (size_t i = 0; i < entries_.size(); ++i)
+    size += entries_[i].size() + 2;
+
+  string out;
+  out.reserve(size);
+  out += "[\n";
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    out += entries_[i];
+    out += i + 1 < entries_.size() ? ",\n" : "\n";
+  }
+  out += "]\n";
+  return out;
+}
+
+int CompilationDatabase::Update(const string& path, string* err) const {
+  string old, read_err;
+  if (ReadFile(path, &old, &read_err) < 0)
+    old.clear();
+
+  // An entry is a line; the last one has no comma.
+  unordered_set<StringPiece> known;
+  for (size_t begin = 0, end; begin < old.size(); begin = end + 1) {
+    end = old.find('\n', begin);
+    if (end == string::npos)
+      end = old.size();
+    size_t len = end - begin;
+    if (len > 0 && old[end - 1] == ',')
+      --len;
+    known.insert(StringPiece(old.data() + begin, len));
+  }
+
+  int changed = 0;
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    if (known.count(StringPiece(entries_[i])) == 0)
+      ++changed;
+  }
+
+  int written = UpdateFile(path, Contents(), err);
+  if (written < 0)
+    return -1;
+  // Entries may also have gone, or moved.
+  return written > 0 ? max(changed, 1) : 0;
+}
+
+bool ParseGraphFormat(const string& name, GraphFormat* format) {
+  if (name == "json")
+    *format = kGraphJson;
+  else if (name == "dot" || name == "graphviz")
+    *format = kGraphDot;
+  else if (name == "binary")
+    *format = kGraphBinary;
+  else
+    return false;
+  return true;
+}
+
+namespace {
+
+struct GraphWriter {
+  GraphWriter(GraphFormat format, string* out) : format_(format), out_(out) {}
+
+  void Start(size_t edge_count) {
+    switch (format_) {
+    case kGraphJson:
+      *out_ += "{\"edges\": [";
+      break;
+    case kGraphDot:
+      *out_ += "digraph ninja {\n"
+               "rankdir=\"LR\"\n"
+               "node [fontsize=10, shape=box, height=0.25]\n"
+               "edge [fontsize=10]\n";
+      break;
+    case kGraphBinary:
+      out_->append("njxg", 4);
+      PutInt(1);
+      PutInt(edge_count);
+      break;
+    }
+  }
+
+  void AddEdge(const Edge* edge, size_t index) {
+    const size_t explicit_outs = edge->outputs_.size() - edge->implicit_outs_;
+    const size_t explicit_ins = edge->inputs_.size() - edge->implicit_deps_ -
+                                edge->order_only_deps_;
+    switch (format_) {
+    case kGraphJson: {
+      if (index > 0)
+        *out_ += ",";
+      *out_ += "\n  {\"rule\": \"" + EncodeJSONString(edge->rule().name()) +
+               "\", \"outputs\": [";
+      AddIds(edge->outputs_);
+      *out_ += "], \"inputs\": [";
+      AddIds(edge->inputs_);
+      char counts[160];
+      snprintf(counts, sizeof(counts),
+               "], \"implicit_outputs\": %d, \"implicit_inputs\": %d, "
+               "\"order_only_inputs\": %d}",
+               edge->implicit_outs_, edge->implicit_deps_,
+               edge->order_only_deps_);
+      *out_ += counts;
+      break;
+    }
+    case kGraphDot: {
+      // Nodes are declared where the edges first use them.
+      for (size_t i = 0; i < edge->outputs_.size(); ++i)
+        Id(edge->outputs_[i]);
+      for (size_t i = 0; i < edge->inputs_.size(); ++i)
+        Id(edge->inputs_[i]);
+      const string rule = EncodeJSONString(edge->rule().name());
+      char line[128];
+      if (edge->inputs_.size() == 1 && edge->outputs_.size() == 1) {
+        // Note extra space before label text, as in graphviz.cc.
+        snprintf(line, sizeof(line), "\"n%u\" -> \"n%u\" [label=\" ",
+                 ids_[edge->inputs_[0]], ids_[edge->outputs_[0]]);
+        *out_ += line + rule + "\"]\n";
+        break;
+      }
+      snprintf(line, sizeof(line), "\"e%zu\" [label=\"", index);
+      *out_ += line + rule + "\", shape=ellipse]\n";
+      for (size_t i = 0; i < edge->outputs_.size(); ++i) {
+        snprintf(line, sizeof(line), "\"e%zu\" -> \"n%u\"\n", index,
+                 ids_[edge->outputs_[i]]);
+        *out_ += line;
+      }
+      for (size_t i = 0; i < edge->inputs_.size(); ++i) {
+        snprintf(line, sizeof(line), "\"n%u\" -> \"e%zu\" [arrowhead=none%s]\n",
+                 ids_[edge->inputs_[i]], index,
+                 i >= edge->inputs_.size() - edge->order_only_deps_
+                     ? " style=dotted" : "");
+        *out_ += line;
+      }
+      break;
+    }
+    case kGraphBinary:
+      PutString(edge->rule().name());
+      PutInt(explicit_outs);
+      PutInt(edge->implicit_outs_);
+      PutInt(explicit_ins);
+      PutInt(edge->implicit_deps_);
+      PutInt(edge->order_only_deps_);
+      AddIds(edge->outputs_);
+      AddIds(edge->inputs_);
+      break;
+    }
+  }
+
+  void Finish() {
+    switch (format_) {
+    case kGraphJson:
+      *out_ += "\n], \"nodes\": [";
+      for (size_t i = 0; i < nodes_.size(); ++i) {
+        *out_ += i > 0 ? ",\n  \"" : "\n  \"";
+        *out_ += EncodeJSONString(nodes_[i]->path());
+        *out_ += "\"";
+      }
+      *out_ += "\n]}\n";
+      break;
+    case kGraphDot:
+      *out_ += "}\n";
+      break;
+    case kGraphBinary:
+      break;
+    }
+  }
+
+ private:
+  /// The id of \a node, numbering it if it is new.  New nodes are declared
+  /// in the dot and binary formats right away.
+  unsigned Id(const Node* node) {
+    pair<unordered_map<const Node*, unsigned>::iterator, bool> it =
+        ids_.insert(make_pair(node, (unsigned)nodes_.size()));
+    if (!it.second)
+      return it.first->second;
+    nodes_.push_back(node);
+    if (format_ == kGraphDot) {
+      string path = node->path();
+      replace(path.begin(), path.end(), '\\', '/');
+      char id[32];
+      snprintf(id, sizeof(id), "\"n%u\" [label=\"", it.first->second);
+      *out_ += id + EncodeJSONString(path) + "\"]\n";
+    }
+    return it.first->second;
+  }
+
+  void AddIds(const vector<Node*>& nodes) {
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      size_t known = nodes_.size();
+      unsigned id = Id(nodes[i]);
+      if (format_ == kGraphJson) {
+        char text[16];
+        snprintf(text, sizeof(text), i > 0 ? ", %u" : "%u", id);
+        *out_ += text;
+      } else if (format_ == kGraphBinary) {
+        PutInt(id);
+        if (nodes_.size() > known)
+          PutString(nodes[i]->path());
+      }
+    }
+  }
+
+  void PutInt(size_t value) {
+    uint32_t v = (uint32_t)value;
+    out_->append((const char*)&v, sizeof(v));
+  }
+
+  void PutString(const string& s) {
+    PutInt(s.size());
+    *out_ += s;
+  }
+
+  GraphFormat format_;
+  string* out_;
+  unordered_map<const Node*, unsigned> ids_;
+  vector<const Node*> nodes_;
+};
+
+}  // anonymous namespace
+
+void WriteGraph(const State& state, GraphFormat format, string* out) {
+  GraphWriter writer(format, out);
+  writer.Start(state.edges_.size());
+  for (size_t i = 0; i < state.edges_.size(); ++i)
+    writer.AddEdge(state.edges_[i], i);
+  writer.Finish();
+}
+
+int UpdateFile(const string& path, const string& contents, string* err) {
+  string old, read_err;
+  if (ReadFile(path, &old, &read_err) == 0 && old == contents)
+    return 0;
+
+  // Write under a temporary name so a reader never sees a partial file.
+  string temp_path = path + ".tmp";
+  FILE* f = fopen(temp_path.c_str(), "wb");
+  if (!f) {
+    *err = temp_path + ": " + strerror(errno);
+    return -1;
+  }
+  bool ok = fwrite(contents.data(), 1, contents.size(), f) == contents.size();
+  if (fclose(f) != 0)
+    ok = false;
+#ifdef _WIN32
+  if (ok)
+    unlink(path.c_str());
+#endif
+  if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+    *err = path + ": " + strerror(errno);
+    unlink(temp_path.c_str());
+    return -1;
+  }
+  return 1;
+}
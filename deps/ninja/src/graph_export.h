@@ -0,0 +1,70 @@
+#ifndef NINJA_GRAPH_EXPORT_H_
+#define NINJA_GRAPH_EXPORT_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+struct Edge;
+struct State;
+
+/// The graph as other tools read it: the compilation database of IDEs
+/// (compile_commands.json) and dumps of the graph itself.  Both are built in
+/// one pass over State::edges_ and written with UpdateFile(), so files that
+/// tools watch are only replaced when they changed.
+
+enum EvaluateCommandMode {
+  ECM_NORMAL,
+  ECM_EXPAND_RSPFILE
+};
+
+/// The command of \a edge; with ECM_EXPAND_RSPFILE, an @rspfile argument is
+/// replaced by the contents the response file would have.
+std::string EvaluateCommandWithRspfile(const Edge* edge,
+                                       EvaluateCommandMode mode);
+
+struct CompilationDatabase {
+  /// Evaluate the commands of the edges of \a state that have inputs, are
+  /// not phony and that \a filter accepts (all of them when it is empty), on
+  /// up to \a parallelism threads.  Entries keep the order of the edges.
+  void Collect(const State& state, const std::string& directory,
+               const std::function<bool(const Edge*)>& filter,
+               EvaluateCommandMode mode, int parallelism);
+
+  /// The JSON array, one entry per line.
+  std::string Contents() const;
+
+  /// Write Contents() to \a path.  Returns the number of entries that were
+  /// not in the file already (at least 1 if it was written), 0 if it was
+  /// left alone, or -1 on error.
+  int Update(const std::string& path, std::string* err) const;
+
+  std::vector<std::string> entries_;
+};
+
+enum GraphFormat {
+  kGraphJson,    ///< {"edges": [{rule, outputs, inputs...}], "nodes": [path]}
+  kGraphDot,     ///< graphviz, as `ninja -t graph` draws it
+  kGraphBinary,  ///< node paths and edges, see WriteGraph()
+};
+
+/// "json", "dot" (or "graphviz") and "binary".
+bool ParseGraphFormat(const std::string& name, GraphFormat* format);
+
+/// Append the edges of \a state and the nodes they use to \a out.  Nodes
+/// are numbered as the edges reach them.
+///
+/// The binary format is in host byte order: "njxg", a uint32 version and the
+/// number of edges, then for each edge its rule name, the uint32 counts of
+/// explicit and implicit outputs, explicit, implicit and order-only inputs,
+/// and a uint32 id per node; a node's path follows the first use of its id.
+/// Strings are a uint32 length and the bytes.
+void WriteGraph(const State& state, GraphFormat format, std::string* out);
+
+/// Make \a path hold \a contents, replacing it through a temporary file
+/// unless it already holds them.  Returns 1 if it was written, 0 if it was
+/// left alone, or -1 on error.
+int UpdateFile(const std::string& path, const std::string& contents,
+               std::string* err);
+
+#endif  // NINJA_GRAPH_EXPORT_H_
@@ -0,0 +1,131 @@
+#include "graph_export.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "graph.h"
+#include "state.h"
+#include "test.h"
+#include "util.h"
+
+using namespace std;
+
+namespace {
+
+struct GraphExportTest : public StateTestWithBuiltinRules {
+  void SetUp() {
+    ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cc\n"
+"  command = cc -c $in -o $out\n"
+"rule link\n"
+"  command = ld @$out.rsp -o $out\n"
+"  rspfile = $out.rsp\n"
+"  rspfile_content = $in\n"
+"build a.o: cc a.c\n"
+"build b.o: cc b.c | b.h || gen\n"
+"build gen: phony\n"
+"build all: phony a.o\n"
+"build app: link a.o b.o\n"));
+  }
+};
+
+TEST_F(GraphExportTest, CompilationDatabase) {
+  CompilationDatabase compdb;
+  compdb.Collect(state_, "/src", function<bool(const Edge*)>(), ECM_NORMAL, 1);
+  EXPECT_EQ("[\n"
+"  {\"directory\": \"/src\", \"command\": \"cc -c a.c -o a.o\", "
+"\"file\": \"a.c\", \"output\": \"a.o\"},\n"
+"  {\"directory\": \"/src\", \"command\": \"cc -c b.c -o b.o\", "
+"\"file\": \"b.c\", \"output\": \"b.o\"},\n"
+"  {\"directory\": \"/src\", \"command\": \"ld @app.rsp -o app\", "
+"\"file\": \"a.o\", \"output\": \"app\"}\n"
+"]\n", compdb.Contents());
+
+  compdb.Collect(state_, "/src", [](const Edge* edge) {
+    return edge->rule().name() == "link";
+  }, ECM_EXPAND_RSPFILE, 1);
+  ASSERT_EQ(1u, compdb.entries_.size());
+  EXPECT_NE(string::npos, compdb.entries_[0].find("\"ld a.o b.o -o app\""));
+}
+
+TEST_F(GraphExportTest, CompilationDatabaseParallel) {
+  State state;
+  string manifest = "rule cc\n  command = cc -c $in -o $out\n";
+  for (int i = 0; i < 2000; ++i) {
+    char line[64];
+    snprintf(line, sizeof(line), "build o%d.o: cc s%d.c\n", i, i);
+    manifest += line;
+  }
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state, manifest.c_str()));
+
+  CompilationDatabase serial, parallel;
+  serial.Collect(state, ".", function<bool(const Edge*)>(), ECM_NORMAL, 1);
+  parallel.Collect(state, ".", function<bool(const Edge*)>(), ECM_NORMAL, 8);
+  EXPECT_EQ(2000u, parallel.entries_.size());
+  EXPECT_EQ(serial.Contents(), parallel.Contents());
+}
+
+TEST_F(GraphExportTest, UpdateOnlyChanged) {
+  ScopedTempDir temp_dir;
+  temp_dir.CreateAndEnter("GraphExportTest");
+
+  CompilationDatabase compdb;
+  compdb.Collect(state_, "/src", function<bool(const Edge*)>(), ECM_NORMAL, 1);
+  string err;
+  EXPECT_EQ(3, compdb.Update("compile_commands.json", &err));
+  EXPECT_EQ(0, compdb.Update("compile_commands.json", &err));
+
+  compdb.entries_[1] = "  {\"changed\": true}";
+  EXPECT_EQ(1, compdb.Update("compile_commands.json", &err));
+  compdb.entries_.pop_back();
+  EXPECT_EQ(1, compdb.Update("compile_commands.json", &err));
+
+  // A shorter file is truncated.
+  string contents;
+  ASSERT_EQ(0, ReadFile("compile_commands.json", &contents, &err));
+  EXPECT_EQ(compdb.Contents(), contents);
+
+  EXPECT_EQ(1, UpdateFile("x", "abcdef", &err));
+  EXPECT_EQ(1, UpdateFile("x", "abX", &err));
+  contents.clear();
+  ASSERT_EQ(0, ReadFile("x", &contents, &err));
+  EXPECT_EQ("abX", contents);
+  // Written under a temporary name, which does not stay behind.
+  EXPECT_EQ(-ENOENT, ReadFile("x.tmp", &contents, &err));
+
+  temp_dir.Cleanup();
+}
+
+TEST_F(GraphExportTest, Json) {
+  string out;
+  WriteGraph(state_, kGraphJson, &out);
+  EXPECT_NE(string::npos, out.find(
+      "{\"rule\": \"cc\", \"outputs\": [2], \"inputs\": [3, 4, 5], "
+      "\"implicit_outputs\": 0, \"implicit_inputs\": 1, "
+      "\"order_only_inputs\": 1}"));
+  EXPECT_NE(string::npos, out.find(
+      "\"nodes\": [\n  \"a.o\",\n  \"a.c\",\n  \"b.o\""));
+}
+
+TEST_F(GraphExportTest, Dot) {
+  string out;
+  WriteGraph(state_, kGraphDot, &out);
+  EXPECT_EQ(0u, out.find("digraph ninja {\n"));
+  EXPECT_NE(string::npos, out.find("\"n1\" -> \"n0\" [label=\" cc\"]\n"));
+  EXPECT_NE(string::npos, out.find("\"n5\" -> \"e1\" [arrowhead=none "
+                                   "style=dotted]\n"));
+}
+
+TEST_F(GraphExportTest, Binary) {
+  string out;
+  WriteGraph(state_, kGraphBinary, &out);
+  ASSERT_GT(out.size(), 12u);
+  EXPECT_EQ("njxg", out.substr(0, 4));
+  uint32_t header[2];
+  memcpy(header, out.data() + 4, sizeof(header));
+  EXPECT_EQ(1u, header[0]);
+  EXPECT_EQ(state_.edges_.size(), header[1]);
+}
+
+}  // anonymous namespace
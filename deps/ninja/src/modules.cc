@@ -0,0 +1,449 @@
+#include "modules.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <set>
+
+#include "util.h"
+
+using namespace std;
+
+namespace {
+
+/// Just enough JSON for P1689: values are kept as a tree.
+struct JsonValue {
+  enum Type { kNull, kBool, kNumber, kString, kArray, kObject } type;
+  string text;
+  vector<JsonValue> items;
+  vector<pair<string, JsonValue> > members;
+
+  JsonValue() : type(kNull) {}
+
+  const JsonValue* Get(const string& key) const {
+    for (size_t i = 0; i < members.size(); ++i)
+      if (members[i].first == key)
+        return &members[i].second;
+    return NULL;
+  }
+};
+
+struct JsonParser {
+  explicit JsonParser(const string& input) : p_(input.c_str()),
+                                             end_(p_ + input.size()) {}
+
+  bool Parse(JsonValue* value, string* err) {
+    if (!ParseValue(value, 0, err))
+      return false;
+    SkipSpace();
+    if (p_ != end_)
+      return Fail("trailing characters", err);
+    return true;
+  }
+
+ private:
+  bool Fail(const char* what, string* err) {
+    *err = string("invalid JSON: ") + what;
+    return false;
+  }
+
+  void SkipSpace() {
+    while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' ||
+                         *p_ == '\r'))
+      ++p_;
+  }
+
+  bool Literal(const char* word) {
+    const char* q = p_;
+    for (; *word; ++word, ++q)
+      if (q == end_ || *q != *word)
+        return false;
+    p_ = q;
+    return true;
+  }
+
+  static void AppendUtf8(unsigned c, string* out) {
+    if (c < 0x80) {
+      out->push_back((char)c);
+    } else if (c < 0x800) {
+      out->push_back((char)(0xc0 | (c >> 6)));
+      out->push_back((char)(0x80 | (c & 0x3f)));
+    } else if (c < 0x10000) {
+      out->push_back((char)(0xe0 | (c >> 12)));
+      out->push_back((char)(0x80 | ((c >> 6) & 0x3f)));
+      out->push_back((char)(0x80 | (c & 0x3f)));
+    } else {
+      out->push_back((char)(0xf0 | (c >> 18)));
+      out->push_back((char)(0x80 | ((c >> 12) & 0x3f)));
+      out->push_back((char)(0x80 | ((c >> 6) & 0x3f)));
+      out->push_back((char)(0x80 | (c & 0x3f)));
+    }
+  }
+
+  bool ParseHex4(unsigned* c, string* err) {
+    if (end_ - p_ < 4)
+      return Fail("truncated escape", err);
+    char hex[5] = { p_[0], p_[1], p_[2], p_[3], 0 };
+    char* hex_end;
+    *c = (unsigned)strtoul(hex, &hex_end, 16);
+    if (hex_end != hex + 4)
+      return Fail("bad escape", err);
+    p_ += 4;
+    return true;
+  }
+
+  bool ParseString(string* out, string* err) {
+    ++p_;  // '"'
+    while (p_ < end_ && *p_ != '"') {
+      if (*p_ != '\\') {
+        out->push_back(*p_++);
+        continue;
+      }
+      if (++p_ == end_)
+        break;
+      char c = *p_++;
+      switch (c) {
+        case 'b': out->push_back('\b'); break;
+        case 'f': out->push_back('\f'); break;
+        case 'n': out->push_back('\n'); break;
+        case 'r': out->push_back('\r'); break;
+        case 't': out->push_back('\t'); break;
+        case 'u': {
+          unsigned code;
+          if (!ParseHex4(&code, err))
+            return false;
+          if (code >= 0xd800 && code < 0xdc00 && end_ - p_ >= 6 &&
+              p_[0] == '\\' && p_[1] == 'u') {
+            p_ += 2;
+            unsigned low;
+            if (!ParseHex4(&low, err))
+              return false;
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+          }
+          AppendUtf8(code, out);
+          break;
+        }
+        default: out->push_back(c); break;
+      }
+    }
+    if (p_ == end_)
+      return Fail("unterminated string", err);
+    ++p_;
+    return true;
+  }
+
+  bool ParseValue(JsonValue* value, int depth, string* err) {
+    if (depth > 64)
+      return Fail("nested too deeply", err);
+    SkipSpace();
+    if (p_ == end_)
+      return Fail("unexpected end", err);
+
+    if (*p_ == '{') {
+      value->type = JsonValue::kObject;
+      ++p_;
+      SkipSpace();
+      if (p_ < end_ && *p_ == '}') {
+        ++p_;
+        return true;
+      }
+      for (;;) {
+        SkipSpace();
+        if (p_ == end_ || *p_ != '"')
+          return Fail("expected key", err);
+        value->members.push_back(make_pair(string(), JsonValue()));
+        pair<string, JsonValue>& member = value->members.back();
+        if (!ParseString(&member.first, err))
+          return false;
+        SkipSpace();
+        if (p_ == end_ || *p_++ != ':')
+          return Fail("expected ':'", err);
+        if (!ParseValue(&member.second, depth + 1, err))
+          return false;
+        SkipSpace();
+        if (p_ < end_ && *p_ == ',') {
+          ++p_;
+          continue;
+        }
+        if (p_ < end_ && *p_ == '}') {
+          ++p_;
+          return true;
+        }
+        return Fail("expected ',' or '}'", err);
+      }
+    }
+
+    if (*p_ == '[') {
+      value->type = JsonValue::kArray;
+      ++p_;
+      SkipSpace();
+      if (p_ < end_ && *p_ == ']') {
+        ++p_;
+        return true;
+      }
+      for (;;) {
+        value->items.push_back(JsonValue());
+        if (!ParseValue(&value->items.back(), depth + 1, err))
+          return false;
+        SkipSpace();
+        if (p_ < end_ && *p_ == ',') {
+          ++p_;
+          continue;
+        }
+        if (p_ < end_ && *p_ == ']') {
+          ++p_;
+          return true;
+        }
+        return Fail("expected ',' or ']'", err);
+      }
+    }
+
+    if (*p_ == '"') {
+      value->type = JsonValue::kString;
+      return ParseString(&value->text, err);
+    }
+
+    if (Literal("true") || Literal("false")) {
+      value->type = JsonValue::kBool;
+      return true;
+    }
+    if (Literal("null")) {
+      value->type = JsonValue::kNull;
+      return true;
+    }
+
+    const char* start = p_;
+    while (p_ < end_ && (isdigit((unsigned char)*p_) || *p_ == '-' ||
+                         *p_ == '+' || *p_ == '.' || *p_ == 'e' ||
+                         *p_ == 'E'))
+      ++p_;
+    if (p_ == start)
+      return Fail("unexpected character", err);
+    value->type = JsonValue::kNumber;
+    value->text.assign(start, p_ - start);
+    return true;
+  }
+
+  const char* p_;
+  const char* end_;
+};
+
+/// The logical names in a P1689 "provides" or "requires" array.
+void LogicalNames(const JsonValue* array, vector<string>* names) {
+  if (!array || array->type != JsonValue::kArray)
+    return;
+  for (size_t i = 0; i < array->items.size(); ++i) {
+    const JsonValue* name = array->items[i].Get("logical-name");
+    if (name && name->type == JsonValue::kString)
+      names->push_back(name->text);
+  }
+}
+
+/// \a path as a dyndep file path.
+string EscapePath(const string& path) {
+  string out;
+  for (size_t i = 0; i < path.size(); ++i) {
+    if (path[i] == '$' || path[i] == ' ' || path[i] == ':')
+      out.push_back('$');
+    out.push_back(path[i]);
+  }
+  return out;
+}
+
+/// \a arg as one response file argument.
+string QuoteArgument(const string& arg) {
+  if (arg.find_first_of(" \t\"'\\") == string::npos)
+    return arg;
+  string out = "\"";
+  for (size_t i = 0; i < arg.size(); ++i) {
+    if (arg[i] == '"' || arg[i] == '\\')
+      out.push_back('\\');
+    out.push_back(arg[i]);
+  }
+  return out + "\"";
+}
+
+}  // anonymous namespace
+
+bool ParseModuleScan(const string& json, ModuleScan* scan, string* err) {
+  JsonValue root;
+  if (!JsonParser(json).Parse(&root, err))
+    return false;
+
+  const JsonValue* rules = root.Get("rules");
+  if (!rules || rules->type != JsonValue::kArray) {
+    *err = "P1689: missing 'rules'";
+    return false;
+  }
+  if (rules->items.empty())
+    return true;
+
+  const JsonValue& rule = rules->items[0];
+  LogicalNames(rule.Get("provides"), &scan->provides);
+  LogicalNames(rule.Get("requires"), &scan->requires_);
+  return true;
+}
+
+bool ParseModuleList(const string& text, ModuleList* modules, string* err) {
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t end = text.find('\n', start);
+    if (end == string::npos)
+      end = text.size();
+
+    vector<string> fields;
+    size_t p = start;
+    while (p < end) {
+      size_t q = text.find(' ', p);
+      if (q == string::npos || q > end)
+        q = end;
+      if (q > p)
+        fields.push_back(text.substr(p, q - p));
+      p = q + 1;
+    }
+    start = end + 1;
+
+    if (fields.empty())
+      continue;
+    if (fields.size() < 2) {
+      *err = "module list: no BMI for '" + fields[0] + "'";
+      return false;
+    }
+    ModuleInfo& info = (*modules)[fields[0]];
+    info.bmi = fields[1];
+    info.requires_.assign(fields.begin() + 2, fields.end());
+  }
+  return true;
+}
+
+string WriteModuleList(const ModuleList& modules) {
+  string out;
+  for (ModuleList::const_iterator i = modules.begin(); i != modules.end();
+       ++i) {
+    out += i->first + " " + i->second.bmi;
+    for (size_t j = 0; j < i->second.requires_.size(); ++j)
+      out += " " + i->second.requires_[j];
+    out += "\n";
+  }
+  return out;
+}
+
+void ModuleCollator::AddDependencyModules(const ModuleList& modules) {
+  for (ModuleList::const_iterator i = modules.begin(); i != modules.end();
+       ++i)
+    deps_[i->first] = i->second;
+}
+
+bool ModuleCollator::AddScan(const ModuleScan& scan, string* err) {
+  for (size_t i = 0; i < scan.provides.size(); ++i) {
+    const string& name = scan.provides[i];
+    if (own_.count(name)) {
+      *err = "module '" + name + "' is provided by more than one source";
+      return false;
+    }
+    ModuleInfo& info = own_[name];
+    info.bmi = BmiPath(name);
+    info.requires_ = scan.requires_;
+  }
+  scans_.push_back(scan);
+  return true;
+}
+
+string ModuleCollator::BmiPath(const string& name) const {
+  string file = name;
+  for (size_t i = 0; i < file.size(); ++i)
+    if (file[i] == ':' || file[i] == '/' || file[i] == '\\')
+      file[i] = '-';
+  return bmi_dir_ + "/" + file + bmi_extension_;
+}
+
+const ModuleInfo* ModuleCollator::Lookup(const string& name) const {
+  ModuleList::const_iterator i = own_.find(name);
+  if (i != own_.end())
+    return &i->second;
+  i = deps_.find(name);
+  return i != deps_.end() ? &i->second : NULL;
+}
+
+vector<string> ModuleCollator::Closure(const vector<string>& names) const {
+  set<string> seen;
+  vector<string> pending(names);
+  while (!pending.empty()) {
+    string name = pending.back();
+    pending.pop_back();
+    const ModuleInfo* info = Lookup(name);
+    if (!info || !seen.insert(name).second)
+      continue;
+    pending.insert(pending.end(), info->requires_.begin(),
+                   info->requires_.end());
+  }
+  return vector<string>(seen.begin(), seen.end());
+}
+
+string ModuleCollator::DyndepContents() const {
+  string out = "ninja_dyndep_version = 1\n";
+  for (size_t i = 0; i < scans_.size(); ++i) {
+    const ModuleScan& scan = scans_[i];
+    out += "build " + EscapePath(scan.object);
+    if (!scan.provides.empty()) {
+      out += " |";
+      for (size_t j = 0; j < scan.provides.size(); ++j)
+        out += " " + EscapePath(BmiPath(scan.provides[j]));
+    }
+    out += ": dyndep";
+    vector<string> imports = Closure(scan.requires_);
+    if (!imports.empty()) {
+      out += " |";
+      for (size_t j = 0; j < imports.size(); ++j)
+        out += " " + EscapePath(Lookup(imports[j])->bmi);
+    }
+    out += "\n";
+  }
+  return out;
+}
+
+string ModuleCollator::ModuleMapContents(size_t i) const {
+  const ModuleScan& scan = scans_[i];
+  vector<string> imports = Closure(scan.requires_);
+  string out;
+  if (format_ == kClang) {
+    for (size_t j = 0; j < scan.provides.size(); ++j)
+      out += QuoteArgument("-fmodule-output=" + BmiPath(scan.provides[j])) +
+             "\n";
+    for (size_t j = 0; j < imports.size(); ++j)
+      out += QuoteArgument("-fmodule-file=" + imports[j] + "=" +
+                           Lookup(imports[j])->bmi) + "\n";
+  } else {
+    for (size_t j = 0; j < scan.provides.size(); ++j)
+      out += scan.provides[j] + " " + BmiPath(scan.provides[j]) + "\n";
+    for (size_t j = 0; j < imports.size(); ++j)
+      out += imports[j] + " " + Lookup(imports[j])->bmi + "\n";
+  }
+  return out;
+}
+
+ModuleList ModuleCollator::Modules() const {
+  return own_;
+}
+
+bool WriteFileIfChanged(const string& path, const string& contents,
+                        string* err) {
+  string old, read_err;
+  if (ReadFile(path, &old, &read_err) == 0 && old == contents)
+    return true;
+
+  FILE* f = fopen(path.c_str(), "wb");
+  if (!f) {
+    *err = path + ": " + strerror(errno);
+    return false;
+  }
+  bool ok = fwrite(contents.data(), 1, contents.size(), f) == contents.size();
+  if (fclose(f) != 0)
+    ok = false;
+  if (!ok)
+    *err = path + ": " + strerror(errno);
+  return ok;
+}
@@ -0,0 +1,94 @@
+#ifndef NINJA_MODULES_H_
+#define NINJA_MODULES_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+/// C++20 modules.  Each source is scanned by the compiler into a P1689
+/// file (.ddi) naming the modules it provides and requires; the collator
+/// reads the scans of a target and writes
+///  - a dyndep file that gives each object the module interfaces (BMIs) it
+///    builds as implicit outputs and the BMIs it imports as implicit inputs,
+///    so interface units build before their importers;
+///  - for each object, a module map that tells the compiler where its BMIs
+///    go and where to find those it imports (a response file for clang, a
+///    -fmodule-mapper file for gcc);
+///  - a module list, "<name> <bmi> <required>...", that targets depending
+///    on this one read to find its modules.
+
+/// One scanned translation unit.
+struct ModuleScan {
+  std::string object;
+  std::vector<std::string> provides;
+  std::vector<std::string> requires_;
+};
+
+/// A module, where its BMI is and what it imports.
+struct ModuleInfo {
+  std::string bmi;
+  std::vector<std::string> requires_;
+};
+
+typedef std::map<std::string, ModuleInfo> ModuleList;
+
+/// Read the first rule of a P1689 scan into \a scan.  The object is left
+/// to the caller, which knows it from the scan's file name.
+bool ParseModuleScan(const std::string& json, ModuleScan* scan,
+                     std::string* err);
+
+/// Add the modules listed in \a text, as written by WriteModuleList(), to
+/// \a modules.
+bool ParseModuleList(const std::string& text, ModuleList* modules,
+                     std::string* err);
+
+std::string WriteModuleList(const ModuleList& modules);
+
+struct ModuleCollator {
+  enum Format { kClang, kGcc };
+
+  ModuleCollator(Format format, const std::string& bmi_dir,
+                 const std::string& bmi_extension)
+      : format_(format), bmi_dir_(bmi_dir), bmi_extension_(bmi_extension) {}
+
+  /// Modules of other targets that scans may import.
+  void AddDependencyModules(const ModuleList& modules);
+
+  /// Record the modules \a scan provides; fails if another scan of this
+  /// target provides one of them.
+  bool AddScan(const ModuleScan& scan, std::string* err);
+
+  /// The contents of the dyndep file.  Imports of unknown modules, such as
+  /// those the compiler provides, are left to the compiler.
+  std::string DyndepContents() const;
+
+  /// The contents of the module map of scan \a i, in order of AddScan().
+  std::string ModuleMapContents(size_t i) const;
+
+  /// The modules of this target, for WriteModuleList().
+  ModuleList Modules() const;
+
+  /// Where the BMI of module \a name is written.
+  std::string BmiPath(const std::string& name) const;
+
+ private:
+  /// \a names and everything they import, in a stable order.
+  std::vector<std::string> Closure(
+      const std::vector<std::string>& names) const;
+
+  const ModuleInfo* Lookup(const std::string& name) const;
+
+  Format format_;
+  std::string bmi_dir_;
+  std::string bmi_extension_;
+  std::vector<ModuleScan> scans_;
+  ModuleList own_;
+  ModuleList deps_;
+};
+
+/// Write \a contents to \a path unless it already holds them, so that
+/// restat rules can prune the edges that depend on it.
+bool WriteFileIfChanged(const std::string& path, const std::string& contents,
+                        std::string* err);
+
+#endif  // NINJA_MODULES_H_
@@ -0,0 +1,131 @@
+#include "modules.h"
+
+#include "dyndep.h"
+#include "dyndep_parser.h"
+#include "state.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+ModuleScan Scan(const string& object, const string& json) {
+  ModuleScan scan;
+  scan.object = object;
+  string err;
+  EXPECT_TRUE(ParseModuleScan(json, &scan, &err)) << err;
+  return scan;
+}
+
+const char kInterface[] =
+"{\"revision\": 0, \"version\": 1, \"rules\": [{\n"
+"  \"primary-output\": \"b/m.cpp.o\",\n"
+"  \"provides\": [{\"logical-name\": \"m\", \"is-interface\": true,\n"
+"                \"source-path\": \"/src/m.cppm\"}],\n"
+"  \"requires\": [{\"logical-name\": \"m:part\"},\n"
+"               {\"logical-name\": \"std\", \"lookup-method\": \"by-name\"}]\n"
+"}]}\n";
+
+const char kPartition[] =
+"{\"revision\": 0, \"version\": 1, \"rules\": [{\n"
+"  \"primary-output\": \"b/part.cpp.o\",\n"
+"  \"provides\": [{\"logical-name\": \"m:part\", \"is-interface\": true}]\n"
+"}]}\n";
+
+const char kUser[] =
+"{\"revision\": 0, \"version\": 1, \"rules\": [{\n"
+"  \"primary-output\": \"b/main.cpp.o\",\n"
+"  \"requires\": [{\"logical-name\": \"m\"}]\n"
+"}]}\n";
+
+TEST(ModulesTest, ParseScan) {
+  ModuleScan scan = Scan("b/m.cpp.o", kInterface);
+  ASSERT_EQ(1u, scan.provides.size());
+  EXPECT_EQ("m", scan.provides[0]);
+  ASSERT_EQ(2u, scan.requires_.size());
+  EXPECT_EQ("m:part", scan.requires_[0]);
+  EXPECT_EQ("std", scan.requires_[1]);
+
+  string err;
+  EXPECT_FALSE(ParseModuleScan("{\"rules\": [", &scan, &err));
+  EXPECT_FALSE(err.empty());
+}
+
+TEST(ModulesTest, DyndepOrdersImporters) {
+  ModuleCollator collator(ModuleCollator::kClang, "b/bmi", ".pcm");
+  string err;
+  ASSERT_TRUE(collator.AddScan(Scan("b/m.cpp.o", kInterface), &err));
+  ASSERT_TRUE(collator.AddScan(Scan("b/part.cpp.o", kPartition), &err));
+  ASSERT_TRUE(collator.AddScan(Scan("b/main.cpp.o", kUser), &err));
+
+  // std is the compiler's business.
+  EXPECT_EQ("ninja_dyndep_version = 1\n"
+            "build b/m.cpp.o | b/bmi/m.pcm: dyndep | b/bmi/m-part.pcm\n"
+            "build b/part.cpp.o | b/bmi/m-part.pcm: dyndep\n"
+            "build b/main.cpp.o: dyndep | b/bmi/m.pcm b/bmi/m-part.pcm\n",
+            collator.DyndepContents());
+
+  EXPECT_EQ("-fmodule-file=m=b/bmi/m.pcm\n"
+            "-fmodule-file=m:part=b/bmi/m-part.pcm\n",
+            collator.ModuleMapContents(2));
+  EXPECT_EQ("-fmodule-output=b/bmi/m.pcm\n"
+            "-fmodule-file=m:part=b/bmi/m-part.pcm\n",
+            collator.ModuleMapContents(0));
+
+  // The dyndep file is one ninja can load.
+  State state;
+  AssertParse(&state,
+"rule cxx\n"
+"  command = c++ $in\n"
+"build b/m.cpp.o: cxx m.cppm || dd\n"
+"  dyndep = dd\n"
+"build b/part.cpp.o: cxx part.cppm || dd\n"
+"  dyndep = dd\n"
+"build b/main.cpp.o: cxx main.cpp || dd\n"
+"  dyndep = dd\n");
+  DyndepFile dyndep_file;
+  DyndepParser parser(&state, NULL, &dyndep_file);
+  EXPECT_TRUE(parser.ParseTest(collator.DyndepContents(), &err)) << err;
+  EXPECT_EQ(3u, dyndep_file.size());
+}
+
+TEST(ModulesTest, GccModuleMapper) {
+  ModuleCollator collator(ModuleCollator::kGcc, "b/bmi", ".gcm");
+  string err;
+  ASSERT_TRUE(collator.AddScan(Scan("b/part.cpp.o", kPartition), &err));
+  ASSERT_TRUE(collator.AddScan(Scan("b/m.cpp.o", kInterface), &err));
+  EXPECT_EQ("m b/bmi/m.gcm\n"
+            "m:part b/bmi/m-part.gcm\n",
+            collator.ModuleMapContents(1));
+}
+
+TEST(ModulesTest, DuplicateModule) {
+  ModuleCollator collator(ModuleCollator::kClang, "b", ".pcm");
+  string err;
+  ASSERT_TRUE(collator.AddScan(Scan("b/a.o", kPartition), &err));
+  EXPECT_FALSE(collator.AddScan(Scan("b/b.o", kPartition), &err));
+  EXPECT_EQ("module 'm:part' is provided by more than one source", err);
+}
+
+TEST(ModulesTest, DependencyModules) {
+  ModuleCollator lib(ModuleCollator::kClang, "lib/bmi", ".pcm");
+  string err;
+  ASSERT_TRUE(lib.AddScan(Scan("lib/m.cpp.o", kInterface), &err));
+  ASSERT_TRUE(lib.AddScan(Scan("lib/part.cpp.o", kPartition), &err));
+
+  string list = WriteModuleList(lib.Modules());
+  EXPECT_EQ("m lib/bmi/m.pcm m:part std\n"
+            "m:part lib/bmi/m-part.pcm\n", list);
+
+  ModuleList modules;
+  ASSERT_TRUE(ParseModuleList(list, &modules, &err)) << err;
+  ModuleCollator app(ModuleCollator::kClang, "app/bmi", ".pcm");
+  app.AddDependencyModules(modules);
+  ASSERT_TRUE(app.AddScan(Scan("app/main.cpp.o", kUser), &err));
+  EXPECT_EQ("ninja_dyndep_version = 1\n"
+            "build app/main.cpp.o: dyndep | lib/bmi/m.pcm "
+            "lib/bmi/m-part.pcm\n",
+            app.DyndepContents());
+}
+
+}  // anonymous namespace
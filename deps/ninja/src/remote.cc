@@ -0,0 +1,1104 @@
+#include "remote.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "graph.h"
+#include "sha256.h"
+#include "util.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+using namespace std;
+
+/// An edge's command as shipped to a worker, and what came back.
+struct RemoteJob {
+  RemoteJob() : edge(NULL), worker_failed(false), exit_code(-1) {}
+
+  Edge* edge;
+  string command;
+  /// Relative paths of the inputs and outputs.
+  vector<string> inputs;
+  vector<string> outputs;
+
+  /// The connection to the worker was lost.
+  bool worker_failed;
+  /// Why the job could not run remotely, if it could not.
+  string error;
+  int exit_code;
+  string output;
+};
+
+namespace {
+
+enum MessageType {
+  kChallenge = 1,  // string nonce, sent by the worker on accept -> kAuth
+  kAuth,       // string HMAC-SHA256 of the nonce under the shared secret
+  kHello,      // -> kCapacity
+  kCapacity,   // int jobs
+  kHave,       // int n, n * string digest -> kMissing
+  kMissing,    // int n, n * string digest, those the worker lacks
+  kBlob,       // string digest, string contents
+  kRun,        // string command, int n, n * (string path, string digest),
+               // int m, m * string output -> kResult or kError
+  kResult,     // int exit code, string output,
+               // int m, m * (string path, int mode, string contents)
+               // where mode is -1 for an output that was not created
+  kError,      // string message
+};
+
+/// Frames larger than this are a protocol error.
+const uint64_t kMaxFrameSize = 1u << 30;
+/// The most a worker reads from a connection that has not authenticated.
+const uint64_t kMaxAuthFrameSize = 1024;
+/// Bytes of nonce in a kChallenge.
+const size_t kNonceSize = 32;
+
+void PutInt(string* out, int64_t value) {
+  uint64_t v = value;
+  for (int i = 0; i < 8; ++i)
+    out->push_back((char)(v >> (8 * i)));
+}
+
+void PutString(string* out, const string& s) {
+  PutInt(out, s.size());
+  out->append(s);
+}
+
+/// Reads the values of a payload back in order.
+struct PayloadReader {
+  explicit PayloadReader(const string& data)
+      : data_(data), pos_(0), ok_(true) {}
+
+  int64_t Int() {
+    if (data_.size() - pos_ < 8) {
+      ok_ = false;
+      return 0;
+    }
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i)
+      v |= (uint64_t)(unsigned char)data_[pos_ + i] << (8 * i);
+    pos_ += 8;
+    return (int64_t)v;
+  }
+
+  string String() {
+    uint64_t len = Int();
+    if (!ok_ || len > data_.size() - pos_) {
+      ok_ = false;
+      return string();
+    }
+    string s = data_.substr(pos_, len);
+    pos_ += len;
+    return s;
+  }
+
+  bool ok() const { return ok_; }
+
+ private:
+  const string& data_;
+  size_t pos_;
+  bool ok_;
+};
+
+bool WriteAll(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool ReadAll(int fd, char* data, size_t size) {
+  while (size > 0) {
+    ssize_t n = recv(fd, data, size, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool SendFrame(int fd, MessageType type, const string& payload) {
+  if (payload.size() > kMaxFrameSize)
+    return false;
+  char header[5];
+  uint32_t size = payload.size();
+  for (int i = 0; i < 4; ++i)
+    header[i] = (char)(size >> (8 * i));
+  header[4] = (char)type;
+  return WriteAll(fd, header, sizeof(header)) &&
+         WriteAll(fd, payload.data(), payload.size());
+}
+
+bool RecvFrame(int fd, MessageType* type, string* payload,
+               uint64_t max_size = kMaxFrameSize) {
+  unsigned char header[5];
+  if (!ReadAll(fd, (char*)header, sizeof(header)))
+    return false;
+  uint32_t size = 0;
+  for (int i = 0; i < 4; ++i)
+    size |= (uint32_t)header[i] << (8 * i);
+  if (size > max_size)
+    return false;
+  *type = (MessageType)header[4];
+  payload->resize(size);
+  return size == 0 || ReadAll(fd, &(*payload)[0], size);
+}
+
+/// Split "host:port".  The host may be empty.
+bool SplitAddress(const string& address, string* host, string* port,
+                  string* err) {
+  size_t colon = address.rfind(':');
+  if (colon == string::npos || colon + 1 == address.size()) {
+    *err = "expected host:port, got '" + address + "'";
+    return false;
+  }
+  *host = address.substr(0, colon);
+  *port = address.substr(colon + 1);
+  return true;
+}
+
+void SetSocketOptions(int fd) {
+  SetCloseOnExec(fd);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+}
+
+/// Connect to a "host:port" address; an empty host is this machine.
+int ConnectTo(const string& address, string* err) {
+  string host, port;
+  if (!SplitAddress(address, &host, &port, err))
+    return -1;
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* info;
+  int r = getaddrinfo(host.empty() ? "localhost" : host.c_str(), port.c_str(),
+                      &hints, &info);
+  if (r != 0) {
+    *err = gai_strerror(r);
+    return -1;
+  }
+  int fd = -1;
+  for (addrinfo* ai = info; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  if (fd < 0)
+    *err = strerror(errno);
+  freeaddrinfo(info);
+  if (fd >= 0)
+    SetSocketOptions(fd);
+  return fd;
+}
+
+/// Answer the challenge a worker sends on every new connection \a fd.
+bool Authenticate(int fd, const string& secret) {
+  MessageType type;
+  string payload;
+  if (!RecvFrame(fd, &type, &payload, kMaxAuthFrameSize) ||
+      type != kChallenge)
+    return false;
+  PayloadReader reader(payload);
+  string nonce = reader.String();
+  if (!reader.ok())
+    return false;
+  string reply;
+  PutString(&reply, Sha256::Hmac(secret, nonce));
+  return SendFrame(fd, kAuth, reply);
+}
+
+/// Compare two MACs without leaking where they first differ.
+bool MacsEqual(const string& a, const string& b) {
+  if (a.size() != b.size())
+    return false;
+  unsigned char diff = 0;
+  for (size_t i = 0; i < a.size(); ++i)
+    diff |= a[i] ^ b[i];
+  return diff == 0;
+}
+
+bool RandomBytes(size_t size, string* out, string* err) {
+  int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    *err = string("/dev/urandom: ") + strerror(errno);
+    return false;
+  }
+  out->resize(size);
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = read(fd, &(*out)[done], size - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      *err = string("/dev/urandom: ") + strerror(n < 0 ? errno : EIO);
+      close(fd);
+      return false;
+    }
+    done += n;
+  }
+  close(fd);
+  return true;
+}
+
+bool IsLoopback(const sockaddr* addr) {
+  if (addr->sa_family == AF_INET) {
+    uint32_t ip = ntohl(((const sockaddr_in*)addr)->sin_addr.s_addr);
+    return (ip >> 24) == 127;
+  }
+  if (addr->sa_family == AF_INET6)
+    return IN6_IS_ADDR_LOOPBACK(&((const sockaddr_in6*)addr)->sin6_addr);
+  return false;
+}
+
+/// A file's digest: the SHA-256 of its contents and its size, plus "x"
+/// for an executable, so that blobs can keep their mode on the worker.
+string ContentDigest(const string& contents, bool executable) {
+  char size[32];
+  snprintf(size, sizeof(size), "-%" PRIu64 "%s", (uint64_t)contents.size(),
+           executable ? "x" : "");
+  return Sha256::Hex(contents) + size;
+}
+
+/// Whether \a digest looks like one ContentDigest() made, so that it is
+/// safe to use as a file name.
+bool IsDigest(const string& digest) {
+  const size_t kHexSize = Sha256::kDigestSize * 2;
+  if (digest.size() < kHexSize + 2 || digest[kHexSize] != '-')
+    return false;
+  for (size_t i = 0; i < digest.size(); ++i) {
+    char c = digest[i];
+    if (!isalnum((unsigned char)c) && c != '-')
+      return false;
+  }
+  return true;
+}
+
+/// The number of leading "../" components of a relative path, or -1 if
+/// the path is absolute or goes up anywhere else.
+int ParentDepth(const string& path) {
+  if (path.empty() || path[0] == '/')
+    return -1;
+  int depth = 0;
+  size_t pos = 0;
+  while (path.compare(pos, 3, "../") == 0) {
+    ++depth;
+    pos += 3;
+  }
+  if (path.find("../", pos) != string::npos || path == ".." ||
+      (path.size() >= 3 && path.compare(path.size() - 3, 3, "/..") == 0))
+    return -1;
+  return depth;
+}
+
+int RemoveEntry(const char* path, const struct stat*, int, struct FTW*) {
+  remove(path);
+  return 0;
+}
+
+/// Remove \a path and everything under it.
+void RemoveTree(const string& path) {
+  nftw(path.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+bool WriteFileWithMode(const string& path, const string& contents, int mode,
+                       string* err) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+  if (fd < 0) {
+    *err = path + ": " + strerror(errno);
+    return false;
+  }
+  bool ok = write(fd, contents.data(), contents.size()) ==
+            (ssize_t)contents.size();
+  if (!ok)
+    *err = path + ": " + strerror(errno);
+  close(fd);
+  // open() only applies the mode to new files.
+  if (ok && chmod(path.c_str(), mode) != 0) {
+    *err = path + ": " + strerror(errno);
+    ok = false;
+  }
+  return ok;
+}
+
+}  // namespace
+
+RemoteCommandRunner::RemoteCommandRunner(const BuildConfig& config)
+    : RealCommandRunner(config), uploaded_blobs_(0) {
+  if (pipe(wake_pipe_) < 0)
+    Fatal("pipe: %s", strerror(errno));
+  for (int i = 0; i < 2; ++i) {
+    SetCloseOnExec(wake_pipe_[i]);
+    fcntl(wake_pipe_[i], F_SETFL, fcntl(wake_pipe_[i], F_GETFL) | O_NONBLOCK);
+  }
+  subprocs_.wake_fd_ = wake_pipe_[0];
+
+  if (!config.remote_workers.empty() && config.remote_secret.empty())
+    Warning("remote workers need a shared secret, running all jobs locally");
+  for (size_t i = 0; i < config.remote_workers.size(); ++i) {
+    Worker worker = { config.remote_workers[i], 0, false };
+    workers_.push_back(worker);
+    if (config.remote_secret.empty())
+      workers_.back().dead = true;
+    else
+      Connect(i);
+  }
+}
+
+RemoteCommandRunner::~RemoteCommandRunner() {
+  ShutDownSlots();
+  for (vector<Slot*>::iterator s = slots_.begin(); s != slots_.end(); ++s) {
+    if ((*s)->fd >= 0)
+      close((*s)->fd);
+    delete *s;
+  }
+  subprocs_.wake_fd_ = -1;
+  close(wake_pipe_[0]);
+  close(wake_pipe_[1]);
+}
+
+void RemoteCommandRunner::Connect(size_t w) {
+  Worker* worker = &workers_[w];
+  string err;
+  int fd = ConnectTo(worker->address, &err);
+  MessageType type;
+  string payload;
+  if (fd >= 0) {
+    if (!Authenticate(fd, config_.remote_secret) ||
+        !SendFrame(fd, kHello, string()) || !RecvFrame(fd, &type, &payload) ||
+        type != kCapacity) {
+      err = "not a worker, or a different secret";
+    } else {
+      PayloadReader reader(payload);
+      worker->capacity = (int)reader.Int();
+      if (!reader.ok() || worker->capacity < 1)
+        err = "not a worker";
+    }
+  }
+  if (!err.empty()) {
+    Warning("remote worker %s: %s", worker->address.c_str(), err.c_str());
+    if (fd >= 0)
+      close(fd);
+    worker->dead = true;
+    return;
+  }
+
+  // One connection per job the worker can run at once.
+  for (int i = 0; i < worker->capacity; ++i) {
+    if (i > 0) {
+      if ((fd = ConnectTo(worker->address, &err)) < 0)
+        break;
+      if (!Authenticate(fd, config_.remote_secret)) {
+        close(fd);
+        break;
+      }
+    }
+    Slot* slot = new Slot;
+    slot->fd = fd;
+    slot->worker = w;
+    slot->job = NULL;
+    slots_.push_back(slot);
+  }
+}
+
+bool RemoteCommandRunner::IsRemotable(const Edge* edge) const {
+  // The first run of a command with a depfile is what discovers its
+  // inputs, so the worker could not be sent all of them yet.
+  return edge->GetBindingBool("remote") && !edge->use_console() &&
+         !edge->deps_missing_;
+}
+
+RemoteCommandRunner::Slot* RemoteCommandRunner::PickSlot() const {
+  vector<int> busy(workers_.size());
+  for (vector<Slot*>::const_iterator s = slots_.begin(); s != slots_.end();
+       ++s) {
+    if ((*s)->job)
+      ++busy[(*s)->worker];
+  }
+  Slot* best = NULL;
+  double best_load = 1.0;
+  for (vector<Slot*>::const_iterator s = slots_.begin(); s != slots_.end();
+       ++s) {
+    const Worker& worker = workers_[(*s)->worker];
+    if ((*s)->job || (*s)->fd < 0 || worker.dead)
+      continue;
+    double load = (double)busy[(*s)->worker] / worker.capacity;
+    if (load < best_load) {
+      best = *s;
+      best_load = load;
+    }
+  }
+  return best;
+}
+
+bool RemoteCommandRunner::CanRunMore() const {
+  // At most one edge waits for local capacity, so the rest stay in the
+  // plan where a later remote slot can still pick them up.
+  if (!deferred_.empty())
+    return false;
+  return RealCommandRunner::CanRunMore() || PickSlot() != NULL;
+}
+
+int RemoteCommandRunner::AvailableWeight() const {
+  // A remote slot takes an edge of any weight; one that ends up running
+  // locally waits in deferred_ until it fits.
+  if (PickSlot() != NULL)
+    return -1;
+  return RealCommandRunner::AvailableWeight();
+}
+
+bool RemoteCommandRunner::StartCommand(Edge* edge) {
+  Slot* slot = IsRemotable(edge) ? PickSlot() : NULL;
+  if (!slot)
+    return StartLocal(edge);
+
+  RemoteJob* job = new RemoteJob;
+  job->edge = edge;
+  job->command = edge->EvaluateCommand();
+  for (vector<Node*>::iterator i = edge->inputs_.begin();
+       i != edge->inputs_.end(); ++i) {
+    if (ParentDepth((*i)->path()) >= 0)
+      job->inputs.push_back((*i)->path());
+  }
+  string rspfile = edge->GetUnescapedRspfile();
+  if (!rspfile.empty())
+    job->inputs.push_back(rspfile);
+  for (vector<Node*>::iterator o = edge->outputs_.begin();
+       o != edge->outputs_.end(); ++o)
+    job->outputs.push_back((*o)->path());
+  string depfile = edge->GetUnescapedDepfile();
+  if (!depfile.empty())
+    job->outputs.push_back(depfile);
+  for (vector<string>::iterator o = job->outputs.begin();
+       o != job->outputs.end(); ++o) {
+    if (ParentDepth(*o) < 0) {
+      delete job;
+      return StartLocal(edge);
+    }
+  }
+
+  slot->job = job;
+  slot->thread = thread(&RemoteCommandRunner::RunJob, this, slot, job);
+  return true;
+}
+
+bool RemoteCommandRunner::StartLocal(Edge* edge) {
+  if (!RealCommandRunner::CanRun(edge)) {
+    deferred_.push_back(edge);
+    return true;
+  }
+  return RealCommandRunner::StartCommand(edge);
+}
+
+bool RemoteCommandRunner::StartDeferred() {
+  while (!deferred_.empty() && RealCommandRunner::CanRun(deferred_.front())) {
+    Edge* edge = deferred_.front();
+    deferred_.pop_front();
+    if (!RealCommandRunner::StartCommand(edge))
+      return false;
+  }
+  return true;
+}
+
+bool RemoteCommandRunner::WaitForCommand(Result* result) {
+  for (;;) {
+    if (!StartDeferred())
+      return false;
+
+    RemoteJob* job = NULL;
+    {
+      lock_guard<mutex> lock(mutex_);
+      if (!finished_.empty()) {
+        job = finished_.front();
+        finished_.erase(finished_.begin());
+      }
+    }
+
+    if (job) {
+      Slot* slot = NULL;
+      for (vector<Slot*>::iterator s = slots_.begin(); s != slots_.end(); ++s) {
+        if ((*s)->job == job)
+          slot = *s;
+      }
+      slot->thread.join();
+      slot->job = NULL;
+      Worker* worker = &workers_[slot->worker];
+
+      if (job->worker_failed || !job->error.empty()) {
+        if (job->worker_failed) {
+          close(slot->fd);
+          slot->fd = -1;
+          if (!worker->dead)
+            Warning("remote worker %s went away, running its jobs locally",
+                    worker->address.c_str());
+          worker->dead = true;
+        } else {
+          Warning("remote worker %s: %s, running locally",
+                  worker->address.c_str(), job->error.c_str());
+        }
+        Edge* edge = job->edge;
+        delete job;
+        if (!StartLocal(edge))
+          return false;
+        continue;
+      }
+
+      result->edge = job->edge;
+      result->status = job->exit_code == 0 ? ExitSuccess : ExitFailure;
+      result->output = job->output;
+      delete job;
+      return true;
+    }
+
+    if (!subprocs_.finished_.empty())
+      return RealCommandRunner::WaitForCommand(result);
+    if (subprocs_.DoWork())
+      return false;
+  }
+}
+
+vector<Edge*> RemoteCommandRunner::GetActiveEdges() {
+  vector<Edge*> edges = RealCommandRunner::GetActiveEdges();
+  for (vector<Slot*>::iterator s = slots_.begin(); s != slots_.end(); ++s) {
+    if ((*s)->job)
+      edges.push_back((*s)->job->edge);
+  }
+  return edges;
+}
+
+void RemoteCommandRunner::Abort() {
+  ShutDownSlots();
+  deferred_.clear();
+  RealCommandRunner::Abort();
+}
+
+void RemoteCommandRunner::ShutDownSlots() {
+  // Closing the connection of a running job makes its thread give up.
+  for (vector<Slot*>::iterator s = slots_.begin(); s != slots_.end(); ++s) {
+    if ((*s)->job)
+      shutdown((*s)->fd, SHUT_RDWR);
+  }
+  for (vector<Slot*>::iterator s = slots_.begin(); s != slots_.end(); ++s) {
+    if (!(*s)->job)
+      continue;
+    (*s)->thread.join();
+    delete (*s)->job;
+    (*s)->job = NULL;
+    close((*s)->fd);
+    (*s)->fd = -1;
+  }
+  lock_guard<mutex> lock(mutex_);
+  finished_.clear();
+}
+
+bool RemoteCommandRunner::Digest(const string& path, bool executable,
+                                 string* digest, string* err) {
+  TimeStamp mtime = disk_interface_.Stat(path, err);
+  if (mtime <= 0) {
+    if (err->empty())
+      *err = path + ": file not found";
+    return false;
+  }
+  {
+    lock_guard<mutex> lock(mutex_);
+    map<string, pair<TimeStamp, string> >::iterator i = digests_.find(path);
+    if (i != digests_.end() && i->second.first == mtime) {
+      *digest = i->second.second;
+      return true;
+    }
+  }
+  string contents;
+  if (::ReadFile(path, &contents, err) < 0)
+    return false;
+  *digest = ContentDigest(contents, executable);
+  lock_guard<mutex> lock(mutex_);
+  digests_[path] = make_pair(mtime, *digest);
+  return true;
+}
+
+void RemoteCommandRunner::RunJob(Slot* slot, RemoteJob* job) {
+  int fd = slot->fd;
+  MessageType type;
+  string payload;
+
+  // Digest the inputs that are files; directories and phony inputs have
+  // nothing to send.
+  vector<pair<string, string> > inputs;
+  map<string, string> digest_paths;
+  for (vector<string>::iterator i = job->inputs.begin();
+       i != job->inputs.end(); ++i) {
+    struct stat st;
+    if (stat(i->c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+      continue;
+    string digest;
+    if (!Digest(*i, (st.st_mode & 0111) != 0, &digest, &job->error)) {
+      JobFinished(job);
+      return;
+    }
+    inputs.push_back(make_pair(*i, digest));
+    digest_paths.insert(make_pair(digest, *i));
+  }
+
+  // Ask which blobs the worker lacks, and upload those.
+  string have;
+  PutInt(&have, digest_paths.size());
+  for (map<string, string>::iterator d = digest_paths.begin();
+       d != digest_paths.end(); ++d)
+    PutString(&have, d->first);
+  if (!SendFrame(fd, kHave, have) || !RecvFrame(fd, &type, &payload) ||
+      type != kMissing) {
+    job->worker_failed = true;
+    JobFinished(job);
+    return;
+  }
+  PayloadReader missing(payload);
+  int64_t num_missing = missing.Int();
+  for (int64_t i = 0; i < num_missing && missing.ok(); ++i) {
+    string digest = missing.String();
+    map<string, string>::iterator d = digest_paths.find(digest);
+    if (d == digest_paths.end())
+      continue;
+    string contents, blob;
+    if (::ReadFile(d->second, &contents, &job->error) < 0) {
+      JobFinished(job);
+      return;
+    }
+    PutString(&blob, digest);
+    PutString(&blob, contents);
+    if (!SendFrame(fd, kBlob, blob)) {
+      job->worker_failed = true;
+      JobFinished(job);
+      return;
+    }
+    lock_guard<mutex> lock(mutex_);
+    ++uploaded_blobs_;
+  }
+
+  string run;
+  PutString(&run, job->command);
+  PutInt(&run, inputs.size());
+  for (vector<pair<string, string> >::iterator i = inputs.begin();
+       i != inputs.end(); ++i) {
+    PutString(&run, i->first);
+    PutString(&run, i->second);
+  }
+  PutInt(&run, job->outputs.size());
+  for (vector<string>::iterator o = job->outputs.begin();
+       o != job->outputs.end(); ++o)
+    PutString(&run, *o);
+  if (!SendFrame(fd, kRun, run) || !RecvFrame(fd, &type, &payload) ||
+      (type != kResult && type != kError)) {
+    job->worker_failed = true;
+    JobFinished(job);
+    return;
+  }
+
+  PayloadReader reply(payload);
+  if (type == kError) {
+    job->error = reply.String();
+    JobFinished(job);
+    return;
+  }
+  job->exit_code = (int)reply.Int();
+  job->output = reply.String();
+  int64_t num_outputs = reply.Int();
+  for (int64_t i = 0; i < num_outputs && reply.ok(); ++i) {
+    string path = reply.String();
+    int64_t mode = reply.Int();
+    string contents = reply.String();
+    if (!reply.ok() || mode < 0 ||
+        find(job->outputs.begin(), job->outputs.end(), path) ==
+            job->outputs.end())
+      continue;
+    string err;
+    if (!disk_interface_.MakeDirs(path) ||
+        !WriteFileWithMode(path, contents, (int)mode & 0777, &err)) {
+      job->output += "ninja: " + err + "\n";
+      job->exit_code = 1;
+    }
+  }
+  if (!reply.ok())
+    job->worker_failed = true;
+  JobFinished(job);
+}
+
+void RemoteCommandRunner::JobFinished(RemoteJob* job) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    finished_.push_back(job);
+  }
+  // The pipe only needs to be non-empty; a full one is fine.
+  if (write(wake_pipe_[1], "", 1) < 0) {}
+}
+
+RemoteWorker::RemoteWorker(const string& dir, int jobs, const string& secret)
+    : dir_(dir), jobs_(jobs), secret_(secret), listen_fd_(-1), port_(0), stopped_(false),
+      running_(0), next_job_id_(0) {}
+
+RemoteWorker::~RemoteWorker() {
+  Stop();
+  for (vector<thread>::iterator t = threads_.begin(); t != threads_.end(); ++t)
+    t->join();
+  if (listen_fd_ >= 0)
+    close(listen_fd_);
+}
+
+bool RemoteWorker::Listen(const string& address, bool allow_remote,
+                          string* err) {
+  string host, port;
+  if (!SplitAddress(address, &host, &port, err))
+    return false;
+
+  RealDiskInterface disk;
+  if (!disk.MakeDirs(dir_ + "/blobs/.") || !disk.MakeDirs(dir_ + "/jobs/.")) {
+    *err = dir_ + ": " + strerror(errno);
+    return false;
+  }
+  // Scratch directories left behind by a previous worker.
+  RemoveTree(dir_ + "/jobs");
+  disk.MakeDirs(dir_ + "/jobs/.");
+
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  addrinfo* info;
+  int r = getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints,
+                      &info);
+  if (r != 0) {
+    *err = gai_strerror(r);
+    return false;
+  }
+  for (addrinfo* ai = info; ai && !allow_remote; ai = ai->ai_next) {
+    if (!IsLoopback(ai->ai_addr)) {
+      *err = "not a loopback address; listening on it lets other machines "
+             "run commands here";
+      freeaddrinfo(info);
+      return false;
+    }
+  }
+  for (addrinfo* ai = info; ai; ai = ai->ai_next) {
+    listen_fd_ = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (listen_fd_ < 0)
+      continue;
+    int one = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(listen_fd_, ai->ai_addr, ai->ai_addrlen) == 0 &&
+        listen(listen_fd_, 64) == 0)
+      break;
+    close(listen_fd_);
+    listen_fd_ = -1;
+  }
+  if (listen_fd_ < 0)
+    *err = strerror(errno);
+  freeaddrinfo(info);
+  if (listen_fd_ < 0)
+    return false;
+  SetCloseOnExec(listen_fd_);
+
+  sockaddr_storage bound;
+  socklen_t len = sizeof(bound);
+  getsockname(listen_fd_, (sockaddr*)&bound, &len);
+  if (bound.ss_family == AF_INET6)
+    port_ = ntohs(((sockaddr_in6*)&bound)->sin6_port);
+  else
+    port_ = ntohs(((sockaddr_in*)&bound)->sin_port);
+  return true;
+}
+
+void RemoteWorker::Serve() {
+  for (;;) {
+    int fd = accept(listen_fd_, NULL, NULL);
+
+    unique_lock<mutex> lock(mutex_);
+    // Reap connections that have been closed.
+    for (vector<thread::id>::iterator id = finished_threads_.begin();
+         id != finished_threads_.end(); ++id) {
+      for (vector<thread>::iterator t = threads_.begin(); t != threads_.end();
+           ++t) {
+        if (t->get_id() == *id) {
+          t->join();
+          threads_.erase(t);
+          break;
+        }
+      }
+    }
+    finished_threads_.clear();
+
+    if (stopped_) {
+      if (fd >= 0)
+        close(fd);
+      return;
+    }
+    if (fd < 0) {
+      if (errno != EINTR && errno != ECONNABORTED)
+        Error("accept: %s", strerror(errno));
+      continue;
+    }
+    SetSocketOptions(fd);
+    connections_.push_back(fd);
+    threads_.push_back(thread(&RemoteWorker::ServeConnection, this, fd));
+  }
+}
+
+void RemoteWorker::Stop() {
+  lock_guard<mutex> lock(mutex_);
+  if (stopped_)
+    return;
+  stopped_ = true;
+  // Wakes up accept() and the connection threads.
+  if (listen_fd_ >= 0)
+    shutdown(listen_fd_, SHUT_RDWR);
+  for (vector<int>::iterator c = connections_.begin();
+       c != connections_.end(); ++c)
+    shutdown(*c, SHUT_RDWR);
+}
+
+void RemoteWorker::ServeConnection(int fd) {
+  MessageType type;
+  string payload;
+  bool authenticated = Challenge(fd);
+  while (authenticated && RecvFrame(fd, &type, &payload)) {
+    PayloadReader reader(payload);
+    string reply, err;
+    bool ok = true;
+    switch (type) {
+    case kHello:
+      PutInt(&reply, jobs_);
+      ok = SendFrame(fd, kCapacity, reply);
+      break;
+    case kHave: {
+      int64_t n = reader.Int();
+      vector<string> missing;
+      for (int64_t i = 0; i < n && reader.ok(); ++i) {
+        string digest = reader.String();
+        struct stat st;
+        if (!IsDigest(digest) ||
+            stat((dir_ + "/blobs/" + digest).c_str(), &st) != 0)
+          missing.push_back(digest);
+      }
+      PutInt(&reply, missing.size());
+      for (vector<string>::iterator d = missing.begin(); d != missing.end();
+           ++d)
+        PutString(&reply, *d);
+      ok = reader.ok() && SendFrame(fd, kMissing, reply);
+      break;
+    }
+    case kBlob: {
+      string digest = reader.String();
+      string contents = reader.String();
+      if (!reader.ok() || !IsDigest(digest) ||
+          ContentDigest(contents, digest[digest.size() - 1] == 'x') != digest) {
+        Error("worker: corrupt blob %s", digest.c_str());
+        ok = false;
+        break;
+      }
+      // Write under a temporary name so a partial blob is never used.
+      string path = dir_ + "/blobs/" + digest;
+      char tmp[32];
+      snprintf(tmp, sizeof(tmp), ".tmp%d", fd);
+      int mode = digest[digest.size() - 1] == 'x' ? 0755 : 0644;
+      if (!WriteFileWithMode(path + tmp, contents, mode, &err) ||
+          rename((path + tmp).c_str(), path.c_str()) != 0) {
+        Error("worker: %s", err.c_str());
+        ok = false;
+      }
+      break;
+    }
+    case kRun:
+      if (RunJob(payload, &reply, &err)) {
+        ok = SendFrame(fd, kResult, reply);
+      } else {
+        PutString(&reply, err);
+        ok = SendFrame(fd, kError, reply);
+      }
+      break;
+    default:
+      ok = false;
+      break;
+    }
+    if (!ok)
+      break;
+  }
+
+  lock_guard<mutex> lock(mutex_);
+  connections_.erase(find(connections_.begin(), connections_.end(), fd));
+  close(fd);
+  finished_threads_.push_back(this_thread::get_id());
+}
+
+bool RemoteWorker::Challenge(int fd) {
+  string nonce, err;
+  if (!RandomBytes(kNonceSize, &nonce, &err)) {
+    Error("worker: %s", err.c_str());
+    return false;
+  }
+  string challenge;
+  PutString(&challenge, nonce);
+  MessageType type;
+  string payload;
+  if (!SendFrame(fd, kChallenge, challenge) ||
+      !RecvFrame(fd, &type, &payload, kMaxAuthFrameSize) || type != kAuth)
+    return false;
+  PayloadReader reader(payload);
+  string mac = reader.String();
+  if (!reader.ok() || !MacsEqual(mac, Sha256::Hmac(secret_, nonce))) {
+    Warning("worker: rejected a connection with the wrong secret");
+    return false;
+  }
+  return true;
+}
+
+bool RemoteWorker::RunJob(const string& request, string* reply, string* err) {
+  PayloadReader reader(request);
+  string command = reader.String();
+  vector<pair<string, string> > inputs;
+  int64_t num_inputs = reader.Int();
+  for (int64_t i = 0; i < num_inputs && reader.ok(); ++i) {
+    string path = reader.String();
+    string digest = reader.String();
+    inputs.push_back(make_pair(path, digest));
+  }
+  vector<string> outputs;
+  int64_t num_outputs = reader.Int();
+  for (int64_t i = 0; i < num_outputs && reader.ok(); ++i)
+    outputs.push_back(reader.String());
+  if (!reader.ok()) {
+    *err = "malformed job";
+    return false;
+  }
+
+  // Lay the job out under a scratch directory as it is in the build
+  // directory, nested deep enough that "../" paths stay inside it.
+  int depth = 0;
+  for (size_t i = 0; i < inputs.size() + outputs.size(); ++i) {
+    const string& path = i < inputs.size() ? inputs[i].first
+                                           : outputs[i - inputs.size()];
+    int d = ParentDepth(path);
+    if (d < 0) {
+      *err = "bad path '" + path + "'";
+      return false;
+    }
+    depth = max(depth, d);
+  }
+  int id;
+  {
+    lock_guard<mutex> lock(mutex_);
+    id = next_job_id_++;
+  }
+  char name[32];
+  snprintf(name, sizeof(name), "/jobs/%d", id);
+  string scratch = dir_ + name;
+  string cwd = scratch;
+  for (int i = 0; i < depth; ++i)
+    cwd += "/_";
+
+  RealDiskInterface disk;
+  bool ok = true;
+  for (vector<pair<string, string> >::iterator i = inputs.begin();
+       ok && i != inputs.end(); ++i) {
+    string path = cwd + "/" + i->first;
+    string blob = dir_ + "/blobs/" + i->second;
+    // An input can be listed more than once.
+    if (!IsDigest(i->second) || !disk.MakeDirs(path) ||
+        (link(blob.c_str(), path.c_str()) != 0 && errno != EEXIST)) {
+      *err = i->first + ": " + strerror(errno);
+      ok = false;
+    }
+  }
+  for (vector<string>::iterator o = outputs.begin(); ok && o != outputs.end();
+       ++o) {
+    if (!disk.MakeDirs(cwd + "/" + *o)) {
+      *err = *o + ": " + strerror(errno);
+      ok = false;
+    }
+  }
+  if (!ok) {
+    RemoveTree(scratch);
+    return false;
+  }
+
+  {
+    unique_lock<mutex> lock(mutex_);
+    while (running_ >= jobs_)
+      job_done_.wait(lock);
+    ++running_;
+  }
+
+  string escaped_cwd;
+  GetShellEscapedString(cwd, &escaped_cwd);
+  string shell = "cd " + escaped_cwd + " && (" + command +
+                 "\n) </dev/null 2>&1";
+  string output;
+  int exit_code = 1;
+  if (FILE* f = popen(shell.c_str(), "r")) {
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+      output.append(buf, n);
+    int status = pclose(f);
+    if (status != -1 && WIFEXITED(status))
+      exit_code = WEXITSTATUS(status);
+  } else {
+    output = string("popen: ") + strerror(errno) + "\n";
+  }
+
+  {
+    lock_guard<mutex> lock(mutex_);
+    --running_;
+  }
+  job_done_.notify_one();
+
+  PutInt(reply, exit_code);
+  PutString(reply, output);
+  PutInt(reply, outputs.size());
+  for (vector<string>::iterator o = outputs.begin(); o != outputs.end(); ++o) {
+    string path = cwd + "/" + *o;
+    string contents, read_err;
+    struct stat st;
+    int64_t mode = -1;
+    if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+        ::ReadFile(path, &contents, &read_err) >= 0)
+      mode = st.st_mode & 0777;
+    PutString(reply, *o);
+    PutInt(reply, mode);
+    PutString(reply, contents);
+  }
+  RemoveTree(scratch);
+  return true;
+}
@@ -0,0 +1,157 @@
+#ifndef NINJA_REMOTE_H_
+#define NINJA_REMOTE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "build.h"
+#include "disk_interface.h"
+
+/// Remote execution.  Edges with a "remote" binding of 1 are shipped to
+/// worker processes (see RemoteWorker) over TCP: their command, the
+/// content digest of each relative input path, and the outputs to send
+/// back.  Workers keep a cache of blobs by digest, so only inputs a worker
+/// has not seen before are uploaded.  Absolute paths, such as the
+/// toolchain and system headers, are expected to exist on the worker.
+///
+/// Workers run arbitrary commands, so every connection starts with a
+/// challenge: the worker sends a random nonce and drops the connection
+/// unless the reply is its HMAC-SHA256 under the secret both sides share
+/// (BuildConfig::remote_secret).
+///
+/// Each message is a frame: a 4-byte little-endian payload length, a
+/// 1-byte type, then the payload, a sequence of 8-byte little-endian
+/// integers and length-prefixed strings.
+struct RemoteJob;
+
+/// RemoteCommandRunner runs remotable edges on the workers listed in
+/// BuildConfig::remote_workers and everything else locally, as
+/// RealCommandRunner would.  Each worker connection runs one job at a
+/// time, and a worker is connected to once per job it reports it can run
+/// concurrently, so jobs are placed by worker capacity.  A job whose
+/// worker goes away is rerun locally.
+struct RemoteCommandRunner : public RealCommandRunner {
+  explicit RemoteCommandRunner(const BuildConfig& config);
+  virtual ~RemoteCommandRunner();
+  virtual bool CanRunMore() const;
+  virtual int AvailableWeight() const;
+  virtual bool StartCommand(Edge* edge);
+  virtual bool WaitForCommand(Result* result);
+  virtual std::vector<Edge*> GetActiveEdges();
+  virtual void Abort();
+
+  /// Number of blobs uploaded to workers so far.
+  int uploaded_blobs() const { return uploaded_blobs_; }
+
+ private:
+  struct Worker {
+    std::string address;
+    int capacity;
+    bool dead;
+  };
+
+  /// A connection to a worker and the job running on it, if any.
+  struct Slot {
+    int fd;
+    size_t worker;
+    RemoteJob* job;
+    std::thread thread;
+  };
+
+  void Connect(size_t worker);
+
+  /// Whether \a edge may run on a worker.
+  bool IsRemotable(const Edge* edge) const;
+
+  /// An idle connection to the least loaded live worker, or NULL.
+  Slot* PickSlot() const;
+
+  /// Start \a edge locally, or queue it if no local capacity is left.
+  bool StartLocal(Edge* edge);
+  /// Start queued local edges while there is capacity.
+  bool StartDeferred();
+
+  /// Run \a job on \a slot's worker; called on the slot's thread.
+  void RunJob(Slot* slot, RemoteJob* job);
+
+  /// Content digest of the file at \a path, cached by modification time.
+  bool Digest(const std::string& path, bool executable, std::string* digest,
+              std::string* err);
+
+  /// Put \a job on the finished list and wake the build loop.
+  void JobFinished(RemoteJob* job);
+
+  void ShutDownSlots();
+
+  std::vector<Worker> workers_;
+  std::vector<Slot*> slots_;
+  std::deque<Edge*> deferred_;
+  RealDiskInterface disk_interface_;
+
+  /// Guards the members below, which job threads touch.
+  std::mutex mutex_;
+  std::vector<RemoteJob*> finished_;
+  std::map<std::string, std::pair<TimeStamp, std::string> > digests_;
+  int uploaded_blobs_;
+
+  /// Job threads write to [1] when they finish; subprocs_ wakes on [0].
+  int wake_pipe_[2];
+};
+
+/// RemoteWorker runs jobs sent by RemoteCommandRunner: it materializes
+/// each job's inputs from its blob cache in a scratch directory, runs the
+/// command there with `/bin/sh -c`, and sends the output files back.
+/// Inputs are hard links into the cache, so commands must not modify
+/// their inputs in place.
+struct RemoteWorker {
+  /// Keep blobs and scratch directories under \a dir, run at most
+  /// \a jobs commands at once, and serve only clients that know \a secret.
+  RemoteWorker(const std::string& dir, int jobs, const std::string& secret);
+  ~RemoteWorker();
+
+  /// Listen on "host:port" or ":port" (all interfaces).  Port 0 picks a
+  /// free port.  Anything but a loopback address fails unless
+  /// \a allow_remote is set.
+  bool Listen(const std::string& address, bool allow_remote, std::string* err);
+
+  /// The port Listen() bound to.
+  int port() const { return port_; }
+
+  /// Serve connections, each on its own thread, until Stop() is called.
+  void Serve();
+  void Stop();
+
+ private:
+  void ServeConnection(int fd);
+
+  /// Check that the client on \a fd knows the secret.
+  bool Challenge(int fd);
+
+  /// Run one job from a kRun payload and build the kResult payload.
+  bool RunJob(const std::string& request, std::string* reply,
+              std::string* err);
+
+  std::string dir_;
+  int jobs_;
+  std::string secret_;
+  int listen_fd_;
+  int port_;
+  bool stopped_;
+
+  /// Guards the members below.
+  std::mutex mutex_;
+  std::condition_variable job_done_;
+  int running_;
+  int next_job_id_;
+  std::vector<int> connections_;
+  std::vector<std::thread> threads_;
+  /// Connection threads that have returned and can be joined.
+  std::vector<std::thread::id> finished_threads_;
+};
+
+#endif  // NINJA_REMOTE_H_
@@ -0,0 +1,174 @@
+#include "remote.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include <memory>
+#include <thread>
+
+#include "disk_interface.h"
+#include "graph.h"
+#include "state.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+struct RemoteTest : public StateTestWithBuiltinRules {
+  virtual void SetUp() {
+    StateTestWithBuiltinRules::SetUp();
+    temp_dir_.CreateAndEnter("RemoteTest");
+
+    string err;
+    worker_.reset(new RemoteWorker("worker", 2, "secret"));
+    ASSERT_TRUE(worker_->Listen("127.0.0.1:0", false, &err)) << err;
+    server_ = thread(&RemoteWorker::Serve, worker_.get());
+    char address[32];
+    snprintf(address, sizeof(address), "127.0.0.1:%d", worker_->port());
+    config_.remote_workers.push_back(address);
+    config_.remote_secret = "secret";
+    config_.parallelism = 1;
+
+    disk_interface_.WriteFile("in1", "one\n");
+    disk_interface_.MakeDirs("sub/in2");
+    disk_interface_.WriteFile("sub/in2", "two\n");
+  }
+
+  virtual void TearDown() {
+    if (worker_.get()) {
+      worker_->Stop();
+      server_.join();
+      worker_.reset();
+    }
+    temp_dir_.Cleanup();
+  }
+
+  /// Run \a edge through \a runner and wait for it.
+  void Run(CommandRunner* runner, Edge* edge, CommandRunner::Result* result) {
+    ASSERT_TRUE(runner->CanRunMore());
+    ASSERT_TRUE(runner->StartCommand(edge));
+    ASSERT_TRUE(runner->WaitForCommand(result));
+    ASSERT_EQ(edge, result->edge);
+  }
+
+  Edge* EdgeFor(const char* output) {
+    return state_.GetNode(output, 0)->in_edge();
+  }
+
+  ScopedTempDir temp_dir_;
+  RealDiskInterface disk_interface_;
+  BuildConfig config_;
+  unique_ptr<RemoteWorker> worker_;
+  thread server_;
+};
+
+TEST_F(RemoteTest, RunsRemotableEdgesOnWorker) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule remote_cat\n"
+"  command = cat $in > $out && pwd\n"
+"  remote = 1\n"
+"build sub/out: remote_cat in1 sub/in2\n"
+"build sub/out2: remote_cat in1\n"));
+
+  RemoteCommandRunner runner(config_);
+  CommandRunner::Result result;
+  Run(&runner, EdgeFor("sub/out"), &result);
+  EXPECT_TRUE(result.success()) << result.output;
+  EXPECT_NE(string::npos, result.output.find("/worker/jobs/"));
+
+  string contents, err;
+  EXPECT_EQ(DiskInterface::Okay,
+            disk_interface_.ReadFile("sub/out", &contents, &err));
+  EXPECT_EQ("one\ntwo\n", contents);
+  EXPECT_EQ(2, runner.uploaded_blobs());
+
+  // The worker already has in1.
+  Run(&runner, EdgeFor("sub/out2"), &result);
+  EXPECT_TRUE(result.success()) << result.output;
+  EXPECT_EQ(2, runner.uploaded_blobs());
+}
+
+TEST_F(RemoteTest, KeepsOtherEdgesLocal) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule remote_fail\n"
+"  command = exit 3\n"
+"  remote = 1\n"
+"rule local\n"
+"  command = pwd > $out\n"
+"build failed: remote_fail in1\n"
+"build local: local in1\n"));
+
+  RemoteCommandRunner runner(config_);
+  CommandRunner::Result result;
+  Run(&runner, EdgeFor("failed"), &result);
+  EXPECT_EQ(ExitFailure, result.status);
+
+  Run(&runner, EdgeFor("local"), &result);
+  EXPECT_TRUE(result.success()) << result.output;
+  string contents, err;
+  disk_interface_.ReadFile("local", &contents, &err);
+  EXPECT_EQ(string::npos, contents.find("/worker/jobs/"));
+}
+
+TEST_F(RemoteTest, OutputsKeepTheirMode) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule remote_cp\n"
+"  command = cp $in $out\n"
+"  remote = 1\n"
+"build tool.copy: remote_cp tool\n"));
+  disk_interface_.WriteFile("tool", "#!/bin/sh\n");
+  chmod("tool", 0755);
+
+  RemoteCommandRunner runner(config_);
+  CommandRunner::Result result;
+  Run(&runner, EdgeFor("tool.copy"), &result);
+  EXPECT_TRUE(result.success()) << result.output;
+  struct stat st;
+  ASSERT_EQ(0, stat("tool.copy", &st));
+  EXPECT_EQ(0755, (int)(st.st_mode & 0777));
+}
+
+TEST_F(RemoteTest, UnreachableWorkerRunsLocally) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule remote_cat\n"
+"  command = cat $in > $out\n"
+"  remote = 1\n"
+"build out: remote_cat in1\n"));
+
+  // Nothing listens on the worker's port once it is gone.
+  worker_->Stop();
+  server_.join();
+  worker_.reset();
+
+  RemoteCommandRunner runner(config_);
+  CommandRunner::Result result;
+  Run(&runner, EdgeFor("out"), &result);
+  EXPECT_TRUE(result.success()) << result.output;
+  EXPECT_EQ(0, runner.uploaded_blobs());
+}
+
+TEST_F(RemoteTest, WrongSecretRunsLocally) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule remote_cat\n"
+"  command = cat $in > $out\n"
+"  remote = 1\n"
+"build out: remote_cat in1\n"));
+
+  config_.remote_secret = "guess";
+  RemoteCommandRunner runner(config_);
+  CommandRunner::Result result;
+  Run(&runner, EdgeFor("out"), &result);
+  EXPECT_TRUE(result.success()) << result.output;
+  EXPECT_EQ(0, runner.uploaded_blobs());
+}
+
+TEST_F(RemoteTest, ListensOnlyOnLoopbackByDefault) {
+  RemoteWorker worker("worker2", 1, "secret");
+  string err;
+  EXPECT_FALSE(worker.Listen(":0", false, &err));
+  EXPECT_NE(string::npos, err.find("loopback")) << err;
+  EXPECT_TRUE(worker.Listen("localhost:0", false, &err)) << err;
+}
+
+}  // anonymous namespace
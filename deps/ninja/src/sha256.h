@@ -0,0 +1,36 @@
+#ifndef NINJA_SHA256_H_
+#define NINJA_SHA256_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+/// SHA-256 (FIPS 180-4), for content digests that must not collide.
+struct Sha256 {
+  enum { kDigestSize = 32 };
+
+  Sha256();
+
+  void Update(const void* data, size_t size);
+
+  /// Finish the message and write its digest to \a digest.  The object
+  /// must not be updated afterwards.
+  void Final(unsigned char digest[kDigestSize]);
+
+  /// The lowercase hex digest of \a data.
+  static std::string Hex(const std::string& data);
+
+  /// The raw HMAC-SHA256 (RFC 2104) of \a message under \a key.
+  static std::string Hmac(const std::string& key, const std::string& message);
+
+ private:
+  void Compress(const unsigned char block[64]);
+
+  uint32_t state_[8];
+  uint64_t length_;
+  unsigned char buffer_[64];
+  size_t buffered_;
+};
+
+#endif  // NINJA_SHA256_H_
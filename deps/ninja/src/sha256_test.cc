@@ -0,0 +1,61 @@
+#include "sha256.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+string ToHex(const string& bytes) {
+  string hex;
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    char byte[3];
+    snprintf(byte, sizeof(byte), "%02x", (unsigned char)bytes[i]);
+    hex += byte;
+  }
+  return hex;
+}
+
+}  // anonymous namespace
+
+TEST(Sha256Test, KnownAnswers) {
+  EXPECT_EQ("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+            Sha256::Hex(""));
+  EXPECT_EQ("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+            Sha256::Hex("abc"));
+  EXPECT_EQ("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+            Sha256::Hex(
+                "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"));
+  EXPECT_EQ("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+            Sha256::Hex(string(1000000, 'a')));
+}
+
+TEST(Sha256Test, Incremental) {
+  string data;
+  for (int i = 0; i < 300; ++i)
+    data.push_back((char)i);
+  string expected = Sha256::Hex(data);
+  // Feed it in uneven pieces that straddle block boundaries.
+  for (size_t step = 1; step < 130; step += 7) {
+    Sha256 sha;
+    for (size_t i = 0; i < data.size(); i += step)
+      sha.Update(data.data() + i, min(step, data.size() - i));
+    unsigned char digest[Sha256::kDigestSize];
+    sha.Final(digest);
+    EXPECT_EQ(expected, ToHex(string((const char*)digest, sizeof(digest))));
+  }
+}
+
+TEST(Sha256Test, Hmac) {
+  // RFC 4231 test cases 2 and 6.
+  EXPECT_EQ("5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843",
+            ToHex(Sha256::Hmac("Jefe", "what do ya want for nothing?")));
+  EXPECT_EQ("60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54",
+            ToHex(Sha256::Hmac(
+                string(131, '\xaa'),
+                "Test Using Larger Than Block-Size Key - Hash Key First")));
+}
@@ -42,7 +42,8 @@ void Pool::RetrieveReadyEdges(EdgeSet* ready_queue) {
   DelayedEdges::iterator it = delayed_.begin();
   while (it != delayed_.end()) {
     Edge* edge = *it;
-    if (current_use_ + edge->weight() > depth_)
+    // An edge heavier than the whole pool still runs, but only on its own.
+    if (current_use_ > 0 && current_use_ + edge->weight() > depth_)
       break;
     ready_queue->insert(edge);
     EdgeScheduled(*edge);
@@ -97,7 +98,7 @@ Node* State::GetNode(StringPiece path, uint64_t slash_bits) {
   Node* node = LookupNode(path);
   if (node)
     return node;
-  node = new Node(path.AsString(), slash_bits);
+  node = new Node(path, slash_bits);
   paths_[node->path()] = node;
   return node;
 }
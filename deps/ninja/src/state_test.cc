@@ -45,4 +45,15 @@ TEST(State, Basic) {
   EXPECT_FALSE(state.GetNode("out", 0)->dirty());
 }
 
+TEST(State, GetNodeFromPiece) {
+  State state;
+
+  // The piece need not be NUL-terminated; the node keeps its own copy.
+  const char buf[] = "dir/in1 dir/in2";
+  Node* node = state.GetNode(StringPiece(buf, 7), 0);
+  EXPECT_EQ("dir/in1", node->path());
+  EXPECT_EQ(node, state.GetNode(string("dir/in1"), 0));
+  EXPECT_EQ(node, state.LookupNode("dir/in1"));
+}
+
 }  // namespace
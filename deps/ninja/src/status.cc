@@ -17,19 +17,26 @@
 #include <stdarg.h>
 #include <stdlib.h>
 
+#include <chrono>
+
 #ifdef _WIN32
 #include <fcntl.h>
 #include <io.h>
 #endif
 
 #include "debug_flags.h"
+#include "disk_interface.h"
+#include "metrics.h"
+#include "util.h"
 
 using namespace std;
 
 StatusPrinter::StatusPrinter(const BuildConfig& config)
     : config_(config),
       started_edges_(0), finished_edges_(0), total_edges_(0), running_edges_(0),
-      time_millis_(0), progress_status_format_(NULL),
+      time_millis_(0), has_pending_status_(false), output_busy_(false),
+      output_flushing_(false), output_stop_(false), last_status_millis_(0),
+      output_logs_written_(0), progress_status_format_(NULL),
       current_rate_(config.parallelism) {
 
   // Don't do anything fancy in verbose mode.
@@ -41,6 +48,18 @@ StatusPrinter::StatusPrinter(const BuildConfig& config)
     progress_status_format_ = "[%f/%t] ";
 }
 
+StatusPrinter::~StatusPrinter() {
+  if (!output_thread_.joinable())
+    return;
+  Flush();
+  {
+    std::lock_guard<std::mutex> lock(output_mutex_);
+    output_stop_ = true;
+  }
+  output_ready_.notify_one();
+  output_thread_.join();
+}
+
 void StatusPrinter::PlanHasTotalEdges(int total) {
   total_edges_ = total;
 }
@@ -54,8 +73,14 @@ void StatusPrinter::BuildEdgeStarted(const Edge* edge,
   if (edge->use_console() || printer_.is_smart_terminal())
     PrintStatus(edge, start_time_millis);
 
-  if (edge->use_console())
-    printer_.SetConsoleLocked(true);
+  if (edge->use_console()) {
+    // The command is about to write to the terminal itself, so everything
+    // queued before it must be out first.
+    OutputMessage msg;
+    msg.kind = OutputMessage::kConsoleLock;
+    Post(&msg);
+    Flush();
+  }
 }
 
 void StatusPrinter::BuildEdgeFinished(Edge* edge, int64_t end_time_millis,
@@ -63,8 +88,11 @@ void StatusPrinter::BuildEdgeFinished(Edge* edge, int64_t end_time_millis,
   time_millis_ = end_time_millis;
   ++finished_edges_;
 
-  if (edge->use_console())
-    printer_.SetConsoleLocked(false);
+  if (edge->use_console()) {
+    OutputMessage msg;
+    msg.kind = OutputMessage::kConsoleUnlock;
+    Post(&msg);
+  }
 
   if (config_.verbosity == BuildConfig::QUIET)
     return;
@@ -81,43 +109,83 @@ void StatusPrinter::BuildEdgeFinished(Edge* edge, int64_t end_time_millis,
          o != edge->outputs_.end(); ++o)
       outputs += (*o)->path() + " ";
 
+    OutputMessage msg;
+    msg.kind = OutputMessage::kPrintOnNewLine;
     if (printer_.supports_color()) {
-        printer_.PrintOnNewLine("\x1B[31m" "FAILED: " "\x1B[0m" + outputs + "\n");
+        msg.text = "\x1B[31m" "FAILED: " "\x1B[0m" + outputs + "\n";
     } else {
-        printer_.PrintOnNewLine("FAILED: " + outputs + "\n");
+        msg.text = "FAILED: " + outputs + "\n";
     }
-    printer_.PrintOnNewLine(edge->EvaluateCommand() + "\n");
+    Post(&msg);
+    msg.kind = OutputMessage::kPrintOnNewLine;
+    msg.text = edge->EvaluateCommand() + "\n";
+    Post(&msg);
   }
 
   if (!output.empty()) {
-    // ninja sets stdout and stderr of subprocesses to a pipe, to be able to
-    // check if the output is empty. Some compilers, e.g. clang, check
-    // isatty(stderr) to decide if they should print colored output.
-    // To make it possible to use colored output with ninja, subprocesses should
-    // be run with a flag that forces them to always print color escape codes.
-    // To make sure these escape codes don't show up in a file if ninja's output
-    // is piped to a file, ninja strips ansi escape codes again if it's not
-    // writing to a |smart_terminal_|.
-    // (Launching subprocesses in pseudo ttys doesn't work because there are
-    // only a few hundred available on some systems, and ninja can launch
-    // thousands of parallel compile commands.)
-    string final_output;
-    if (!printer_.supports_color())
-      final_output = StripAnsiEscapeCodes(output);
-    else
-      final_output = output;
+    OutputMessage msg;
+    msg.kind = OutputMessage::kEdgeOutput;
+    msg.text = output;
+    if (success && !output_log_dir_.empty())
+      msg.log_name = edge->outputs_[0]->path();
+    Post(&msg);
+  }
+}
+
+void StatusPrinter::WriteEdgeOutput(const string& output) {
+  // ninja sets stdout and stderr of subprocesses to a pipe, to be able to
+  // check if the output is empty. Some compilers, e.g. clang, check
+  // isatty(stderr) to decide if they should print colored output.
+  // To make it possible to use colored output with ninja, subprocesses should
+  // be run with a flag that forces them to always print color escape codes.
+  // To make sure these escape codes don't show up in a file if ninja's output
+  // is piped to a file, ninja strips ansi escape codes again if it's not
+  // writing to a |smart_terminal_|.
+  // (Launching subprocesses in pseudo ttys doesn't work because there are
+  // only a few hundred available on some systems, and ninja can launch
+  // thousands of parallel compile commands.)
+  string final_output;
+  if (!printer_.supports_color())
+    final_output = StripAnsiEscapeCodes(output);
+  else
+    final_output = output;
 
 #ifdef _WIN32
-    // Fix extra CR being added on Windows, writing out CR CR LF (#773)
-    _setmode(_fileno(stdout), _O_BINARY);  // Begin Windows extra CR fix
+  // Fix extra CR being added on Windows, writing out CR CR LF (#773)
+  _setmode(_fileno(stdout), _O_BINARY);  // Begin Windows extra CR fix
 #endif
 
-    printer_.PrintOnNewLine(final_output);
+  printer_.PrintOnNewLine(final_output);
 
 #ifdef _WIN32
-    _setmode(_fileno(stdout), _O_TEXT);  // End Windows extra CR fix
+  _setmode(_fileno(stdout), _O_TEXT);  // End Windows extra CR fix
 #endif
+}
+
+void StatusPrinter::LogEdgeOutput(const string& name, const string& output) {
+  // One file per output, so separators are %-escaped, and so is '%' itself
+  // so that no two outputs share a file.
+  string file_name;
+  for (size_t i = 0; i < name.size(); ++i) {
+    char c = name[i];
+    if (c == '/' || c == '\\' || c == ':' || c == '%') {
+      char escape[4];
+      snprintf(escape, sizeof(escape), "%%%02X", static_cast<unsigned char>(c));
+      file_name += escape;
+    } else {
+      file_name += c;
+    }
+  }
+  string path = output_log_dir_ + "/" + file_name + ".log";
+
+  RealDiskInterface disk_interface;
+  if (!disk_interface.MakeDirs(path) ||
+      !disk_interface.WriteFile(path, StripAnsiEscapeCodes(output))) {
+    // Better on the terminal than nowhere.
+    WriteEdgeOutput(output);
+    return;
   }
+  ++output_logs_written_;
 }
 
 void StatusPrinter::BuildLoadDyndeps() {
@@ -130,8 +198,12 @@ void StatusPrinter::BuildLoadDyndeps() {
   // line.  Start a new line so that the first explanation does not
   // append to the status line.  After the explanations are done a
   // new build status line will appear.
-  if (g_explaining)
-    printer_.PrintOnNewLine("");
+  if (g_explaining) {
+    OutputMessage msg;
+    msg.kind = OutputMessage::kPrintOnNewLine;
+    Post(&msg);
+    Flush();
+  }
 }
 
 void StatusPrinter::BuildStarted() {
@@ -141,10 +213,118 @@ void StatusPrinter::BuildStarted() {
 }
 
 void StatusPrinter::BuildFinished() {
-  printer_.SetConsoleLocked(false);
+  OutputMessage msg;
+  msg.kind = OutputMessage::kConsoleUnlock;
+  Post(&msg);
+  Flush();
+
+  if (output_logs_written_ > 0) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "ninja: output of %d command%s written to ",
+             output_logs_written_, output_logs_written_ == 1 ? "" : "s");
+    printer_.PrintOnNewLine(buf + output_log_dir_ + "\n");
+    output_logs_written_ = 0;
+  }
   printer_.PrintOnNewLine("");
 }
 
+void StatusPrinter::Post(OutputMessage* msg) {
+  {
+    std::lock_guard<std::mutex> lock(output_mutex_);
+    output_queue_.push_back(OutputMessage());
+    std::swap(output_queue_.back(), *msg);
+  }
+  if (!output_thread_.joinable())
+    output_thread_ = std::thread(&StatusPrinter::OutputThreadMain, this);
+  output_ready_.notify_one();
+}
+
+void StatusPrinter::PostStatus(const string& status) {
+  {
+    std::lock_guard<std::mutex> lock(output_mutex_);
+    pending_status_ = status;
+    has_pending_status_ = true;
+  }
+  if (!output_thread_.joinable())
+    output_thread_ = std::thread(&StatusPrinter::OutputThreadMain, this);
+  output_ready_.notify_one();
+}
+
+void StatusPrinter::Flush() {
+  if (!output_thread_.joinable())
+    return;
+  std::unique_lock<std::mutex> lock(output_mutex_);
+  output_flushing_ = true;
+  output_ready_.notify_one();
+  while (!output_queue_.empty() || has_pending_status_ || output_busy_)
+    output_idle_.wait(lock);
+  output_flushing_ = false;
+}
+
+void StatusPrinter::OutputThreadMain() {
+  std::unique_lock<std::mutex> lock(output_mutex_);
+  for (;;) {
+    if (!output_queue_.empty()) {
+      OutputMessage msg;
+      std::swap(msg, output_queue_.front());
+      output_queue_.pop_front();
+      output_busy_ = true;
+      lock.unlock();
+      WriteMessage(msg);
+      lock.lock();
+      output_busy_ = false;
+      continue;
+    }
+
+    if (has_pending_status_) {
+      int64_t wait_millis =
+          last_status_millis_ + kStatusRedrawMillis - GetTimeMillis();
+      if (wait_millis > 0 && !output_flushing_ && !output_stop_) {
+        output_ready_.wait_for(lock, std::chrono::milliseconds(wait_millis));
+        continue;
+      }
+      string status;
+      status.swap(pending_status_);
+      has_pending_status_ = false;
+      output_busy_ = true;
+      lock.unlock();
+      printer_.Print(status, LinePrinter::ELIDE);
+      last_status_millis_ = GetTimeMillis();
+      lock.lock();
+      output_busy_ = false;
+      continue;
+    }
+
+    output_idle_.notify_all();
+    if (output_stop_)
+      return;
+    output_ready_.wait(lock);
+  }
+}
+
+void StatusPrinter::WriteMessage(const OutputMessage& msg) {
+  switch (msg.kind) {
+  case OutputMessage::kPrint:
+    printer_.Print(msg.text, msg.type);
+    break;
+  case OutputMessage::kPrintOnNewLine:
+    printer_.PrintOnNewLine(msg.text);
+    break;
+  case OutputMessage::kEdgeOutput:
+    if (msg.log_name.empty())
+      WriteEdgeOutput(msg.text);
+    else
+      LogEdgeOutput(msg.log_name, msg.text);
+    break;
+  case OutputMessage::kConsoleLock:
+    printer_.SetConsoleLocked(true);
+    break;
+  case OutputMessage::kConsoleUnlock:
+    printer_.SetConsoleLocked(false);
+    break;
+  }
+}
+
 string StatusPrinter::FormatProgressStatus(const char* progress_status_format,
                                            int64_t time_millis) const {
   string out;
@@ -236,16 +416,27 @@ void StatusPrinter::PrintStatus(const Edge* edge, int64_t time_millis) {
 
   string to_print = edge->GetBinding("description");
   if (to_print.empty() || force_full_command)
-    to_print = edge->GetBinding("command");
+    to_print = edge->EvaluateCommand();
 
   to_print = FormatProgressStatus(progress_status_format_, time_millis)
       + to_print;
 
-  printer_.Print(to_print,
-                 force_full_command ? LinePrinter::FULL : LinePrinter::ELIDE);
+  // On a smart terminal each status line overprints the last one, so only
+  // the latest needs drawing.
+  if (printer_.is_smart_terminal() && !force_full_command) {
+    PostStatus(to_print);
+    return;
+  }
+
+  OutputMessage msg;
+  msg.kind = OutputMessage::kPrint;
+  msg.type = force_full_command ? LinePrinter::FULL : LinePrinter::ELIDE;
+  msg.text = to_print;
+  Post(&msg);
 }
 
 void StatusPrinter::Warning(const char* msg, ...) {
+  Flush();
   va_list ap;
   va_start(ap, msg);
   ::Warning(msg, ap);
@@ -253,6 +444,7 @@ void StatusPrinter::Warning(const char* msg, ...) {
 }
 
 void StatusPrinter::Error(const char* msg, ...) {
+  Flush();
   va_list ap;
   va_start(ap, msg);
   ::Error(msg, ap);
@@ -260,6 +452,7 @@ void StatusPrinter::Error(const char* msg, ...) {
 }
 
 void StatusPrinter::Info(const char* msg, ...) {
+  Flush();
   va_list ap;
   va_start(ap, msg);
   ::Info(msg, ap);
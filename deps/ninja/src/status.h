@@ -15,8 +15,12 @@
 #ifndef NINJA_STATUS_H_
 #define NINJA_STATUS_H_
 
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <mutex>
 #include <string>
+#include <thread>
 
 #include "build.h"
 #include "line_printer.h"
@@ -40,7 +44,12 @@ struct Status {
 };
 
 /// Implementation of the Status interface that prints the status as
-/// human-readable strings to stdout
+/// human-readable strings to stdout.
+///
+/// The terminal is written from a dedicated output thread, so that a slow
+/// terminal or a command printing megabytes of warnings does not hold up
+/// the build loop.  Overprinted status lines are coalesced and redrawn at
+/// most every kStatusRedrawMillis.
 struct StatusPrinter : Status {
   explicit StatusPrinter(const BuildConfig& config);
   virtual void PlanHasTotalEdges(int total);
@@ -55,7 +64,18 @@ struct StatusPrinter : Status {
   virtual void Warning(const char* msg, ...);
   virtual void Error(const char* msg, ...);
 
-  virtual ~StatusPrinter() { }
+  virtual ~StatusPrinter();
+
+  /// Write the output of successful commands to one file per edge under
+  /// \a dir instead of the terminal, and print only a summary.  Output of
+  /// failed commands is still printed.  An empty \a dir turns this off.
+  void set_output_log_dir(const std::string& dir) { output_log_dir_ = dir; }
+
+  /// Block until everything queued for the output thread is written.
+  void Flush();
+
+  /// Minimum time between two redraws of the status line.
+  static const int64_t kStatusRedrawMillis = 50;
 
   /// Format the progress status string by replacing the placeholders.
   /// See the user manual for more information about the available
@@ -68,14 +88,57 @@ struct StatusPrinter : Status {
  private:
   void PrintStatus(const Edge* edge, int64_t time_millis);
 
+  /// A request for the output thread, performed in the order queued.
+  struct OutputMessage {
+    enum Kind {
+      kPrint,
+      kPrintOnNewLine,
+      kEdgeOutput,
+      kConsoleLock,
+      kConsoleUnlock
+    };
+    Kind kind;
+    LinePrinter::LineType type;
+    std::string text;
+    /// For kEdgeOutput: the edge's first output, or empty to print.
+    std::string log_name;
+  };
+
+  /// Queue \a msg for the output thread, starting it if needed.
+  void Post(OutputMessage* msg);
+  /// Replace the status line to be drawn next.
+  void PostStatus(const std::string& status);
+  void OutputThreadMain();
+  void WriteMessage(const OutputMessage& msg);
+  void WriteEdgeOutput(const std::string& output);
+  void LogEdgeOutput(const std::string& name, const std::string& output);
+
   const BuildConfig& config_;
 
   int started_edges_, finished_edges_, total_edges_, running_edges_;
   int64_t time_millis_;
 
-  /// Prints progress output.
+  /// Prints progress output.  Only touched by the output thread once it
+  /// is running.
   LinePrinter printer_;
 
+  std::thread output_thread_;
+  std::mutex output_mutex_;
+  /// Signalled when there is work for the output thread.
+  std::condition_variable output_ready_;
+  /// Signalled when the output thread has nothing left to write.
+  std::condition_variable output_idle_;
+  std::deque<OutputMessage> output_queue_;
+  std::string pending_status_;
+  bool has_pending_status_;
+  bool output_busy_;
+  bool output_flushing_;
+  bool output_stop_;
+  int64_t last_status_millis_;
+
+  std::string output_log_dir_;
+  int output_logs_written_;
+
   /// The custom progress status format to use.
   const char* progress_status_format_;
 
@@ -14,6 +14,7 @@
 
 #include "status.h"
 
+#include "disk_interface.h"
 #include "test.h"
 
 TEST(StatusTest, StatusFormatElapsed) {
@@ -33,3 +34,48 @@ TEST(StatusTest, StatusFormatReplacePlaceholder) {
   EXPECT_EQ("[%/s0/t0/r0/u0/f0]",
             status.FormatProgressStatus("[%%/s%s/t%t/r%r/u%u/f%f]", 0));
 }
+
+TEST(StatusTest, OutputLogDir) {
+  ScopedTempDir temp_dir;
+  temp_dir.CreateAndEnter("NinjaStatusTest");
+
+  State state;
+  AssertParse(&state,
+"rule cc\n"
+"  command = cc $in\n"
+"build out/a.o: cc a.c\n"
+"build out_a.o: cc a.c\n"
+"build out%a.o: cc a.c\n");
+
+  BuildConfig config;
+  config.verbosity = BuildConfig::NO_STATUS_UPDATE;
+  {
+    StatusPrinter status(config);
+    status.set_output_log_dir("logs");
+    status.BuildStarted();
+    status.BuildEdgeStarted(state.edges_[0], 0);
+    status.BuildEdgeFinished(state.edges_[0], 1, true, "a.c:1: warning\n");
+    status.BuildEdgeStarted(state.edges_[1], 0);
+    status.BuildEdgeFinished(state.edges_[1], 1, true, "a.c:2: warning\n");
+    status.BuildEdgeStarted(state.edges_[2], 0);
+    status.BuildEdgeFinished(state.edges_[2], 1, true, "a.c:3: warning\n");
+    status.Flush();
+  }
+
+  RealDiskInterface disk_interface;
+  std::string contents, err;
+  EXPECT_EQ(DiskInterface::Okay,
+            disk_interface.ReadFile("logs/out%2Fa.o.log", &contents, &err));
+  EXPECT_EQ("a.c:1: warning\n", contents);
+  // Escaped so that it cannot collide with another output.
+  contents.clear();
+  EXPECT_EQ(DiskInterface::Okay,
+            disk_interface.ReadFile("logs/out_a.o.log", &contents, &err));
+  EXPECT_EQ("a.c:2: warning\n", contents);
+  contents.clear();
+  EXPECT_EQ(DiskInterface::Okay,
+            disk_interface.ReadFile("logs/out%25a.o.log", &contents, &err));
+  EXPECT_EQ("a.c:3: warning\n", contents);
+
+  temp_dir.Cleanup();
+}
@@ -21,9 +21,17 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <spawn.h>
 
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mount.h>
+#include <sys/syscall.h>
+#endif
+
 #define USE_PPOLL
 
 #if defined(USE_PPOLL)
@@ -38,6 +46,7 @@ extern char** environ;
 
 using namespace std;
 
+#include <set>
 #include <vector>
 #include <string>
 #include <sstream>
@@ -70,7 +79,223 @@ struct argparse {
 };
 
 
-Subprocess::Subprocess(bool use_console) : fd_(-1), pid_(-1),
+#ifdef __linux__
+namespace {
+
+/// System directories every sandboxed command can see.
+const char* const kSandboxSystemPaths[] = {
+  "/bin", "/sbin", "/usr", "/lib", "/lib32", "/lib64", "/libx32", "/etc",
+  "/opt", "/dev", "/proc",
+};
+
+/// What a sandboxed child has to do to set up its root.  Worked out
+/// before fork() so the child only makes system calls.
+struct SandboxPlan {
+  string cwd;
+  string uid_map;
+  string gid_map;
+  /// Directories to create in the new root, parents before children.
+  set<string> dirs;
+  /// Empty files to create in the new root as mount points.
+  vector<string> files;
+  /// Paths to bind from the old root into the new one.
+  vector<string> binds;
+};
+
+void AddParentDirs(const string& path, set<string>* dirs) {
+  for (size_t i = path.find('/', 1); i != string::npos;
+       i = path.find('/', i + 1))
+    dirs->insert(path.substr(0, i));
+}
+
+bool IsCoveredBy(const string& path, const vector<string>& dirs) {
+  for (vector<string>::const_iterator i = dirs.begin(); i != dirs.end(); ++i) {
+    if (path.compare(0, i->size(), *i) == 0 &&
+        (path.size() == i->size() || path[i->size()] == '/'))
+      return true;
+  }
+  return false;
+}
+
+void MakeSandboxPlan(const SubprocessSandbox& sandbox, SandboxPlan* plan) {
+  char cwd[4096];
+  if (!getcwd(cwd, sizeof(cwd)))
+    Fatal("getcwd: %s", strerror(errno));
+  plan->cwd = cwd;
+
+  char map[64];
+  snprintf(map, sizeof(map), "%u %u 1\n", (unsigned)getuid(),
+           (unsigned)getuid());
+  plan->uid_map = map;
+  snprintf(map, sizeof(map), "%u %u 1\n", (unsigned)getgid(),
+           (unsigned)getgid());
+  plan->gid_map = map;
+
+  struct stat st;
+
+  // Whole directories first: the system ones and those outputs go to.
+  vector<string> dirs;
+  for (size_t i = 0;
+       i < sizeof(kSandboxSystemPaths) / sizeof(kSandboxSystemPaths[0]); ++i) {
+    if (stat(kSandboxSystemPaths[i], &st) == 0)
+      dirs.push_back(kSandboxSystemPaths[i]);
+  }
+  for (vector<string>::const_iterator o = sandbox.outputs.begin();
+       o != sandbox.outputs.end(); ++o) {
+    string path = (*o)[0] == '/' ? *o : plan->cwd + "/" + *o;
+    string dir = path.substr(0, path.rfind('/'));
+    if (!dir.empty() && !IsCoveredBy(dir, dirs))
+      dirs.push_back(dir);
+  }
+  for (vector<string>::const_iterator d = dirs.begin(); d != dirs.end(); ++d) {
+    AddParentDirs(*d, &plan->dirs);
+    plan->dirs.insert(*d);
+    plan->binds.push_back(*d);
+  }
+
+  for (vector<string>::const_iterator i = sandbox.inputs.begin();
+       i != sandbox.inputs.end(); ++i) {
+    string path = (*i)[0] == '/' ? *i : plan->cwd + "/" + *i;
+    if (IsCoveredBy(path, dirs) || stat(path.c_str(), &st) != 0)
+      continue;
+    AddParentDirs(path, &plan->dirs);
+    if (S_ISDIR(st.st_mode))
+      plan->dirs.insert(path);
+    else
+      plan->files.push_back(path);
+    plan->binds.push_back(path);
+  }
+
+  AddParentDirs(plan->cwd, &plan->dirs);
+  plan->dirs.insert(plan->cwd);
+}
+
+/// Send errno and the failed sandbox setup step to the parent over \a fd
+/// and exit the child.  The parent formats the message: strerror() is not
+/// async-signal-safe.
+void SandboxFail(int fd, const char* what) {
+  int err = errno;
+  if (fd >= 0 && (write(fd, &err, sizeof(err)) < 0 ||
+                  write(fd, what, strlen(what)) < 0)) {
+    // Nothing more we can do.
+  }
+  _exit(127);
+}
+
+/// Read what SandboxFail() sent over \a fd, which closes on a successful
+/// exec.  Returns false if the child got that far.
+bool ReadSandboxFailure(int fd, string* message) {
+  string data;
+  char buf[512];
+  for (;;) {
+    ssize_t len = read(fd, buf, sizeof(buf));
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      break;
+    data.append(buf, len);
+  }
+  if (data.size() < sizeof(int))
+    return false;
+  int err;
+  memcpy(&err, data.data(), sizeof(err));
+  *message = "ninja: sandbox: " + data.substr(sizeof(err)) + ": " +
+             strerror(err) + "\n";
+  return true;
+}
+
+void WriteProcFile(int err_fd, const char* path, const char* contents) {
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd < 0 || write(fd, contents, strlen(contents)) < 0)
+    SandboxFail(err_fd, path);
+  close(fd);
+}
+
+/// In a freshly forked child: move to new user and mount namespaces with
+/// a tmpfs root that holds only the paths in \a plan.  Does not return on
+/// failure; errors go to SandboxFail(err_fd, \a err_fd).
+void EnterSandbox(const SandboxPlan& plan, int err_fd) {
+  if (unshare(CLONE_NEWUSER | CLONE_NEWNS) < 0)
+    SandboxFail(err_fd, "unshare");
+  WriteProcFile(err_fd, "/proc/self/setgroups", "deny");
+  WriteProcFile(err_fd, "/proc/self/uid_map", plan.uid_map.c_str());
+  WriteProcFile(err_fd, "/proc/self/gid_map", plan.gid_map.c_str());
+
+  if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) < 0)
+    SandboxFail(err_fd, "mount /");
+  if (mount("tmpfs", "/tmp", "tmpfs", MS_NOSUID | MS_NODEV, "mode=0755") < 0)
+    SandboxFail(err_fd, "mount tmpfs");
+  if (mkdir("/tmp/oldroot", 0755) < 0)
+    SandboxFail(err_fd, "mkdir oldroot");
+  if (syscall(SYS_pivot_root, "/tmp", "/tmp/oldroot") < 0)
+    SandboxFail(err_fd, "pivot_root");
+  if (chdir("/") < 0)
+    SandboxFail(err_fd, "chdir /");
+
+  // A private scratch /tmp; anything declared below it is mounted on top.
+  if (mkdir("/tmp", 01777) < 0 ||
+      mount("tmpfs", "/tmp", "tmpfs", MS_NOSUID | MS_NODEV, NULL) < 0)
+    SandboxFail(err_fd, "mount /tmp");
+
+  for (set<string>::const_iterator d = plan.dirs.begin();
+       d != plan.dirs.end(); ++d) {
+    if (mkdir(d->c_str(), 0755) < 0 && errno != EEXIST)
+      SandboxFail(err_fd, d->c_str());
+  }
+  for (vector<string>::const_iterator f = plan.files.begin();
+       f != plan.files.end(); ++f) {
+    int fd = open(f->c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+      SandboxFail(err_fd, f->c_str());
+    close(fd);
+  }
+  char source[4096];
+  for (vector<string>::const_iterator b = plan.binds.begin();
+       b != plan.binds.end(); ++b) {
+    if (b->size() + sizeof("/oldroot") > sizeof(source))
+      continue;
+    memcpy(source, "/oldroot", 8);
+    memcpy(source + 8, b->c_str(), b->size() + 1);
+    if (mount(source, b->c_str(), NULL, MS_BIND | MS_REC, NULL) < 0)
+      SandboxFail(err_fd, b->c_str());
+  }
+
+  if (umount2("/oldroot", MNT_DETACH) < 0)
+    SandboxFail(err_fd, "umount oldroot");
+  rmdir("/oldroot");
+  if (chdir(plan.cwd.c_str()) < 0)
+    SandboxFail(err_fd, plan.cwd.c_str());
+}
+
+}  // anonymous namespace
+
+bool Subprocess::SandboxAvailable() {
+  static int available = -1;
+  if (available < 0) {
+    SandboxPlan plan;
+    MakeSandboxPlan(SubprocessSandbox(), &plan);
+    pid_t pid = fork();
+    if (pid < 0)
+      Fatal("fork: %s", strerror(errno));
+    if (pid == 0) {
+      int devnull = open("/dev/null", O_WRONLY);
+      dup2(devnull, 2);
+      EnterSandbox(plan, -1);
+      _exit(0);
+    }
+    int status;
+    available = waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+                WEXITSTATUS(status) == 0;
+  }
+  return available != 0;
+}
+#else
+bool Subprocess::SandboxAvailable() {
+  return false;
+}
+#endif  // __linux__
+
+Subprocess::Subprocess(bool use_console) : peak_rss_(0), fd_(-1), pid_(-1),
                                            use_console_(use_console) {
 }
 
@@ -82,7 +307,8 @@ Subprocess::~Subprocess() {
     Finish();
 }
 
-bool Subprocess::Start(SubprocessSet* set, const string& command) {
+bool Subprocess::Start(SubprocessSet* set, const string& command,
+                       const SubprocessSandbox* sandbox) {
   int output_pipe[2];
   if (pipe(output_pipe) < 0)
     Fatal("pipe: %s", strerror(errno));
@@ -95,6 +321,55 @@ bool Subprocess::Start(SubprocessSet* set, const string& command) {
 #endif  // !USE_PPOLL
   SetCloseOnExec(fd_);
 
+#ifdef __linux__
+  if (sandbox) {
+    // posix_spawn() cannot enter namespaces, so fork and set up by hand,
+    // mirroring the file actions below.
+    SandboxPlan plan;
+    MakeSandboxPlan(*sandbox, &plan);
+#ifdef __COSMOCC__
+    argparse ap(command);
+    char* const * spawned_args = ap;
+#else
+    const char* spawned_args[] = { "/bin/sh", "-c", command.c_str(), NULL };
+#endif
+    // The child reports setup failures here; a successful exec closes it.
+    int err_pipe[2];
+    if (pipe2(err_pipe, O_CLOEXEC) < 0)
+      Fatal("pipe: %s", strerror(errno));
+
+    pid_ = fork();
+    if (pid_ < 0)
+      Fatal("fork: %s", strerror(errno));
+    if (pid_ == 0) {
+      close(output_pipe[0]);
+      close(err_pipe[0]);
+      if (!use_console_) {
+        setpgid(0, 0);
+        int devnull = open("/dev/null", O_RDONLY);
+        if (devnull < 0 || dup2(devnull, 0) < 0 ||
+            dup2(output_pipe[1], 1) < 0 || dup2(output_pipe[1], 2) < 0)
+          SandboxFail(err_pipe[1], "stdio");
+        close(devnull);
+        close(output_pipe[1]);
+      }
+      EnterSandbox(plan, err_pipe[1]);
+      sigprocmask(SIG_SETMASK, &set->old_mask_, 0);
+#ifdef __COSMOCC__
+      execvp(spawned_args[0], const_cast<char**>(spawned_args));
+#else
+      execve(spawned_args[0], const_cast<char**>(spawned_args), environ);
+#endif
+      SandboxFail(err_pipe[1], spawned_args[0]);
+    }
+    close(output_pipe[1]);
+    close(err_pipe[1]);
+    ReadSandboxFailure(err_pipe[0], &buf_);
+    close(err_pipe[0]);
+    return true;
+  }
+#endif  // __linux__
+
   posix_spawn_file_actions_t action;
   int err = posix_spawn_file_actions_init(&action);
   if (err != 0)
@@ -193,9 +468,15 @@ void Subprocess::OnPipeReady() {
 ExitStatus Subprocess::Finish() {
   assert(pid_ != -1);
   int status;
-  if (waitpid(pid_, &status, 0) < 0)
-    Fatal("waitpid(%d): %s", pid_, strerror(errno));
+  struct rusage usage;
+  if (wait4(pid_, &status, 0, &usage) < 0)
+    Fatal("wait4(%d): %s", pid_, strerror(errno));
   pid_ = -1;
+#ifdef __APPLE__
+  peak_rss_ = usage.ru_maxrss;
+#else
+  peak_rss_ = (int64_t)usage.ru_maxrss * 1024;  // Reported in kilobytes.
+#endif
 
 #ifdef _AIX
   if (WIFEXITED(status) && WEXITSTATUS(status) & 0x80) {
@@ -249,7 +530,7 @@ void SubprocessSet::HandlePendingInterruption() {
     interrupted_ = SIGHUP;
 }
 
-SubprocessSet::SubprocessSet() {
+SubprocessSet::SubprocessSet() : wake_fd_(-1) {
   sigset_t set;
   sigemptyset(&set);
   sigaddset(&set, SIGINT);
@@ -282,9 +563,10 @@ SubprocessSet::~SubprocessSet() {
     Fatal("sigprocmask: %s", strerror(errno));
 }
 
-Subprocess *SubprocessSet::Add(const string& command, bool use_console) {
+Subprocess *SubprocessSet::Add(const string& command, bool use_console,
+                               const SubprocessSandbox* sandbox) {
   Subprocess *subprocess = new Subprocess(use_console);
-  if (!subprocess->Start(this, command)) {
+  if (!subprocess->Start(this, command, sandbox)) {
     delete subprocess;
     return 0;
   }
@@ -292,6 +574,11 @@ Subprocess *SubprocessSet::Add(const string& command, bool use_console) {
   return subprocess;
 }
 
+void SubprocessSet::DrainWakeFd() {
+  char buf[64];
+  while (read(wake_fd_, buf, sizeof(buf)) == (ssize_t)sizeof(buf)) {}
+}
+
 #ifdef USE_PPOLL
 bool SubprocessSet::DoWork() {
   vector<pollfd> fds;
@@ -306,6 +593,11 @@ bool SubprocessSet::DoWork() {
     fds.push_back(pfd);
     ++nfds;
   }
+  if (wake_fd_ >= 0) {
+    pollfd pfd = { wake_fd_, (int16_t)POLLIN, 0 };
+    fds.push_back(pfd);
+    ++nfds;
+  }
 
   interrupted_ = 0;
 
@@ -347,6 +639,8 @@ __1:
     }
     ++i;
   }
+  if (wake_fd_ >= 0 && fds.back().revents)
+    DrainWakeFd();
 
   return IsInterrupted();
 }
@@ -366,6 +660,11 @@ bool SubprocessSet::DoWork() {
         nfds = fd+1;
     }
   }
+  if (wake_fd_ >= 0) {
+    FD_SET(wake_fd_, &set);
+    if (nfds < wake_fd_+1)
+      nfds = wake_fd_+1;
+  }
 
   interrupted_ = 0;
   int ret = pselect(nfds, &set, 0, 0, 0, &old_mask_);
@@ -394,6 +693,8 @@ bool SubprocessSet::DoWork() {
     }
     ++i;
   }
+  if (wake_fd_ >= 0 && FD_ISSET(wake_fd_, &set))
+    DrainWakeFd();
 
   return IsInterrupted();
 }
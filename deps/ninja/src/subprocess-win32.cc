@@ -16,6 +16,7 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <psapi.h>
 
 #include <algorithm>
 
@@ -23,7 +24,8 @@
 
 using namespace std;
 
-Subprocess::Subprocess(bool use_console) : child_(NULL) , overlapped_(),
+Subprocess::Subprocess(bool use_console) : peak_rss_(0), child_(NULL),
+                                           overlapped_(),
                                            is_reading_(false),
                                            use_console_(use_console) {
 }
@@ -74,7 +76,12 @@ HANDLE Subprocess::SetupPipe(HANDLE ioport) {
   return output_write_child;
 }
 
-bool Subprocess::Start(SubprocessSet* set, const string& command) {
+bool Subprocess::SandboxAvailable() {
+  return false;
+}
+
+bool Subprocess::Start(SubprocessSet* set, const string& command,
+                       const SubprocessSandbox* sandbox) {
   HANDLE child_pipe = SetupPipe(set->ioport_);
 
   SECURITY_ATTRIBUTES security_attributes;
@@ -195,6 +202,10 @@ ExitStatus Subprocess::Finish() {
   DWORD exit_code = 0;
   GetExitCodeProcess(child_, &exit_code);
 
+  PROCESS_MEMORY_COUNTERS counters;
+  if (K32GetProcessMemoryInfo(child_, &counters, sizeof(counters)))
+    peak_rss_ = counters.PeakWorkingSetSize;
+
   CloseHandle(child_);
   child_ = NULL;
 
@@ -238,9 +249,10 @@ BOOL WINAPI SubprocessSet::NotifyInterrupted(DWORD dwCtrlType) {
   return FALSE;
 }
 
-Subprocess *SubprocessSet::Add(const string& command, bool use_console) {
+Subprocess *SubprocessSet::Add(const string& command, bool use_console,
+                               const SubprocessSandbox* sandbox) {
   Subprocess *subprocess = new Subprocess(use_console);
-  if (!subprocess->Start(this, command)) {
+  if (!subprocess->Start(this, command, sandbox)) {
     delete subprocess;
     return 0;
   }
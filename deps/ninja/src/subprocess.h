@@ -19,6 +19,8 @@
 #include <vector>
 #include <queue>
 
+#include <stdint.h>
+
 #ifdef _WIN32
 #include <windows.h>
 #else
@@ -35,6 +37,17 @@
 
 #include "exit_status.h"
 
+/// Limits the file system a command sees to the paths it declares.  On
+/// Linux the command runs in its own user and mount namespace whose root
+/// holds only these paths and the system toolchain directories, so
+/// reading an undeclared file fails with ENOENT.
+struct SubprocessSandbox {
+  /// Files or directories the command may read.
+  std::vector<std::string> inputs;
+  /// Files the command writes; their directories are made writable.
+  std::vector<std::string> outputs;
+};
+
 /// Subprocess wraps a single async subprocess.  It is entirely
 /// passive: it expects the caller to notify it when its fds are ready
 /// for reading, as well as call Finish() to reap the child once done()
@@ -50,12 +63,20 @@ struct Subprocess {
 
   const std::string& GetOutput() const;
 
+  /// Peak resident set size of the finished process in bytes, 0 if unknown.
+  int64_t GetPeakRss() const { return peak_rss_; }
+
+  /// Whether commands can be run in a SubprocessSandbox on this system.
+  static bool SandboxAvailable();
+
  private:
   Subprocess(bool use_console);
-  bool Start(struct SubprocessSet* set, const std::string& command);
+  bool Start(struct SubprocessSet* set, const std::string& command,
+             const SubprocessSandbox* sandbox);
   void OnPipeReady();
 
   std::string buf_;
+  int64_t peak_rss_;
 
 #ifdef _WIN32
   /// Set up pipe_ as the parent-side pipe of the subprocess; return the
@@ -83,7 +104,9 @@ struct SubprocessSet {
   SubprocessSet();
   ~SubprocessSet();
 
-  Subprocess* Add(const std::string& command, bool use_console = false);
+  /// Start \a command, confined to \a sandbox if not NULL.
+  Subprocess* Add(const std::string& command, bool use_console = false,
+                  const SubprocessSandbox* sandbox = NULL);
   bool DoWork();
   Subprocess* NextFinished();
   void Clear();
@@ -102,6 +125,12 @@ struct SubprocessSet {
   static int interrupted_;
 
   static bool IsInterrupted() { return interrupted_ != 0; }
+  void DrainWakeFd();
+
+  /// Also return from DoWork() when this descriptor becomes readable,
+  /// e.g. the read end of a pipe other threads signal finished work on.
+  /// Its contents are drained.  -1 if unused.
+  int wake_fd_;
 
   struct sigaction old_int_act_;
   struct sigaction old_term_act_;
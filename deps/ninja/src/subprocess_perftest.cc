@@ -0,0 +1,49 @@
+// Measures the cost of starting a command, with and without a sandbox.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "metrics.h"
+#include "subprocess.h"
+#include "util.h"
+
+using namespace std;
+
+const int kNumCommands = 200;
+
+/// Run kNumCommands "true" commands one after the other and return the
+/// average time per command in milliseconds.
+double TimeCommands(const SubprocessSandbox* sandbox) {
+  SubprocessSet subprocs;
+  int64_t start = GetTimeMillis();
+  for (int i = 0; i < kNumCommands; ++i) {
+    Subprocess* subproc = subprocs.Add("true", false, sandbox);
+    if (!subproc)
+      Fatal("failed to start command");
+    while (!subproc->Done())
+      subprocs.DoWork();
+    if (subproc->Finish() != ExitSuccess)
+      Fatal("command failed: %s", subproc->GetOutput().c_str());
+    delete subprocs.NextFinished();
+  }
+  return (GetTimeMillis() - start) / (double)kNumCommands;
+}
+
+int main(int argc, char** argv) {
+  printf("plain:   %.2fms per command\n", TimeCommands(NULL));
+
+  if (!Subprocess::SandboxAvailable()) {
+    printf("sandbox: not available\n");
+    return 0;
+  }
+
+  // Declare the files given on the command line, e.g. the headers of a
+  // typical compile.
+  SubprocessSandbox sandbox;
+  for (int i = 1; i < argc; ++i)
+    sandbox.inputs.push_back(argv[i]);
+  sandbox.outputs.push_back("subprocess_perftest.out");
+  printf("sandbox: %.2fms per command (%d declared inputs)\n",
+         TimeCommands(&sandbox), argc - 1);
+  return 0;
+}
@@ -19,6 +19,7 @@
 #ifndef _WIN32
 // SetWithLots need setrlimit.
 #include <stdio.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <unistd.h>
@@ -261,3 +262,47 @@ TEST_F(SubprocessTest, ReadStdin) {
   ASSERT_EQ(1u, subprocs_.finished_.size());
 }
 #endif  // _WIN32
+
+#ifdef __linux__
+TEST_F(SubprocessTest, Sandbox) {
+  if (!Subprocess::SandboxAvailable()) {
+    printf("Sandboxing is not available here, skipping test\n");
+    return;
+  }
+
+  ScopedTempDir temp_dir;
+  temp_dir.CreateAndEnter("NinjaSubprocessTest");
+  ASSERT_EQ(0, mkdir("out", 0755));
+  FILE* f = fopen("declared", "w");
+  fputs("declared\n", f);
+  fclose(f);
+  f = fopen("undeclared", "w");
+  fclose(f);
+
+  SubprocessSandbox sandbox;
+  sandbox.inputs.push_back("declared");
+  sandbox.outputs.push_back("out/copy");
+
+  Subprocess* declared =
+      subprocs_.Add("cat declared > out/copy", false, &sandbox);
+  ASSERT_NE((Subprocess *) 0, declared);
+  Subprocess* undeclared = subprocs_.Add("cat undeclared", false, &sandbox);
+  ASSERT_NE((Subprocess *) 0, undeclared);
+
+  while (!subprocs_.running_.empty())
+    subprocs_.DoWork();
+
+  EXPECT_EQ(ExitSuccess, declared->Finish());
+  EXPECT_EQ(ExitFailure, undeclared->Finish());
+  EXPECT_NE(string::npos, undeclared->GetOutput().find("undeclared"));
+
+  char buf[32] = {};
+  f = fopen("out/copy", "r");
+  ASSERT_TRUE(f != NULL);
+  EXPECT_TRUE(fgets(buf, sizeof(buf), f) != NULL);
+  fclose(f);
+  EXPECT_STREQ("declared\n", buf);
+
+  temp_dir.Cleanup();
+}
+#endif  // __linux__
@@ -854,6 +854,31 @@ string ElideMiddle(const string& str, size_t width) {
   return result;
 }
 
+bool ParseMemorySize(const string& str, int64_t* bytes) {
+  const char* start = str.c_str();
+  char* end;
+  double value = strtod(start, &end);
+  if (end == start || value < 0)
+    return false;
+  while (*end == ' ')
+    ++end;
+  double scale = 1;
+  switch (*end) {
+    case 'k': case 'K': scale = 1 << 10; ++end; break;
+    case 'm': case 'M': scale = 1 << 20; ++end; break;
+    case 'g': case 'G': scale = double(1 << 30); ++end; break;
+    case 't': case 'T': scale = double(1 << 30) * (1 << 10); ++end; break;
+  }
+  if (scale != 1 && *end == 'i')
+    ++end;
+  if (*end == 'b' || *end == 'B')
+    ++end;
+  if (*end != '\0')
+    return false;
+  *bytes = (int64_t)(value * scale);
+  return true;
+}
+
 bool Truncate(const string& path, size_t size, string* err) {
 #ifdef _WIN32
   int fh = _sopen(path.c_str(), _O_RDWR | _O_CREAT, _SH_DENYNO,
@@ -107,6 +107,10 @@ double GetLoadAverage();
 /// exceeds @a width.
 std::string ElideMiddle(const std::string& str, size_t width);
 
+/// Parse a memory size such as "4096", "512K", "1.5G" or "8GB" (binary
+/// units) into a byte count.  @return false if @a str is malformed.
+bool ParseMemorySize(const std::string& str, int64_t* bytes);
+
 /// Truncates a file to the given size.
 bool Truncate(const std::string& path, size_t size, std::string* err);
 
@@ -424,3 +424,24 @@ TEST(ElideMiddle, ElideInTheMiddle) {
   EXPECT_EQ("012...789", elided);
   EXPECT_EQ("01234567...23456789", ElideMiddle(input, 19));
 }
+
+TEST(ParseMemorySize, Units) {
+  int64_t bytes = -1;
+  EXPECT_TRUE(ParseMemorySize("4096", &bytes));
+  EXPECT_EQ(4096, bytes);
+  EXPECT_TRUE(ParseMemorySize("512K", &bytes));
+  EXPECT_EQ(512 << 10, bytes);
+  EXPECT_TRUE(ParseMemorySize("1.5M", &bytes));
+  EXPECT_EQ(3 << 19, bytes);
+  EXPECT_TRUE(ParseMemorySize("8G", &bytes));
+  EXPECT_EQ(int64_t(8) << 30, bytes);
+  EXPECT_TRUE(ParseMemorySize("2 GiB", &bytes));
+  EXPECT_EQ(int64_t(2) << 30, bytes);
+  EXPECT_TRUE(ParseMemorySize("1TB", &bytes));
+  EXPECT_EQ(int64_t(1) << 40, bytes);
+
+  EXPECT_FALSE(ParseMemorySize("", &bytes));
+  EXPECT_FALSE(ParseMemorySize("G", &bytes));
+  EXPECT_FALSE(ParseMemorySize("8X", &bytes));
+  EXPECT_FALSE(ParseMemorySize("-1M", &bytes));
+}
@@ -3,7 +3,7 @@
 #include <stdint.h>
 #include <time.h>
 
-#include <map>
+#include <algorithm>
 #include <memory>
 #include <vector>
 #include <chrono>
@@ -114,57 +114,141 @@ struct dget {
 template<typename T, typename F>
 dget(dtag<T>, F &&) -> dget<T, F>;
 
+// timers on a hierarchical timing wheel: 4 levels of 64 slots, of 1, 64,
+// 4096 and 262144 ms, so adding and removing a timer are O(1) list
+// operations, and a timer moves down a level at most 3 times before it
+// fires. timers live in a table indexed by their id and are linked through
+// it, so neither adding nor firing allocates once the table has grown. an id
+// released is only reused from the next update on: by then the caller has
+// delivered the batch that may still name it.
 struct dtimer {
-    struct timer_data {
-        bool repeat; int id; int t; intptr_t value;
+    static constexpr int bits = 6, nslots = 1 << bits, nlevels = 4;
 
-        timer_data(bool repeat, int id, int t, intptr_t value) : repeat(repeat), id(id), t(t), value(value) {}
+    struct timer_data {
+        uint64_t due; int t; int prev, next, slot; bool repeat, active;
     };
 
-    typedef auto_ptr<timer_data> timer_data_ptr;
+    std::vector<timer_data> timers; int flist {-1}; std::vector<int> released;
+
+    // heads of the lists of timers, slot s of level l at l * nslots + s.
+    int slots[nlevels * nslots]; uint64_t current {0}; size_t count {0};
+
+    std::vector<int> fired;
+
+    dtimer() { for(auto & x : slots) x = -1; }
+
+    // a coarse clock, read once per add or update: a few ns instead of a syscall.
+    static uint64_t clock() {
+#ifdef CLOCK_MONOTONIC_COARSE
+        // where the kernel lacks it, the precise one.
+        timespec ts; if(clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) != 0) return now();
+
+        return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+        return now();
+#endif
+    }
+
+    int slot_of(uint64_t due) {
+        uint64_t delta = due - current; int level = 0; while(level < nlevels - 1 && delta >= ((uint64_t)1 << (bits * (level + 1)))) {
+            level++;
+        }
+
+        // beyond the top level: park in its furthest slot, and come down from there.
+        if(delta >= ((uint64_t)1 << (bits * nlevels))) due = current + ((uint64_t)1 << (bits * nlevels)) - 1;
 
-    typedef std::multimap<uint64_t, timer_data_ptr> timers_type;
+        return level * nslots + ((due >> (bits * level)) & (nslots - 1));
+    }
 
-    timers_type timers;
-    std::vector<timer_data_ptr> tdtable;
-    basic_reftable<timers_type::iterator> idtable;
+    void link(int id) {
+        auto & x = timers[id]; x.slot = slot_of(x.due); int & head = slots[x.slot];
 
-    int add(int t, intptr_t v, bool r) {
-        auto it = timers.emplace(t + now(), timer_data_ptr::make(r, 0, t, v));
+        x.prev = -1; x.next = head; if(head >= 0) timers[head].prev = id; head = id;
+    }
 
-        int id = idtable.ref(it); it->second->id = id;
+    void unlink(int id) {
+        auto & x = timers[id];
 
-        return id;
+        if(x.prev >= 0) timers[x.prev].next = x.next; else slots[x.slot] = x.next;
+
+        if(x.next >= 0) timers[x.next].prev = x.prev;
+    }
+
+    int add(int t, bool r) {
+        uint64_t t_now = clock(); if(count == 0) current = t_now;
+
+        int id; if(flist < 0) {
+            id = (int)timers.size(); timers.emplace_back();
+        }
+        else {
+            id = flist; flist = timers[id].next;
+        }
+
+        // due after the tick being processed, so a 0 ms timer fires on the next update.
+        auto & x = timers[id]; x = { std::max(t_now + t, current + 1), t, -1, -1, -1, r, true };
+
+        link(id); count++; return id;
+    }
+
+    void release(int id) {
+        timers[id].active = false; released.push_back(id); count--;
     }
 
     void remove(int id) {
-        auto const & it = idtable[id]; timers.erase(it); idtable.unref(id);
+        if(id < 0 || id >= (int)timers.size() || !timers[id].active) return;
+
+        unlink(id); release(id);
     }
 
+    // move the timers of a slot of a higher level down to where they now belong.
+    void cascade(int level) {
+        int & head = slots[level * nslots + ((current >> (bits * level)) & (nslots - 1))]; int id = head; head = -1;
+
+        while(id >= 0) {
+            int next = timers[id].next; link(id); id = next;
+        }
+    }
+
+    // advance the wheel to the clock and call f(ids, n) with the ids of the
+    // timers that fired, in order of their due time.
     template<typename F>
     void update(F && f) {
-        auto t_now = now();
+        for(int id : released) { timers[id].next = flist; flist = id; }
+        released.clear();
 
-        auto it_begin = timers.begin(), it_end = timers.upper_bound(t_now); if(it_begin != it_end) {
-            f(it_begin, it_end);
+        uint64_t t_now = clock(); if(count == 0) { current = t_now; return; }
 
-            for(auto it = it_begin; it != it_end; ++it) {
-                auto & data = it->second; if(data->repeat) {
-                    tdtable.push_back(std::move(data));
-                }
-                else {
-                    idtable.unref(data->id);
-                }
+        fired.clear(); while(current < t_now) {
+            current++; for(int level = 1; level < nlevels; level++) {
+                if((current & (((uint64_t)1 << (bits * level)) - 1)) != 0) break;
+
+                cascade(level);
             }
 
-            timers.erase(it_begin, it_end); if(!tdtable.empty()) {
-                for(auto & td : tdtable) {
-                    auto id = td->id; idtable[id] = timers.emplace(td->t + t_now, std::move(td));
+            int & head = slots[current & (nslots - 1)]; int id = head; head = -1;
+
+            while(id >= 0) {
+                auto & x = timers[id]; int next = x.next;
+
+                if(x.due > current) {
+                    link(id);
+                }
+                else {
+                    fired.push_back(id); if(x.repeat) {
+                        x.due = current + std::max(x.t, 1); link(id);
+                    }
+                    else {
+                        release(id);
+                    }
                 }
 
-                tdtable.clear();
+                id = next;
             }
+
+            if(count == 0) { current = t_now; break; }
         }
+
+        if(!fired.empty()) f(fired.data(), fired.size());
     }
 };
 
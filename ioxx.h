@@ -1,12 +1,22 @@
 #pragma once
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 
+#include <atomic>
+#include <filesystem>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "ljx.h"
 
@@ -126,4 +136,209 @@ struct afile {
 
         return s;
     }
-};
\ No newline at end of file
+};
+
+// fnv-1a 64 of a file's contents.
+static inline bool file_hash(const char * fname, uint64_t & h) {
+    autofd fd(open(fname, O_RDONLY)); if(!fd) return false;
+
+    h = 14695981039346656037ull; char buf[64 * 1024]; ssize_t n;
+
+    while((n = ::read(fd, buf, sizeof(buf))) > 0) {
+        for(ssize_t i = 0; i < n; i++) { h ^= (uint8_t)buf[i]; h *= 1099511628211ull; }
+    }
+
+    return n == 0;
+}
+
+#ifndef FICLONE
+#define FICLONE 0x40049409 // _IOW(0x94, 9, int)
+#endif
+
+// file copies the cheapest way the system has: a reflink (FICLONE) where
+// the filesystem shares extents, else copy_file_range() in the kernel, else
+// sendfile(), and read()/write() as the last resort.
+enum class copy_mode {
+    fail_existing,  // an existing destination is an error
+    overwrite,      // always copy
+    update_newer,   // copy if the source is newer
+    skip_unchanged, // copy if size or mtime differ (or contents, by hash), and keep the mtime
+};
+
+struct copy_stats {
+    std::atomic<uint64_t> total {0}, files {0}, copied {0}, skipped {0}, bytes {0};
+};
+
+static inline bool copy_fd(int in, int out, uint64_t size, std::string & err) {
+    if(ioctl(out, FICLONE, in) == 0) return true;
+
+    uint64_t done = 0; bool range = true, send = true; while(done < size) {
+        ssize_t n = -1;
+
+        if(range) {
+            n = copy_file_range(in, nullptr, out, nullptr, size - done, 0); if(n < 0 && done == 0) { range = false; continue; }
+        }
+        else if(send) {
+            n = sendfile(out, in, nullptr, size - done); if(n < 0 && done == 0) { send = false; continue; }
+        }
+        else {
+            char buf[256 * 1024]; n = ::read(in, buf, sizeof(buf)); if(n > 0) {
+                for(ssize_t w = 0, k; w < n; w += k) {
+                    if((k = ::write(out, buf + w, n - w)) < 0) { n = -1; break; }
+                }
+            }
+        }
+
+        if(n < 0) { err = strerror(errno); return false; }
+
+        if(n == 0) break;
+
+        done += n;
+    }
+
+    return true;
+}
+
+static inline bool copy_file_fast(const char * src, const char * dst, copy_mode mode, bool by_hash, copy_stats & stats, std::string & err) {
+    struct stat ss, ds; if(stat(src, &ss) != 0) {
+        err = std::string("failed to copy '") + src + "' to '" + dst + "': " + strerror(errno); return false;
+    }
+
+    // open() would block on a fifo, and a device has no end.
+    if(!S_ISREG(ss.st_mode)) {
+        err = std::string("failed to copy '") + src + "' to '" + dst + "': not a regular file"; return false;
+    }
+
+    stats.files++; if(stat(dst, &ds) == 0) {
+        bool skip = false; switch(mode) {
+            case copy_mode::fail_existing:
+                err = std::string("failed to copy '") + src + "' to '" + dst + "': File exists"; return false;
+            case copy_mode::overwrite:
+                // dst is src itself, a hard link or a symlink to it: O_TRUNC would empty the source.
+                // the other modes skip it, its size and mtime being the same.
+                if(ds.st_dev == ss.st_dev && ds.st_ino == ss.st_ino) {
+                    err = std::string("failed to copy '") + src + "' to '" + dst + "': same file"; return false;
+                }
+                break;
+            case copy_mode::update_newer:
+                skip = (ds.st_mtim.tv_sec > ss.st_mtim.tv_sec) ||
+                       (ds.st_mtim.tv_sec == ss.st_mtim.tv_sec && ds.st_mtim.tv_nsec >= ss.st_mtim.tv_nsec);
+                break;
+            case copy_mode::skip_unchanged:
+                if(ds.st_size == ss.st_size) {
+                    uint64_t a, b; skip = by_hash ? (file_hash(src, a) && file_hash(dst, b) && a == b)
+                                                  : (ds.st_mtim.tv_sec == ss.st_mtim.tv_sec && ds.st_mtim.tv_nsec == ss.st_mtim.tv_nsec);
+                }
+                break;
+        }
+
+        if(skip) { stats.skipped++; return true; }
+    }
+
+    autofd in(open(src, O_RDONLY)), out(open(dst, O_WRONLY | O_CREAT | O_TRUNC, ss.st_mode & 0777)); if(!in || !out) {
+        err = std::string("failed to copy '") + src + "' to '" + dst + "': " + strerror(errno); return false;
+    }
+
+    if(!copy_fd(in, out, ss.st_size, err)) {
+        err = std::string("failed to copy '") + src + "' to '" + dst + "': " + err; return false;
+    }
+
+    if(mode == copy_mode::skip_unchanged) {
+        timespec ts[2] = { ss.st_atim, ss.st_mtim }; futimens(out, ts);
+    }
+
+    stats.copied++; stats.bytes += ss.st_size; return true;
+}
+
+// copy the symlink src as a symlink to the same target.
+static inline bool copy_symlink_fast(std::filesystem::path const & src, std::filesystem::path const & dst, copy_mode mode,
+                                     copy_stats & stats, std::string & err) {
+    namespace fs = std::filesystem;
+
+    std::error_code ec; auto fail = [&](fs::path const & p) {
+        err = "failed to copy '" + src.string() + "' to '" + p.string() + "': " + ec.message(); return false;
+    };
+
+    auto target = fs::read_symlink(src, ec); if(ec) return fail(dst);
+
+    stats.files++; if(fs::symlink_status(dst, ec).type() != fs::file_type::not_found) {
+        if(mode == copy_mode::fail_existing) { ec = std::make_error_code(std::errc::file_exists); return fail(dst); }
+
+        auto current = fs::read_symlink(dst, ec); if(!ec && current == target) { stats.skipped++; return true; }
+
+        fs::remove(dst, ec); if(ec) return fail(dst);
+    }
+
+    fs::create_symlink(target, dst, ec); if(ec) return fail(dst);
+
+    stats.copied++; return true;
+}
+
+// copy the files of the directory src, and of its subdirectories if
+// recursive, to dst: the directories first, on this thread, then the files
+// on up to `threads` threads. symlinks are copied as symlinks, and fifos,
+// sockets and devices are left out.
+static inline bool copy_tree(std::filesystem::path const & src, std::filesystem::path const & dst, bool recursive, copy_mode mode,
+                             bool by_hash, unsigned threads, copy_stats & stats, std::string & err) {
+    namespace fs = std::filesystem;
+
+    std::error_code ec; std::vector<std::pair<std::string, std::string>> files;
+
+    auto fail = [&](const char * what, fs::path const & p) {
+        err = std::string("failed to ") + what + " '" + p.string() + "': " + ec.message(); return false;
+    };
+
+    if(!fs::is_directory(src, ec)) {
+        auto to = fs::is_directory(dst, ec) ? dst / src.filename() : dst; stats.total++;
+
+        return copy_file_fast(src.c_str(), to.c_str(), mode, by_hash, stats, err);
+    }
+
+    fs::create_directories(dst, ec); if(ec) return fail("create directory", dst);
+
+    auto visit = [&](fs::directory_entry const & e) {
+        auto to = dst / e.path().lexically_relative(src); auto type = e.symlink_status(ec).type(); if(ec) return fail("read", e.path());
+
+        if(type == fs::file_type::symlink) {
+            stats.total++; return copy_symlink_fast(e.path(), to, mode, stats, err);
+        }
+        else if(type == fs::file_type::directory) {
+            if(recursive) { fs::create_directories(to, ec); if(ec) return fail("create directory", to); }
+        }
+        else if(type == fs::file_type::regular) {
+            files.emplace_back(e.path().string(), to.string());
+        }
+
+        return true;
+    };
+
+    if(recursive) {
+        for(fs::recursive_directory_iterator it(src, ec), end; !ec && it != end; it.increment(ec)) if(!visit(*it)) return false;
+    }
+    else {
+        for(fs::directory_iterator it(src, ec), end; !ec && it != end; it.increment(ec)) if(!visit(*it)) return false;
+    }
+
+    if(ec) return fail("read directory", src);
+
+    stats.total += files.size();
+
+    std::atomic<size_t> next {0}; std::atomic<bool> failed {false}; std::mutex mutex;
+
+    auto work = [&] {
+        std::string e; for(size_t i; !failed && (i = next++) < files.size();) {
+            if(!copy_file_fast(files[i].first.c_str(), files[i].second.c_str(), mode, by_hash, stats, e)) {
+                std::lock_guard<std::mutex> lock(mutex); if(!failed.exchange(true)) err = e;
+            }
+        }
+    };
+
+    // a thread per 64 files at most: small trees are not worth the threads.
+    size_t n = std::min<size_t>(std::max(threads, 1u), files.size() / 64 + 1);
+
+    std::vector<std::thread> pool; for(size_t i = 1; i < n; i++) pool.emplace_back(work);
+
+    work(); for(auto & t : pool) t.join();
+
+    return !failed;
+}
@@ -5,8 +5,15 @@
 #include "spawn.h"
 #include "fnmatch.h"
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 namespace fs = std::filesystem;
 
@@ -25,15 +32,201 @@ struct ninja_initializer {
 
 extern fs::path $build_script;
 extern bool $reload_build_script;
+extern bool $daemon;
+
+bool daemon_client(int argc, char ** argv, int * rc);
+
+int remote_worker_main(int argc, char ** argv);
+int modules_collate_main(int argc, char ** argv);
+int thin_archive_main(int argc, char ** argv);
 
 extern "C" char * GetProgramExecutableName(void);
 
+static std::string errorf(const char * fmt, ...) {
+    char buf[1024]; va_list args; va_start(args, fmt); vsnprintf(buf, sizeof(buf), fmt, args); va_end(args); return buf;
+}
+
+// spawn argv[0] with our environment and wait for it, with stdout and stderr
+// sent to /dev/null if quiet. the wait status, or -1 with `err` set.
+static int spawn_wait(const char * const * argv, bool quiet, std::string & err) {
+    pid_t pid {-1};
+
+    posix_spawn_file_actions_t actions; {
+        ok = posix_spawn_file_actions_init(&actions); if(quiet) {
+            ok = posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+            ok = posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+        }
+    }
+
+    posix_spawnattr_t attrs; {
+        ok = posix_spawnattr_init(&attrs);
+    }
+
+    int r = posix_spawnp(&pid, argv[0], &actions, &attrs, (char * const *)argv, environ);
+
+    posix_spawn_file_actions_destroy(&actions); posix_spawnattr_destroy(&attrs);
+
+    if(r != 0) {
+        err = errorf("failed to spawn '%s': %s", argv[0], strerror(r)); return -1;
+    }
+
+    int status; while(waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+
+    return status;
+}
+
+// blocking work (processes, copies, hashing, globbing) for the `async` table:
+// a call queues a job on a pool of threads and returns its id, and the thread,
+// so the lua_State, that queued it collects the result with async.complete().
+// see async.spawn and async.await in ljx.lua.
+struct async_job;
+
+struct async_completions {
+    std::mutex mutex; std::condition_variable ready; std::vector<async_job *> done;
+
+    // touched by the owning thread only.
+    uint64_t next_id {1}; int pending {0}; std::unordered_map<uint64_t, async_job *> running;
+};
+
+inline async_completions * $async_completions {nullptr};
+
+struct async_job {
+    // what async.complete() hands back: true, the exit status, a string, a list or copy counts.
+    enum kind_t { none, status, text, list, counts } kind {none};
+
+    uint64_t id; async_completions * owner; std::function<void(async_job &)> run;
+
+    bool ok {true}; int code {0}; std::string value; std::vector<std::string> values;
+
+    // updated as a copy goes, see async.progress().
+    copy_stats stats;
+
+    void fail(std::string err) { ok = false; value = std::move(err); }
+};
+
+// most jobs wait on a process or the disk, hence twice as many threads as cores.
+struct async_pool {
+    std::mutex mutex; std::condition_variable ready; std::deque<async_job *> jobs;
+
+    async_pool() {
+        unsigned n = std::max(4u, 2 * std::thread::hardware_concurrency()); for(unsigned i = 0; i < n; i++) {
+            std::thread([this] { work(); }).detach();
+        }
+    }
+
+    void work() {
+        for(;;) {
+            async_job * job; {
+                std::unique_lock<std::mutex> lock(mutex); ready.wait(lock, [&] { return !jobs.empty(); });
+
+                job = jobs.front(); jobs.pop_front();
+            }
+
+            job->run(*job);
+
+            auto q = job->owner; {
+                std::lock_guard<std::mutex> lock(q->mutex); q->done.push_back(job);
+            }
+
+            q->ready.notify_one();
+        }
+    }
+
+    // started on first use and never destroyed: the threads outlive static destruction.
+    static async_pool & get() { static auto pool = new async_pool(); return *pool; }
+};
+
+static int async_submit(lua_State * L, async_job::kind_t kind, std::function<void(async_job &)> && run) {
+    if(!$async_completions) $async_completions = new async_completions();
+
+    auto q = $async_completions; auto job = new async_job { kind, q->next_id++, q, std::move(run) };
+
+    q->pending++; q->running[job->id] = job; auto & pool = async_pool::get(); {
+        std::lock_guard<std::mutex> lock(pool.mutex); pool.jobs.push_back(job);
+    }
+
+    pool.ready.notify_one();
+
+    lua_pushnumber(L, (lua_Number)job->id); return 1;
+}
+
+// a job copying argument 2 to argument 1 with copy_tree(), whose counts it
+// returns. argument 3 "h" compares files by contents rather than mtime.
+static int async_copy(lua_State * L, copy_mode mode, bool recursive) {
+    std::string dst = luaL_checkstring(L, 1), src = luaL_checkstring(L, 2); const char * opts = luaL_optstring(L, 3, "");
+
+    bool by_hash = strchr(opts, 'h') != nullptr;
+
+    return async_submit(L, async_job::counts, [=](async_job & job) {
+        std::string err; unsigned threads = std::max(4u, 2 * std::thread::hardware_concurrency());
+
+        if(!copy_tree(src, dst, recursive, mode, by_hash, threads, job.stats, err)) job.fail(err);
+    });
+}
+
+// the flags of fs.copy, e.g. "fr" for overwrite_existing | recursive.
+static bool copy_options_parse(const char * opts, fs::copy_options & flags, std::string & err) {
+    for(const char * p = opts ? opts : ""; *p; p++) {
+        switch(*p) {
+            case 'f': flags |= fs::copy_options::overwrite_existing; break;
+            case 'd': flags |= fs::copy_options::directories_only; break;
+            case 'i': flags |= fs::copy_options::skip_symlinks; break;
+            case 'l': flags |= fs::copy_options::create_symlinks; break;
+            case 'k': flags |= fs::copy_options::copy_symlinks; break;
+            case 'u': flags |= fs::copy_options::update_existing; break;
+            case 'r': flags |= fs::copy_options::recursive; break;
+            case 'h': break;
+            default: err = errorf("invalid option '%c'", *p); return false;
+        }
+    }
+
+    return true;
+}
+
 int main(int argc, char ** argv) {
     ShowCrashReports();
+
+    // njx worker ...: run jobs for other machines' builds, no build script.
+    if(argc > 1 && strcmp(argv[1], "worker") == 0) return remote_worker_main(argc - 1, argv + 1);
+
+    // njx collate ...: the C++ modules collator of build edges.
+    if(argc > 1 && strcmp(argv[1], "collate") == 0) return modules_collate_main(argc - 1, argv + 1);
+
+    // njx ar ...: the thin archive writer of static library edges.
+    if(argc > 1 && strcmp(argv[1], "ar") == 0) return thin_archive_main(argc - 1, argv + 1);
+
+    int dargc = 0; char ** dargv = (char **)alloca(argc * sizeof(char *)); bool no_daemon = false;
+
+    for(int i = 1; i < argc; ++i) {
+        const char * x = argv[i]; if(*x == '-') {
+            if(strcmp(x, "--daemon") == 0) $daemon = true;
+            else if(strcmp(x, "--no-daemon") == 0) no_daemon = true;
+            continue;
+        }
+
+        if($build_script.empty()) $build_script = x; else dargv[dargc++] = argv[i];
+    }
     
+    if($build_script.empty()) $build_script = "build.lua";
+
+    if(!$build_script.is_absolute()) {
+        $build_script = fs::current_path() / $build_script;
+    }
+
+    // $build_script = (argc > 1) ? argv[1] : "build.lua"; if(!$build_script.is_absolute()) {
+    //     $build_script = fs::current_path() / $build_script;
+    // }
+
+    $build_script = $build_script.lexically_normal();
+
+    // hand the request to a resident daemon before paying for lua startup.
+    if(!$daemon && !no_daemon) {
+        int rc; if(daemon_client(dargc, dargv, &rc)) return (rc < 0) ? 0 : rc;
+    }
+
     { static ninja_initializer _; }
 
-    $L([&]() {
+    $lua_initialize([=]() {
         lua_table package = $L["package"]; {
             package.def("path", "./?.lua;/zip/?.lua");
         }
@@ -53,7 +246,8 @@ int main(int argc, char ** argv) {
                     lua_pushinteger(L, std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()); return 1;
                 })
             .def(
-                "exec", (lua_CFunction)[](lua_State * L)->int {
+                "cexec", (lua_CFunction)[](lua_State * L)->int {
+                    // exec, see ljx.lua, runs on the async pool; this one blocks and keeps the output.
                     int argc = lua_gettop(L); {
                         if(argc < 1) {
                             fatal("exec: expected at least 1 argument, got %d", argc); return 0;
@@ -68,99 +262,242 @@ int main(int argc, char ** argv) {
                         argv[argc] = nullptr;
                     }
 
-                    pid_t pid {-1};
+                    std::string err; int status = spawn_wait(argv, false, err); if(status < 0) {
+                        fatal("%s", err.c_str()); return 0;
+                    }
+
+                    lua_pushinteger(L, status);
 
-                    posix_spawn_file_actions_t actions; {
-                        ok = posix_spawn_file_actions_init(&actions);
-                        ok = posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
-                        ok = posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+                    return 1;
+                });
+
+        _G.def("gc", lua_table::make(0, 3)
+            .def(
+                "stats", (lua_CFunction)[](lua_State * L) {
+                    GCStats s = {}; if(auto p = lj_gc_stats(G(L))) s = *p;
+
+                    auto ms = [](uint64_t ns) { return (double)ns / 1e6; };
+
+                    lua_table t = lua_table::make(0, 4); {
+                        t.def("cycles", s.cycles).def("total_ms", ms(s.total_ns)).def("worst_ms", ms(s.worst_ns));
+                        t.def("last", lua_table::make(0, 2).def("steps", s.last_steps).def("ms", ms(s.last_ns)).def("max_ms", ms(s.last_maxns)));
+                        t.def("current", lua_table::make(0, 2).def("steps", s.steps).def("ms", ms(s.ns)).def("max_ms", ms(s.maxns)));
                     }
 
-                    posix_spawnattr_t attrs; {
-                        ok = posix_spawnattr_init(&attrs);
-                        // ok = posix_spawnattr_setflags(&attrs, POSIX_SPAWN_SETSIGMASK);
-                        // ok = posix_spawnattr_setsigmask(&attrs, nullptr);
+                    settabV(L, L->top, t); incr_top(L); return 1;
+                })
+            .def(
+                "reset", (lua_CFunction)[](lua_State * L) {
+                    if(auto p = lj_gc_stats(G(L))) *p = {};
+
+                    return 0;
+                })
+            .def(
+                "hold", (lua_CFunction)[](lua_State * L) {
+                    // no GC step until `bytes` more are allocated.
+                    auto g = G(L); GCSize bytes = (GCSize)luaL_checknumber(L, 1);
+
+                    if(g->gc.total + bytes > g->gc.threshold) g->gc.threshold = g->gc.total + bytes;
+
+                    return 0;
+                })
+            .def(
+                "release", (lua_CFunction)[](lua_State * L) {
+                    auto g = G(L); if(g->gc.threshold > g->gc.total) g->gc.threshold = g->gc.total;
+
+                    return 0;
+                }));
+
+        lua_table($L["table"])
+            .def(
+                "tag", (lua_CFunction)[](lua_State * L) {
+                    // L, not $L: this may run on a coroutine.
+                    int argc = lua_gettop(L);
+
+                    if(argc == 0) return 0;
+
+                    lua_table t = lua_value(L->base[0]); if(argc > 1) {
+                        t->tag = L->base[1]; settabV(L, L->top, t);
+                    }
+                    else {
+                        *L->top = t->tag;
                     }
 
-                    int r = posix_spawnp(&pid, argv[0], &actions, &attrs, (char * const *)argv, nullptr); {
-                        if(r != 0) {
-                            fatal("failed to spawn '%s': %s", argv[0], strerror(r)); return 0;
-                        }
+                    incr_top(L); return 1;
+                });
+
+        // anchored before it is filled: the closures below allocate, and so may step the collector.
+        lua_table async = lua_table::make(0, 4); _G.def("async", async);
+
+        async
+            .def(
+                "exec", (lua_CFunction)[](lua_State * L) {
+                    int argc = lua_gettop(L); if(argc < 1) luaL_error(L, "exec: expected at least 1 argument, got %d", argc);
+
+                    std::vector<std::string> argv; for(int i = 1; i <= argc; i++) argv.push_back(luaL_checkstring(L, i));
+
+                    return async_submit(L, async_job::status, [argv = std::move(argv)](async_job & job) {
+                        std::vector<const char *> xs; for(auto & x : argv) xs.push_back(x.c_str()); xs.push_back(nullptr);
+
+                        std::string err; job.code = spawn_wait(xs.data(), true, err); if(job.code < 0) job.fail(err);
+                    });
+                })
+            .def(
+                "copy", (lua_CFunction)[](lua_State * L) {
+                    // f, u and r go to copy_tree(), with h for "skip what is unchanged by contents";
+                    // the symlink and directory flags to std::filesystem::copy.
+                    std::string err; fs::copy_options flags = fs::copy_options::none; const char * opts = luaL_optstring(L, 3, "");
+
+                    if(!copy_options_parse(opts, flags, err)) luaL_error(L, "%s", err.c_str());
+
+                    bool recursive = strchr(opts, 'r') != nullptr; if(strpbrk(opts, "dilk") == nullptr) {
+                        copy_mode mode = strchr(opts, 'h') ? copy_mode::skip_unchanged
+                                       : strchr(opts, 'u') ? copy_mode::update_newer
+                                       : strchr(opts, 'f') ? copy_mode::overwrite : copy_mode::fail_existing;
+
+                        return async_copy(L, mode, recursive);
                     }
 
-                    int status;
+                    std::string dst = luaL_checkstring(L, 1), src = luaL_checkstring(L, 2);
 
-                    waitpid(pid, &status, 0);
+                    return async_submit(L, async_job::none, [=](async_job & job) {
+                        std::error_code ec; fs::copy(src, dst, flags, ec);
 
-                    lua_pushinteger(L, status);
+                        if(ec) job.fail(errorf("failed to copy '%s' to '%s': %s", src.c_str(), dst.c_str(), ec.message().c_str()));
+                    });
+                })
+            .def(
+                "copy_file", (lua_CFunction)[](lua_State * L) {
+                    return async_copy(L, copy_mode::overwrite, false);
+                })
+            .def(
+                "update_file", (lua_CFunction)[](lua_State * L) {
+                    return async_copy(L, copy_mode::update_newer, false);
+                })
+            .def(
+                "copy_dir", (lua_CFunction)[](lua_State * L) {
+                    return async_copy(L, copy_mode::skip_unchanged, false);
+                })
+            .def(
+                "copy_dir_recursive", (lua_CFunction)[](lua_State * L) {
+                    return async_copy(L, copy_mode::skip_unchanged, true);
+                })
+            .def(
+                "rmdir", (lua_CFunction)[](lua_State * L) {
+                    std::string path = luaL_checkstring(L, 1);
 
-                    return 1;
+                    return async_submit(L, async_job::none, [=](async_job & job) {
+                        std::error_code ec; fs::remove_all(path, ec);
+
+                        if(ec) job.fail(errorf("failed to remove directory '%s': %s", path.c_str(), ec.message().c_str()));
+                    });
                 })
             .def(
-                "cexec", (lua_CFunction)[](lua_State * L)->int {
-                    int argc = lua_gettop(L); {
-                        if(argc < 1) {
-                            fatal("exec: expected at least 1 argument, got %d", argc); return 0;
+                "hash", (lua_CFunction)[](lua_State * L) {
+                    // fnv-1a 64 of the file's contents, as 16 hex digits.
+                    std::string path = luaL_checkstring(L, 1);
+
+                    return async_submit(L, async_job::text, [=](async_job & job) {
+                        uint64_t h; if(!file_hash(path.c_str(), h)) {
+                            job.fail(errorf("failed to read '%s': %s", path.c_str(), strerror(errno))); return;
                         }
-                    }
 
-                    auto argv = (const char **)alloca((argc + 1) * sizeof(char *)); {
-                        for(int i = 0; i < argc; i++) {
-                            argv[i] = (char *)luaL_checkstring(L, i + 1);
+                        char hex[17]; snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h); job.value = hex;
+                    });
+                })
+            .def(
+                "glob", (lua_CFunction)[](lua_State * L) {
+                    // files under dir whose path relative to it matches pattern, see path.fnmatch.
+                    std::string dir = luaL_checkstring(L, 1), pattern = luaL_checkstring(L, 2);
+
+                    return async_submit(L, async_job::list, [=](async_job & job) {
+                        std::error_code ec; fs::recursive_directory_iterator it(dir, ec), end; if(ec) {
+                            job.fail(errorf("failed to read directory '%s': %s", dir.c_str(), ec.message().c_str())); return;
                         }
 
-                        argv[argc] = nullptr;
-                    }
+                        for(; it != end; it.increment(ec)) {
+                            if(!it->is_regular_file(ec)) continue;
 
-                    pid_t pid {-1};
+                            auto rel = it->path().lexically_relative(dir).generic_string();
 
-                    posix_spawn_file_actions_t actions; {
-                        ok = posix_spawn_file_actions_init(&actions);
-                        // ok = posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
-                        // ok = posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
-                    }
+                            if(fnmatch(pattern.c_str(), rel.c_str(), 0) == 0) job.values.push_back(it->path().generic_string());
+                        }
+
+                        std::sort(job.values.begin(), job.values.end());
+                    });
+                })
+            .def(
+                "complete", (lua_CFunction)[](lua_State * L) {
+                    // the finished jobs as triples id, ok, result (or error) into t[1], t[2], ...; their number.
+                    luaL_checktype(L, 1, LUA_TTABLE);
+
+                    auto q = $async_completions; if(!q || q->pending == 0) { lua_pushinteger(L, 0); return 1; }
 
-                    posix_spawnattr_t attrs; {
-                        ok = posix_spawnattr_init(&attrs);
-                        // ok = posix_spawnattr_setflags(&attrs, POSIX_SPAWN_SETSIGMASK);
-                        // ok = posix_spawnattr_setsigmask(&attrs, nullptr);
+                    std::vector<async_job *> done; {
+                        std::lock_guard<std::mutex> lock(q->mutex); done.swap(q->done);
                     }
 
-                    int r = posix_spawnp(&pid, argv[0], &actions, &attrs, (char * const *)argv, nullptr); {
-                        if(r != 0) {
-                            fatal("failed to spawn '%s': %s", argv[0], strerror(r)); return 0;
+                    int i = 0; for(auto job : done) {
+                        lua_pushnumber(L, (lua_Number)job->id); lua_rawseti(L, 1, ++i);
+                        lua_pushboolean(L, job->ok); lua_rawseti(L, 1, ++i);
+
+                        if(!job->ok) lua_pushlstring(L, job->value.data(), job->value.size());
+                        else switch(job->kind) {
+                            case async_job::none: lua_pushboolean(L, 1); break;
+                            case async_job::status: lua_pushinteger(L, job->code); break;
+                            case async_job::text: lua_pushlstring(L, job->value.data(), job->value.size()); break;
+                            case async_job::list: {
+                                lua_createtable(L, (int)job->values.size(), 0); int k = 0; for(auto & x : job->values) {
+                                    lua_pushlstring(L, x.data(), x.size()); lua_rawseti(L, -2, ++k);
+                                }
+                            } break;
+                            case async_job::counts: {
+                                lua_createtable(L, 0, 4);
+                                lua_pushnumber(L, (lua_Number)job->stats.files); lua_setfield(L, -2, "files");
+                                lua_pushnumber(L, (lua_Number)job->stats.copied); lua_setfield(L, -2, "copied");
+                                lua_pushnumber(L, (lua_Number)job->stats.skipped); lua_setfield(L, -2, "skipped");
+                                lua_pushnumber(L, (lua_Number)job->stats.bytes); lua_setfield(L, -2, "bytes");
+                            } break;
                         }
+
+                        lua_rawseti(L, 1, ++i); q->running.erase(job->id); delete job;
                     }
 
-                    int status;
+                    q->pending -= (int)done.size(); lua_pushinteger(L, (int)done.size()); return 1;
+                })
+            .def(
+                "wait", (lua_CFunction)[](lua_State * L) {
+                    // block until a job finishes, for at most ms milliseconds if ms >= 0; whether one did.
+                    auto ms = luaL_optinteger(L, 1, -1); auto q = $async_completions;
 
-                    waitpid(pid, &status, 0);
+                    if(!q || q->pending == 0) { lua_pushboolean(L, 0); return 1; }
 
-                    lua_pushinteger(L, status);
+                    std::unique_lock<std::mutex> lock(q->mutex); auto ready = [&] { return !q->done.empty(); };
 
-                    return 1;
-                });
+                    bool r; if(ms < 0) { q->ready.wait(lock, ready); r = true; }
+                    else r = q->ready.wait_for(lock, std::chrono::milliseconds(ms), ready);
 
-        lua_table($L["table"])
+                    lua_pushboolean(L, r); return 1;
+                })
             .def(
-                "tag", (lua_CFunction)[](lua_State * L) {
-                    int argc = $L.argc();
+                "progress", (lua_CFunction)[](lua_State * L) {
+                    // of a running copy: the files found so far, those done and the bytes copied.
+                    auto q = $async_completions; if(!q) return 0;
 
-                    if(argc == 0) return 0;
+                    auto it = q->running.find((uint64_t)luaL_checknumber(L, 1)); if(it == q->running.end()) return 0;
 
-                    lua_table t = $L.argv(0); if(argc > 1) {
-                        t->tag = $L.argv(1); $L.push(t);
-                    }
-                    else {
-                        $L.push(t->tag);
-                    }
+                    auto & s = it->second->stats;
 
-                    return 1;
+                    lua_pushnumber(L, (lua_Number)s.total); lua_pushnumber(L, (lua_Number)s.files); lua_pushnumber(L, (lua_Number)s.bytes); return 3;
+                })
+            .def(
+                "pending", (lua_CFunction)[](lua_State * L) {
+                    auto q = $async_completions; lua_pushinteger(L, q ? q->pending : 0); return 1;
                 });
 
         $L.load("ljx", "ninja");
 
-        lua_table($L["path"])
+        lua_ffi($L["path"], "path")
             .def("fnmatch", [](const char * pattern, const char * path) {
                 return fnmatch(pattern, path, 0) == 0;
             })
@@ -168,7 +505,7 @@ int main(int argc, char ** argv) {
                 return fnmatch(pattern, path, FNM_CASEFOLD) == 0;
             });
 
-        lua_table($L["fs"])
+        lua_ffi($L["fs"], "fs")
             .def("is_uptodate", [](const char * dst, const char * src) {
                 std::error_code ec;
 
@@ -206,44 +543,6 @@ int main(int argc, char ** argv) {
 
                 fclose(f);
             })
-            .def("copy", [](const char * dst, const char * src, const char * opts) {
-                std::filesystem::copy_options flags = std::filesystem::copy_options::none; {
-                    if(opts) {
-                        for(const char * p = opts; *p; p++) {
-                            switch(*p) {
-                                case 'f': flags |= std::filesystem::copy_options::overwrite_existing; break;
-                                case 'd': flags |= std::filesystem::copy_options::directories_only; break;
-                                case 'i': flags |= std::filesystem::copy_options::skip_symlinks; break;
-                                case 'l': flags |= std::filesystem::copy_options::create_symlinks; break;
-                                case 'k': flags |= std::filesystem::copy_options::copy_symlinks; break;
-                                case 'u': flags |= std::filesystem::copy_options::update_existing; break;
-                                case 'r': flags |= std::filesystem::copy_options::recursive; break;
-                                default: fatal("invalid option '%c'", *p);
-                            }
-                        }
-                    }
-                }
-
-                std::error_code ec;
-
-                std::filesystem::copy(src, dst, flags, ec);
-
-                if(ec) fatal("failed to copy '%s' to '%s': %s", src, dst, ec.message().c_str());
-            })
-            .def("copy_file", [](const char * dst, const char * src) {
-                std::error_code ec;
-
-                std::filesystem::copy_file(src, dst, std::filesystem::copy_options::overwrite_existing, ec);
-
-                if(ec) fatal("failed to copy '%s' to '%s': %s", src, dst, ec.message().c_str());
-            })
-            .def("update_file", [](const char * dst, const char * src) {
-                std::error_code ec;
-
-                std::filesystem::copy_file(src, dst, std::filesystem::copy_options::update_existing, ec);
-
-                if(ec) fatal("failed to update '%s' with '%s': %s", dst, src, ec.message().c_str());
-            })
             .def("update_mtime", [](const char * dst, const char * src) {
                 std::error_code ec;
 
@@ -255,19 +554,11 @@ int main(int argc, char ** argv) {
 
                 if(ec) fatal("failed to update last write time of '%s': %s", dst, ec.message().c_str());
             })
-            .def("copy_dir", [](const char * dst, const char * src) {
-                std::error_code ec;
-
-                std::filesystem::copy(src, dst, std::filesystem::copy_options::none, ec);
+            .def("mtime", [](const char * path) -> double {
+                // seconds since the epoch, or -1 when there is no such file.
+                struct stat st; if(stat(path, &st) != 0) return -1;
 
-                if(ec) fatal("failed to copy '%s' to '%s': %s", src, dst, ec.message().c_str());
-            })
-            .def("copy_dir_recursive", [](const char * dst, const char * src) {
-                std::error_code ec;
-
-                std::filesystem::copy(src, dst, std::filesystem::copy_options::recursive, ec);
-
-                if(ec) fatal("failed to copy '%s' to '%s': %s", src, dst, ec.message().c_str());
+                return (double)st.st_mtim.tv_sec + st.st_mtim.tv_nsec / 1e9;
             })
             .def("mkdir", [](const char * path) {
                 std::error_code ec;
@@ -276,13 +567,6 @@ int main(int argc, char ** argv) {
 
                 if(ec) fatal("failed to create directory '%s': %s", path, ec.message().c_str());
             })
-            .def("rmdir", [](const char * path) {
-                std::error_code ec;
-
-                std::filesystem::remove_all(path, ec);
-
-                if(ec) fatal("failed to remove directory '%s': %s", path, ec.message().c_str());
-            })
             .def("remove_all_in", [](const char * path) {
                 std::error_code ec;
 
@@ -303,30 +587,21 @@ int main(int argc, char ** argv) {
 
                 if(ec) fatal("failed to remove file '%s': %s", path, ec.message().c_str());
             });
-    }).open();
+    });
 
-    for(int i = 1; i < argc; ++i) {
-        const char * x = argv[i]; if(*x == '-') continue;
+    $L.open();
 
-        $build_script = x; break;
-    }
-    
-    if($build_script.empty()) $build_script = "build.lua";
-
-    if(!$build_script.is_absolute()) {
-        $build_script = fs::current_path() / $build_script;
-    }
-
-    // $build_script = (argc > 1) ? argv[1] : "build.lua"; if(!$build_script.is_absolute()) {
-    //     $build_script = fs::current_path() / $build_script;
-    // }
-
-    $build_script = $build_script.lexically_normal();
+    // time every GC step, see gc.stats().
+    lj_gc_setclock(G($L.L), []() -> uint64_t {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    });
 
     fs::exists($build_script) || fatal("%s not found\n", $build_script.c_str());
 
     $L.run(afile($build_script.c_str()).read());
 
+    if($daemon) $L.run("ninja.serve()");
+
     if($reload_build_script) {
         char ** xargv = (char **)alloca((argc + 1) * sizeof(char *)); {
             for(int i = 0; i < argc; i++) {
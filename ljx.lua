@@ -20,13 +20,21 @@ ffi.cdef [[
     int reftable_ref(gcptr t, gcptr x);
     void reftable_unref(gcptr t, int r);
 
-    int timer_add(int ms, int fx, int repeat);
+    int timer_add(int ms, int repeat);
     void timer_remove(int id);
     int timer_update(gcptr xs);
 
     int path_fnmatch(const char * pattern, const char * path);
+
+    const char * host_os();
+
+    int inotify_watch_open(const char * dir);
+    void inotify_watch_close(int fd);
+    gcstr inotify_watch_read(int fd);
 ]]
 
+local IS_WINDOWS = ffi.string(C.host_os()) == 'Windows'
+
 local printf = C.printf
 
 local ON, OFF = true, false; _G.ON = ON; _G.OFF = OFF
@@ -504,6 +512,8 @@ local FindFirstFileW = kernel32.FindFirstFileW
 local FindNextFileW = kernel32.FindNextFileW
 local FindClose = kernel32.FindClose
 
+local FILE_NOTIFY_CHANGE_FILE_NAME = 0x00000001
+local FILE_NOTIFY_CHANGE_DIR_NAME = 0x00000002
 local FILE_NOTIFY_CHANGE_LAST_WRITE = 0x00000010
 local ReadDirectoryChangesW = kernel32.ReadDirectoryChangesW
 
@@ -807,6 +817,156 @@ do
     _G.fs = fs
 end
 
+-- gc: pause stats (gc.stats(), gc.reset()) and regions. no GC step runs while
+-- a region runs, unless it allocates more than gc.region_limit bytes: what
+-- it leaves behind, e.g. the option tables of a configure, is collected in
+-- one go once it is done, by the steps that follow or by gc.idle()
+do
+    local depth = 0
+
+    gc.region_limit = 256 * 1024 * 1024
+
+    local function leave(ok, ...)
+        depth = depth - 1; if depth == 0 then gc.release() end
+
+        if not ok then error((...), 0) end
+
+        return ...
+    end
+
+    function gc.region(fx, ...)
+        depth = depth + 1; if depth == 1 then gc.hold(gc.region_limit) end
+
+        return leave(pcall(fx, ...))
+    end
+
+    -- a full collection, for a long-running session that is about to wait
+    function gc.idle()
+        if depth == 0 then collectgarbage() end
+    end
+end
+
+-- async: the native jobs of the `async` table (exec, copies, rmdir, hash,
+-- glob) run on a pool of threads. async.spawn(fx, ...) runs fx in a coroutine
+-- that async.await() suspends until its job is done, so many of them proceed
+-- at once; the event loop (run, poll) and async.join() resume them. awaited
+-- outside a spawned coroutine, a job blocks the caller as before.
+do
+    local complete, wait, pending = async.complete, async.wait, async.pending
+
+    local tasks = setmetatable({}, { __mode = 'k' }) -- coroutine -> handle
+    local waiting = {}                               -- job id -> coroutine
+    local results = {}                               -- job id -> { ok, value }, nobody waiting yet
+    local done = table.new(48, 0)
+
+    local step
+
+    local function finish(h, ok, ...)
+        if coroutine.status(h.co) ~= 'dead' then return end
+
+        h.done = true; if ok then
+            h.n = select('#', ...); h.results = { ... }
+        else
+            h.err = (...)
+        end
+
+        local joiners = h.joiners; h.joiners = nil; if joiners then
+            for _, co in ipairs(joiners) do step(co) end
+        end
+    end
+
+    step = function(co, ...)
+        finish(tasks[co], coroutine.resume(co, ...))
+    end
+
+    -- resume the coroutines whose jobs are done, after waiting up to timeout
+    -- ms (forever if negative) for one; the number of jobs done
+    local function pump(timeout)
+        if timeout and timeout ~= 0 then wait(timeout) end
+
+        local n = complete(done); for i = 0, n - 1 do
+            local id, ok, value = done[3 * i + 1], done[3 * i + 2], done[3 * i + 3]
+
+            local co = waiting[id]; if co then
+                waiting[id] = nil; step(co, ok, value)
+            else
+                results[id] = { ok, value }
+            end
+        end
+
+        return n
+    end; async.pump = pump
+
+    -- the result of job id, or an error with its message
+    function async.await(id)
+        local ok, value; local r = results[id]; if r then
+            results[id] = nil; ok, value = r[1], r[2]
+        elseif tasks[coroutine.running()] then
+            waiting[id] = coroutine.running(); ok, value = coroutine.yield()
+        else
+            repeat
+                if pending() == 0 then error('async.await: unknown job ' .. tostring(id), 2) end
+
+                pump(-1); r = results[id]
+            until r
+
+            results[id] = nil; ok, value = r[1], r[2]
+        end
+
+        if not ok then error(value, 0) end
+
+        return value
+    end
+
+    function async.spawn(fx, ...)
+        local co = coroutine.create(fx)
+        local h = { co = co, done = false }; tasks[co] = h
+
+        step(co, ...); return h
+    end
+
+    -- wait for a handle of async.spawn, or a list of them, and rethrow the
+    -- first error; the results of a single handle
+    function async.join(x)
+        local hs = x.co and { x } or x
+
+        local co = coroutine.running(); for _, h in ipairs(hs) do
+            while not h.done do
+                if tasks[co] then
+                    h.joiners = h.joiners or {}; table.insert(h.joiners, co); coroutine.yield()
+                elseif pending() == 0 then
+                    error('async.join: task waits on something other than a job', 2)
+                else
+                    pump(-1)
+                end
+            end
+        end
+
+        for _, h in ipairs(hs) do
+            if h.err then error(h.err, 0) end
+        end
+
+        if x.co then return unpack(x.results, 1, x.n) end
+    end
+
+    local await = async.await
+
+    -- like the blocking calls they replace: an error is fatal
+    local function sync(name)
+        local fx = async[name]; return function(...)
+            local ok, r = pcall(await, fx(...)); if not ok then fatal('%s', r) end
+
+            return r
+        end
+    end
+
+    for _, name in ipairs({ 'copy', 'copy_file', 'update_file', 'copy_dir', 'copy_dir_recursive', 'rmdir' }) do
+        fs[name] = sync(name)
+    end
+
+    fs.hash = sync('hash'); fs.glob = sync('glob'); _G.exec = sync('exec')
+end
+
 local reftable_new = C.reftable_new
 local reftable_ref = C.reftable_ref
 local reftable_unref = C.reftable_unref
@@ -866,32 +1026,42 @@ local timer_remove = C.timer_remove
 local timer_update = C.timer_update
 
 local timer_registry = registry.new()
+local timer_refs = {} -- timer id -> index in timer_registry
 
 local function set_timeout(ms, fx)
-    local i; i = timer_registry:register(function()
-        fx(); timer_registry:unregister(i);
+    local i, id; i = timer_registry:register(function()
+        timer_registry:unregister(i); timer_refs[id] = nil; fx()
     end)
-    return timer_add(ms, i, 0)
+    id = timer_add(ms, 0); timer_refs[id] = i; return id
 end; _G.set_timeout = set_timeout
 
 local function set_interval(ms, fx)
-    return timer_add(ms, timer_registry:register(fx), 1)
+    local i = timer_registry:register(fx); local id = timer_add(ms, 1); timer_refs[id] = i; return id
 end; _G.set_interval = set_interval
 
 local function clear_timeout(id)
-    timer_remove(id); timer_registry:unregister(id)
-end; _G.clear_timeout = clear_timeout
+    local i = timer_refs[id]; if i then
+        timer_remove(id); timer_registry:unregister(i); timer_refs[id] = nil
+    end
+end; _G.clear_timeout = clear_timeout; _G.clear_interval = clear_timeout
 
 local __timeouts = table.new(32, 0)
+local __timeouts_delivering = false
 
+-- run the callbacks of the timers that are due; called by run() and poll().
+-- a batch names timers by id, so one cleared by an earlier callback of the
+-- batch is skipped. a callback that polls does not run timers: the wheel
+-- reuses ids, and __timeouts is reused, only once the batch is delivered
 local function update_timer()
-    -- local c = timer_update(__timeouts); if c == 0 then
-    --     return
-    -- end
-    -- for i = 0, c - 1 do
-    --     timer_registry[__timeouts[i]]()
-    -- end
-end
+    if __timeouts_delivering then return end
+
+    local c = timer_update(__timeouts); __timeouts_delivering = true; for k = 0, c - 1 do
+        local i = timer_refs[__timeouts[k]]; if i then
+            local ok, err = pcall(timer_registry[i]); if not ok then __timeouts_delivering = false; error(err, 0) end
+        end
+    end
+    __timeouts_delivering = false
+end; _G.update_timer = update_timer
 
 -- IOCP
 local IOCP = CreateIoCompletionPort(-1, 0, 0, 0); ok(IOCP ~= 0)
@@ -924,9 +1094,10 @@ local function run()
     local timeout = 8; while not iocp_quit do
         if (GetQueuedCompletionStatus(IOCP, iocp_lpNumberOfBytes, iocp_lpCompletionKey, iocp_lpOverlapped, timeout) ~= 0) then
             iocp_on_complete(iocp_lpCompletionKey[0], iocp_lpOverlapped[0]);
-        else
-            update_timer()
         end
+
+        -- every turn, not just on a timeout: a busy port would starve the timers
+        update_timer(); async.pump(0)
     end; iocp_quit = false
 end; _G.run = run
 
@@ -942,17 +1113,27 @@ local function poll()
     while (GetQueuedCompletionStatus(IOCP, iocp_lpNumberOfBytes, iocp_lpCompletionKey, iocp_lpOverlapped, 0) ~= 0) do
         iocp_on_complete(iocp_lpCompletionKey[0], iocp_lpOverlapped[0]);
     end
-    update_timer()
+    update_timer(); async.pump(0)
 end; _G.poll = poll
 
 -- fs watch file changes
 local FS_WATCH_DEBOUNCE = 1000
 
-local function fs_watch(dir, fx)
+-- writes, and files and directories created, deleted or renamed
+local FS_WATCH_FILTER = bit.bor(FILE_NOTIFY_CHANGE_FILE_NAME, FILE_NOTIFY_CHANGE_DIR_NAME, FILE_NOTIFY_CHANGE_LAST_WRITE)
+
+-- how often the inotify backend reads its events
+local FS_WATCH_POLL = 50
+
+local function fs_watch(dir, fx, debounce)
+    debounce = debounce or FS_WATCH_DEBOUNCE
+
     local hdir = CreateFileW(u82w(dir), 0x0001, 0x0007, nil, 3, 0x42000000, 0); ok(hdir ~= INVALID_HANDLE_VALUE)
     local h = CreateIoCompletionPort(hdir, IOCP, 0, 0); ok(h == IOCP)
 
-    local BUFFER_SIZE = 1024
+    -- room for the notifications of a whole build's outputs; when they do not
+    -- fit they are dropped and the directory itself is reported instead
+    local BUFFER_SIZE = 64 * 1024
 
     local buf = ffi.new('char[?]', BUFFER_SIZE)
     local lpBytesReturned = ffi.new('DWORD[1]')
@@ -965,22 +1146,26 @@ local function fs_watch(dir, fx)
     local read_change, on_change; on_change = function()
         local now = _G.clock()
 
-        if (last_change_time == 0) or ((now - last_change_time) > FS_WATCH_DEBOUNCE) then
+        if (last_change_time == 0) or ((now - last_change_time) > debounce) then
             last_change_time = now
 
-            local p = buf; while true do
-                local info = ffi.cast("FILE_NOTIFY_INFORMATION*", p)
-                local filename = w2u8(info.FileName, info.FileNameLength / 2)
+            if overlapped.InternalHigh == 0 then
+                fx(dir)
+            else
+                local p = buf; while true do
+                    local info = ffi.cast("FILE_NOTIFY_INFORMATION*", p)
+                    local filename = w2u8(info.FileName, info.FileNameLength / 2)
 
-                if filename ~= '.' and filename ~= '..' then
-                    if fx(path.combine(dir, filename)) == 'break' then
+                    if filename ~= '.' and filename ~= '..' then
+                        if fx(path.combine(dir, filename)) == 'break' then
+                            break
+                        end
+                    end
+                    if info.NextEntryOffset == 0 then
                         break
                     end
+                    p = p + info.NextEntryOffset
                 end
-                if info.NextEntryOffset == 0 then
-                    break
-                end
-                p = p + info.NextEntryOffset
             end
         end
 
@@ -990,12 +1175,38 @@ local function fs_watch(dir, fx)
     read_change = function()
         overlapped.data = iocp_registry:register(on_change)
 
-        ok(ReadDirectoryChangesW(hdir, buf, BUFFER_SIZE, 1, FILE_NOTIFY_CHANGE_LAST_WRITE, lpBytesReturned, lpOverlapped,
-            nil) ~= 0)
+        ok(ReadDirectoryChangesW(hdir, buf, BUFFER_SIZE, 1, FS_WATCH_FILTER, lpBytesReturned, lpOverlapped, nil) ~= 0)
     end
 
     fx('.'); read_change(); -- set_timeout(FS_WATCH_DEBOUNCE, read_change)
-end; fs.watch = fs_watch
+end
+
+-- the same on inotify, read from a timer: the event loop only waits on IOCP.
+local function fs_watch_inotify(dir, fx, debounce)
+    debounce = debounce or FS_WATCH_DEBOUNCE
+
+    local fd = C.inotify_watch_open(dir); ok(fd >= 0, 'fs.watch: failed to watch ' .. dir)
+
+    local last_change_time = 0
+
+    set_interval(FS_WATCH_POLL, function()
+        local changes = C.inotify_watch_read(fd); if #changes == 0 then return end
+
+        local now = _G.clock()
+
+        if (last_change_time == 0) or ((now - last_change_time) > debounce) then
+            last_change_time = now
+
+            for fpath in changes:gmatch('[^\n]+') do
+                if fx(fpath) == 'break' then break end
+            end
+        end
+    end)
+
+    fx('.')
+end
+
+fs.watch = IS_WINDOWS and fs_watch or fs_watch_inotify
 
 -- fs_watch('r:/temp', function(fname)
 --     printf('file changed-->: %s\n', fname)
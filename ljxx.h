@@ -3,6 +3,7 @@
 
 #include <string>
 #include <array>
+#include <atomic>
 #include <vector>
 
 extern "C" {
@@ -17,11 +18,14 @@ extern "C" {
 #include <lj_udata.h>
 #include <lj_cdata.h>
 #include <lj_state.h>
+#include <lj_gc.h>
+#include <lj_strfmt.h>
 #undef Node
 }
 
 #include "ljx.h"
 #include "function.h"
+#include "clib.h"
 
 struct tvalue {
     double value;
@@ -32,6 +36,18 @@ struct tvalue {
 struct lua_table;
 struct lua_gcptr;
 
+template<size_t N>
+struct lua_key_literal {
+    char s[N];
+
+    constexpr lua_key_literal(const char (&x)[N]) { for(size_t i = 0; i < N; ++i) s[i] = x[i]; }
+
+    constexpr std::string_view view() const { return {s, N - 1}; }
+};
+
+template<lua_key_literal K>
+struct lua_key;
+
 struct lua_value {
     TValue value {(uint64_t)-1};
 
@@ -179,6 +195,9 @@ struct lua_table {
 
     lua_value operator()(const char * name) const { return operator()(std::string_view(name)); }
 
+    template<lua_key_literal K>
+    lua_value operator()(lua_key<K>) const;
+
     lua_table & push(lua_value const & x);
 
     lua_table & push_back(lua_value const & x) { return push(x); }
@@ -244,6 +263,19 @@ struct lua_table {
                 }
             }
         }
+
+        // integer keys past the array part, e.g. appended to a table that had
+        // only hash keys, live in the hash part.
+        for(int32_t i = std::max<int32_t>((int32_t)c, 1);; ++i) {
+            TValue * v = (TValue *)lj_tab_getinth(t, i); if(!v || tvisnil(v)) return;
+
+            if constexpr(no_return) {
+                f(i, (lua_value &)(*v));
+            }
+            else {
+                if(!f(i, (lua_value &)(*v))) return;
+            }
+        }
     }
 };
 
@@ -351,6 +383,11 @@ inline lua_initialize_t $lua_initialize;
 struct lua_state {
     lua_State * L {nullptr}; std::vector<function<void()>> initializers;
 
+    // distinct for every state opened in the process, even one reusing a freed address.
+    uint32_t serial {0};
+
+    static inline std::atomic<uint32_t> serials {0};
+
     template<typename F>
     lua_state & on_initialize(F && f) { initializers.emplace_back(std::forward<F>(f)); return *this; }
 
@@ -358,7 +395,7 @@ struct lua_state {
     lua_state & operator()(F && f) { return on_initialize(std::forward<F>(f)); }
 
     lua_state & open() {
-        L = luaL_newstate(); luaL_openlibs(L); {
+        L = luaL_newstate(); serial = ++serials; luaL_openlibs(L); {
             for(auto & f : $lua_initialize.initializers) f();
             for(auto & f : initializers) { f(); initializers.clear(); }
         }
@@ -418,6 +455,48 @@ struct lua_state {
 
 inline thread_local lua_state $L;
 
+// a constant key, interned once per lua_State and fixed against the collector,
+// so a lookup is a plain lj_tab_getstr with no hashing of the key bytes:
+//
+//     t[lua_key<"implicit">()]  or  t["implicit"_key], and t("a.b.c"_key) for paths
+template<lua_key_literal K>
+struct lua_key {
+    static constexpr std::string_view name = K.view();
+
+    static constexpr size_t nsegments = [] {
+        size_t n = 1; for(char c : name) n += (c == '.'); return n;
+    }();
+
+    static GCstr * intern(std::string_view s) {
+        GCstr * x = lj_str_new($L, s.data(), s.size()); fixstring(x); return x;
+    }
+
+    static GCstr * str() {
+        static thread_local uint32_t serial {0}; static thread_local GCstr * x {nullptr};
+
+        if(serial != $L.serial) { x = intern(name); serial = $L.serial; } return x;
+    }
+
+    static std::array<GCstr *, nsegments> const & segments() {
+        static thread_local uint32_t serial {0}; static thread_local std::array<GCstr *, nsegments> x {};
+
+        if(serial != $L.serial) {
+            size_t i = 0, k = 0; for(size_t j = 0; j <= name.size(); ++j) {
+                if(j == name.size() || name[j] == '.') { x[k++] = intern(name.substr(i, j - i)); i = j + 1; }
+            }
+
+            serial = $L.serial;
+        }
+
+        return x;
+    }
+
+    operator const GCstr *() const { return str(); }
+};
+
+template<lua_key_literal K>
+constexpr lua_key<K> operator""_key() { return {}; }
+
 inline lua_value::lua_value(const void * x) { setrawlightudV(&value, lj_lightud_intern($L, (void *)x)); }
 
 inline lua_value::lua_value(const char * s) { setstrV($L, &value, lj_str_newz($L, s)); }
@@ -454,7 +533,7 @@ lua_value::lua_value(F && f) {
             }
             else {
                 lua_value r = std::apply(*((fx_type *)nullptr), argv); {
-                    $L.push(r);
+                    *L->top = r.value; incr_top(L);
                 }
 
                 return 1;
@@ -477,7 +556,7 @@ lua_value::lua_value(F && f) {
             }
             else {
                 lua_value r = std::apply(*f, argv); {
-                    $L.push(r);
+                    *L->top = r.value; incr_top(L);
                 }
 
                 return 1;
@@ -545,8 +624,23 @@ inline lua_value lua_table::operator()(std::string_view const & name) const {
     return r;
 }
 
+template<lua_key_literal K>
+lua_value lua_table::operator()(lua_key<K>) const {
+    lua_value r {value}; for(GCstr * s : lua_key<K>::segments()) {
+        if(!tvistab(r)) return lua_nil;
+
+        auto xp = lj_tab_getstr(tabV(r), s); if(!xp) return lua_nil;
+
+        r = *xp;
+    }
+
+    return r;
+}
+
+// the barriers: value may already be black, e.g. _G while the collector is
+// in its propagate phase.
 inline lua_table & lua_table::def(size_t idx, lua_value const & x) {
-    *lj_tab_setint($L, value, idx) = x.value; return *this;
+    *lj_tab_setint($L, value, idx) = x.value; lj_gc_anybarriert($L.L, value); return *this;
 }
 
 inline lua_table & lua_table::def(std::string_view const & name, lua_value const & x) {
@@ -554,11 +648,114 @@ inline lua_table & lua_table::def(std::string_view const & name, lua_value const
 }
 
 inline lua_table & lua_table::def(const GCstr * name, lua_value const & x) {
-    *lj_tab_setstr($L, value, name) = x.value; return *this;
+    *lj_tab_setstr($L, value, name) = x.value; lj_gc_anybarriert($L.L, value); return *this;
 }
 
-inline lua_table & lua_table::push(lua_value const & x) { *lj_tab_setint($L, value, lj_tab_len(value) + 1) = x.value; return *this; }
+inline lua_table & lua_table::push(lua_value const & x) {
+    *lj_tab_setint($L, value, lj_tab_len(value) + 1) = x.value; lj_gc_anybarriert($L.L, value); return *this;
+}
 
 inline lua_table & lua_table::reasize(size_t asize) { lj_tab_reasize($L, value, asize); return *this; }
 
+// the ffi.cdef spelling of a parameter or return type.
+template<typename T>
+constexpr const char * ffi_ctype() {
+    if constexpr(std::is_same_v<T, void>) return "void";
+    else if constexpr(std::is_same_v<T, bool>) return "bool";
+    else if constexpr(std::is_same_v<T, int8_t>) return "int8_t";
+    else if constexpr(std::is_same_v<T, uint8_t>) return "uint8_t";
+    else if constexpr(std::is_same_v<T, int16_t>) return "int16_t";
+    else if constexpr(std::is_same_v<T, uint16_t>) return "uint16_t";
+    else if constexpr(std::is_same_v<T, int32_t>) return "int32_t";
+    else if constexpr(std::is_same_v<T, uint32_t>) return "uint32_t";
+    else if constexpr(std::is_same_v<T, int64_t>) return "int64_t";
+    else if constexpr(std::is_same_v<T, uint64_t>) return "uint64_t";
+    else if constexpr(std::is_same_v<T, float>) return "float";
+    else if constexpr(std::is_same_v<T, double>) return "double";
+    else if constexpr(std::is_same_v<T, const char *>) return "const char *";
+    else if constexpr(std::is_same_v<T, char *>) return "char *";
+    else if constexpr(std::is_same_v<T, const void *>) return "const void *";
+    else if constexpr(std::is_same_v<T, void *>) return "void *";
+    else static_assert(sizeof(T) == 0, "ffi_ctype: no ffi spelling for this type");
+}
+
+// binds captureless lambdas as ffi.C functions instead of lua_CFunction closures:
+// a lua_CFunction call aborts the trace it is in, an ffi call is compiled into it.
+//
+//     lua_ffi($L["fs"], "fs").def("copy_file", [](const char * dst, const char * src) { ... });
+//
+// registers the lambda as the executable symbol `ljx_fs_copy_file`, declares it
+// with a matching ffi.cdef and sets fs.copy_file = C.ljx_fs_copy_file. arguments
+// are converted by the ffi, except that nil for a pointer raises "bad argument"
+// as luaL_checkstring did: the ffi would pass NULL. such a binding is wrapped
+// in a Lua function checking its pointers, which the JIT inlines.
+struct lua_ffi {
+    lua_table table; std::string prefix;
+
+    lua_ffi(lua_table t, std::string_view const & name) : table(t), prefix("ljx_") { prefix.append(name).push_back('_'); }
+
+    template<typename F>
+    lua_ffi & def(std::string_view const & name, F && f) {
+        typedef std::remove_reference_t<F> fx_type; typedef function_traits<fx_type> fx_traits;
+
+        return def(name, to_pointer(f, (typename fx_traits::args *)nullptr));
+    }
+
+    template<typename R, typename... A>
+    lua_ffi & def(std::string_view const & name, R (*fx)(A...)) {
+        std::string sym = prefix; sym.append(name);
+
+        std::string decl = ffi_ctype<R>(); decl.append(" ").append(sym).append("("); {
+            const char * args[] = { ffi_ctype<A>()..., nullptr };
+
+            for(size_t i = 0; i < sizeof...(A); ++i) decl.append(i ? ", " : "").append(args[i]);
+
+            decl.append(sizeof...(A) ? ");" : "void);");
+        }
+
+        // function(a1, a2) if a1 == nil then error(...) end ... return f(a1, a2) end
+        std::string wrap; if constexpr((std::is_pointer_v<A> || ...)) {
+            const bool ptrs[] = { std::is_pointer_v<A>... }; const bool strs[] = { std::is_same_v<std::remove_cv_t<std::remove_pointer_t<A>>, char>... };
+
+            std::string params; for(size_t i = 0; i < sizeof...(A); ++i) params.append(i ? ", a" : "a").append(std::to_string(i + 1));
+
+            wrap = "local f = ...; return function(" + params + ") ";
+
+            for(size_t i = 0; i < sizeof...(A); ++i) if(ptrs[i]) {
+                auto n = std::to_string(i + 1);
+
+                wrap.append("if a" + n + " == nil then error(\"bad argument #" + n + " to '").append(name).append("' (").append(strs[i] ? "string" : "cdata").append(" expected, got nil)\", 2) end ");
+            }
+
+            wrap.append("return f(" + params + ") end");
+        }
+
+        $clib_dynamic_syms.add(sym, (void *)fx);
+
+        static const char bind[] = "local t, k, sym, decl, wrap = ...; local ffi = require('ffi'); ffi.cdef(decl); local f = ffi.C[sym]; "
+                                   "t[k] = wrap and assert(loadstring(wrap, '=' .. k))(f) or f";
+
+        lua_State * L = $L; if(luaL_loadbuffer(L, bind, sizeof(bind) - 1, "=lua_ffi") != 0) {
+            fatal("lua_ffi: %s", lua_tostring(L, -1)); return *this;
+        }
+
+        $L.push(table); lua_pushlstring(L, name.data(), name.size());
+        lua_pushlstring(L, sym.data(), sym.size()); lua_pushlstring(L, decl.data(), decl.size());
+
+        if(wrap.empty()) lua_pushnil(L); else lua_pushlstring(L, wrap.data(), wrap.size());
+
+        lua_call(L, 5, 0); return *this;
+    }
+
+private:
+    template<typename F, typename... A>
+    static auto to_pointer(F & f, std::tuple<A...> *) {
+        typedef decltype(f(std::declval<A>()...)) R;
+
+        static_assert(std::is_convertible_v<F, R (*)(A...)>, "lua_ffi: only captureless lambdas can be bound");
+
+        return static_cast<R (*)(A...)>(f);
+    }
+};
+
 #endif // ljxx_ac444ba0f14f422f9e50be80caa40bca
@@ -18,6 +18,7 @@ var OPT = "-O2 -g"
 // var OPT = "-O0 -g"
 
 var ninja_src = [
+    'deps/ninja/src/archive.cc',
     'deps/ninja/src/build.cc',
     'deps/ninja/src/build_log.cc',
     'deps/ninja/src/clean.cc',
@@ -32,6 +33,7 @@ var ninja_src = [
     'deps/ninja/src/eval_env.cc',
     'deps/ninja/src/getopt.c',
     'deps/ninja/src/graph.cc',
+    'deps/ninja/src/graph_export.cc',
     'deps/ninja/src/graphviz.cc',
     'deps/ninja/src/json.cc',
     'deps/ninja/src/lexer.cc',
@@ -39,8 +41,11 @@ var ninja_src = [
     'deps/ninja/src/manifest_parser.cc',
     'deps/ninja/src/metrics.cc',
     'deps/ninja/src/missing_deps.cc',
+    'deps/ninja/src/modules.cc',
     'deps/ninja/src/ninja.cc',
     'deps/ninja/src/parser.cc',
+    'deps/ninja/src/remote.cc',
+    'deps/ninja/src/sha256.cc',
     'deps/ninja/src/state.cc',
     'deps/ninja/src/status.cc',
     'deps/ninja/src/string_piece_util.cc',
@@ -16,6 +16,8 @@ ffi.cdef [[
         int parallelism;
         int failures_allowed;
         double max_load_average;
+        int64_t max_memory;
+        bool sandbox;
         //DepfileParserOptions depfile_parser_options;
     } ninja_config_t;
 
@@ -36,12 +38,32 @@ ffi.cdef [[
     void ninja_edge_add(gcptr outputs, const char * rule_name, gcptr inputs, gcptr vars);
     void ninja_default_add(gcptr defaults);
     void ninja_exit_on_error(int b);
+    void ninja_output_log(bool b);
+    void ninja_remote_worker_add(const char * address);
+    void ninja_remote_secret(const char * secret);
     int ninja_build(gcptr targets);
-    void ninja_clean();
+    gctab ninja_options_share(gcptr shares, gcptr target, gcptr own);
+    gctab ninja_options_collect(gcptr shares, gcptr own);
+    int ninja_clean(gcptr targets, bool subgraph);
+    int ninja_compdb(const char * file, gcptr rules);
+    int ninja_graph_export(const char * file, const char * format);
+    int ninja_log_entry(const char * output, int64_t * mtime);
+    const char * program_path();
+    int command_line_max();
+
+    const char * daemon_path();
+    bool daemon_mode();
+    int daemon_listen(const char * path);
+    void daemon_close(int fd);
+    int daemon_accept(int fd, int timeout);
+    gcstr daemon_request(int fd);
+    void daemon_redirect(int fd);
+    void daemon_reply(int fd, int rc);
 ]]
 
 local HOST_OS = ffi.string(C.host_os())
 
+
 local TARGET_EXTENSION = {}; do
     if HOST_OS == 'Windows' then
         TARGET_EXTENSION['binary'] = '.exe'
@@ -59,11 +81,19 @@ end
 
 local TARGET_DEFAULT_TYPE = 'phony'
 
+-- how long a command can get before its inputs go to a response file, with
+-- room for what the variables of its rule expand to
+local command_line_max = C.command_line_max() - 4096
+
 local ninja = {}; _G.ninja = ninja
 
 ninja.targets = {}
 ninja.toolchains = {}
 
+-- with --daemon the builds requested by the build script are deferred and
+-- served later, see ninja.serve
+local daemon_deferred = C.daemon_mode() and {} or nil
+
 function ninja.config(fx)
     if fx(C.ninja_config_get()) ~= false then C.ninja_config_apply() end
 end
@@ -76,6 +106,18 @@ function ninja.build_dir(dir)
     end
 end
 
+local MEMORY_UNITS = { K = 2 ^ 10, M = 2 ^ 20, G = 2 ^ 30, T = 2 ^ 40 }
+
+-- '512M', '1.5G', 4096 -> bytes
+function ninja.memory_size(x)
+    if type(x) == 'number' then return x end
+    local n, unit = string.match(x, '^%s*([%d%.]+)%s*([KMGTkmgt]?)i?[Bb]?%s*$')
+    n = n and tonumber(n); if not n then
+        fatal('invalid memory size: %s', tostring(x))
+    end
+    return math.floor(n * (MEMORY_UNITS[string.upper(unit)] or 1))
+end
+
 local function ensure_field(t, field, default)
     local x = t[field]; if x == nil then
         x = default; t[field] = x
@@ -176,6 +218,53 @@ local function options_public_merge(tout, ...)
     return tout
 end
 
+-- what ninja.deps_foreach(target) merges for target.opts[field]: each
+-- dependency's public options, then all of the target's own. a dependency's
+-- share, the targets whose options it passes on, is collected once per build
+-- (see build_step); options are only flattened for the target that uses them
+local options_shared = {}
+
+local options_share
+
+local function options_of_deps(target, field, depth)
+    local r = {}; local function add(dep)
+        local t = ninja.target_of(dep); if t then
+            table.insert(r, options_share(t, field, depth + 1))
+        end
+    end
+
+    -- as target_walk goes: private deps only count for the target itself
+    if target.opts.deps then
+        table.iforeach(target.opts.deps, function(dep)
+            if (type(dep) == 'table') and (xtype(dep) ~= 'target') then
+                if (xtype(dep) ~= 'private') or (depth == 0) then
+                    table.iforeach(dep, add)
+                end
+            else
+                add(dep)
+            end
+        end)
+    end
+
+    return r
+end
+
+options_share = function(target, field, depth)
+    local shared = options_shared[target]; if shared == nil then
+        shared = {}; options_shared[target] = shared
+    end
+
+    local r = shared[field]; if r == nil then
+        r = C.ninja_options_share(options_of_deps(target, field, depth), target, target.opts[field]); shared[field] = r
+    end
+
+    return r
+end
+
+local function options_collect(target, field)
+    return C.ninja_options_collect(options_of_deps(target, field, 0), target.opts[field])
+end
+
 local function options_tobuf(buf, t)
     options_foreach(t, function(k, x)
         if k == nil then
@@ -224,8 +313,30 @@ local options = {
     pick = options_pick,
 }; _G.options = options
 
+-- numbered per prefix, so a name only depends on what was generated for the
+-- same prefix
+local symgen_counters = {}
+
 local function symgen(prefix)
-    return (prefix or '') .. tostring(__counter_next())
+    prefix = prefix or ''; local n = (symgen_counters[prefix] or 0) + 1; symgen_counters[prefix] = n
+    return prefix .. tostring(n)
+end
+
+-- the rules of C/C++ compiles, which go into the compilation database
+local compdb_rules = {}
+
+-- the orders ninja.deps_foreach walks targets' dependencies in (deps_order),
+-- kept until a deps() call or a new named target may have changed them
+local deps_orders, deps_generation = setmetatable({}, { __mode = 'k' }), 0
+
+-- nested builds (of a target's dependencies, say) inside the one the script
+-- asked for
+local build_depth = 0
+
+-- a build the script asks for: option shares are collected again, to see
+-- what the script changed since the last one
+local function build_step()
+    if build_depth == 0 then options_shared = {} end
 end
 
 ninja.action = {
@@ -364,6 +475,17 @@ local function setupaction_run(x, stage)
     end)
 end
 
+-- the after_build hooks of the targets a ninja.build has built so far, by
+-- target, each on an async task that runs alongside the builds that follow
+-- until a target depending on it is built
+local after_build_tasks = {}
+
+local function after_build_run(target)
+    for _, fx in ipairs(target.after_build_actions) do
+        fx(target)
+    end
+end
+
 ninja.tool = {
 }
 
@@ -437,7 +559,7 @@ local function file_is_typeof(files, extensions)
 end
 
 local c_file_extensions = { '.c' }
-local cxx_file_extensions = { '.cpp', '.cxx', '.cc', '.cu' }
+local cxx_file_extensions = { '.cpp', '.cxx', '.cc', '.cu', '.cppm', '.ixx', '.cxxm', '.mpp' }
 local asm_file_extensions = { '.s', '.S', '.asm' }
 
 local c_option_fields = { 'c_flags', 'cx_flags', 'defines', 'includes', 'include_dirs' }
@@ -468,6 +590,126 @@ local function source_foreach(srcs, fx)
     end
 end
 
+-- unity builds: sources compiled with the same command from one directory are
+-- included, a chunk at a time, by generated translation units. a sorted group
+-- is cut before every file whose name hash is 0 modulo the chunk size, so
+-- adding or removing a file only changes the chunk it falls into.
+local unity_file_extensions = { '.c', '.cpp', '.cxx', '.cc' }
+
+local function string_hash(s)
+    local h = 0x811c9dc5; for i = 1, #s do
+        h = bit.bxor(h, string.byte(s, i)); h = bit.tobit(h * 403 + bit.lshift(h, 24))
+    end
+    return h
+end
+
+local function unity_chunks(files, n)
+    table.sort(files)
+
+    local chunks, chunk = {}, nil; for _, f in ipairs(files) do
+        if chunk == nil or #chunk >= 2 * n or string_hash(f) % n == 0 then
+            chunk = {}; table.insert(chunks, chunk)
+        end
+        table.insert(chunk, f)
+    end
+    return chunks
+end
+
+local function file_write_if_changed(file, content)
+    local f = io.open(file, 'rb'); if f then
+        local x = f:read('*a'); f:close(); if x == content then return end
+    end
+
+    fs.mkdir(path.parent(file))
+
+    f = io.open(file, 'wb') or fatal('failed to write %s', file); f:write(content); f:close()
+end
+
+-- how a file generated in dir includes file
+local function include_path(dir, file)
+    if path.is_absolute(file) then return file end
+
+    if path.is_absolute(dir) then return path.getcwd() .. '/' .. file end
+
+    return string.rep('../', select(2, string.gsub(dir, '[^/\\]+', ''))) .. file
+end
+
+-- sources whose unity chunk failed to build although each compiled alone
+local function unity_split_load(build_dir)
+    local split = {}; local f = io.open(path.combine(build_dir, 'unity.split'), 'r'); if f then
+        for line in f:lines() do split[line] = true end; f:close()
+    end
+    return split
+end
+
+-- log mtime of each pch when its build was last reported
+local pch_reported = {}
+
+-- the linker of the gcc-style toolchains: 'auto' for the first of their
+-- faster linkers (mold, lld) the link driver takes, a name for that one, or
+-- false for the driver's own. target:linker() sets it per target
+ninja.linker = 'auto'
+
+-- static libraries of the toolchains that can, as thin archives written by
+-- njx ar: the archive names its objects instead of copying them, and an
+-- update reads the symbols of the objects that changed only. such an archive
+-- is only good next to its objects, so not for installing; ar_flags do not
+-- apply. target:thin_archive() sets it per target
+ninja.thin_archive = false
+
+-- builddir -> { [driver, flags and programs] = whether they link }, kept in
+-- <builddir>/linker.probe across runs. the key holds where the driver and
+-- the linker were found on PATH and their mtimes, so installing, removing or
+-- upgrading either, or another PATH, probes again
+local linker_probes = {}
+
+-- `name` as found on PATH and its mtime, or '-' when it is not there
+local function program_stamp(name)
+    local sep, exe = ':', ''; if HOST_OS == 'Windows' then sep, exe = ';', '.exe' end
+
+    for dir in string.gmatch(os.getenv('PATH') or '', '[^' .. sep .. ']+') do
+        local file = path.combine(dir, name .. exe); local mtime = fs.mtime(file); if mtime >= 0 then
+            return string.format('%s@%.6f', file, mtime)
+        end
+    end
+
+    return '-'
+end
+
+-- whether `driver flags` links a program with the linker program `linker`,
+-- tried once in dir. every probe links its own output, so probes running
+-- side by side never read each other's results
+local function linker_probe(dir, driver, flags, linker)
+    local file = path.combine(ninja.build_dir(), 'linker.probe')
+
+    local probes = linker_probes[file]; if not probes then
+        probes = {}; linker_probes[file] = probes; local f = io.open(file, 'r'); if f then
+            for line in f:lines() do
+                local k, v = string.match(line, '^(.*)\t([01])$'); if k then probes[k] = (v == '1') end
+            end; f:close()
+        end
+    end
+
+    local command = driver .. ' ' .. flags
+    local key = table.concat({ command, program_stamp(string.match(driver, '^%S+')), program_stamp(linker) }, ' ')
+
+    local ok = probes[key]; if ok == nil then
+        local src = path.combine(dir, 'linker_probe.c'); file_write_if_changed(src, 'int main(void) { return 0; }\n')
+        local out = path.combine(dir, symgen('linker_probe_' .. bit.tohex(string_hash(key)) .. '_'))
+
+        local argv = string.split(command, ' '); table.insert(argv, src); table.insert(argv, '-o'); table.insert(argv, out)
+
+        local status; ok, status = pcall(async.await, async.exec(unpack(argv))); ok = ok and status == 0
+        probes[key] = ok; os.remove(out); os.remove(out .. '.exe')
+
+        local f = io.open(file, 'a'); if f then
+            f:write(key, '\t', ok and '1' or '0', '\n'); f:close()
+        end
+    end
+
+    return ok
+end
+
 local basic_cc_toolchain; basic_cc_toolchain = object({
     target = {
         new = function(name, opts)
@@ -476,7 +718,7 @@ local basic_cc_toolchain; basic_cc_toolchain = object({
             }, 'target')), basic_cc_toolchain.target.basic, basic_toolchain.target.basic)
 
             if name ~= nil then
-                ninja.targets[name] = target
+                ninja.targets[name] = target; deps_generation = deps_generation + 1
             end
 
             return target
@@ -513,6 +755,7 @@ local basic_cc_toolchain; basic_cc_toolchain = object({
                 vargs_foreach(function(x)
                     table.insert(deps, x)
                 end, ...)
+                deps_generation = deps_generation + 1
                 return self
             end,
 
@@ -527,10 +770,159 @@ local basic_cc_toolchain; basic_cc_toolchain = object({
                 self.opts.extension = ext; return self
             end,
 
+            -- peak memory of one compile/link job, e.g. '2G' or { cxx = '2G', ld = '8G' }
+            memory = function(self, x)
+                self.opts.memory = x; return self
+            end,
+
+            -- job slots taken by one compile/link job, e.g. 2 or { ld = 4 }
+            weight = function(self, x)
+                self.opts.weight = x; return self
+            end,
+
+            -- run compile/link jobs confined to their declared inputs (linux);
+            -- true, false, or a list of extra paths the tools may read
+            sandbox = function(self, x)
+                self.opts.sandbox = x; return self
+            end,
+
+            -- run jobs on ninja.remote_workers(); true for compile jobs,
+            -- or per kind, e.g. { cxx = true, ld = true }
+            remote = function(self, x)
+                self.opts.remote = x; return self
+            end,
+
+            -- the linker, see ninja.linker
+            linker = function(self, x)
+                self.opts.linker = x; return self
+            end,
+
+            -- write the static library as a thin archive, see ninja.thin_archive
+            thin_archive = function(self, x)
+                self.opts.thin_archive = x; return self
+            end,
+
+            -- link incrementally, keeping the previous output and relinking
+            -- what changed, where the toolchain's linker can (msvc link); true,
+            -- false, or the flags that do it for another linker
+            incremental_link = function(self, x)
+                self.opts.incremental_link = x; return self
+            end,
+
+            -- compile C/C++ sources in unity chunks of about n files; a source
+            -- given as { file, unity = false } is always compiled on its own
+            unity = function(self, n)
+                self.opts.unity = n; return self
+            end,
+
+            -- after a failed build: a unity chunk that does not compile while
+            -- each of its files compiles alone is split for good, and the build
+            -- script is run again.
+            unity_split = function(self)
+                local split = {}; for _, chunk in ipairs(self.unity_chunks) do
+                    if C.ninja_build(chunk.obj) > 0 and not chunk.isolated then
+                        chunk.isolated = true
+
+                        local alone = true; for _, f in ipairs(chunk.files) do
+                            local obj = path.combine(self.build_dir, f .. '.o')
+
+                            local src = f; if self.opts.pch_header and file_is_typeof(f, cxx_file_extensions) then
+                                src = { f, implicit = self.opts.pch }
+                            end
+
+                            C.ninja_edge_add(obj, chunk.rule, src, nil); if C.ninja_build(obj) > 0 then
+                                alone = false; break
+                            end
+                        end
+
+                        if alone then table.merge(split, chunk.files) end
+                    end
+                end
+
+                if #split > 0 then
+                    local f = io.open(path.combine(self.build_dir, 'unity.split'), 'a') or
+                        fatal('failed to write %s', path.combine(self.build_dir, 'unity.split'))
+                    f:write(table.concat(split, '\n'), '\n'); f:close()
+
+                    print(string.format('unity: %s: compiling %d files on their own, rerunning', self.name, #split)); io.stdout:flush()
+
+                    C.reload()
+                end
+            end,
+
+            -- after a build that made the pch: what it cost and roughly what
+            -- the compiles using it saved, if each parsed the header as slowly
+            pch_report = function(self)
+                local mtime = ffi.new('int64_t[1]'); local ms = C.ninja_log_entry(self.opts.pch, mtime)
+                if ms < 0 or mtime[0] == pch_reported[self.opts.pch] then return end
+                pch_reported[self.opts.pch] = mtime[0]
+
+                local n = self.pch_users; print(string.format('PCH %s: %.2fs, used by %d compiles, saves about %.1fs',
+                    self.opts.pch, ms / 1000, n, math.max(n - 1, 0) * ms / 1000))
+            end,
+
+            -- the flags choosing how the target links: incremental linking
+            -- when asked for and known, else the linker of ninja.linker
+            linker_options = function(self)
+                local opts = self.opts
+
+                local incremental = opts.incremental_link; if incremental == true then incremental = self.incremental_ld end
+                if incremental and incremental ~= '' then return incremental end
+
+                local flag, driver = self.flag_map.linker, string.match(self.ld, '^(.-)%s*%$in')
+                local linker = opts.linker; if linker == nil then linker = ninja.linker end
+                if not flag or not driver or not linker or linker == '' then return nil end
+
+                if linker ~= 'auto' then return flag .. linker end
+
+                -- the target's own flags (--target, --sysroot, -m32) decide
+                -- which linkers work, so they are probed too
+                local ld_flags = {}; for _, x in ipairs(string.split(options_tostring(self.ld_flags_options or {}), ' ')) do
+                    if not string.find(x, '$', 1, true) then table.insert(ld_flags, x) end
+                end
+                ld_flags = #ld_flags > 0 and table.concat(ld_flags, ' ') .. ' ' or ''
+
+                for _, x in ipairs(self.linkers or {}) do
+                    if linker_probe(self.build_dir, driver, ld_flags .. flag .. x, 'ld.' .. x) then return flag .. x end
+                end
+
+                return nil
+            end,
+
+            rule_vars = function(self, kind)
+                local opts = self.opts; local memory, weight = opts.memory, opts.weight
+                if type(memory) == 'table' then memory = memory[kind] end
+                if type(weight) == 'table' then weight = weight[kind] end
+
+                local remote = opts.remote; if type(remote) == 'table' then
+                    remote = remote[kind]
+                elseif remote then
+                    remote = (kind == 'cc' or kind == 'cxx' or kind == 'as')
+                end
+
+                local sandbox, sandbox_paths = opts.sandbox, nil; if type(sandbox) == 'table' then
+                    sandbox_paths = table.concat(sandbox, ' '); sandbox = true
+                end
+
+                return {
+                    memory = memory and tostring(ninja.memory_size(memory)) or nil,
+                    weight = weight and tostring(weight) or nil,
+                    sandbox = (sandbox ~= nil) and (sandbox and '1' or '0') or nil,
+                    sandbox_paths = sandbox_paths,
+                    remote = remote and '1' or nil,
+                }
+            end,
+
             cxx_pch = function(self, pch_header)
                 self.opts.pch_header = pch_header; return self
             end,
 
+            -- C++20 modules: sources are scanned for the modules they provide
+            -- and import, and compiled in that order (clang and gcc)
+            cxx_modules = function(self, b)
+                self.opts.modules = (b ~= false); return self
+            end,
+
             src = function(self, ...)
                 local srcs = ensure_field(self.opts, 'srcs', {})
                 vargs_foreach(function(src)
@@ -670,24 +1062,17 @@ local basic_cc_toolchain; basic_cc_toolchain = object({
                 end
                 self.output = output
 
-                local defines, include_dirs, include, lib_dirs, libs = {}, {}, {}, {}, {}
-                local c_flags, cx_flags, cxx_flags, as_flags, ld_flags, ar_flags = {}, {}, {}, {}, {}, {}
-
-                ninja.deps_foreach(self, function(dep)
-                    local mergefx = (dep == self) and options_merge or options_public_merge
-
-                    mergefx(defines, dep.opts.defines)
-                    mergefx(include_dirs, dep.opts.include_dirs)
-                    mergefx(include, dep.opts.includes)
-                    mergefx(lib_dirs, dep.opts.lib_dirs)
-                    mergefx(libs, dep.opts.libs)
-                    mergefx(c_flags, dep.opts.c_flags)
-                    mergefx(cx_flags, dep.opts.cx_flags)
-                    mergefx(cxx_flags, dep.opts.cxx_flags)
-                    mergefx(as_flags, dep.opts.as_flags)
-                    mergefx(ld_flags, dep.opts.ld_flags)
-                    mergefx(ar_flags, dep.opts.ar_flags)
-                end)
+                local defines = options_collect(self, 'defines')
+                local include_dirs = options_collect(self, 'include_dirs')
+                local include = options_collect(self, 'includes')
+                local lib_dirs = options_collect(self, 'lib_dirs')
+                local libs = options_collect(self, 'libs')
+                local c_flags = options_collect(self, 'c_flags')
+                local cx_flags = options_collect(self, 'cx_flags')
+                local cxx_flags = options_collect(self, 'cxx_flags')
+                local as_flags = options_collect(self, 'as_flags')
+                local ld_flags = options_collect(self, 'ld_flags')
+                local ar_flags = options_collect(self, 'ar_flags')
 
                 local srcs = {}; ninja.deps_foreach(self, function(dep)
                     local dsrcs = dep.opts.srcs
@@ -742,9 +1127,12 @@ local basic_cc_toolchain; basic_cc_toolchain = object({
                 end)
                 self.as_options = as_options
 
-                local ld_options = options_merge({}, options_map(ld_flags, function(k, v)
+                local ld_flags_options = options_map(ld_flags, function(k, v)
                     return self:make_flag(k, v)
-                end), lib_dirs_options, libs_options)
+                end)
+                self.ld_flags_options = ld_flags_options
+
+                local ld_options = options_merge({}, ld_flags_options, lib_dirs_options, libs_options)
                 self.ld_options = ld_options
 
                 local ar_options = options_map(ar_flags, function(k, v)
@@ -775,29 +1163,38 @@ local basic_cc_toolchain; basic_cc_toolchain = object({
                 local dep_type = self.dep_type
 
                 local cc_rule_name = symgen(self.name .. '_cc_'); do
-                    C.ninja_rule_add(cc_rule_name, {
+                    C.ninja_rule_add(cc_rule_name, table.merge({
                         command = options_tostring(ccache(), self.cc, c_options),
                         depfile = '$out.d',
                         deps = dep_type,
                         description = 'CC $out',
-                    })
+                    }, self:rule_vars('cc')))
                 end
                 table.iforeach(c_file_extensions, function(ext)
                     rules[ext] = cc_rule_name
                 end)
+                table.insert(compdb_rules, cc_rule_name)
 
                 if opts.pch_header then
-                    opts.pch = path.combine(build_dir, path.fname(path.remove_extension(opts.pch_header)) .. '.pch')
+                    -- targets compiling the header with the same flags share one pch
+                    local pch_cxx_options = self:make_flag('pch', { cxx = cxx_options })
+                    local pch_key = bit.tohex(string_hash(options_tostring(self.cxx, pch_cxx_options) .. '|' .. opts.pch_header))
+                    local pch_dir = path.combine(ninja.build_dir(), 'pch', pch_key)
+
+                    opts.pch = self:make_flag('pch', { file = { pch_header = opts.pch_header, dir = pch_dir } })
+                    if type(opts.pch) ~= 'string' then
+                        opts.pch = path.combine(pch_dir, path.fname(path.remove_extension(opts.pch_header)) .. '.pch')
+                    end
 
                     local pch_command = options_tostring(self.cxx,
-                        self:make_flag('pch',
-                            { cxx = cxx_options }),
+                        pch_cxx_options,
                         self:make_flag('pch',
                             { create = { pch_header = opts.pch_header, pch = opts.pch } }))
 
-                    local pch_rule_name = symgen(self.name .. '_pch_'); do
+                    local pch_rule_name = 'pch_' .. pch_key; do
                         C.ninja_rule_add(pch_rule_name, {
                             command = pch_command,
+                            depfile = (dep_type == 'gcc') and '$out.d' or nil,
                             deps = dep_type,
                             description = 'PCH ' .. opts.pch_header,
                         })
@@ -811,33 +1208,62 @@ local basic_cc_toolchain; basic_cc_toolchain = object({
                     )
                 end
 
+                -- modules: each C++ source is scanned into <obj>.ddi, and the target's
+                -- scans are collated into a dyndep file and a <obj>.modmap per source
+                local scan_rule_name, modules_dd, modules_list, modules_scans; if opts.modules then
+                    if type(self.flag_map.modules) ~= 'function' then
+                        fatal('%s: C++ modules are not supported by this toolchain', self.name)
+                    end
+
+                    modules_dd = path.combine(build_dir, 'modules.dd')
+                    modules_list = path.combine(build_dir, 'modules.list')
+                    modules_scans = {}
+
+                    scan_rule_name = symgen(self.name .. '_scan_'); do
+                        C.ninja_rule_add(scan_rule_name, {
+                            command = options_tostring(self:make_flag('modules', { scan = { cxx = self.cxx, scan_deps = self.scan_deps, cxx_options = cxx_options } })),
+                            depfile = '$out.d',
+                            deps = dep_type,
+                            description = 'SCAN $in',
+                        })
+                    end
+                end
+
                 local cxx_rule_name = symgen(self.name .. '_cxx_'); do
                     local pch_options = opts.pch_header and
                         self:make_flag('pch', { use = { pch_header = opts.pch_header, pch = opts.pch } }) or ''
 
-                    C.ninja_rule_add(cxx_rule_name, {
-                        command = options_tostring(ccache(), self.cxx, cxx_options, pch_options),
+                    local modules_options = opts.modules and self:make_flag('modules', { use = true }) or ''
+
+                    C.ninja_rule_add(cxx_rule_name, table.merge({
+                        command = options_tostring(opts.modules and '' or ccache(), self.cxx, modules_options, cxx_options, pch_options),
                         depfile = '$out.d',
                         deps = dep_type,
                         description = 'CXX $out',
-                    })
+                    }, self:rule_vars('cxx')))
                 end
                 table.iforeach(cxx_file_extensions, function(ext)
                     rules[ext] = cxx_rule_name
                 end)
+                table.insert(compdb_rules, cxx_rule_name)
 
                 local as_rule_name = symgen(self.name .. '_as_'); do
-                    C.ninja_rule_add(as_rule_name, {
+                    C.ninja_rule_add(as_rule_name, table.merge({
                         command = options_tostring(self.as, as_options),
                         description = 'AS $out',
-                    })
+                    }, self:rule_vars('as')))
                 end
                 table.iforeach(asm_file_extensions, function(ext)
                     rules[ext] = as_rule_name
                 end)
 
-                local objs = {}; do
-                    local function add_src(src, xrules, xopts)
+                local unity, unity_split = opts.unity, nil; if unity then
+                    unity_split = unity_split_load(build_dir)
+                end
+                local unity_groups, unity_keys = {}, {}
+
+                local objs, pch_users = {}, 0; do
+                    local function add_src(src, xrules, xopts, xunity)
                         xopts = xopts or {};
 
                         local ext = path.extension(src); if ext == '.obj' or ext == '.o' then
@@ -849,6 +1275,15 @@ local basic_cc_toolchain; basic_cc_toolchain = object({
                             table.insert(objs, src); return
                         end
 
+                        if unity and xunity and type(rule) == 'string' and not unity_split[src]
+                            and file_is_typeof(src, unity_file_extensions)
+                            and not (opts.modules and file_is_typeof(src, cxx_file_extensions)) then
+                            local key = rule .. '|' .. path.parent(src); local group = unity_groups[key]; if group == nil then
+                                group = { rule = rule, files = {} }; unity_groups[key] = group; table.insert(unity_keys, key)
+                            end
+                            table.insert(group.files, src); return
+                        end
+
                         local obj, vars; if type(rule) == 'string' then
                             obj = path.combine(build_dir, src .. '.o')
                         else
@@ -859,7 +1294,18 @@ local basic_cc_toolchain; basic_cc_toolchain = object({
                         table.insert(objs, obj)
 
                         if opts.pch_header and file_is_typeof(src, cxx_file_extensions) then
-                            src = { src, implicit = opts.pch }
+                            src = { src, implicit = { opts.pch } }; if rule == cxx_rule_name then pch_users = pch_users + 1 end
+                        end
+
+                        if opts.modules and rule == cxx_rule_name and path.extension(obj) == '.o' then
+                            local file = type(src) == 'table' and src[1] or src
+
+                            C.ninja_edge_add(obj .. '.ddi', scan_rule_name, file, { obj = obj })
+                            table.insert(modules_scans, obj .. '.ddi')
+
+                            src = type(src) == 'table' and src or { src, implicit = {} }
+                            src.implicit = src.implicit or {}; table.insert(src.implicit, obj .. '.modmap')
+                            src.order_only = modules_dd; vars = { dyndep = modules_dd }
                         end
 
                         C.ninja_edge_add(obj, rule, src, vars)
@@ -869,7 +1315,9 @@ local basic_cc_toolchain; basic_cc_toolchain = object({
                         if type(src) == 'table' then
                             local src_opts = table_as_option(src)
 
-                            local xtarget = self:new(); for k, v in pairs(src) do
+                            local xtarget = self:new(); xtarget.name = symgen(self.name .. '_src_')
+
+                            for k, v in pairs(src) do
                                 if type(k) == 'number' then
                                     goto continue
                                 else
@@ -894,7 +1342,7 @@ local basic_cc_toolchain; basic_cc_toolchain = object({
                                     local x = type(xopts.tool); if x == 'string' then
                                         n = xopts.tool; t = ninja.tool[n]
                                     else
-                                        n = symgen(); if x == 'function' then
+                                        n = 'fx'; if x == 'function' then
                                             t = { fx = xopts.tool, opts = {} }
                                         else
                                             t = xopts.tool
@@ -925,41 +1373,43 @@ local basic_cc_toolchain; basic_cc_toolchain = object({
 
                                 if file_is_typeof(src, c_file_extensions) then
                                     local cc_rule_name = symgen(self.name .. '_cc_'); do
-                                        C.ninja_rule_add(cc_rule_name, {
+                                        C.ninja_rule_add(cc_rule_name, table.merge({
                                             command = options_tostring(ccache(), self.cc,
                                                 options_merge({}, c_options, xc_options)),
                                             depfile = '$out.d',
                                             deps = dep_type,
                                             description = 'CC $out',
-                                        })
+                                        }, self:rule_vars('cc')))
                                     end
                                     table.iforeach(c_file_extensions, function(ext)
                                         xrules[ext] = cc_rule_name
                                     end)
+                                    table.insert(compdb_rules, cc_rule_name)
                                 end
 
                                 if file_is_typeof(src, cxx_file_extensions) then
                                     local cxx_rule_name = symgen(self.name .. '_cxx_'); do
-                                        C.ninja_rule_add(cxx_rule_name, {
+                                        C.ninja_rule_add(cxx_rule_name, table.merge({
                                             command = options_tostring(ccache(), self.cxx,
                                                 options_merge({}, cxx_options, xcxx_options)),
                                             depfile = '$out.d',
                                             deps = dep_type,
                                             description = 'CXX $out',
-                                        })
+                                        }, self:rule_vars('cxx')))
                                     end
                                     table.iforeach(cxx_file_extensions, function(ext)
                                         xrules[ext] = cxx_rule_name
                                     end)
+                                    table.insert(compdb_rules, cxx_rule_name)
                                 end
 
                                 if file_is_typeof(src, asm_file_extensions) then
                                     local as_rule_name = symgen(self.name .. '_as_'); do
-                                        C.ninja_rule_add(as_rule_name, {
+                                        C.ninja_rule_add(as_rule_name, table.merge({
                                             command = options_tostring(self.as,
                                                 options_merge({}, as_options, xas_options)),
                                             description = 'AS $out',
-                                        })
+                                        }, self:rule_vars('as')))
                                     end
                                     table.iforeach(asm_file_extensions, function(ext)
                                         xrules[ext] = as_rule_name
@@ -986,16 +1436,82 @@ local basic_cc_toolchain; basic_cc_toolchain = object({
                                 end
 
                                 source_foreach(src, function(f)
-                                    add_src(f, xrules, src_opts)
+                                    add_src(f, xrules, src_opts, xopts.unity ~= false)
                                 end)
                             end
                         else
                             source_foreach(src, function(f)
-                                add_src(f, rules)
+                                add_src(f, rules, nil, true)
                             end)
                         end
                     end
-                end; self.objs = objs
+
+                    local chunks = {}; for _, key in ipairs(unity_keys) do
+                        local group = unity_groups[key]
+
+                        for _, files in ipairs(unity_chunks(group.files, unity)) do
+                            if #files == 1 then
+                                add_src(files[1], { [path.extension(files[1])] = group.rule }, nil, false)
+                            else
+                                local cxx = file_is_typeof(files[1], cxx_file_extensions)
+                                local name = string.format('unity_%s%s', bit.tohex(string_hash(files[1])),
+                                    cxx and '.cpp' or '.c')
+                                local unity_src = path.combine(build_dir, 'unity', name)
+
+                                local content = {}; for _, f in ipairs(files) do
+                                    table.insert(content, string.format('#include "%s"\n',
+                                        include_path(path.parent(unity_src), f)))
+                                end
+                                file_write_if_changed(unity_src, table.concat(content))
+
+                                local obj = unity_src .. '.o'; table.insert(objs, obj)
+
+                                local implicits = table.merge({}, files); if opts.pch_header and cxx then
+                                    table.insert(implicits, opts.pch); if group.rule == cxx_rule_name then pch_users = pch_users + 1 end
+                                end
+
+                                C.ninja_edge_add(obj, group.rule, { unity_src, implicit = implicits }, nil)
+
+                                table.insert(chunks, { obj = obj, rule = group.rule, files = files })
+                            end
+                        end
+                    end
+                    self.unity_chunks = unity and chunks or nil
+
+                    if modules_scans and #modules_scans > 0 then
+                        -- modules of the targets this one depends on
+                        local dep_lists = {}; ninja.deps_foreach(self, function(dep)
+                            if dep ~= self and dep.opts.modules then
+                                table.insert(dep_lists, path.combine(ninja.build_dir(), dep.name, 'modules.list'))
+                            end
+                        end)
+
+                        local collate = { path.try_quote(ffi.string(C.program_path())), 'collate',
+                            '--format', self:make_flag('modules', { format = true }),
+                            '--bmi-dir', path.combine(build_dir, 'bmi'),
+                            '--ext', self:make_flag('modules', { bmi_extension = true }),
+                            '--dd $out --modules', modules_list }
+                        for _, x in ipairs(dep_lists) do
+                            table.insert(collate, '--dep-modules'); table.insert(collate, x)
+                        end
+                        table.insert(collate, '$in')
+
+                        local collate_rule_name = symgen(self.name .. '_collate_'); do
+                            C.ninja_rule_add(collate_rule_name, {
+                                command = table.concat(collate, ' '),
+                                description = 'COLLATE $out',
+                                restat = '1',
+                            })
+                        end
+
+                        local modmaps = { modules_list }; for _, x in ipairs(modules_scans) do
+                            table.insert(modmaps, path.remove_extension(x) .. '.modmap')
+                        end
+
+                        C.ninja_edge_add({ modules_dd, implicit = modmaps }, collate_rule_name,
+                            table.merge({ implicit = dep_lists }, modules_scans), nil)
+                    end
+                end; self.objs = objs; self.pch_users = pch_users
 
                 if opts.type == 'phony' then
                     if table.isempty(objs) then
@@ -1020,33 +1536,60 @@ local basic_cc_toolchain; basic_cc_toolchain = object({
                         inputs.implicit = implicits
                     end
 
-                    local ld_rule_name, ld_cmd, ld_desc, ld_vars; if opts.type == 'static' then
+                    local thin = opts.thin_archive; if thin == nil then thin = ninja.thin_archive end
+                    thin = thin and self.thin_ar and path.try_quote(ffi.string(C.program_path())) .. ' ar'
+
+                    local ld_rule_name, ld_cmd, ld_desc, ld_vars, ld_kind; if opts.type == 'static' then
                         ld_rule_name = symgen(self.name .. '_ar_')
-                        ld_cmd = options_tostring(self.ar, ar_options)
+                        ld_cmd = thin and (thin .. ' $out $in') or options_tostring(self.ar, ar_options)
                         ld_desc = 'AR $out'
+                        ld_kind = 'ar'
                     else
                         ld_rule_name = symgen(self.name .. '_ld_')
-                        ld_cmd = options_tostring(self.ld, ld_options, self.default_libs)
+                        ld_cmd = options_tostring(self.ld, ld_options, self:linker_options(), self.default_libs)
                         ld_desc = 'LD $out'
+                        ld_kind = 'ld'
                     end
 
+                    -- $in goes through a response file only when the command
+                    -- would not fit on a command line. ninja writes it from the
+                    -- input list and keeps it, so an unchanged one is not
+                    -- written again
                     do
-                        local c = 0; for _, obj in ipairs(objs) do
-                            c = c + string.len(obj)
+                        local c = string.len(string.replace(ld_cmd, '$out', output)); for _, x in ipairs(inputs) do
+                            c = c + string.len(x) + 1
                         end
 
-                        if c > 1024 then
+                        if c > command_line_max then
                             ld_cmd = string.replace(ld_cmd, '$in', '@$out.rsp'); ld_vars = {
                                 rspfile = '$out.rsp',
-                                rspfile_content = '$in'
+                                rspfile_content = '$in',
+                                rspfile_keep = 1
                             }
                         end
                     end
 
+                    -- an archive that is already there gets the objects that
+                    -- changed replaced in place. archivers match members by
+                    -- file name, so not when two objects share one; a thin
+                    -- archive's members are paths
+                    if ld_kind == 'ar' and thin then
+                        ld_vars = table.merge({ update_command = thin .. ' --update $out $in_changed' }, ld_vars)
+                    elseif ld_kind == 'ar' and self.ar_update and self.ar_update ~= '' then
+                        local names, unique = {}, true; for _, obj in ipairs(objs) do
+                            local name = path.fname(obj); if names[name] then unique = false; break end
+                            names[name] = true
+                        end
+
+                        if unique then
+                            ld_vars = table.merge({ update_command = options_tostring(self.ar_update, ar_options) }, ld_vars)
+                        end
+                    end
+
                     C.ninja_rule_add(ld_rule_name, table.merge({
                         command = ld_cmd,
                         description = ld_desc,
-                    }, ld_vars))
+                    }, self:rule_vars(ld_kind), ld_vars))
 
                     C.ninja_edge_add(output, ld_rule_name, inputs, nil)
 
@@ -1061,24 +1604,40 @@ local basic_cc_toolchain; basic_cc_toolchain = object({
             end,
 
             build = function(self)
+                build_step()
+
+                if daemon_deferred then
+                    table.insert(daemon_deferred, self); return -1
+                end
+
                 if not self.configured then
                     self:configure()
                 end
 
-                setupaction_run(self.opts.setup, 'build')
+                local setup = self.setup_task; if setup then
+                    self.setup_task = nil; async.join(setup)
+                else
+                    setupaction_run(self.opts.setup, 'build')
+                end
 
-                if self.output then
-                    if C.ninja_build(self.output) == 0 then
-                        if self.after_build_actions then
-                            for _, fx in ipairs(self.after_build_actions) do
-                                fx(self)
-                            end
+                local rc = -1; if self.output then
+                    rc = C.ninja_build(self.output); if rc > 0 and self.unity_chunks then
+                        self:unity_split()
+                    end
+                    if rc == 0 and self.opts.pch then self:pch_report() end
+                    if rc == 0 and self.after_build_actions then
+                        local hooks = async.spawn(after_build_run, self); if build_depth > 0 then
+                            after_build_tasks[self] = hooks
+                        else
+                            async.join(hooks)
                         end
                     end
                 end
+                return rc
             end,
 
             clean = function(self)
+                if self.output then C.ninja_clean(self.output, false) end
                 fs.remove_all_in(self.build_dir)
                 setupaction_run(self.opts.setup, 'clean')
             end,
@@ -1086,11 +1645,22 @@ local basic_cc_toolchain; basic_cc_toolchain = object({
     },
 });
 
+-- how the gcc toolchains compile $in into $out
+local GCC_COMPILE_FLAGS = '-MMD -MF $out.d -o $out -c $in'
+
+-- cxx_options without GCC_COMPILE_FLAGS, for commands that do not compile
+local function gcc_without_compile(cxx_options)
+    return options_map(cxx_options, function(k, v)
+        if v == GCC_COMPILE_FLAGS then return nil end
+        return k, v
+    end)
+end
+
 local gcc_toolchain; gcc_toolchain = object({
     target = {
         new = function(...)
             local t = extends(basic_cc_toolchain.target.new(...), gcc_toolchain.target.basic); do
-                t:cx_flags('-MMD -MF $out.d -o $out -c $in')
+                t:cx_flags(GCC_COMPILE_FLAGS)
             end
             return t
         end,
@@ -1100,7 +1670,15 @@ local gcc_toolchain; gcc_toolchain = object({
             cxx = 'g++',
             as = 'as -o $out $in',
             ar = 'ar rcs $out $in',
+            -- replaces the members that changed in the existing archive, see
+            -- update_command; '' for archivers that always write a new one
+            ar_update = 'ar rcs $out $in_changed',
+            -- whether objects are ELF, which njx ar reads, see ninja.thin_archive
+            thin_ar = HOST_OS == 'Linux',
             ld = 'g++ $in -o $out',
+            -- tried in order for ninja.linker 'auto'. no incremental_ld: gold's
+            -- --incremental wants -no-pie and -z norelro, and its updates crash
+            linkers = { 'mold', 'lld' },
 
             dep_type = 'gcc',
 
@@ -1116,11 +1694,48 @@ local gcc_toolchain; gcc_toolchain = object({
                 shared = '-shared',
                 debug_cc = '-g',
                 debug_ld = '-g',
-                pch_create = function(pch_header)
-                    return '-include ' .. pch_header
+                linker = '-fuse-ld=',
+                -- <dir>/<header>.gch, used through -include <dir>/<header>: gcc
+                -- takes the .gch when it matches the compile's flags and reads
+                -- <dir>/<header>, which includes the real one, when it does not.
+                pch = function(opts)
+                    if opts.cxx then
+                        return { '-x c++-header', opts.cxx }
+                    elseif opts.input then
+                        return { opts.input.pch_header }
+                    elseif opts.output then
+                        return { opts.output.pch }
+                    elseif opts.file then
+                        opts = opts.file; local header = path.combine(opts.dir, path.fname(opts.pch_header))
+                        file_write_if_changed(header, string.format('#include "%s"\n', include_path(opts.dir, opts.pch_header)))
+                        return header .. '.gch'
+                    elseif opts.create then
+                        return ''
+                    elseif opts.use then
+                        return '-include ' .. path.remove_extension(opts.use.pch) .. ' -Winvalid-pch'
+                    end
+
+                    return nil
                 end,
-                pch_use = function(pch_header)
-                    return '-include ' .. pch_header
+                -- gcc 14 or later: P1689 scans through -fdeps-*, and a module
+                -- mapper file per source; sources are read as C++ whatever
+                -- their extension, .cppm and .ixx included. -Mno-modules keeps
+                -- gcc's make-style module rules out of the depfile, which
+                -- ninja cannot read; the dyndep file carries them instead
+                modules = function(opts)
+                    if opts.scan then
+                        opts = opts.scan; return { opts.cxx, '-fmodules-ts', gcc_without_compile(opts.cxx_options),
+                            '-x c++ -E $in -MT $out -MD -MF $out.d -Mno-modules',
+                            '-fdeps-format=p1689r5 -fdeps-file=$out -fdeps-target=$obj -o $out.i' }
+                    elseif opts.use then
+                        return '-fmodules-ts -Mno-modules -fmodule-mapper=$out.modmap -x c++'
+                    elseif opts.format then
+                        return 'gcc'
+                    elseif opts.bmi_extension then
+                        return '.gcm'
+                    end
+
+                    return nil
                 end,
             },
         },
@@ -1137,7 +1752,10 @@ local cosmocc_toolchain; cosmocc_toolchain = object({
             cc = 'cosmocc',
             cxx = 'cosmoc++',
             ar = 'cosmoar rcs $out $in',
+            ar_update = '',
+            thin_ar = false,
             ld = 'cosmoc++ $in -o $out',
+            linkers = {},
         },
     },
 }); ninja.toolchains.cosmocc = cosmocc_toolchain
@@ -1152,10 +1770,37 @@ local clang_toolchain; clang_toolchain = object({
             cc = 'clang',
             cxx = 'clang++',
             ar = 'llvm-ar rcs $out $in',
+            ar_update = 'llvm-ar rcs $out $in_changed',
             ld = 'clang++ $in -o $out',
+            scan_deps = 'clang-scan-deps',
 
             flag_map = extends({}, gcc_toolchain.target.basic.flag_map, {
                 debug_cc = '-g -gcodeview',
+                pch = function(opts)
+                    if opts.file then
+                        opts = opts.file; return path.combine(opts.dir, path.fname(opts.pch_header) .. '.pch')
+                    elseif opts.use then
+                        return '-include-pch ' .. opts.use.pch
+                    end
+
+                    return gcc_toolchain.target.basic.flag_map.pch(opts)
+                end,
+                -- clang 17 or later: P1689 scans by clang-scan-deps, and a
+                -- response file per source with -fmodule-output/-fmodule-file
+                modules = function(opts)
+                    if opts.scan then
+                        opts = opts.scan; return { opts.scan_deps, '-format=p1689 -o $out --', opts.cxx,
+                            gcc_without_compile(opts.cxx_options), '-c $in -o $obj -MT $out -MD -MF $out.d' }
+                    elseif opts.use then
+                        return '@$out.modmap'
+                    elseif opts.format then
+                        return 'clang'
+                    elseif opts.bmi_extension then
+                        return '.pcm'
+                    end
+
+                    return nil
+                end,
             }),
         },
     },
@@ -1171,7 +1816,10 @@ local zig_toolchain; zig_toolchain = object({
             cc = 'zig cc',
             cxx = 'zig c++',
             ar = 'zig lib $out $in',
+            ar_update = '',
+            thin_ar = false,
             ld = 'zig cc $in -o $out',
+            linkers = {},
         },
     },
 }); ninja.toolchains.zig = zig_toolchain
@@ -1233,6 +1881,8 @@ local msvc_toolchain; msvc_toolchain = object({
             as = 'ml64',
             ar = 'lib',
             ld = 'link',
+            -- comes after debug_ld's /INCREMENTAL:NO, which it overrides
+            incremental_ld = '/INCREMENTAL /ILK:$out.ilk',
 
             dep_type = 'msvc',
 
@@ -1290,6 +1940,8 @@ local clangcl_toolchain; clangcl_toolchain = object({
             cxx = 'clang-cl',
             ar = 'llvm-lib',
             ld = 'lld-link',
+            -- lld-link ignores /INCREMENTAL
+            incremental_ld = '',
 
             -- flag_map = extends({}, msvc_toolchain.target.basic.flag_map, {
             --     debug_cc = '/Zi',
@@ -1339,29 +1991,58 @@ function ninja.target(name, opts)
     return ninja.toolchain_of(opts.toolchain).target.new(name, opts)
 end
 
--- walk through the target dependencies
-local function target_walk(target, fx, ctx, depth)
-    target = ninja.target_of(target); if target == nil then
-        return
+-- the targets `target` depends on, dependencies first, each once: those a
+-- build of it needs (depth 0), or those it passes on as a dependency (depth
+-- 1, without its private deps). made of its deps' own orders and kept, see
+-- deps_orders, so walks are a scan of an array
+local function deps_order(target, depth)
+    local orders = deps_orders[target]; if orders == nil or orders.generation ~= deps_generation then
+        orders = { generation = deps_generation }; deps_orders[target] = orders
+    end
+
+    local key = (depth == 0) and 'own' or 'shared'; local order = orders[key]; if order then
+        return order
     end
 
-    if ctx[target] then return end
+    order = {}; local seen = {}
+
+    local function add(dep)
+        dep = ninja.target_of(dep); if seen[dep] then return end
+
+        local xs = deps_order(dep, 1); for i = 1, #xs do
+            local x = xs[i]; if not seen[x] then
+                seen[x] = true; order[#order + 1] = x
+            end
+        end
+
+        seen[dep] = true; order[#order + 1] = dep
+    end
 
     if target.opts.deps then
-        depth = depth or 0
         table.iforeach(target.opts.deps, function(dep)
             if (type(dep) == 'table') and (xtype(dep) ~= 'target') then
-                if (xtype(dep) ~= 'private') or ((xtype(dep) == 'private') and (depth == 0)) then
-                    table.iforeach(dep, function(d)
-                        target_walk(d, fx, ctx, depth + 1)
-                    end)
+                if (xtype(dep) ~= 'private') or (depth == 0) then
+                    table.iforeach(dep, add)
                 end
             else
-                target_walk(dep, fx, ctx, depth + 1)
+                add(dep)
             end
         end)
     end
 
+    orders[key] = order; return order
+end
+
+-- walk through the target dependencies
+local function target_walk(target, fx, ctx)
+    target = ninja.target_of(target); if ctx[target] then return end
+
+    local order = deps_order(target, 0); for i = 1, #order do
+        local t = order[i]; if not ctx[t] then
+            fx(t); ctx[t] = true
+        end
+    end
+
     fx(target); ctx[target] = true
 end
 
@@ -1387,9 +2068,9 @@ end
 function ninja.deps_foreach(target, fx)
     target = ninja.target_of(target)
 
-    local ctx = {}; target_walk(target, function(t)
-        if t ~= target then fx(t) end
-    end, ctx)
+    local order = deps_order(target, 0); for i = 1, #order do
+        fx(order[i])
+    end
 
     fx(target)
 end
@@ -1402,40 +2083,150 @@ function ninja.defaults_foreach(fx)
     end)
 end
 
-function ninja.build(...)
-    if select('#', ...) == 0 then
+local function build_targets(...)
+    local targets = {}; if select('#', ...) == 0 then
         ninja.defaults_foreach(function(target)
-            target:build()
-        end); return
+            table.insert(targets, target)
+        end)
+    else
+        -- one walk for all of them, so shared dependencies are built once
+        local ctx = {}; vargs_foreach(function(target)
+            vargs_foreach(function(t)
+                target_walk(t, function(x)
+                    table.insert(targets, x)
+                end, ctx)
+            end, ninja.target_of(target))
+        end, ...)
     end
 
-    vargs_foreach(function(target)
-        vargs_foreach(function(t)
-            ninja.targets_foreach(t, function(x)
-                x:build()
-            end)
-        end, ninja.target_of(target))
-    end, ...)
+    local building = {}; for _, target in ipairs(targets) do
+        building[target] = true
+    end
+
+    -- the dependencies of each target built here, whose outputs and
+    -- after_build copies its setup and build may use
+    local built_deps = {}; for _, target in ipairs(targets) do
+        local deps = {}; ninja.deps_foreach(target, function(dep)
+            if dep ~= target and building[dep] then table.insert(deps, dep) end
+        end)
+        built_deps[target] = deps
+    end
+
+    -- the setup actions of targets that depend on none of the others start
+    -- now, as async tasks, and are done by the time their own build starts:
+    -- their copies and execs overlap with each other and with the builds of
+    -- the targets before them. the rest run once their dependencies are done.
+    if not daemon_deferred then
+        for _, target in ipairs(targets) do
+            if target.opts and target.opts.setup and #built_deps[target] == 0 then
+                target.setup_task = async.spawn(setupaction_run, target.opts.setup, 'build')
+            end
+        end
+    end
+
+    build_depth = build_depth + 1; for _, target in ipairs(targets) do
+        for _, dep in ipairs(built_deps[target]) do
+            local hooks = after_build_tasks[dep]; if hooks then
+                after_build_tasks[dep] = nil; async.join(hooks)
+            end
+        end
+        target:build(); async.pump(0)
+    end; build_depth = build_depth - 1
+
+    local hooks = {}; for _, task in pairs(after_build_tasks) do
+        table.insert(hooks, task)
+    end
+    after_build_tasks = {}; async.join(hooks)
+end
+
+function ninja.build(...)
+    build_step(); gc.region(build_targets, ...)
 end
 
+-- the outputs of all targets are cleaned by one pass over the graph, which
+-- unlinks them on several threads; each target then drops what is left in
+-- its build dir and runs its clean actions.
 function ninja.clean(...)
+    local targets, outputs = {}, {}
+
     vargs_foreach(function(target)
         vargs_foreach(function(t)
             ninja.targets_foreach(t, function(x)
-                x:clean()
+                table.insert(targets, x); if x.output then table.insert(outputs, x.output) end
             end)
         end, ninja.target_of(target))
     end, ...)
+
+    if #outputs > 0 then C.ninja_clean(outputs, true) end
+
+    for _, x in ipairs(targets) do
+        fs.remove_all_in(x.build_dir)
+        setupaction_run(x.opts.setup, 'clean')
+    end
+end
+
+-- configure the targets (all of them when none are given) and their
+-- dependencies, without building anything
+local function configure_targets(...)
+    local targets = {}; if select('#', ...) == 0 then
+        ninja.targets_foreach(function(t) table.insert(targets, t) end)
+    else
+        local ctx = {}; vargs_foreach(function(target)
+            vargs_foreach(function(t)
+                target_walk(t, function(x)
+                    table.insert(targets, x)
+                end, ctx)
+            end, ninja.target_of(target))
+        end, ...)
+    end
+
+    for _, t in ipairs(targets) do t:configure() end
+end
+
+-- write the compilation database of the C/C++ sources of the targets (all
+-- of them when none are given) to `file`, compile_commands.json by default.
+-- the file is only replaced when entries changed; returns their number.
+function ninja.compdb(file, ...)
+    configure_targets(...)
+
+    return C.ninja_compdb(file or 'compile_commands.json', compdb_rules)
+end
+
+-- configure the targets (all of them when none are given), then write the
+-- graph to `file` as 'json' (the default), 'dot' or 'binary'
+function ninja.graph_export(file, format, ...)
+    configure_targets(...)
+
+    return C.ninja_graph_export(file, format or 'json') > 0
 end
 
 function ninja.reset()
-    C.ninja_reset()
+    C.ninja_reset(); compdb_rules = {}
 end
 
 function ninja.exit_on_error(b)
     C.ninja_exit_on_error(b)
 end
 
+-- keep compiler chatter out of the console: output of successful commands
+-- goes to $builddir/.ninja_output/<output>.log, with / escaped as %2F, only
+-- a summary is printed
+function ninja.output_log(b)
+    C.ninja_output_log(b)
+end
+
+-- addresses ('host:port') of `njx worker` processes that run jobs of
+-- targets marked :remote(); other jobs keep running locally
+function ninja.remote_workers(...)
+    for _, address in ipairs({...}) do C.ninja_remote_worker_add(address) end
+end
+
+-- the secret `njx worker` challenges every connection for, instead of
+-- $NJX_REMOTE_SECRET
+function ninja.remote_secret(secret)
+    C.ninja_remote_secret(secret)
+end
+
 function ninja.watch(dir, wildcard, ...)
     local targets = {}; vargs_foreach(function(target)
         if type(target) == 'function' then
@@ -1477,7 +2268,7 @@ function ninja.watch(dir, wildcard, ...)
                     ninja.build(unpack(targets))
                 end
 
-                is_building = false; last_build_time = os.clock()
+                is_building = false; last_build_time = os.clock(); gc.idle()
 
                 return 'break'
             end
@@ -1487,4 +2278,59 @@ function ninja.watch(dir, wildcard, ...)
     ninja.exit_on_error(false); _G.run()
 end
 
+-- serve build requests from `njx` clients until the build script changes,
+-- keeping the loaded state and logs resident in between
+function ninja.serve()
+    local defaults = daemon_deferred or {}; daemon_deferred = nil
+
+    local fd = C.daemon_listen(C.daemon_path())
+
+    -- every request is checked by ninja's own scan: the watch cannot see all
+    -- the inputs (headers outside the script's directory, for one), so it
+    -- only looks out for edits to the build script.
+    local stop = false
+
+    fs.watch(path.parent(ffi.string(C.build_script())), function(fpath)
+        if C.is_build_script(fpath) then
+            C.reload(); stop = true; return 'break'
+        end
+    end, 0)
+
+    ninja.exit_on_error(false)
+
+    while not stop do
+        poll()
+
+        local cfd = C.daemon_accept(fd, 8); if cfd >= 0 then
+            local request = C.daemon_request(cfd)
+
+            C.daemon_redirect(cfd)
+
+            ninja.reset()
+
+            local rc = -1; local function build(target)
+                rc = math.max(rc, target:build())
+            end
+
+            local names = string.split(request, '\n'); gc.region(function()
+                if #names == 0 then
+                    table.iforeach(defaults, build)
+                else
+                    for _, name in ipairs(names) do
+                        if ninja.targets[name] then
+                            ninja.targets_foreach(name, build)
+                        else
+                            print('ninja: error: unknown target \'' .. name .. '\''); rc = 1
+                        end
+                    end
+                end
+            end)
+
+            C.daemon_reply(cfd, rc); gc.idle()
+        end
+    end
+
+    C.daemon_close(fd)
+end
+
 return ninja
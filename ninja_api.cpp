@@ -1,24 +1,37 @@
+#include <archive.h>
 #include <state.h>
 #include <eval_env.h>
 #include <build.h>
+#include <remote.h>
 #include <clean.h>
 #include <disk_interface.h>
+#include <graph_export.h>
 #include <build_log.h>
 #include <deps_log.h>
 #include <status.h>
 #include <metrics.h>
+#include <modules.h>
 #include <util.h>
 
 #include "ljx.h"
 #include "ljxx.h"
 #include "dyn.h"
+#include "clib.h"
 
 #include <filesystem>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
 
 #define _COSMO_SOURCE
 #include <libc/dce.h>
 
 #include <fnmatch.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 namespace fs = std::filesystem;
 
@@ -26,6 +39,8 @@ fs::path $build_script;
 
 bool $reload_build_script = false;
 
+bool $daemon = false;
+
 struct reftable {
     static constexpr uint32_t NOFREE_REF = (uint32_t)-1;
 
@@ -58,8 +73,13 @@ lua_gcptr reftable_new(uint32_t size) {
     return {t.value};
 }
 
+// grows the table when it is full: a registry of thousands of timers outgrows any initial size.
 int reftable_ref(lua_table t, lua_gcptr x) {
-    auto rtab = reftable::from(t); return rtab->ref(x.tvalue());
+    auto rtab = reftable::from(t); if(rtab->flist == reftable::NOFREE_REF && rtab->size + 1 >= t.asize()) {
+        t.reasize(2 * t.asize()); rtab = reftable::from(t);
+    }
+
+    int r = rtab->ref(x.tvalue()); lj_gc_anybarriert($L.L, t.value); return r;
 }
 
 void reftable_unref(lua_table t, int r) {
@@ -68,19 +88,16 @@ void reftable_unref(lua_table t, int r) {
 
 static dtimer $timer;
 
-int timer_add(int ms, int fx, int repeat) { return $timer.add(ms, fx, repeat); }
+int timer_add(int ms, int repeat) { return $timer.add(ms, repeat); }
 
 void timer_remove(int id) { $timer.remove(id); }
 
+// the ids of the timers due since the last update into xs[0], xs[1], ...; their number.
 int timer_update(lua_table xs) {
-    int c = 0; $timer.update([&](auto it_begin, auto it_end) {
-        c = std::distance(it_begin, it_end); xs.ensure_asize(c);
+    int c = 0; $timer.update([&](int const * ids, size_t n) {
+        c = (int)n; xs.ensure_asize(c);
 
-        auto ts = (double *)xs.array(); int i = 0;
-
-        for(auto it = it_begin; it != it_end; ++it) {
-            ts[i++] = it->second->value;
-        }
+        auto ts = (double *)xs.array(); for(size_t i = 0; i < n; i++) ts[i] = (double)ids[i];
     });
 
     return c;
@@ -150,7 +167,6 @@ extern bool g_explaining;
 
 extern Metrics * g_metrics;
 
-static std::string $buf;
 static BuildConfig $config;
 
 static dtag<NinjaMain> tninja;
@@ -178,9 +194,31 @@ void ninja_clear() { $state->paths_.clear(); $state->edges_.clear(); }
 
 void ninja_dump() { $state->Dump(); }
 
-const char * ninja_var_get(const char * key) { $buf = $state->bindings_.LookupVariable(key); return $buf.c_str(); }
+// a rule, edge or default as plain strings, applied to $state.
+struct ninja_def {
+    enum kind_t { RULE, EDGE, DEFAULT } kind;
+
+    std::string rule; std::vector<std::pair<std::string, std::string>> vars;
+
+    // EDGE: outputs, implicit outputs, inputs, implicit inputs, order-only inputs, validations.
+    // DEFAULT: paths[0].
+    enum { OUTS, IMPLICIT_OUTS, INS, IMPLICIT_INS, ORDER_ONLY, VALIDATIONS, NPATHS };
+
+    // NUL-terminated: the bytes of the lua strings, alive for the call that applies them.
+    std::vector<std::string_view> paths[NPATHS];
+};
+
+static std::string $buf;
+
+static void ninja_def_apply(ninja_def & def);
+
+const char * ninja_var_get(const char * key) {
+    $buf = $state->bindings_.LookupVariable(key); return $buf.c_str();
+}
 
-void ninja_var_set(const char * key, const char * value) { $state->bindings_.AddBinding(key, value); }
+void ninja_var_set(const char * key, const char * value) {
+    $state->bindings_.AddBinding(key, value);
+}
 
 void ninja_pool_add(const char * name, int depth) {
     ($state->LookupPool(name) != nullptr) || fatal("duplicate pool '%s'", name);
@@ -189,36 +227,101 @@ void ninja_pool_add(const char * name, int depth) {
     $state->AddPool(new Pool(name, depth));
 }
 
+static void ninja_vars_read(lua_table vars, std::vector<std::pair<std::string, std::string>> * out) {
+    if(vars) vars.for_pairs([&](lua_value const & k, lua_value const & v) {
+        if(k.is_string() && v.is_string()) out->emplace_back(k.c_str(), v.c_str());
+    });
+}
+
+static void ninja_paths_read(lua_value const & x, ninja_def * def, int slot) {
+    auto add = [&](std::string_view s) {
+        def->paths[slot].emplace_back(s);
+    };
+
+    if(x.is_string()) add(x.to_string());
+    else if(x.is_table()) lua_table(x).for_ipairs([&](int, lua_value const & v) {
+        if(v.is_string()) add(v.to_string());
+    });
+}
+
 void ninja_rule_add(const char * name, lua_table vars) {
+    ninja_def def {ninja_def::RULE, name}; ninja_vars_read(vars, &def.vars); ninja_def_apply(def);
+}
+
+// the bindings each rule was defined with: a rule defined again with the
+// same ones, as by targets sharing a precompiled header, is the same rule.
+static std::unordered_map<std::string, std::string> $rule_defs;
+
+static void ninja_rule_apply(ninja_def const & def) {
+    const char * name = def.rule.c_str();
+
+    std::string vars; for(auto & [k, v] : def.vars) {
+        vars += k; vars += '\0'; vars += v; vars += '\0';
+    }
+
+    auto [it, added] = $rule_defs.try_emplace(def.rule, vars); if(!added) {
+        if(it->second == vars) return;
+
+        fatal("duplicate rule '%s'", name);
+    }
+
     ($env->LookupRuleCurrentScope(name) == nullptr) || fatal("duplicate rule '%s'", name);
 
     auto r = new Rule(name);
 
-    vars.for_pairs([&](lua_value const & k, lua_value const & v) {
-        if(k.is_string() && v.is_string()) {
-            Rule::IsReservedBinding(k.c_str()) || fatal("unexpected variable '%s'", k.c_str());
-
-            EvalString es; {
-                ninja_evalstring_read(v.c_str(), &es, false);
-            }
+    for(auto & [k, v] : def.vars) {
+        Rule::IsReservedBinding(k) || fatal("unexpected variable '%s'", k.c_str());
 
-            r->AddBinding(k.c_str(), es);
+        EvalString es; {
+            ninja_evalstring_read(v.c_str(), &es, false);
         }
-    });
+
+        r->AddBinding(k, es);
+    }
 
     $state->bindings_.AddRule(r);
 }
 
-std::string ninja_path_read(BindingEnv * env, const char * s, uint64_t * slash_bits = 0) {
-    EvalString es; ninja_evalstring_read(s, &es, true);
+// whether s can be used as a node path as it is: no `$`, nothing the path
+// reader stops at, and already in the form CanonicalizePath() would give it.
+static bool ninja_path_literal(std::string_view s) {
+    if(s.empty() || s.back() == '/') return false;
 
-    std::string path = es.Evaluate(env); if(path.empty()) {
-        fatal("empty path");
+    size_t component = 0; for(size_t i = 0; i <= s.size(); ++i) {
+        if(i == s.size() || s[i] == '/') {
+            size_t n = i - component; if(i > 0 && n == 0) return false;
+
+            if(n == 1 && s[component] == '.') return false;
+            if(n == 2 && s[component] == '.' && s[component + 1] == '.') return false;
+
+            component = i + 1; continue;
+        }
+
+        switch(s[i]) {
+        case '$': case ' ': case ':': case '|': case '\\': case '\n': case '\r': return false;
+        }
     }
 
-    uint64_t bits;
+    return true;
+}
+
+// the path s names in env, canonicalized. literal paths are returned as they
+// are, without a copy; others are evaluated into a buffer, valid
+// until the next call.
+StringPiece ninja_path_read(BindingEnv * env, std::string_view s, uint64_t * slash_bits = 0) {
+    uint64_t bits; if(!slash_bits) slash_bits = &bits;
+
+    if(ninja_path_literal(s)) { *slash_bits = 0; return StringPiece(s.data(), s.size()); }
 
-    CanonicalizePath(&path, slash_bits ? slash_bits : &bits);
+    static std::string path;
+
+    EvalString es; ninja_evalstring_read(s.data(), &es, true);
+
+    path = es.Evaluate(env); if(path.empty()) {
+        fatal("empty path");
+    }
+
+    CanonicalizePath(&path, slash_bits);
 
     return path;
 }
@@ -226,16 +329,63 @@ std::string ninja_path_read(BindingEnv * env, const char * s, uint64_t * slash_b
 void ninja_edge_add(lua_gcptr outputs, const char * rule_name, lua_gcptr inputs, lua_table vars) {
     (rule_name != nullptr) || fatal("missing rule name");
 
+    ninja_def def {ninja_def::EDGE, rule_name}; ninja_vars_read(vars, &def.vars);
+
+    if(outputs) {
+        ninja_paths_read(outputs.tvalue(), &def, ninja_def::OUTS); if(outputs.is_table()) {
+            ninja_paths_read(outputs.as_table()["implicit"_key], &def, ninja_def::IMPLICIT_OUTS);
+        }
+    }
+
+    if(inputs) {
+        ninja_paths_read(inputs.tvalue(), &def, ninja_def::INS); if(inputs.is_table()) {
+            lua_table t = inputs.as_table();
+
+            ninja_paths_read(t["implicit"_key], &def, ninja_def::IMPLICIT_INS);
+            ninja_paths_read(t["order_only"_key], &def, ninja_def::ORDER_ONLY);
+            ninja_paths_read(t["validations"_key], &def, ninja_def::VALIDATIONS);
+        }
+    }
+
+    ninja_def_apply(def);
+}
+
+// whether `edge` has exactly the paths of `def`, in the same roles and order.
+static bool ninja_edge_same(Edge const * edge, ninja_def const & def) {
+    auto same = [](std::vector<Node *> const & nodes, std::initializer_list<std::vector<std::string_view> const *> lists) {
+        size_t i = 0; for(auto paths : lists) for(auto & s : *paths) {
+            if(i == nodes.size() || StringPiece(nodes[i++]->path()) != ninja_path_read($env, s)) return false;
+        }
+
+        return i == nodes.size();
+    };
+
+    auto & p = def.paths; return
+        edge->implicit_outs_ == (int)p[ninja_def::IMPLICIT_OUTS].size() &&
+        edge->implicit_deps_ == (int)p[ninja_def::IMPLICIT_INS].size() &&
+        edge->order_only_deps_ == (int)p[ninja_def::ORDER_ONLY].size() &&
+        same(edge->outputs_, { &p[ninja_def::OUTS], &p[ninja_def::IMPLICIT_OUTS] }) &&
+        same(edge->inputs_, { &p[ninja_def::INS], &p[ninja_def::IMPLICIT_INS], &p[ninja_def::ORDER_ONLY] }) &&
+        same(edge->validations_, { &p[ninja_def::VALIDATIONS] });
+}
+
+static void ninja_edge_apply(ninja_def const & def) {
+    const char * rule_name = def.rule.c_str();
+
     const Rule * rule = $env->LookupRule(rule_name); {
         (rule != nullptr) || fatal("unknown rule '%s'", rule_name);
     }
 
-    BindingEnv * env = vars.empty() ? $env : new BindingEnv($env); if(!vars.empty()) {
-        vars.for_pairs([&](lua_value const & k, lua_value const & v) {
-            if(k.is_string() && v.is_string()) {
-                env->AddBinding(k.c_str(), v.c_str());
-            }
-        });
+    // the same edge defined again by another target, such as a pch shared by targets that compile
+    // it alike; anything else writing an existing output is an error below.
+    if(def.vars.empty() && !def.paths[ninja_def::OUTS].empty()) {
+        Node * node = $state->LookupNode(ninja_path_read($env, def.paths[ninja_def::OUTS][0]));
+
+        if(node && node->in_edge() && node->in_edge()->rule_ == rule && ninja_edge_same(node->in_edge(), def)) return;
+    }
+
+    BindingEnv * env = def.vars.empty() ? $env : new BindingEnv($env); for(auto & [k, v] : def.vars) {
+        env->AddBinding(k, v);
     }
 
     Edge * edge = $state->AddEdge(rule); edge->env_ = env;
@@ -248,94 +398,50 @@ void ninja_edge_add(lua_gcptr outputs, const char * rule_name, lua_gcptr inputs,
         edge->pool_ = pool;
     }
 
-    std::string err; int c;
+    std::string err;
 
-    // outputs
-    outputs.for_ipairs([&](int, lua_value const & v) {
-        if(v.is_string()) {
+    auto add_outs = [&](std::vector<std::string_view> const & paths) {
+        for(auto & s : paths) {
             uint64_t slash_bits;
-            std::string path = ninja_path_read(edge->env_, v.c_str(), &slash_bits);
+            StringPiece path = ninja_path_read(edge->env_, s, &slash_bits);
             $state->AddOut(edge, path, slash_bits, &err) || fatal("%s", err.c_str());
         }
-    });
 
-    lua_value implicit_outs; if(outputs.is_table()) {
-        implicit_outs = outputs.as_table()["implicit"];
-    }
+        return (int)paths.size();
+    };
 
-    c = 0; if(implicit_outs && implicit_outs.is_gcobj()) {
-        implicit_outs.to_gcptr().for_ipairs([&](int, lua_value const & v) {
-            if(v.is_string()) {
-                uint64_t slash_bits;
-                std::string path = ninja_path_read(edge->env_, v.c_str(), &slash_bits);
-                $state->AddOut(edge, path, slash_bits, &err) || fatal("%s", err.c_str());
-                ++c;
-            }
-        });
-    }
-
-    !edge->outputs_.empty() || fatal("build does not have any outputs");
-
-    edge->implicit_outs_ = c;
-
-    // inputs
-    inputs.for_ipairs([&](int, lua_value const & v) {
-        if(v.is_string()) {
+    auto add_ins = [&](std::vector<std::string_view> const & paths) {
+        for(auto & s : paths) {
             uint64_t slash_bits;
-            std::string path = ninja_path_read(edge->env_, v.c_str(), &slash_bits);
+            StringPiece path = ninja_path_read(edge->env_, s, &slash_bits);
             $state->AddIn(edge, path, slash_bits);
         }
-    });
 
-    !edge->inputs_.empty() || fatal("build does not have any inputs");
+        return (int)paths.size();
+    };
 
-    lua_value implicit_ins; if(inputs.is_table()) {
-        implicit_ins = inputs.as_table()["implicit"];
-    }
+    // outputs
+    add_outs(def.paths[ninja_def::OUTS]);
 
-    c = 0; if(implicit_ins && implicit_ins.is_gcobj()) {
-        implicit_ins.to_gcptr().for_ipairs([&](int, lua_value const & v) {
-            if(v.is_string()) {
-                uint64_t slash_bits;
-                std::string path = ninja_path_read(edge->env_, v.c_str(), &slash_bits);
-                $state->AddIn(edge, path, slash_bits);
-                ++c;
-            }
-        });
-    }
+    int c = add_outs(def.paths[ninja_def::IMPLICIT_OUTS]);
 
-    edge->implicit_deps_ = c;
+    !edge->outputs_.empty() || fatal("build does not have any outputs");
 
-    lua_value order_only; if(inputs.is_table()) {
-        order_only = inputs.as_table()["order_only"];
-    }
+    edge->implicit_outs_ = c;
 
-    c = 0; if(order_only && order_only.is_gcobj()) {
-        order_only.to_gcptr().for_ipairs([&](int, lua_value const & v) {
-            if(v.is_string()) {
-                uint64_t slash_bits;
-                std::string path = ninja_path_read(edge->env_, v.c_str(), &slash_bits);
-                $state->AddIn(edge, path, slash_bits);
-                ++c;
-            }
-        });
-    }
+    // inputs
+    add_ins(def.paths[ninja_def::INS]);
 
-    edge->order_only_deps_ = c;
+    !edge->inputs_.empty() || fatal("build does not have any inputs");
 
-    lua_value validations; if(inputs.is_table()) {
-        validations = inputs.as_table()["validations"];
-    }
+    edge->implicit_deps_ = add_ins(def.paths[ninja_def::IMPLICIT_INS]);
 
-    if(validations && validations.is_gcobj()) {
-        validations.to_gcptr().for_ipairs([&](int, lua_value const & v) {
-            if(v.is_string()) {
-                uint64_t slash_bits;
-                std::string path = ninja_path_read(edge->env_, v.c_str(), &slash_bits);
-                $state->AddValidation(edge, path, slash_bits);
-                ++c;
-            }
-        });
+    edge->order_only_deps_ = add_ins(def.paths[ninja_def::ORDER_ONLY]);
+
+    for(auto & s : def.paths[ninja_def::VALIDATIONS]) {
+        uint64_t slash_bits;
+        StringPiece path = ninja_path_read(edge->env_, s, &slash_bits);
+        $state->AddValidation(edge, path, slash_bits);
     }
 
     // phony cycle check
@@ -359,19 +465,20 @@ void ninja_edge_add(lua_gcptr outputs, const char * rule_name, lua_gcptr inputs,
 }
 
 void ninja_default_add(lua_gcptr defaults) {
-    std::string e;
+    ninja_def def {ninja_def::DEFAULT}; if(defaults) ninja_paths_read(defaults.tvalue(), &def, 0);
 
-    if(defaults.is_string()) {
-        ok == $state->AddDefault(ninja_path_read($env, defaults.as_string().c_str()), &e) || fatal("%s", e.c_str());
-    }
-    else if(defaults.is_table()) {
-        lua_table const & t = defaults.as_table();
+    ninja_def_apply(def);
+}
 
-        t.for_ipairs([&](int, lua_value const & v) {
-            if(v.is_string()) {
-                ok == $state->AddDefault(ninja_path_read($env, v.c_str()), &e) || fatal("%s", e.c_str());
-            }
-        });
+static void ninja_def_apply(ninja_def & def) {
+    switch(def.kind) {
+    case ninja_def::RULE: ninja_rule_apply(def); break;
+    case ninja_def::EDGE: ninja_edge_apply(def); break;
+    case ninja_def::DEFAULT: {
+        std::string e; for(auto & s : def.paths[0]) {
+            ok == $state->AddDefault(ninja_path_read($env, s), &e) || fatal("%s", e.c_str());
+        }
+    } break;
     }
 }
 
@@ -400,6 +507,183 @@ void ninja_exit_on_error(bool b) {
     __exit_on_error = b;
 }
 
+static bool __output_log = false;
+
+// write the output of successful commands to $builddir/.ninja_output instead of the console.
+void ninja_output_log(bool b) {
+    __output_log = b;
+}
+
+// edges with remote = 1 run on these `njx worker` processes ("host:port").
+void ninja_remote_worker_add(const char * address) {
+    $config.remote_workers.push_back(address);
+    const char * secret = getenv("NJX_REMOTE_SECRET"); if(secret && $config.remote_secret.empty()) $config.remote_secret = secret;
+}
+
+// the secret the workers challenge every connection for (default: $NJX_REMOTE_SECRET).
+void ninja_remote_secret(const char * secret) {
+    $config.remote_secret = secret;
+}
+
+// njx worker [--listen host:port] [--allow-remote] [--secret-file path] [-j jobs] [--dir path]: serve remote
+// jobs to clients that know the secret, from --secret-file or $NJX_REMOTE_SECRET. workers run whatever they
+// are sent, so they only listen on loopback unless --allow-remote is given.
+int remote_worker_main(int argc, char ** argv) {
+    std::string address = "127.0.0.1:7878", dir = (fs::temp_directory_path() / "njx_worker").string(), secret, err;
+    int jobs = GetProcessorCount(); bool allow_remote = false;
+
+    if(const char * env = getenv("NJX_REMOTE_SECRET")) secret = env;
+
+    for(int i = 1; i < argc; ++i) {
+        const char * x = argv[i]; const char * v = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+        if(strcmp(x, "--listen") == 0 && v) address = argv[++i];
+        else if(strcmp(x, "--allow-remote") == 0) allow_remote = true;
+        else if(strcmp(x, "--secret-file") == 0 && v) {
+            if(ReadFile(argv[++i], &secret, &err) != 0) { fprintf(stderr, "njx worker: %s: %s\n", v, err.c_str()); return 1; }
+            while(!secret.empty() && isspace((unsigned char)secret.back())) secret.pop_back();
+        }
+        else if(strcmp(x, "-j") == 0 && v) jobs = std::max(atoi(argv[++i]), 1);
+        else if(strcmp(x, "--dir") == 0 && v) dir = argv[++i];
+        else {
+            fprintf(stderr, "usage: njx worker [--listen host:port] [--allow-remote] [--secret-file path] [-j jobs] [--dir path]\n"); return 1;
+        }
+    }
+
+    if(secret.empty()) {
+        fprintf(stderr, "njx worker: no secret, pass --secret-file or set NJX_REMOTE_SECRET\n"); return 1;
+    }
+
+    RemoteWorker worker(dir, jobs, secret); if(!worker.Listen(address, allow_remote, &err)) {
+        fprintf(stderr, "njx worker: %s: %s%s\n", address.c_str(), err.c_str(), allow_remote ? "" : " (see --allow-remote)"); return 1;
+    }
+
+    printf("njx worker: port %d, %d jobs, cache in %s\n", worker.port(), jobs, dir.c_str()); fflush(stdout);
+
+    worker.Serve(); return 0;
+}
+
+// njx collate --format clang|gcc --bmi-dir dir --ext .pcm --dd file --modules file
+//             [--dep-modules file]... scan.ddi...: turn the P1689 scans of a
+// target's sources, <object>.ddi each, into its dyndep file, its module list
+// and a module map <object>.modmap per source.
+int modules_collate_main(int argc, char ** argv) {
+    std::string format = "clang", bmi_dir, ext = ".pcm", dd, modules; std::vector<std::string> dep_modules, scans;
+
+    for(int i = 1; i < argc; ++i) {
+        const char * x = argv[i]; const char * v = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+        if(strcmp(x, "--format") == 0 && v) format = argv[++i];
+        else if(strcmp(x, "--bmi-dir") == 0 && v) bmi_dir = argv[++i];
+        else if(strcmp(x, "--ext") == 0 && v) ext = argv[++i];
+        else if(strcmp(x, "--dd") == 0 && v) dd = argv[++i];
+        else if(strcmp(x, "--modules") == 0 && v) modules = argv[++i];
+        else if(strcmp(x, "--dep-modules") == 0 && v) dep_modules.push_back(argv[++i]);
+        else if(*x != '-') scans.push_back(x);
+        else { bmi_dir.clear(); break; }
+    }
+
+    if(bmi_dir.empty() || dd.empty() || modules.empty() || (format != "clang" && format != "gcc")) {
+        fprintf(stderr, "usage: njx collate --format clang|gcc --bmi-dir dir --ext .pcm --dd file --modules file "
+                        "[--dep-modules file]... scan.ddi...\n");
+        return 1;
+    }
+
+    auto fail = [](std::string const & err) { fprintf(stderr, "njx collate: %s\n", err.c_str()); return 1; };
+
+    ModuleCollator collator(format == "gcc" ? ModuleCollator::kGcc : ModuleCollator::kClang, bmi_dir, ext);
+
+    std::string text, err;
+
+    for(auto & file : dep_modules) {
+        ModuleList list; text.clear();
+
+        if(ReadFile(file, &text, &err) != 0 || !ParseModuleList(text, &list, &err)) return fail(file + ": " + err);
+
+        collator.AddDependencyModules(list);
+    }
+
+    for(auto & file : scans) {
+        ModuleScan scan; scan.object = file.substr(0, file.size() - (file.ends_with(".ddi") ? 4 : 0)); text.clear();
+
+        if(ReadFile(file, &text, &err) != 0 || !ParseModuleScan(text, &scan, &err)) return fail(file + ": " + err);
+
+        if(!collator.AddScan(scan, &err)) return fail(err);
+    }
+
+    std::error_code ec; fs::create_directories(bmi_dir, ec);
+
+    for(size_t i = 0; i < scans.size(); ++i) {
+        std::string object = scans[i].substr(0, scans[i].size() - (scans[i].ends_with(".ddi") ? 4 : 0));
+
+        if(!WriteFileIfChanged(object + ".modmap", collator.ModuleMapContents(i), &err)) return fail(err);
+    }
+
+    if(!WriteFileIfChanged(modules, WriteModuleList(collator.Modules()), &err)) return fail(err);
+
+    if(!WriteFileIfChanged(dd, collator.DyndepContents(), &err)) return fail(err);
+
+    return 0;
+}
+
+// njx ar [--update] archive object...: write the thin archive of the objects,
+// or with --update make them members of the existing one, replacing those of
+// the same path. @file reads shell-quoted objects from a response file.
+int thin_archive_main(int argc, char ** argv) {
+    bool update = false; const char * out = nullptr; std::vector<std::string> objects; std::string text, err;
+
+    auto fail = [](std::string const & err) { fprintf(stderr, "njx ar: %s\n", err.c_str()); return 1; };
+
+    for(int i = 1; i < argc; ++i) {
+        const char * x = argv[i];
+
+        if(strcmp(x, "--update") == 0) update = true;
+        else if(*x == '-') { out = nullptr; break; }
+        else if(!out) out = x;
+        else if(*x == '@') {
+            if(ReadFile(x + 1, &text, &err) != 0) return fail(std::string(x + 1) + ": " + err);
+
+            // as ninja quotes $in: '...' spans, a backslash escapes one character
+            std::string word; bool in_word = false; char quote = 0; for(size_t j = 0; j < text.size(); ++j) {
+                char c = text[j];
+                if(quote) { if(c == quote) quote = 0; else word += c; }
+                else if(c == '\'' || c == '"') { quote = c; in_word = true; }
+                else if(c == '\\' && j + 1 < text.size()) { word += text[++j]; in_word = true; }
+                else if(isspace((unsigned char)c)) { if(in_word) objects.push_back(word); word.clear(); in_word = false; }
+                else { word += c; in_word = true; }
+            }
+            if(in_word) objects.push_back(word);
+        }
+        else objects.push_back(x);
+    }
+
+    if(!out) {
+        fprintf(stderr, "usage: njx ar [--update] archive object... [@rspfile]\n");
+        return 1;
+    }
+
+    ThinArchive archive(out);
+
+    if(update && (ReadFile(out, &text, &err) != 0 || !archive.Parse(text, &err))) return fail(std::string(out) + ": " + err);
+
+    for(auto & file : objects) {
+        text.clear(); if(ReadFile(file, &text, &err) != 0) return fail(file + ": " + err);
+
+        if(!archive.Add(file, text, &err)) return fail(err);
+    }
+
+    // a linker reading the archive meanwhile sees the old one or the new one
+    std::string tmp = std::string(out) + ".tmp"; text = archive.Contents(); {
+        FILE * f = fopen(tmp.c_str(), "wb"); bool ok = f && fwrite(text.data(), 1, text.size(), f) == text.size();
+        if(f && fclose(f) != 0) ok = false;
+        if(!ok) { unlink(tmp.c_str()); return fail(tmp + ": " + strerror(errno)); }
+    }
+
+    std::error_code ec; fs::rename(tmp, out, ec); if(ec) { unlink(tmp.c_str()); return fail(std::string(out) + ": " + ec.message()); }
+
+    return 0;
+}
+
 int ninja_build(lua_gcptr targets) {
     // g_explaining = true;
     
@@ -422,6 +706,8 @@ int ninja_build(lua_gcptr targets) {
 
     $ninja->EnsureBuildDirExists() || halt();
 
+    if(__output_log) status.set_output_log_dir($ninja->build_dir_ + "/.ninja_output");
+
     ninja_buildlog_open();
 
     int rc = $ninja->RunBuild(paths.size(), (char **)paths.data(), &status);
@@ -436,8 +722,278 @@ int ninja_build(lua_gcptr targets) {
     // $ninja->build_log_.Close(); $ninja->deps_log_.Close();
 }
 
-void ninja_clean() {
-    Cleaner cleaner(&($ninja->state_), $config, &($ninja->disk_interface_)); cleaner.CleanAll(true);
+// clean the outputs of `targets`, and with `subgraph` everything they are built
+// from, or the whole graph when none are given; directories left empty are
+// removed too.
+int ninja_clean(lua_gcptr targets, bool subgraph) {
+    std::vector<char *> paths;
+
+    if(targets) {
+        if(targets.is_string()) {
+            paths.push_back((char *)targets.as_string().c_str());
+        }
+        else if(targets.is_table()) {
+            targets.as_table().for_ipairs([&](int, lua_value const & v) {
+                if(v.is_string()) paths.push_back((char *)v.c_str());
+            });
+        }
+    }
+
+    Cleaner cleaner(&($ninja->state_), $config, &($ninja->disk_interface_)); cleaner.set_remove_empty_dirs(true);
+
+    if(paths.empty()) return cleaner.CleanAll(true);
+
+    return subgraph ? cleaner.CleanTargets(paths.size(), paths.data()) : cleaner.CleanOutputs(paths.size(), paths.data());
+}
+
+// write the compilation database of the edges whose rule is one of the
+// `rules` names, or of all of them when it is nil, to `file` in one pass over
+// the graph; the number of entries that changed, 0 if the file was left as it was.
+int ninja_compdb(const char * file, lua_gcptr rules) {
+    std::unordered_set<std::string_view> names; bool all = !(rules && rules.is_table());
+
+    if(!all) {
+        rules.as_table().for_ipairs([&](int, lua_value const & v) {
+            if(v.is_string()) names.insert(v.c_str());
+        });
+    }
+
+    auto filter = [&](const Edge * edge) { return names.count(edge->rule().name()) > 0; };
+
+    CompilationDatabase compdb; std::string err;
+
+    compdb.Collect($ninja->state_, fs::current_path().string(), all ? std::function<bool(const Edge *)>() : filter,
+        ECM_EXPAND_RSPFILE, $config.parallelism);
+
+    int rc = compdb.Update(file, &err); (rc >= 0) || fatal("compdb: %s", err.c_str());
+
+    return rc;
+}
+
+// write the graph to `file` as "json", "dot" or "binary", see WriteGraph;
+// 1 if the file changed, 0 if not.
+int ninja_graph_export(const char * file, const char * format) {
+    GraphFormat f; ParseGraphFormat(format ? format : "json", &f) || fatal("unknown graph format '%s'", format);
+
+    std::string out, err; WriteGraph($ninja->state_, f, &out);
+
+    int rc = UpdateFile(file, out, &err); (rc >= 0) || fatal("graph_export: %s", err.c_str());
+
+    return rc;
+}
+
+extern "C" char * GetProgramExecutableName(void);
+
+// this executable, for build edges that run `njx collate` and such.
+const char * program_path() { return GetProgramExecutableName(); }
+
+// the longest command a subprocess can be given. commands run as the one
+// argument of `/bin/sh -c`, which Linux caps at MAX_ARG_STRLEN (32 pages)
+// within what ARG_MAX leaves after the environment; Windows caps the whole
+// command line at 32767 characters.
+int command_line_max() {
+    if(IsWindows()) return 32767;
+
+    long n = sysconf(_SC_ARG_MAX); if(n <= 0) n = 128 * 1024;
+
+    for(char ** e = environ; *e; ++e) n -= strlen(*e) + 1 + sizeof(char *);
+
+    return (int)std::clamp<long>(n, 4096, 32 * 4096);
+}
+
+// how long the last build of `output` took in ms, and the mtime it recorded;
+// -1 if the build log has no entry for it or is not open yet.
+int ninja_log_entry(const char * output, int64_t * mtime) {
+    if(!ninja_buildlog_opened) return -1;
+
+    BuildLog::LogEntry * e = $ninja->build_log_.LookupByOutput(output); if(!e) return -1;
+
+    if(mtime) *mtime = e->mtime;
+
+    return e->end_time - e->start_time;
+}
+
+// fs.watch where there is no ReadDirectoryChangesW: an inotify instance with a
+// watch on dir and on every directory below it, added as they appear.
+struct inotify_watch_t {
+    std::string dir; std::unordered_map<int, std::string> dirs; // watch descriptor -> directory
+};
+
+static std::unordered_map<int, inotify_watch_t> $inotify_watches;
+
+static constexpr uint32_t INOTIFY_WATCH_MASK = IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+
+static void inotify_watch_add(int fd, inotify_watch_t & w, fs::path const & dir) {
+    int wd = inotify_add_watch(fd, dir.c_str(), INOTIFY_WATCH_MASK | IN_ONLYDIR); if(wd < 0) return;
+
+    w.dirs[wd] = dir.string();
+
+    std::error_code ec; for(fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if(it->is_directory(ec) && !it->is_symlink(ec)) inotify_watch_add(fd, w, it->path());
+    }
+}
+
+// a non-blocking inotify descriptor watching dir recursively, or -1.
+int inotify_watch_open(const char * dir) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC); if(fd < 0) return -1;
+
+    auto & w = $inotify_watches[fd]; w.dir = dir; inotify_watch_add(fd, w, dir); return fd;
+}
+
+void inotify_watch_close(int fd) {
+    $inotify_watches.erase(fd); close(fd);
+}
+
+// the paths changed since the last call, one per line; the watched directory
+// itself when events were dropped.
+lua_gcptr inotify_watch_read(int fd) {
+    auto & w = $inotify_watches[fd]; std::string paths;
+
+    alignas(inotify_event) char buf[64 * 1024]; for(;;) {
+        ssize_t n = read(fd, buf, sizeof(buf)); if(n <= 0) break;
+
+        for(char * p = buf; p < buf + n;) {
+            auto e = (inotify_event *)p; p += sizeof(inotify_event) + e->len;
+
+            if(e->mask & IN_Q_OVERFLOW) { paths.append(w.dir).push_back('\n'); continue; }
+
+            if(e->mask & IN_IGNORED) { w.dirs.erase(e->wd); continue; }
+
+            auto it = w.dirs.find(e->wd); if(it == w.dirs.end()) continue;
+
+            fs::path path = fs::path(it->second) / (e->len ? e->name : "");
+
+            if((e->mask & IN_ISDIR) && (e->mask & (IN_CREATE | IN_MOVED_TO))) inotify_watch_add(fd, w, path);
+
+            paths.append(path.string()).push_back('\n');
+        }
+    }
+
+    return {lua_string(paths.data(), paths.size())};
+}
+
+// daemon: one resident process per build script keeps the state and logs loaded,
+// clients send their arguments and get the build output streamed back followed
+// by a 4 byte exit code.
+static std::string $daemon_path;
+
+const char * daemon_path() {
+    if($daemon_path.empty()) {
+        $daemon_path = ($build_script.parent_path() / ".njx_daemon").string();
+    }
+
+    return $daemon_path.c_str();
+}
+
+bool daemon_mode() { return $daemon; }
+
+static bool daemon_address(const char * path, sockaddr_un * addr) {
+    memset(addr, 0, sizeof(*addr)); addr->sun_family = AF_UNIX;
+
+    if(strlen(path) >= sizeof(addr->sun_path)) return false;
+
+    strcpy(addr->sun_path, path); return true;
+}
+
+int daemon_listen(const char * path) {
+    sockaddr_un addr; daemon_address(path, &addr) || fatal("daemon socket path too long: %s\n", path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0); (fd >= 0) || fatal("socket: %s\n", strerror(errno));
+
+    // a client that goes away mid-build must not take the daemon with it:
+    // writes to its socket fail with EPIPE instead.
+    signal(SIGPIPE, SIG_IGN);
+
+    unlink(path);
+
+    (bind(fd, (sockaddr *)&addr, sizeof(addr)) == 0) || fatal("failed to bind '%s': %s\n", path, strerror(errno));
+    (listen(fd, 8) == 0) || fatal("failed to listen on '%s': %s\n", path, strerror(errno));
+
+    return fd;
+}
+
+void daemon_close(int fd) {
+    close(fd); unlink(daemon_path());
+}
+
+int daemon_accept(int fd, int timeout) {
+    pollfd pfd {fd, POLLIN, 0}; if(poll(&pfd, 1, timeout) <= 0) return -1;
+
+    return accept(fd, nullptr, nullptr);
+}
+
+lua_gcptr daemon_request(int fd) {
+    std::string request; char buf[1024];
+
+    for(;;) {
+        ssize_t n = read(fd, buf, sizeof(buf)); if(n <= 0) break;
+
+        request.append(buf, n);
+    }
+
+    return {lua_string(request.data(), request.size())};
+}
+
+static int $daemon_stdout = -1;
+static int $daemon_stderr = -1;
+
+void daemon_redirect(int fd) {
+    fflush(stdout); fflush(stderr);
+
+    $daemon_stdout = dup(1); $daemon_stderr = dup(2);
+
+    dup2(fd, 1); dup2(fd, 2);
+}
+
+void daemon_reply(int fd, int rc) {
+    fflush(stdout); fflush(stderr);
+
+    if($daemon_stdout >= 0) {
+        dup2($daemon_stdout, 1); close($daemon_stdout); $daemon_stdout = -1;
+        dup2($daemon_stderr, 2); close($daemon_stderr); $daemon_stderr = -1;
+    }
+
+    int32_t x = rc; if(send(fd, &x, sizeof(x), MSG_NOSIGNAL) != sizeof(x)) {
+        fprintf(stderr, "ninja: daemon: client went away: %s\n", strerror(errno));
+    }
+
+    close(fd);
+}
+
+// returns false if no daemon is serving this build script.
+bool daemon_client(int argc, char ** argv, int * rc) {
+    sockaddr_un addr; if(!daemon_address(daemon_path(), &addr)) return false;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0); if(fd < 0) return false;
+
+    if(connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd); return false;
+    }
+
+    std::string request; for(int i = 0; i < argc; ++i) {
+        request.append(argv[i]); request.push_back('\n');
+    }
+
+    write(fd, request.data(), request.size()); shutdown(fd, SHUT_WR);
+
+    // everything but the trailing exit code is output.
+    std::string pending; char buf[4096];
+
+    for(;;) {
+        ssize_t n = read(fd, buf, sizeof(buf)); if(n <= 0) break;
+
+        pending.append(buf, n); if(pending.size() > sizeof(int32_t)) {
+            size_t c = pending.size() - sizeof(int32_t);
+
+            fwrite(pending.data(), 1, c, stdout); fflush(stdout); pending.erase(0, c);
+        }
+    }
+
+    close(fd);
+
+    if(pending.size() != sizeof(int32_t)) return false;
+
+    int32_t x; memcpy(&x, pending.data(), sizeof(x)); *rc = x; return true;
 }
 
 static bool ninja_evalstring_read(const char * s, EvalString * eval, bool path) {
@@ -673,59 +1229,176 @@ lua_gcptr buffer_tostring(lua_gcptr buf) {
     auto sbuf = (SBuf *)buf; return {lua_string(sbuf->b, sbuflen(sbuf))};
 }
 
+// options as ninja.lua spells them: strings, `k = v` pairs, `flag = true`
+// and nested lists, some of them tagged public. collected into one table:
+// positional options in order, repeats kept (`-Xlinker a -Xlinker b`, link
+// order of libraries), then the `k = v` options, the last value of a key winning.
+struct ninja_options {
+    std::vector<GCstr *> items;
+
+    // not std::pair: TValue's alignment attribute does not survive as a template argument.
+    struct kv { GCstr * k; TValue v; };
+
+    std::vector<kv> pairs; std::unordered_map<const GCstr *, size_t> keys;
+
+    void clear() { items.clear(); pairs.clear(); keys.clear(); }
+
+    void add(GCstr * s) { items.push_back(s); }
+
+    void add(GCstr * k, TValue v) {
+        auto [it, added] = keys.try_emplace(k, pairs.size()); if(added) pairs.push_back({k, v}); else pairs[it->second].v = v;
+    }
+
+    // options_merge
+    void merge(lua_value const & x) {
+        if(x.is_string()) add(strV(x));
+        else if(x.is_number()) add(lj_strfmt_number($L, x));
+        else if(x.is_table()) lua_table(x).for_pairs([&](lua_value const & k, lua_value const & v) {
+            if(k.is_number()) merge(v);
+            else if(!k.is_string()) return;
+            else if(v.is_boolean()) { if(v) add(strV(k)); }
+            else add(strV(k), v);
+        });
+    }
+
+    // options_public_merge
+    void public_merge(lua_value const & x) {
+        if(!x.is_table()) return;
+
+        lua_table t = x; if(tvisstr(&t->tag) && strV(&t->tag) == "public"_key) { merge(x); return; }
+
+        t.for_pairs([&](lua_value const & k, lua_value const & v) { if(k.is_number()) public_merge(v); });
+    }
+
+    lua_table table() const {
+        uint32_t hbits = 0; if(!pairs.empty()) for(hbits = 1; (1u << hbits) < pairs.size(); ++hbits);
+
+        lua_table t = lua_table::make(items.size() + 1, hbits);
+
+        TValue * array = tvref(t->array); for(size_t i = 0; i < items.size(); ++i) {
+            setstrV($L, array + i + 1, items[i]);
+        }
+
+        for(auto & [k, v] : pairs) t.def(k, v);
+
+        return t;
+    }
+};
+
+// the targets whose public options a target gets for one field, each once, in
+// the order ninja.deps_foreach visits them. a dependency's share, which
+// ninja.lua keeps per build, is the same as a flat {target, options, ...} list.
+struct ninja_options_sources {
+    struct source { GCtab * target; TValue options; };
+
+    std::vector<source> list; std::unordered_set<const GCtab *> seen;
+
+    void clear() { list.clear(); seen.clear(); }
+
+    void add(GCtab * target, TValue const & options) {
+        if(seen.insert(target).second) list.push_back({target, options});
+    }
+
+    void add_shares(lua_table shares) {
+        if(shares) shares.for_ipairs([&](int, lua_value const & share) {
+            GCtab * target = nullptr; lua_table(share).for_ipairs([&](int, lua_value const & x) {
+                if(!target) target = tabV(&x.value); else { add(target, x.value); target = nullptr; }
+            });
+        });
+    }
+};
+
+// the share of `target`: those of its dependencies, `shares`, then its own
+// options for the field.
+lua_gcptr ninja_options_share(lua_table shares, lua_table target, lua_gcptr own) {
+    static ninja_options_sources x; x.clear(); x.add_shares(shares);
+
+    if(own && own.is_table()) x.add(target, own.tvalue().value);
+
+    lua_table t = lua_table::make(2 * x.list.size() + 1, 0);
+
+    TValue * array = tvref(t->array); for(size_t i = 0; i < x.list.size(); ++i) {
+        settabV($L, array + 2 * i + 1, x.list[i].target); array[2 * i + 2] = x.list[i].options;
+    }
+
+    return {t.value};
+}
+
+// the options a target gets: the public ones of the targets in `shares`, then
+// all of its own, `own`.
+lua_gcptr ninja_options_collect(lua_table shares, lua_gcptr own) {
+    static ninja_options_sources sources; sources.clear(); sources.add_shares(shares);
+
+    static ninja_options x; x.clear();
+
+    for(auto & source : sources.list) x.public_merge(lua_value(source.options));
+
+    if(own) x.merge(own.tvalue());
+
+    return {x.table().value};
+}
+
 void reload() { $reload_build_script = true; }
 
 int path_fnmatch(const char * pattern, const char * path) {
     return fnmatch(pattern, path, 0);
 }
 
-struct clib_sym_t {
-    const char * name; void * sym;
-};
-
-#define CLIB_SYM(name) { #name, (void *)(name) }
-
-static clib_sym_t __clib_syms[] = {
-    CLIB_SYM(debug),
-    CLIB_SYM(printf),
-    CLIB_SYM(host_os),
-    CLIB_SYM(reload),
-    CLIB_SYM(build_script),
-    CLIB_SYM(is_build_script),
-    CLIB_SYM(buffer_pathappend),
-    CLIB_SYM(buffer_tostring),
-    CLIB_SYM(reftable_new),
-    CLIB_SYM(reftable_ref),
-    CLIB_SYM(reftable_unref),
-    CLIB_SYM(timer_add),
-    CLIB_SYM(timer_remove),
-    CLIB_SYM(timer_update),
-    CLIB_SYM(path_fnmatch),
-    CLIB_SYM(ninja_config_get),
-    CLIB_SYM(ninja_config_apply),
-    CLIB_SYM(ninja_reset),
-    CLIB_SYM(ninja_clear),
-    CLIB_SYM(ninja_dump),
-    CLIB_SYM(ninja_var_get),
-    CLIB_SYM(ninja_var_set),
-    CLIB_SYM(ninja_pool_add),
-    CLIB_SYM(ninja_edge_add),
-    CLIB_SYM(ninja_rule_add),
-    CLIB_SYM(ninja_default_add),
-    CLIB_SYM(ninja_exit_on_error),
-    CLIB_SYM(ninja_build),
-    CLIB_SYM(ninja_clean),
-    {0, 0}};
-
-extern clib_sym_t * clib_syms;
-
-static void clib_init() {
-    clib_syms = __clib_syms;
-}
+#define NINJA_API_SYMS(_) \
+    _(debug) \
+    _(printf) \
+    _(host_os) \
+    _(reload) \
+    _(build_script) \
+    _(is_build_script) \
+    _(buffer_pathappend) \
+    _(buffer_tostring) \
+    _(reftable_new) \
+    _(reftable_ref) \
+    _(reftable_unref) \
+    _(timer_add) \
+    _(timer_remove) \
+    _(timer_update) \
+    _(path_fnmatch) \
+    _(ninja_options_share) \
+    _(ninja_options_collect) \
+    _(ninja_config_get) \
+    _(ninja_config_apply) \
+    _(ninja_reset) \
+    _(ninja_clear) \
+    _(ninja_dump) \
+    _(ninja_var_get) \
+    _(ninja_var_set) \
+    _(ninja_pool_add) \
+    _(ninja_edge_add) \
+    _(ninja_rule_add) \
+    _(ninja_default_add) \
+    _(ninja_exit_on_error) \
+    _(ninja_output_log) \
+    _(ninja_remote_worker_add) \
+    _(ninja_remote_secret) \
+    _(ninja_build) \
+    _(ninja_clean) \
+    _(ninja_compdb) \
+    _(ninja_graph_export) \
+    _(ninja_log_entry) \
+    _(program_path) \
+    _(command_line_max) \
+    _(inotify_watch_open) \
+    _(inotify_watch_close) \
+    _(inotify_watch_read) \
+    _(daemon_path) \
+    _(daemon_mode) \
+    _(daemon_listen) \
+    _(daemon_close) \
+    _(daemon_accept) \
+    _(daemon_request) \
+    _(daemon_redirect) \
+    _(daemon_reply)
+
+CLIB_SYMTAB(ninja_api_syms, NINJA_API_SYMS);
 
 void ninja_initialize() {
-    clib_init();
-
     g_metrics = new Metrics();
 
     $config.parallelism = GetProcessorCount();
@@ -1,9 +1,65 @@
 #include <fcontext.h>
 
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "ljx.h"
 
 static const size_t TASK_DEFAULT_STACK_SIZE = 128 * 1024; // 128K
 
+// stacks for tasks: mmap'ed with a PROT_NONE guard page below them, so an
+// overflow faults instead of writing over the next stack, and kept for the
+// next task of the thread instead of unmapped. sptr is the top of the stack,
+// ssize includes the guard page, as with create_fcontext_stack().
+struct task_stack_pool {
+    static constexpr size_t max_free = 64;
+
+    std::vector<fcontext_stack_t> free;
+
+    static size_t page_size() { static size_t x = (size_t)sysconf(_SC_PAGESIZE); return x; }
+
+    fcontext_stack_t acquire(size_t size) {
+        size_t page = page_size(), ssize = (size + page - 1) / page * page + page;
+
+        for(size_t i = free.size(); i-- > 0;) {
+            if(free[i].ssize == ssize) {
+                auto s = free[i]; free[i] = free.back(); free.pop_back(); return s;
+            }
+        }
+
+        auto p = (char *)mmap(nullptr, ssize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0); {
+            if(p == MAP_FAILED) fatal("task: failed to map a %zu bytes stack", ssize);
+        }
+
+        ok = mprotect(p, page, PROT_NONE);
+
+        return { p + ssize, ssize };
+    }
+
+    void release(fcontext_stack_t & s) {
+        if(!s.sptr) return;
+
+        if(free.size() < max_free) free.push_back(s); else munmap((char *)s.sptr - s.ssize, s.ssize);
+
+        s = {0, 0};
+    }
+
+    ~task_stack_pool() { for(auto & s : free) munmap((char *)s.sptr - s.ssize, s.ssize); }
+};
+
+// a task's stack comes from, and goes back to, the pool of the thread that
+// runs it: see task_scheduler, whose tasks stay on one worker once started.
+inline thread_local task_stack_pool task_stacks;
+
 struct task_t {
     task_t * parent {0};
     fcontext_t ctx {0};
@@ -24,7 +80,7 @@ struct task : task_t {
     task() {}
 
     task(size_t stack_size, F && f) : f(std::forward<F>(f)) {
-        this->stack = create_fcontext_stack(stack_size);
+        this->stack = task_stacks.acquire(stack_size);
 
         this->ctx = make_fcontext(stack.sptr, stack.ssize, [](fcontext_transfer_t t) {
             task & self = activate(t); self.f(); self.completed = true; self.yield();
@@ -34,7 +90,7 @@ struct task : task_t {
 
     task(F && f) : task(TASK_DEFAULT_STACK_SIZE, std::forward<F>(f)) {}
 
-    ~task() { if(stack.sptr) { destroy_fcontext_stack(&stack); } }
+    ~task() { task_stacks.release(stack); }
 
     static task & activate(fcontext_transfer_t const & t) {
         auto self = (task_t *)t.data;
@@ -75,3 +131,153 @@ task(F && f) -> task<F>;
 
 template<typename F>
 task(size_t, F && f) -> task<F>;
+
+// runs many small tasks on a few threads, one per core by default: each
+// worker has its own deque of tasks not started yet, pops the newest one of
+// it and, when it is empty, steals the oldest one of another worker's. a
+// started task can task_scheduler::yield(), and then waits in its worker's
+// ready list, out of reach of thieves: it never changes threads, so neither
+// does its stack nor the thread_local this_task it reads.
+//
+//     task_scheduler scheduler; task_group group;
+//
+//     for(auto & file : files) scheduler.spawn(group, [&] { hash(file); });
+//
+//     scheduler.wait(group);
+struct task_group {
+    std::atomic<size_t> pending {0}; std::mutex mutex; std::condition_variable done;
+
+    void add() { pending.fetch_add(1, std::memory_order_relaxed); }
+
+    void finish() {
+        if(pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(mutex); done.notify_all();
+        }
+    }
+};
+
+struct task_scheduler {
+    using body_type = std::function<int()>; using task_type = task<body_type>;
+
+    struct job { std::function<void()> f; task_group * group; };
+
+    struct worker {
+        std::mutex mutex; std::deque<job> jobs; // not started: the owner's end is the back
+        std::deque<std::pair<task_type *, task_group *>> ready; // started and yielded, the owner's only
+        std::thread thread;
+    };
+
+    size_t stack_size; std::vector<std::unique_ptr<worker>> workers;
+
+    std::mutex idle_mutex; std::condition_variable idle; std::atomic<size_t> queued {0}; std::atomic<unsigned> sleeping {0};
+    std::atomic<unsigned> next {0}; std::atomic<bool> stopping {false};
+
+    static inline thread_local task_scheduler * current {nullptr};
+    static inline thread_local worker * current_worker {nullptr};
+
+    explicit task_scheduler(unsigned n = std::thread::hardware_concurrency(), size_t stack_size = TASK_DEFAULT_STACK_SIZE)
+        : stack_size(stack_size) {
+        n = n ? n : 1; for(unsigned i = 0; i < n; i++) workers.emplace_back(new worker());
+
+        for(unsigned i = 0; i < n; i++) workers[i]->thread = std::thread([this, i] { run(i); });
+    }
+
+    // runs what was spawned before it returns.
+    ~task_scheduler() {
+        stopping = true; {
+            std::lock_guard<std::mutex> lock(idle_mutex); idle.notify_all();
+        }
+
+        for(auto & w : workers) w->thread.join();
+    }
+
+    // queue f: on the calling worker's deque when called from a task of this
+    // scheduler, else on the next worker's in turn.
+    template<typename F>
+    void spawn(task_group & group, F && f) {
+        group.add();
+
+        auto w = (current == this) ? current_worker : workers[next.fetch_add(1, std::memory_order_relaxed) % workers.size()].get(); {
+            std::lock_guard<std::mutex> lock(w->mutex); w->jobs.push_back({ std::forward<F>(f), &group });
+        }
+
+        // seq_cst, against the sleeping count of run(): either a worker going to
+        // sleep sees the job, or this sees the worker.
+        queued.fetch_add(1); if(sleeping.load() != 0) {
+            std::lock_guard<std::mutex> lock(idle_mutex); idle.notify_one();
+        }
+    }
+
+    // block until every task of group is done. from a task of this scheduler,
+    // its worker runs other tasks meanwhile.
+    void wait(task_group & group) {
+        if(current == this && this_task != &main_task) {
+            while(group.pending.load(std::memory_order_acquire) != 0) yield();
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(group.mutex); group.done.wait(lock, [&] {
+            return group.pending.load(std::memory_order_acquire) == 0;
+        });
+    }
+
+    // let the worker of the calling task run its other tasks first.
+    static void yield() { static_cast<task_type *>(this_task)->yield(0); }
+
+    bool pop(worker * w, job & x) {
+        std::lock_guard<std::mutex> lock(w->mutex); if(w->jobs.empty()) return false;
+
+        x = std::move(w->jobs.back()); w->jobs.pop_back(); return true;
+    }
+
+    bool steal(worker * w, job & x) {
+        std::lock_guard<std::mutex> lock(w->mutex); if(w->jobs.empty()) return false;
+
+        x = std::move(w->jobs.front()); w->jobs.pop_front(); return true;
+    }
+
+    bool next_job(unsigned i, job & x) {
+        if(pop(workers[i].get(), x)) return true;
+
+        for(size_t k = 1; k < workers.size(); k++) {
+            if(steal(workers[(i + k) % workers.size()].get(), x)) return true;
+        }
+
+        return false;
+    }
+
+    // resume t until it yields or is done; false once it is done.
+    bool step(task_type * t, task_group * group) {
+        t->resume(0); if(!t->completed) return true;
+
+        delete t; group->finish(); return false;
+    }
+
+    void run(unsigned i) {
+        auto w = workers[i].get(); current = this; current_worker = w;
+
+        for(;;) {
+            // a yielded task goes after the tasks that were ready before it.
+            for(size_t n = w->ready.size(); n > 0; n--) {
+                auto x = w->ready.front(); w->ready.pop_front(); if(step(x.first, x.second)) w->ready.push_back(x);
+            }
+
+            job x; if(next_job(i, x)) {
+                queued.fetch_sub(1, std::memory_order_relaxed);
+
+                auto group = x.group; auto t = new task_type(stack_size, [f = std::move(x.f)]() -> int { f(); return 0; });
+
+                if(step(t, group)) w->ready.push_back({ t, group });
+                continue;
+            }
+
+            if(!w->ready.empty()) continue;
+
+            std::unique_lock<std::mutex> lock(idle_mutex); if(stopping && queued.load() == 0) break;
+
+            sleeping.fetch_add(1); idle.wait(lock, [&] { return stopping || queued.load() != 0; }); sleeping.fetch_sub(1);
+        }
+
+        current = nullptr; current_worker = nullptr;
+    }
+};
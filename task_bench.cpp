@@ -0,0 +1,59 @@
+#include "task.h"
+
+#include <chrono>
+
+// task creation, switch and scheduling costs: cosmoc++ -O2 -Ifcontext task_bench.cpp fcontext/libfcontext.a -o task_bench.exe
+
+// nanoseconds per iteration of n since t0.
+static double ns_since(std::chrono::steady_clock::time_point t0, size_t n) {
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count() / n;
+}
+
+int main(int argc, char ** argv) {
+    const size_t n = 100000;
+
+    // a stack mapped and unmapped for every task, as task did before the pool.
+    auto t0 = std::chrono::steady_clock::now(); for(size_t i = 0; i < n; i++) {
+        auto stack = create_fcontext_stack(TASK_DEFAULT_STACK_SIZE);
+
+        auto ctx = make_fcontext(stack.sptr, stack.ssize, [](fcontext_transfer_t t) { jump_fcontext(t.ctx, t.data); });
+
+        jump_fcontext(ctx, nullptr); destroy_fcontext_stack(&stack);
+    }
+
+    printf("create, run, destroy (mmap per task): %8.1f ns\n", ns_since(t0, n));
+
+    t0 = std::chrono::steady_clock::now(); for(size_t i = 0; i < n; i++) {
+        task t([]() -> int { return 0; }); t();
+    }
+
+    printf("create, run, destroy (pooled stack):  %8.1f ns\n", ns_since(t0, n));
+
+    {
+        using spinner = task<int (*)()>; spinner t(+[]() -> int { for(;;) ((spinner *)this_task)->yield(0); });
+
+        t0 = std::chrono::steady_clock::now(); for(size_t i = 0; i < n; i++) t();
+
+        printf("resume + yield:                       %8.1f ns\n", ns_since(t0, n));
+    }
+
+    unsigned workers = (argc > 1) ? (unsigned)atoi(argv[1]) : std::thread::hardware_concurrency();
+
+    for(int yields : { 0, 4 }) {
+        task_scheduler scheduler(workers); task_group group; std::atomic<size_t> sum {0};
+
+        t0 = std::chrono::steady_clock::now(); for(size_t i = 0; i < n; i++) {
+            scheduler.spawn(group, [&, i] {
+                for(int k = 0; k < yields; k++) task_scheduler::yield();
+
+                sum.fetch_add(i, std::memory_order_relaxed);
+            });
+        }
+
+        scheduler.wait(group);
+
+        printf("scheduled task, %d yields, %u workers: %8.1f ns%s\n", yields, workers, ns_since(t0, n), sum == n * (n - 1) / 2 ? "" : " (wrong sum)");
+    }
+
+    return 0;
+}
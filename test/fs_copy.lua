@@ -0,0 +1,41 @@
+-- njx test/fs_copy.lua: copying a file onto itself, a hard link or a symlink
+-- to it must fail and leave the source as it was.
+local ffi = require('ffi')
+
+ffi.cdef [[
+    int link(const char * from, const char * to);
+    int symlink(const char * target, const char * path);
+    int unlink(const char * path);
+]]
+
+local dir = os.tmpname(); os.remove(dir); fs.mkdir(dir)
+
+local src = path.combine(dir, 'src.txt'); do
+    local f = io.open(src, 'w'); f:write('contents'); f:close()
+end
+
+local function contents(p)
+    local f = io.open(p, 'r'); local s = f:read('*a'); f:close(); return s
+end
+
+local hard, soft = path.combine(dir, 'hard.txt'), path.combine(dir, 'soft.txt')
+assert(ffi.C.link(src, hard) == 0 and ffi.C.symlink(src, soft) == 0)
+
+for _, dst in ipairs({ src, hard, soft }) do
+    local ok, err = pcall(async.await, async.copy_file(dst, src))
+    assert(not ok and err:find('same file'), dst .. ': ' .. tostring(err))
+
+    ok, err = pcall(async.await, async.copy(dst, src, 'f'))
+    assert(not ok and err:find('same file'), dst .. ': ' .. tostring(err))
+
+    assert(contents(src) == 'contents', dst .. ': source truncated')
+end
+
+-- modes that skip unchanged files leave it alone too.
+async.await(async.copy_dir(src, src)); async.await(async.update_file(hard, src))
+assert(contents(src) == 'contents')
+
+for _, p in ipairs({ soft, hard, src }) do ffi.C.unlink(p) end
+fs.rmdir(dir)
+
+print('fs_copy: ok')
@@ -0,0 +1,24 @@
+-- njx test/options.lua: options collected from dependencies keep repeats that
+-- carry meaning, and a dependency reached twice counts once.
+local a = ninja.target('a'):type('static'):src('a.c')
+    :ld_flags(public { '-Xlinker', '-rpath=/a' }):lib(public { 'x', 'y', 'x' })
+
+local b = ninja.target('b'):type('static'):src('b.c')
+    :ld_flags(public { '-Xlinker', '-rpath=/b' }):deps(a)
+
+local app = ninja.target('app'):type('binary'):src('main.c'):deps(a, b)
+    :ld_flags('-Xlinker', '-rpath=/c')
+
+app:configure()
+
+local ld = options_tostring(app.ld_options)
+
+local function expect(pattern)
+    assert(ld:find(pattern), string.format('expected "%s" in "%s"', pattern, ld))
+end
+
+expect('%-Xlinker %-rpath=/a %-Xlinker %-rpath=/b %-Xlinker %-rpath=/c')
+expect('%-lx %-ly %-lx')
+assert(not ld:find('/a.*/a'), 'a counted twice: ' .. ld)
+
+print('options: ok')
@@ -0,0 +1,75 @@
+-- njx test/timers.lua: the timing wheel fires timers in order of their due
+-- time, across its levels, and a timer cleared or created by a callback never
+-- runs in place of another one of the same batch.
+
+local ffi = require('ffi')
+
+ffi.cdef [[
+    int usleep(unsigned us);
+]]
+
+-- run the timers for at least ms, or until done() holds, sleeping between
+-- updates as the event loop waits between events.
+local function wait(ms, done)
+    for _ = 1, ms do
+        if done and done() then return end
+        ffi.C.usleep(1000); update_timer()
+    end
+end
+
+-- in order of due time, also past the first level of 64 ms
+do
+    local order = {}; for _, ms in ipairs({ 30, 5, 100, 10 }) do
+        set_timeout(ms, function() table.insert(order, ms) end)
+    end
+    wait(1000, function() return #order == 4 end)
+    assert(table.concat(order, ' ') == '5 10 30 100', table.concat(order, ' '))
+end
+
+-- cleared before it is due: never runs
+do
+    local ran = false; clear_timeout(set_timeout(5, function() ran = true end))
+    wait(20); assert(not ran)
+end
+
+-- an interval repeats until it is cleared
+do
+    local n = 0; local id; id = set_interval(2, function() n = n + 1 end)
+    wait(1000, function() return n >= 3 end); clear_timeout(id)
+    local m = n; wait(20); assert(n == m and m >= 3, n)
+end
+
+-- a callback clears a timer due in the same batch and creates another: the
+-- cleared one is skipped, and the new one waits for a later batch.
+do
+    local batch, ran, c_ran, ids, c = false, 0, false, {}, nil
+
+    for k = 1, 2 do
+        ids[k] = set_timeout(5, function()
+            ran = ran + 1; batch = true; clear_timeout(ids[3 - k])
+            c = set_timeout(0, function() assert(not batch, 'ran in the batch that created it'); c_ran = true end)
+        end)
+    end
+
+    for _ = 1, 1000 do
+        if c_ran then break end
+        ffi.C.usleep(1000); update_timer(); batch = false
+    end
+    assert(ran == 1 and c_ran, ran); assert(c ~= ids[1] and c ~= ids[2], 'id reused within its batch')
+end
+
+-- many timers: each fires once, in order of due time within the clock's
+-- resolution, as they cascade down the levels.
+do
+    local n, fired, last, late = 2000, 0, 0, 0
+    for i = 1, n do
+        local ms = (i * 7919) % 300
+        set_timeout(ms, function()
+            fired = fired + 1; if ms + 5 < last then late = late + 1 end; last = math.max(last, ms)
+        end)
+    end
+    wait(2000, function() return fired == n end)
+    assert(fired == n and late == 0, fired .. ' fired, ' .. late .. ' out of order')
+end
+
+print('timers: ok')